@@ -2,11 +2,34 @@
 
 #include "log.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
 #include <iostream>
+#include <list>
 #include <map>
 
 #include "config.h"
@@ -56,542 +79,5790 @@ LogLevel::Level LogLevel::FromString(const std::string &str) {
 #undef XX
 }
 
-LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e) {}
+std::atomic<int> LogClock::s_source(LogClock::REALTIME);
+std::atomic<uint32_t> LogClock::s_seq(0);
+std::atomic<uint64_t> LogClock::s_tsc(0);
+std::atomic<uint64_t> LogClock::s_ns(0);
+std::atomic<uint64_t> LogClock::s_mult(0);
+std::atomic<uint64_t> LogClock::s_interval(0);
+std::atomic<uint64_t> LogClock::s_candidate(0);
+std::atomic<LogLimiter::Clock> LogLimiter::s_clock(nullptr);
 
-LogEventWrap::~LogEventWrap() {
-  m_event->getLogger()->log(m_event->getLevel(), m_event);
+static uint64_t ClockNS(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-void LogEvent::format(const char *fmt, ...) {
-  va_list al;
-  va_start(al, fmt);
-  format(fmt, al);
-  va_end(al);
+uint64_t LogClock::Start() {
+  static uint64_t s_start = NowSlow();
+  return s_start;
 }
 
-void LogEvent::format(const char *fmt, va_list al) {
-  char *buf = nullptr;
-  int len = vasprintf(&buf, fmt, al);
-  if (len != -1) {
-    m_ss << std::string(buf, len);
-    free(buf);
+uint64_t LogClock::NowSlow() {
+  return ClockNS(s_source.load(std::memory_order_relaxed) == COARSE
+                     ? CLOCK_REALTIME_COARSE
+                     : CLOCK_REALTIME);
+}
+
+bool LogClock::HasTsc() {
+#if defined(__x86_64__)
+  // CPUID.80000007H:EDX[8], TSC频率不随变频和休眠变化
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+    return false;
   }
+  // 内核发现各核TSC不同步(或虚拟机里不可靠)时会换掉tsc时钟源
+  std::ifstream ifs(
+      "/sys/devices/system/clocksource/clocksource0/current_clocksource");
+  std::string current;
+  if (ifs >> current) {
+    return current == "tsc";
+  }
+  return true;
+#else
+  return false;
+#endif
 }
 
-std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
+uint64_t LogClock::Recalibrate() {
+#if defined(__x86_64__)
+  uint32_t seq = s_seq.load(std::memory_order_relaxed);
+  if ((seq & 1) ||
+      !s_seq.compare_exchange_strong(seq, seq + 1,
+                                     std::memory_order_acquire)) {
+    return NowSlow();
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  uint64_t tsc = __builtin_ia32_rdtsc();
+  uint64_t ns = ClockNS(CLOCK_REALTIME);
+  uint64_t base_tsc = s_tsc.load(std::memory_order_relaxed);
+  uint64_t base_ns = s_ns.load(std::memory_order_relaxed);
+  uint64_t mult = s_mult.load(std::memory_order_relaxed);
+  uint64_t candidate = 0;
+  if (tsc > base_tsc && ns > base_ns) {
+    uint64_t m = (uint64_t)(((unsigned __int128)(ns - base_ns) << 32) /
+                            (tsc - base_tsc));
+    uint64_t prev = s_candidate.load(std::memory_order_relaxed);
+    if (m > mult - mult / 100 && m < mult + mult / 100) {
+      mult = m;
+    } else if (prev && m > prev - prev / 100 && m < prev + prev / 100) {
+      // 连续两个区间测得一致的频率, 说明原来的频率不准(粗测时线程被抢占),
+      // 改用新的频率
+      mult = m;
+    } else {
+      // 单个区间偏差过大可能是系统时间被调整过, 只移动校准点, 暂不更新频率.
+      // 下一个区间测得的频率与它一致时才采用
+      candidate = m;
+    }
+  }
+  s_candidate.store(candidate, std::memory_order_relaxed);
+  // 校准间隔从10ms开始翻倍, 最长1秒, 启动后很快得到准确的频率
+  uint64_t interval = s_interval.load(std::memory_order_relaxed) * 2;
+  uint64_t max_interval =
+      (uint64_t)(((unsigned __int128)1000000000 << 32) / mult);
+  s_tsc.store(tsc, std::memory_order_relaxed);
+  s_ns.store(ns, std::memory_order_relaxed);
+  s_mult.store(mult, std::memory_order_relaxed);
+  s_interval.store(std::min(interval, max_interval),
+                   std::memory_order_relaxed);
+  s_seq.store(seq + 2, std::memory_order_release);
+  return ns;
+#else
+  return NowSlow();
+#endif
+}
 
-void LogAppender::setFormatter(LogFormatter::ptr val) {
-  MutexType::Lock lock(m_mutex);
-  m_formatter = val;
-  if (m_formatter) {
-    m_hasFormatter = true;
-  } else {
-    m_hasFormatter = false;
+bool LogClock::SetSource(Source source) {
+  static Mutex s_mutex;
+  Mutex::Lock lock(s_mutex);
+  Start();
+  if (source != TSC) {
+    s_source.store(source, std::memory_order_relaxed);
+    return true;
+  }
+#if defined(__x86_64__)
+  if (HasTsc()) {
+    if (!s_mult.load(std::memory_order_relaxed)) {
+      // 空转2ms粗测TSC频率, 之后每次重新校准时修正
+      uint64_t tsc0 = __builtin_ia32_rdtsc();
+      uint64_t ns0 = ClockNS(CLOCK_REALTIME);
+      uint64_t ns1 = ns0;
+      while (ns1 - ns0 < 2000000) {
+        ns1 = ClockNS(CLOCK_REALTIME);
+      }
+      uint64_t tsc1 = __builtin_ia32_rdtsc();
+      if (tsc1 > tsc0) {
+        uint32_t seq = s_seq.load(std::memory_order_relaxed);
+        s_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s_tsc.store(tsc1, std::memory_order_relaxed);
+        s_ns.store(ns1, std::memory_order_relaxed);
+        s_mult.store(
+            (uint64_t)(((unsigned __int128)(ns1 - ns0) << 32) / (tsc1 - tsc0)),
+            std::memory_order_relaxed);
+        s_interval.store((tsc1 - tsc0) * 10000000 / (ns1 - ns0),
+                         std::memory_order_relaxed);
+        s_seq.store(seq + 2, std::memory_order_release);
+      }
+    }
+    if (s_mult.load(std::memory_order_relaxed)) {
+      s_source.store(TSC, std::memory_order_relaxed);
+      return true;
+    }
   }
+#endif
+  s_source.store(REALTIME, std::memory_order_relaxed);
+  return false;
 }
 
-LogFormatter::ptr LogAppender::getFormatter() {
-  MutexType::Lock lock(m_mutex);
-  return m_formatter;
+const char *LogClock::SourceToString(Source source) {
+  switch (source) {
+    case REALTIME:
+      return "realtime";
+    case COARSE:
+      return "coarse";
+    case TSC:
+      return "tsc";
+    default:
+      return "realtime";
+  }
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
- public:
-  MessageFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getContent();
+LogClock::Source LogClock::SourceFromString(const std::string &str) {
+  if (str == "tsc" || str == "TSC") {
+    return TSC;
   }
-};
+  if (str == "coarse" || str == "COARSE") {
+    return COARSE;
+  }
+  return REALTIME;
+}
 
-class LevelFormatItem : public LogFormatter::FormatItem {
- public:
-  LevelFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << LogLevel::ToString(level);
+size_t LogCounters::NextShard() {
+  static std::atomic<size_t> s_next(0);
+  return s_next.fetch_add(1, std::memory_order_relaxed) % kShards;
+}
+
+LogCounters::LogCounters() {
+  void *p = nullptr;
+  if (posix_memalign(&p, alignof(Shard), sizeof(Shard) * kShards) != 0) {
+    throw std::bad_alloc();
   }
-};
+  m_shards = (Shard *)p;
+  for (size_t i = 0; i < kShards; ++i) {
+    new (&m_shards[i]) Shard;
+    for (auto &v : m_shards[i].values) {
+      v.store(0, std::memory_order_relaxed);
+    }
+  }
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
- public:
-  ElapseFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getElapse();
+LogCounters::~LogCounters() { free(m_shards); }
+
+uint64_t LogCounters::get(Type type) const {
+  uint64_t v = 0;
+  for (size_t i = 0; i < kShards; ++i) {
+    v += m_shards[i].values[type].load(std::memory_order_relaxed);
   }
-};
+  return v;
+}
 
-class NameFormatItem : public LogFormatter::FormatItem {
- public:
-  NameFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getLogger()->getName();
+LogHistogram::LogHistogram() {
+  for (auto &i : m_buckets) {
+    i.store(0, std::memory_order_relaxed);
   }
-};
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
- public:
-  ThreadIdFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getThreadId();
+uint64_t LogHistogram::UpperBound(size_t index) {
+  if (index < 2 * kSubCount) {
+    return index;
   }
-};
+  int e = (index >> kSubBits) + kSubBits - 1;
+  uint64_t width = 1ull << (e - kSubBits);
+  return ((kSubCount + (index & (kSubCount - 1))) << (e - kSubBits)) +
+         (width - 1);
+}
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
- public:
-  FiberIdFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getFiberId();
+LogHistogram::Snapshot LogHistogram::snapshot() const {
+  Snapshot snap;
+  uint64_t counts[kBuckets];
+  for (size_t i = 0; i < kBuckets; ++i) {
+    counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+    snap.count += counts[i];
+  }
+  if (snap.count == 0) {
+    return snap;
   }
+  struct {
+    double q;
+    uint64_t *value;
+  } targets[] = {{0.5, &snap.p50},
+                 {0.9, &snap.p90},
+                 {0.99, &snap.p99},
+                 {0.999, &snap.p999}};
+  size_t t = 0;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    seen += counts[i];
+    for (; t < sizeof(targets) / sizeof(targets[0]) &&
+           seen >= (uint64_t)std::ceil(snap.count * targets[t].q);
+         ++t) {
+      *targets[t].value = UpperBound(i);
+    }
+    snap.max = UpperBound(i);
+  }
+  return snap;
+}
+
+#if SYLAR_LOG_METRICS
+/**
+ * @brief 当前线程最近一次格式化完成的时间和累计格式化的字节数
+ *
+ * @details Logger::append 用格式化完成的时间把一次写入分成格式化和写出两段,
+ *          采样到的写入读三次时钟, 其余写入不读时钟
+ */
+struct LogFormatStat {
+  uint64_t end;
+  uint64_t bytes;
+  /// 当前写入是否计时
+  bool timed;
 };
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
- public:
-  ThreadNameFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getThreadName();
+static thread_local LogFormatStat t_format_stat;
+
+/// 耗时采样间隔减1, 见 LoggerManager::SetLatencySample
+static std::atomic<uint32_t> s_latency_mask(15);
+
+/**
+ * @brief 当前线程的这次写入是否记录耗时
+ *
+ */
+static bool LogLatencySampled() {
+  static thread_local uint32_t t_tick = 0;
+  return (t_tick++ & s_latency_mask.load(std::memory_order_relaxed)) == 0;
+}
+
+/**
+ * @brief LogFormatter::format 结束时记录
+ *
+ * @details 输出超过缓冲大小时调用方会换更大的缓冲再格式化一次,
+ *          字节数只在写得下的那次计入
+ */
+static void LogFormatDone(size_t total, size_t size) {
+  if (t_format_stat.timed) {
+    t_format_stat.end = LogClock::Now();
+  }
+  if (total <= size) {
+    t_format_stat.bytes += total;
   }
+}
+#endif
+
+static Spinlock s_callsite_mutex;
+
+static std::vector<LogCallSite *> &GetCallSites() {
+  // 不析构, 进程退出时二进制日志后台线程还要查找调用点
+  static std::vector<LogCallSite *> *s_sites = new std::vector<LogCallSite *>;
+  return *s_sites;
+}
+
+/**
+ * @brief LogCallSite::SetEnabled 设置的开关, 应用到之后注册的调用点
+ *
+ */
+struct LogCallSiteRule {
+  std::string file;
+  int32_t line;
+  bool enabled;
 };
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
- public:
-  DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S")
-      : m_format(format) {
-    if (m_format.empty()) {
-      m_format = "%Y-%m-%d %H:%M:%S";
+static std::vector<LogCallSiteRule> &GetCallSiteRules() {
+  static std::vector<LogCallSiteRule> *s_rules =
+      new std::vector<LogCallSiteRule>;
+  return *s_rules;
+}
+
+LogCallSite::LogCallSite(LogLevel::Level level, const char *file,
+                         int32_t line, const char *func, const char *logger,
+                         const char *fmt)
+    : m_level(level),
+      m_file(file ? file : ""),
+      m_line(line),
+      m_func(func ? func : ""),
+      m_logger(logger ? logger : ""),
+      // 格式串可能是局部的字符数组, 复制一份, 随调用点一直保留
+      m_fmt(fmt ? strdup(fmt) : nullptr),
+      m_enabled(true) {
+  const char *slash = strrchr(m_file, '/');
+  m_basename = slash ? slash + 1 : m_file;
+
+  Spinlock::Lock lock(s_callsite_mutex);
+  auto &sites = GetCallSites();
+  sites.push_back(this);
+  // 0 留给没有调用点的记录
+  m_id = sites.size();
+  for (auto &i : GetCallSiteRules()) {
+    if (match(i.file, i.line)) {
+      setEnabled(i.enabled);
     }
   }
+}
 
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    struct tm tm;
-    time_t time = event->getTime();
-    localtime_r(&time, &tm);
-    char buf[64];
-    strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-    os << buf;
+bool LogCallSite::match(const std::string &file, int32_t line) const {
+  if (line && line != m_line) {
+    return false;
   }
-
- private:
-  std::string m_format;
-};
-
-class FilenameFormatItem : public LogFormatter::FormatItem {
- public:
-  FilenameFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getFile();
+  size_t len = strlen(m_file);
+  if (file.empty() || file.size() > len ||
+      memcmp(m_file + len - file.size(), file.c_str(), file.size()) != 0) {
+    return false;
   }
-};
+  // 完整路径, 或者在目录分隔处截断的后缀
+  return file.size() == len || file[0] == '/' ||
+         m_file[len - file.size() - 1] == '/';
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
- public:
-  LineFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << event->getLine();
+const LogCallSite *LogCallSite::Get(uint32_t id) {
+  Spinlock::Lock lock(s_callsite_mutex);
+  auto &sites = GetCallSites();
+  if (id == 0 || id > sites.size()) {
+    return nullptr;
   }
-};
+  return sites[id - 1];
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
+LogCallSite::LogCallSite(LogLevel::Level level, const char *file,
+                         int32_t line, const char *fmt)
+    : m_id(0),
+      m_level(level),
+      m_file(strdup(file ? file : "")),
+      m_line(line),
+      m_func(""),
+      m_logger(""),
+      m_fmt(fmt ? strdup(fmt) : nullptr),
+      m_enabled(true) {
+  const char *slash = strrchr(m_file, '/');
+  m_basename = slash ? slash + 1 : m_file;
+}
+
+/**
+ * @brief LogCallSite::Intern 的调用点表, 开放寻址, 只增不删
+ *
+ * @details 槽位发布后不再修改, 查找时用 acquire 读取, 不加锁.
+ *          按地址命中后再比较一次内容, 地址被别的字符串复用时不会串号
+ */
+class LogInternedSites {
  public:
-  NewLineFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << std::endl;
+  static LogInternedSites *GetInstance() {
+    // 不析构, 进程退出时二进制日志后台线程还可能用到
+    static LogInternedSites *s_instance = new LogInternedSites;
+    return s_instance;
   }
-};
 
-class StringFormatItem : public LogFormatter::FormatItem {
- public:
-  StringFormatItem(const std::string &str) : m_string(str) {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << m_string;
+  const LogCallSite *get(LogLevel::Level level, const char *file,
+                         int32_t line, const char *fmt) {
+    size_t hash = Hash(level, file, line, fmt);
+    const LogCallSite *site = find(hash, level, file, line, fmt);
+    if (site) {
+      return site;
+    }
+    Spinlock::Lock lock(m_mutex);
+    size_t i = hash & (kSlots - 1);
+    for (Entry *e; (e = m_slots[i].load(std::memory_order_relaxed));
+         i = (i + 1) & (kSlots - 1)) {
+      if (e->match(level, file, line, fmt)) {
+        return e->site;
+      }
+    }
+    // 最多填到3/4, 之后都用公共调用点
+    if (m_size >= kSlots / 4 * 3) {
+      LogCallSite *&overflow = m_overflow[level & 7];
+      if (!overflow) {
+        overflow = new LogCallSite(level, nullptr, 0, nullptr);
+      }
+      return overflow;
+    }
+    Entry *e = new Entry{file, line, level, fmt,
+                         new LogCallSite(level, file, line, fmt)};
+    m_slots[i].store(e, std::memory_order_release);
+    ++m_size;
+    return e->site;
   }
 
  private:
-  std::string m_string;
-};
+  struct Entry {
+    /// 调用方传入的地址, 只用于比较
+    const char *file;
+    int32_t line;
+    LogLevel::Level level;
+    const char *fmt;
+    LogCallSite *site;
 
-class TabFormatItem : public LogFormatter::FormatItem {
- public:
-  TabFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
-              LogEvent::ptr event) override {
-    os << "\t";
+    bool match(LogLevel::Level l, const char *f, int32_t n,
+               const char *m) const {
+      return file == f && line == n && level == l && fmt == m &&
+             strcmp(site->getFile(), f ? f : "") == 0 &&
+             (!m || strcmp(site->getFormat(), m) == 0);
+    }
+  };
+
+  static size_t Hash(LogLevel::Level level, const char *file, int32_t line,
+                     const char *fmt) {
+    uint64_t h = (uintptr_t)file ^ ((uint64_t)(uint32_t)line << 3) ^
+                 ((uintptr_t)fmt << 17) ^ level;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h >> 32;
+  }
+
+  const LogCallSite *find(size_t hash, LogLevel::Level level,
+                          const char *file, int32_t line, const char *fmt) {
+    size_t i = hash & (kSlots - 1);
+    for (Entry *e; (e = m_slots[i].load(std::memory_order_acquire));
+         i = (i + 1) & (kSlots - 1)) {
+      if (e->match(level, file, line, fmt)) {
+        return e->site;
+      }
+    }
+    return nullptr;
   }
 
  private:
-  std::string m_string;
+  static const size_t kSlots = 16384;
+  std::atomic<Entry *> m_slots[kSlots] = {};
+  /// 只在持有 m_mutex 时访问
+  size_t m_size = 0;
+  LogCallSite *m_overflow[8] = {};
+  Spinlock m_mutex;
 };
 
-LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
-                   const char *file, int32_t line, uint32_t elapse,
-                   uint32_t thread_id, uint32_t fiber_id, uint64_t time,
-                   const std::string &thread_name)
-    : m_file(file),
-      m_line(line),
-      m_elapse(elapse),
-      m_threadId(thread_id),
-      m_fiberId(fiber_id),
-      m_time(time),
-      m_threadName(thread_name),
-      m_logger(logger),
-      m_level(level) {}
-
-Logger::Logger(const std::string &name)
-    : m_name(name), m_level(LogLevel::DEBUG) {
-  m_formatter.reset(new LogFormatter(
-      "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+const LogCallSite *LogCallSite::Intern(LogLevel::Level level, const char *file,
+                                       int32_t line, const char *fmt) {
+  return LogInternedSites::GetInstance()->get(level, file, line, fmt);
 }
 
-void Logger::setFormatter(LogFormatter::ptr val) {
-  MutexType::Lock lock(m_mutex);
-  m_formatter = val;
+void LogCallSite::List(std::vector<LogCallSite *> &sites) {
+  Spinlock::Lock lock(s_callsite_mutex);
+  sites = GetCallSites();
+}
 
-  for (auto &i : m_appenders) {
-    MutexType::Lock ll(i->m_mutex);
-    if (!i->m_hasFormatter) {
-      i->m_formatter = m_formatter;
+size_t LogCallSite::SetEnabled(const std::string &file, int32_t line, bool v) {
+  Spinlock::Lock lock(s_callsite_mutex);
+  auto &rules = GetCallSiteRules();
+  // 相同文件和行号的设置只保留最新的一条
+  rules.erase(std::remove_if(rules.begin(), rules.end(),
+                             [&](const LogCallSiteRule &i) {
+                               return i.file == file && i.line == line;
+                             }),
+              rules.end());
+  rules.push_back({file, line, v});
+  size_t count = 0;
+  for (auto &i : GetCallSites()) {
+    if (i->match(file, line)) {
+      i->setEnabled(v);
+      ++count;
     }
   }
+  return count;
 }
 
-void Logger::setFormatter(const std::string &val) {
-  std::cout << "--" << val << std::endl;
-  sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(val));
-  if (new_val->isError()) {
-    std::cout << "Logger setFormatter name = " << m_name << " value = " << val
-              << " invalid formatter" << std::endl;
-    return;
-  }
-  setFormatter(new_val);
+LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e) {}
+
+LogEventWrap::~LogEventWrap() {
+  m_event->getLogger()->log(m_event->getLevel(), m_event);
 }
 
-std::string Logger::toYamlString() {
+void LogEvent::format(const char *fmt, ...) {
+  va_list al;
+  va_start(al, fmt);
+  format(fmt, al);
+  va_end(al);
+}
+
+void LogEvent::format(const char *fmt, va_list al) { m_ss.appendf(fmt, al); }
+
+LogStream &LogEventWrap::getSS() { return m_event->getSS(); }
+
+void LogAppender::setFormatter(LogFormatter::ptr val) {
   MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["name"] = m_name;
-  if (m_level != LogLevel::UNKNOW) {
-    node["level"] = LogLevel::ToString(m_level);
-  }
+  m_formatter = val;
   if (m_formatter) {
-    node["formatter"] = m_formatter->getPattern();
-  }
-  for (auto &i : m_appenders) {
-    node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    m_hasFormatter = true;
+  } else {
+    m_hasFormatter = false;
   }
-
-  std::stringstream ss;
-  ss << node;
-  return ss.str();
 }
 
-LogFormatter::ptr Logger::getFormatter() {
+void LogAppender::clearFormatter() {
   MutexType::Lock lock(m_mutex);
-  return m_formatter;
+  m_hasFormatter = false;
 }
 
-void Logger::addAppender(LogAppender::ptr appender) {
+LogFormatter::ptr LogAppender::getFormatter() {
   MutexType::Lock lock(m_mutex);
-  if (!appender->getFommater()) {
-    MutexType::Lock ll(appender->m_mutex);
-    appender->m_formatter = m_formatter;
-  }
-  m_appenders.push_back(appender);
+  return m_formatter;
 }
 
-void Logger::delAppender(LogAppender::ptr appender) {
-  MutexType::Lock lock(m_mutex);
-  for (auto it = m_appenders.begin(); it != m_appenders.end; ++it) {
-    if (*it == appender) {
-      m_appenders.erase(it);
-      break;
-    }
+/**
+ * @brief 把无符号整数转成十进制写到end之前, 返回起始位置
+ *
+ */
+static char *UIntToBuffer(uint64_t v, char *end) {
+  static const char s_digits[] =
+      "0001020304050607080910111213141516171819"
+      "2021222324252627282930313233343536373839"
+      "4041424344454647484950515253545556575859"
+      "6061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+  char *p = end;
+  while (v >= 100) {
+    unsigned idx = (v % 100) * 2;
+    v /= 100;
+    *--p = s_digits[idx + 1];
+    *--p = s_digits[idx];
+  }
+  if (v >= 10) {
+    unsigned idx = v * 2;
+    *--p = s_digits[idx + 1];
+    *--p = s_digits[idx];
+  } else {
+    *--p = '0' + v;
   }
+  return p;
 }
 
-void Logger::clearAppenders() {
-  MutexType::Lock lock(m_mutex);
-  m_appenders.clear();
-}
+LogFields::LogFields() : m_data(m_inlineData), m_dataCapacity(kInlineSize) {}
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-  if (level >= m_level) {
-    auto self = shared_from_this();
-    MutexType::Lock lock(m_mutex);
-    if (!m_appenders.empty()) {
-      for (auto &i : m_appenders) {
-        i->log(self, level, event);
-      }
-    } else if (m_root) {
-      m_root->log(level, event);
-    }
+LogFields::~LogFields() {
+  if (m_data != m_inlineData) {
+    free(m_data);
   }
 }
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-  if (level >= m_level) {
-    auto self = shared_from_this();
-    MutexType::Lock lock(m_mutex);
-    if (!m_appenders.empty)_)
-    {
-        for (auto &i = m_appenders) {
-          i->log(self, level, event);
-        }
-      }
-    else if (m_root) {
-      m_root->log(level, event);
+LogFields::Field &LogFields::append(Type type, const char *key,
+                                    size_t key_len, size_t extra) {
+  size_t need = m_dataSize + key_len + extra;
+  if (need > m_dataCapacity) {
+    size_t cap = m_dataCapacity * 2;
+    while (cap < need) {
+      cap *= 2;
+    }
+    char *data = (char *)malloc(cap);
+    memcpy(data, m_data, m_dataSize);
+    if (m_data != m_inlineData) {
+      free(m_data);
     }
+    m_data = data;
+    m_dataCapacity = cap;
   }
-};
+  Field *f;
+  if (m_size < kInlineFields) {
+    f = &m_inline[m_size];
+  } else {
+    m_more.resize(m_size - kInlineFields + 1);
+    f = &m_more.back();
+  }
+  ++m_size;
+  f->type = type;
+  f->key = m_dataSize;
+  f->keyLen = key_len;
+  memcpy(m_data + m_dataSize, key, key_len);
+  m_dataSize += key_len;
+  return *f;
+}
 
-void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); };
+void LogFields::addInt(const char *key, size_t key_len, int64_t v) {
+  append(INT, key, key_len).i = v;
+}
 
-void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); };
+void LogFields::addUInt(const char *key, size_t key_len, uint64_t v) {
+  append(UINT, key, key_len).u = v;
+}
 
-void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); };
+void LogFields::addDouble(const char *key, size_t key_len, double v) {
+  append(DOUBLE, key, key_len).d = v;
+}
 
-void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); };
+void LogFields::addBool(const char *key, size_t key_len, bool v) {
+  append(BOOL, key, key_len).b = v;
+}
 
-FileLogAppender::FileLogAppender(const std::string &filename)
-    : m_filename(filename) {
-  reopen();
+void LogFields::addString(const char *key, size_t key_len, const char *v,
+                          size_t len) {
+  append(STRING, key, key_len, len).len = len;
+  memcpy(m_data + m_dataSize, v, len);
+  m_dataSize += len;
 }
 
-void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level,
-                          LogEvent::ptr event) {
-  if (level >= m_level) {
-    uint64_t now = event->getTime();
-    if (now >= (m_lastTime + 3)) {
-      reopen();
-      m_lastTime = now;
-    }
-    MutexType::Lock lock(m_mutex);
-    if (!m_formatter->format(m_filestream, logger, level, event)) {
-      std::count << "error" << std::endl;
-    }
+void LogFields::clear() {
+  if (m_dataCapacity > 64 * 1024) {
+    free(m_data);
+    m_data = m_inlineData;
+    m_dataCapacity = kInlineSize;
   }
+  m_dataSize = 0;
+  m_size = 0;
+  m_more.clear();
 }
 
-std::string FileLogAppender::toYamlString() {
-  MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["type"] = "FileLogAppender";
-  node["file"] = m_filename;
-  if (m_level != LogLevel::UNKNOW) {
-    node["level"] = LogLevel::ToString(m_level);
-  }
-  if (m_harFormatter && m_formatter) {
-    node["formatter"] = m_formatter->getPattern();
-  }
+static const std::ios_base::fmtflags kDefaultStreamFlags =
+    std::ios_base::dec | std::ios_base::skipws;
 
-  std::stringstream ss;
-  ss << node;
-  return ss.str();
+LogStream::LogStream()
+    : m_data(m_inline),
+      m_size(0),
+      m_capacity(kInlineSize),
+      m_flags(kDefaultStreamFlags),
+      m_precision(6),
+      m_width(0),
+      m_fill(' ') {}
+
+LogStream::~LogStream() {
+  if (m_data != m_inline) {
+    free(m_data);
+  }
 }
 
-bool FileLogAppender::reopen() {
-  MutexType::Lock lock(m_mutex);
-  if (m_filestream) {
-    m_filestream.close();
+void LogStream::grow(size_t need) {
+  size_t cap = m_capacity * 2;
+  while (cap < need) {
+    cap *= 2;
   }
-  return FSUtil::OpenForWrite(m_filestream, m_filename, std::ios::app);
+  char *data = (char *)malloc(cap);
+  memcpy(data, m_data, m_size);
+  if (m_data != m_inline) {
+    free(m_data);
+  }
+  m_data = data;
+  m_capacity = cap;
 }
 
-void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level,
-                            LogEvent::ptr event) {
-  if (level >= m_level) {
-    MutexType::Lock lock(m_mutex);
-    m_formatter->format(std::cout, logger, level, event);
+void LogStream::reset() {
+  // 偶尔出现的超长日志不长期占用内存
+  if (m_capacity > 64 * 1024) {
+    free(m_data);
+    m_data = m_inline;
+    m_capacity = kInlineSize;
   }
+  m_size = 0;
+  m_flags = kDefaultStreamFlags;
+  m_precision = 6;
+  m_width = 0;
+  m_fill = ' ';
 }
 
-std::string StdoutLogAppender::toYamlString() {
-  MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["type"] = "StdoutLogAppender";
-  if (m_level != LogLevel::UNKNOW) {
-    node["level"] = LogLevel::ToString(m_level);
+void LogStream::appendUInt(unsigned long long v, bool negative) {
+  char tmp[32];
+  char *end = tmp + sizeof(tmp);
+  char *p;
+  if (isHex()) {
+    p = end;
+    do {
+      *--p = "0123456789abcdef"[v & 0xf];
+      v >>= 4;
+    } while (v);
+  } else {
+    p = UIntToBuffer(v, end);
+    if (negative) {
+      *--p = '-';
+    }
   }
-  if (m_hasFormatter && m_formatter) {
-    node["formatter"] = m_formatter->getPattern();
+  append(p, end - p);
+}
+
+LogStream &LogStream::operator<<(bool v) {
+  if (needOStream(std::ios_base::boolalpha)) {
+    return appendOStream(v);
   }
-  std::stringstream ss;
-  ss << node;
-  return ss.str();
+  append(v ? "1" : "0", 1);
+  return *this;
 }
 
-LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern) {
-  init();
+LogStream &LogStream::operator<<(char v) {
+  if (needOStream()) {
+    return appendOStream(v);
+  }
+  append(&v, 1);
+  return *this;
 }
 
-std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level,
+LogStream &LogStream::operator<<(signed char v) { return *this << (char)v; }
+
+LogStream &LogStream::operator<<(unsigned char v) { return *this << (char)v; }
+
+// 八进制, showbase, showpos, uppercase 交给 std::ostream
+static const std::ios_base::fmtflags kIntOStreamFlags =
+    std::ios_base::oct | std::ios_base::showbase | std::ios_base::showpos |
+    std::ios_base::uppercase;
+
+#define XX(type)                                               \
+  LogStream &LogStream::operator<<(type v) {                   \
+    if (needOStream(kIntOStreamFlags)) {                       \
+      return appendOStream(v);                                 \
+    }                                                          \
+    if (v < 0 && !isHex()) {                                   \
+      appendUInt(0 - (unsigned long long)v, true);             \
+    } else {                                                   \
+      appendUInt((unsigned long long)(unsigned type)v, false); \
+    }                                                          \
+    return *this;                                              \
+  }
+
+XX(short);
+XX(int);
+XX(long);
+XX(long long);
+#undef XX
+
+#define XX(type)                             \
+  LogStream &LogStream::operator<<(type v) { \
+    if (needOStream(kIntOStreamFlags)) {     \
+      return appendOStream(v);               \
+    }                                        \
+    appendUInt(v, false);                    \
+    return *this;                            \
+  }
+
+XX(unsigned short);
+XX(unsigned int);
+XX(unsigned long);
+XX(unsigned long long);
+#undef XX
+
+bool LogStream::floatFormat(char *fmt, const char *length) const {
+  // showpos, showpoint, uppercase 和 hexfloat 交给 std::ostream
+  if (needOStream(std::ios_base::showpos | std::ios_base::showpoint |
+                  std::ios_base::uppercase)) {
+    return false;
+  }
+  std::ios_base::fmtflags field = m_flags & std::ios_base::floatfield;
+  char conv;
+  if (field == std::ios_base::fixed) {
+    conv = 'f';
+  } else if (field == std::ios_base::scientific) {
+    conv = 'e';
+  } else if (field == std::ios_base::fmtflags()) {
+    conv = 'g';
+  } else {
+    return false;
+  }
+  // 与 std::num_put 一致: %.*f, %.*e, %.*g
+  *fmt++ = '%';
+  *fmt++ = '.';
+  *fmt++ = '*';
+  while (*length) {
+    *fmt++ = *length++;
+  }
+  *fmt++ = conv;
+  *fmt = '\0';
+  return true;
+}
+
+LogStream &LogStream::operator<<(float v) { return *this << (double)v; }
+
+LogStream &LogStream::operator<<(double v) {
+  char fmt[8];
+  if (!floatFormat(fmt, "")) {
+    return appendOStream(v);
+  }
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), fmt, (int)m_precision, v);
+  if (len < 0 || len >= (int)sizeof(buf)) {
+    // fixed 输出很大的数
+    return appendOStream(v);
+  }
+  append(buf, len);
+  return *this;
+}
+
+LogStream &LogStream::operator<<(long double v) {
+  char fmt[8];
+  if (!floatFormat(fmt, "L")) {
+    return appendOStream(v);
+  }
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), fmt, (int)m_precision, v);
+  if (len < 0 || len >= (int)sizeof(buf)) {
+    return appendOStream(v);
+  }
+  append(buf, len);
+  return *this;
+}
+
+LogStream &LogStream::operator<<(const char *v) {
+  if (!v) {
+    append("(null)", 6);
+  } else if (needOStream()) {
+    return appendOStream(v);
+  } else {
+    append(v, strlen(v));
+  }
+  return *this;
+}
+
+LogStream &LogStream::operator<<(const void *v) {
+  if (needOStream()) {
+    return appendOStream(v);
+  }
+  if (!v) {
+    append("0", 1);
+    return *this;
+  }
+  std::ios_base::fmtflags flags = m_flags;
+  m_flags = (m_flags & ~std::ios_base::basefield) | std::ios_base::hex;
+  append("0x", 2);
+  appendUInt((uintptr_t)v, false);
+  m_flags = flags;
+  return *this;
+}
+
+LogStream &LogStream::operator<<(std::ostream &(*manip)(std::ostream &)) {
+  if (manip == static_cast<std::ostream &(*)(std::ostream &)>(std::endl)) {
+    append("\n", 1);
+    return *this;
+  }
+  manip(beginOStream());
+  endOStream();
+  return *this;
+}
+
+LogStream &LogStream::operator<<(std::ios_base &(*manip)(std::ios_base &)) {
+  if (manip == static_cast<std::ios_base &(*)(std::ios_base &)>(std::hex)) {
+    m_flags = (m_flags & ~std::ios_base::basefield) | std::ios_base::hex;
+  } else if (manip ==
+             static_cast<std::ios_base &(*)(std::ios_base &)>(std::dec)) {
+    m_flags = (m_flags & ~std::ios_base::basefield) | std::ios_base::dec;
+  } else {
+    manip(beginOStream());
+    endOStream();
+  }
+  return *this;
+}
+
+void LogStream::appendf(const char *fmt, va_list al) {
+  va_list ap;
+  va_copy(ap, al);
+  int len = vsnprintf(m_data + m_size, m_capacity - m_size, fmt, ap);
+  va_end(ap);
+  if (len < 0) {
+    return;
+  }
+  if (m_size + len >= m_capacity) {
+    // vsnprintf需要多一个字节写结尾的'\0'
+    grow(m_size + len + 1);
+    va_copy(ap, al);
+    vsnprintf(m_data + m_size, m_capacity - m_size, fmt, ap);
+    va_end(ap);
+  }
+  m_size += len;
+}
+
+static thread_local std::stringstream *t_log_ostream = nullptr;
+
+std::ostream &LogStream::beginOStream() {
+  if (!t_log_ostream) {
+    t_log_ostream = new std::stringstream;
+  }
+  t_log_ostream->str(std::string());
+  t_log_ostream->clear();
+  t_log_ostream->flags(m_flags);
+  t_log_ostream->precision(m_precision);
+  t_log_ostream->width(m_width);
+  t_log_ostream->fill(m_fill);
+  return *t_log_ostream;
+}
+
+void LogStream::endOStream() {
+  // 操纵符修改的格式状态保留到下一次输出, 宽度输出后已被清零
+  m_flags = t_log_ostream->flags();
+  m_precision = t_log_ostream->precision();
+  m_width = t_log_ostream->width();
+  m_fill = t_log_ostream->fill();
+  const std::string &str = t_log_ostream->str();
+  append(str.c_str(), str.size());
+}
+
+/**
+ * @brief 向定长缓冲区追加日志内容, 空间不足后只累计需要的长度
+ *
+ */
+class LogBufferWriter {
+ public:
+  LogBufferWriter(char *buf, size_t size) : m_cur(buf), m_end(buf + size) {}
+
+  void append(const char *data, size_t len) {
+    if (m_cur && (size_t)(m_end - m_cur) >= len) {
+      memcpy(m_cur, data, len);
+      m_cur += len;
+    } else {
+      m_cur = nullptr;
+    }
+    m_total += len;
+  }
+
+  void append(const std::string &str) { append(str.c_str(), str.size()); }
+
+  void appendUInt(uint64_t v) {
+    char tmp[24];
+    char *p = UIntToBuffer(v, tmp + sizeof(tmp));
+    append(p, tmp + sizeof(tmp) - p);
+  }
+
+  void appendInt(int64_t v) {
+    if (v < 0) {
+      append("-", 1);
+      appendUInt(0 - (uint64_t)v);
+    } else {
+      appendUInt(v);
+    }
+  }
+
+  void appendLevel(LogLevel::Level level) {
+    switch (level) {
+#define XX(name)                      \
+  case LogLevel::name:                \
+    append(#name, sizeof(#name) - 1); \
+    break;
+
+      XX(DEBUG);
+      XX(INFO);
+      XX(WARN);
+      XX(ERROR);
+      XX(FATAL);
+#undef XX
+      default:
+        append("UNKNOW", 6);
+    }
+  }
+
+  size_t getTotal() const { return m_total; }
+
+ private:
+  char *m_cur;
+  char *m_end;
+  size_t m_total = 0;
+};
+
+LogEvent::LogEvent(std::shared_ptr<Logger> logger, const LogCallSite &site,
+                   LogLevel::Level level, uint32_t thread_id,
+                   uint32_t fiber_id, uint64_t time,
+                   const std::string &thread_name)
+    : m_site(&site),
+      m_level(level),
+      m_threadId(thread_id),
+      m_fiberId(fiber_id),
+      m_time(time),
+      m_threadName(&m_ownThreadName),
+      m_ownThreadName(thread_name),
+      m_logger(logger),
+      m_refs(0) {
+  m_ss.setFields(&m_fields);
+}
+
+LogEvent::LogEvent()
+    : m_site(nullptr),
+      m_level(LogLevel::UNKNOW),
+      m_time(0),
+      m_threadName(&m_ownThreadName),
+      m_refs(0) {
+  m_ss.setFields(&m_fields);
+}
+
+/**
+ * @brief 线程本地的日志事件对象池
+ *
+ * @details 空闲链表只由所属线程访问; 其他线程释放的事件先压入无锁栈 m_remote,
+ *          所属线程在空闲链表为空时整体取走. 池自身也带引用计数,
+ *          线程退出后等所有在途事件都释放了才销毁
+ */
+class LogEventPool {
+ public:
+  LogEventPool() : m_refs(1), m_remote(nullptr) {
+    m_names.push_back(Thread::GetName());
+    m_name = &m_names.back();
+  }
+
+  ~LogEventPool() {
+    Free(m_free);
+    Free(m_remote.exchange(nullptr, std::memory_order_acquire));
+  }
+
+  /**
+   * @brief 取一个空闲事件, 只能在所属线程调用
+   *
+   */
+  LogEvent *acquire() {
+    LogEvent *event = m_free;
+    if (!event) {
+      event = m_remote.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (event) {
+      m_free = event->m_next;
+      event->m_next = nullptr;
+    } else {
+      event = new LogEvent;
+      event->m_pool = this;
+    }
+    m_refs.fetch_add(1, std::memory_order_relaxed);
+
+    // 名称保留到池销毁, 在途事件的引用始终有效. 线程在几个名称间来回切换
+    // (协程调度, 线程池)时复用已有的名称, 列表只随不同名称的个数增长
+    const std::string &name = Thread::GetName();
+    if (SYLAR_UNLIKELY(name != *m_name)) {
+      auto it = std::find(m_names.begin(), m_names.end(), name);
+      if (it == m_names.end()) {
+        it = m_names.insert(m_names.end(), name);
+      }
+      m_name = &*it;
+    }
+    event->m_threadName = m_name;
+    return event;
+  }
+
+  /**
+   * @brief 归还事件, 可以在任意线程调用
+   *
+   */
+  void release(LogEvent *event) {
+    if (t_pool == this) {
+      event->m_next = m_free;
+      m_free = event;
+    } else {
+      LogEvent *head = m_remote.load(std::memory_order_relaxed);
+      do {
+        event->m_next = head;
+      } while (!m_remote.compare_exchange_weak(head, event,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+    unref();
+  }
+
+  void unref() {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  /**
+   * @brief 获取当前线程的对象池
+   *
+   */
+  static LogEventPool *GetThis() {
+    if (SYLAR_UNLIKELY(!t_pool)) {
+      static thread_local Holder s_holder;
+      s_holder.pool = t_pool = new LogEventPool;
+    }
+    return t_pool;
+  }
+
+ private:
+  /**
+   * @brief 线程退出时释放空闲事件, 并放弃线程对池的引用
+   *
+   */
+  struct Holder {
+    LogEventPool *pool = nullptr;
+    ~Holder() {
+      if (pool) {
+        t_pool = nullptr;
+        Free(pool->m_free);
+        pool->m_free = nullptr;
+        Free(pool->m_remote.exchange(nullptr, std::memory_order_acquire));
+        pool->unref();
+      }
+    }
+  };
+
+  static void Free(LogEvent *event) {
+    while (event) {
+      LogEvent *next = event->m_next;
+      delete event;
+      event = next;
+    }
+  }
+
+ private:
+  std::atomic<int64_t> m_refs;
+  /// 所属线程的空闲链表
+  LogEvent *m_free = nullptr;
+  /// 其他线程归还的事件
+  std::atomic<LogEvent *> m_remote;
+  /// 线程用过的名称, 事件直接引用其中的元素
+  std::list<std::string> m_names;
+  /// 当前名称, 指向 m_names 中的元素
+  const std::string *m_name = nullptr;
+
+  static thread_local LogEventPool *t_pool;
+};
+
+thread_local LogEventPool *LogEventPool::t_pool = nullptr;
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger,
+                               LogLevel::Level level, const char *file,
+                               int32_t line, uint32_t elapse,
+                               uint32_t thread_id, uint32_t fiber_id,
+                               uint64_t time) {
+  LogEvent::ptr event =
+      Create(logger, *LogCallSite::Intern(level, file, line), level,
+             thread_id, fiber_id, time * 1000000000);
+  event->m_elapse = elapse;
+  return event;
+}
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger,
+                               const LogCallSite &site, LogLevel::Level level,
+                               uint32_t thread_id, uint32_t fiber_id,
+                               uint64_t time) {
+  LogEvent *event = LogEventPool::GetThis()->acquire();
+  event->m_site = &site;
+  event->m_level = level;
+  event->m_elapse = LogClock::ElapseMS(time);
+  event->m_threadId = thread_id;
+  event->m_fiberId = fiber_id;
+  event->m_time = time;
+  event->m_logger.swap(logger);
+  return LogEvent::ptr(event);
+}
+
+void LogEvent::Release(LogEvent *event) {
+  if (!event->m_pool) {
+    delete event;
+    return;
+  }
+  event->m_ss.reset();
+  event->m_fields.clear();
+  event->m_logger.reset();
+  event->m_pool->release(event);
+}
+
+namespace {
+
+/**
+ * @brief 基于纪元的延迟释放, 写日志时读取日志器的Appender列表和事件队列不加锁
+ *
+ * @details 读者进入时把当前纪元记录到本线程的槽位, 退出时清零, 只写自己的
+ *          缓存行. 配置修改先发布新指针再推进纪元, 旧对象等到所有在读的线程
+ *          都已退出或进入了更新的纪元才释放. 线程退出时槽位归还复用
+ */
+class LogEpoch {
+ public:
+  class Guard {
+   public:
+    Guard() { Enter(); }
+    ~Guard() { Leave(); }
+
+   private:
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+  };
+
+  static void Enter() {
+    Record *rec = t_record;
+    if (!rec) {
+      if (t_exited) {
+        // 线程局部变量析构期间写日志, 槽位已经归还
+        s_exiting.fetch_add(1, std::memory_order_seq_cst);
+        return;
+      }
+      rec = Acquire();
+    }
+    if (rec->depth++ == 0) {
+      rec->epoch.store(s_epoch.load(std::memory_order_acquire),
+                       std::memory_order_seq_cst);
+    }
+  }
+
+  static void Leave() {
+    Record *rec = t_record;
+    if (!rec) {
+      s_exiting.fetch_sub(1, std::memory_order_release);
+      return;
+    }
+    if (--rec->depth == 0) {
+      rec->epoch.store(0, std::memory_order_release);
+    }
+  }
+
+  /**
+   * @brief 延迟释放已经替换下来的对象
+   *
+   */
+  static void Retire(std::shared_ptr<const void> p) {
+    uint64_t epoch = s_epoch.fetch_add(1, std::memory_order_acq_rel);
+    std::vector<std::shared_ptr<const void> > freed;
+    {
+      MutexType::Lock lock(GetMutex());
+      GetRetired().push_back(std::make_pair(epoch, std::move(p)));
+      Collect(freed);
+    }
+    // freed 在锁外析构: 释放Appender可能停止线程和写日志
+  }
+
+  /**
+   * @brief 等待此前进入的读者全部退出, 当前线程正在读时无法等待, 返回false
+   *
+   */
+  static bool Synchronize() {
+    if (t_exited || (t_record && t_record->depth > 0)) {
+      return false;
+    }
+    uint64_t epoch = s_epoch.fetch_add(1, std::memory_order_acq_rel);
+    while (MinActive() <= epoch) {
+      usleep(100);
+    }
+    std::vector<std::shared_ptr<const void> > freed;
+    {
+      MutexType::Lock lock(GetMutex());
+      Collect(freed);
+    }
+    return true;
+  }
+
+ private:
+  typedef Mutex MutexType;
+
+  struct Record {
+    Record() : epoch(0), used(true), depth(0), next(nullptr) {}
+    /// 进入时的纪元, 0表示不在读
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool> used;
+    uint32_t depth;
+    Record *next;
+    // 各线程的槽位不共享缓存行
+    char pad[40];
+  };
+
+  /**
+   * @brief 线程退出时归还槽位
+   *
+   */
+  struct Holder {
+    ~Holder() {
+      if (t_record) {
+        t_record->epoch.store(0, std::memory_order_release);
+        t_record->used.store(false, std::memory_order_release);
+        t_record = nullptr;
+      }
+      t_exited = true;
+    }
+  };
+
+  static Record *Acquire() {
+    static thread_local Holder t_holder;
+    (void)t_holder;
+    Record *rec = s_records.load(std::memory_order_acquire);
+    for (; rec; rec = rec->next) {
+      bool expected = false;
+      if (!rec->used.load(std::memory_order_relaxed) &&
+          rec->used.compare_exchange_strong(expected, true)) {
+        break;
+      }
+    }
+    if (!rec) {
+      rec = new Record;
+      rec->next = s_records.load(std::memory_order_relaxed);
+      while (!s_records.compare_exchange_weak(rec->next, rec)) {
+      }
+    }
+    t_record = rec;
+    return rec;
+  }
+
+  /**
+   * @brief 正在读的线程中最早的纪元, 没有时为UINT64_MAX
+   *
+   */
+  static uint64_t MinActive() {
+    uint64_t min = UINT64_MAX;
+    if (s_exiting.load(std::memory_order_seq_cst) > 0) {
+      return 0;
+    }
+    for (Record *rec = s_records.load(std::memory_order_acquire); rec;
+         rec = rec->next) {
+      uint64_t epoch = rec->epoch.load(std::memory_order_seq_cst);
+      if (epoch && epoch < min) {
+        min = epoch;
+      }
+    }
+    return min;
+  }
+
+  /**
+   * @brief 取出可以释放的对象, 调用时持有锁
+   *
+   */
+  static void Collect(std::vector<std::shared_ptr<const void> > &freed) {
+    auto &retired = GetRetired();
+    if (retired.empty()) {
+      return;
+    }
+    uint64_t min = MinActive();
+    for (auto it = retired.begin(); it != retired.end();) {
+      if (it->first < min) {
+        freed.push_back(std::move(it->second));
+        it = retired.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  static MutexType &GetMutex() {
+    static MutexType *s_mutex = new MutexType;
+    return *s_mutex;
+  }
+
+  static std::list<std::pair<uint64_t, std::shared_ptr<const void> > > &
+  GetRetired() {
+    static auto *s_retired =
+        new std::list<std::pair<uint64_t, std::shared_ptr<const void> > >;
+    return *s_retired;
+  }
+
+  static std::atomic<uint64_t> s_epoch;
+  static std::atomic<Record *> s_records;
+  static std::atomic<uint32_t> s_exiting;
+  static thread_local Record *t_record;
+  static thread_local bool t_exited;
+};
+
+std::atomic<uint64_t> LogEpoch::s_epoch(1);
+std::atomic<LogEpoch::Record *> LogEpoch::s_records(nullptr);
+std::atomic<uint32_t> LogEpoch::s_exiting(0);
+thread_local LogEpoch::Record *LogEpoch::t_record = nullptr;
+thread_local bool LogEpoch::t_exited = false;
+
+}  // namespace
+
+static std::atomic<uint32_t> s_logger_id(0);
+
+Logger::Logger(const std::string &name)
+    : m_name(name),
+      m_id(++s_logger_id),
+      m_binary(false),
+      m_level(LogLevel::DEBUG),
+      m_ownLevel(LogLevel::DEBUG),
+      m_appenders(std::make_shared<AppenderList>()),
+      m_effectiveAppenders(m_appenders),
+      m_effective(m_appenders.get()),
+      m_queuePtr(nullptr) {
+  m_formatter.reset(new LogFormatter(
+      "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+}
+
+void Logger::setFormatter(LogFormatter::ptr val) {
+  MutexType::Lock lock(m_mutex);
+  m_formatter = val;
+
+  for (auto &i : *m_appenders) {
+    MutexType::Lock ll(i->m_mutex);
+    if (!i->m_hasFormatter) {
+      i->m_formatter = m_formatter;
+    }
+  }
+}
+
+void Logger::setFormatter(const std::string &val) {
+  sylar::LogFormatter::ptr new_val = sylar::LogFormatter::Create(val);
+  if (new_val->isError()) {
+    std::cout << "Logger setFormatter name = " << m_name << " value = " << val
+              << " invalid formatter" << std::endl;
+    return;
+  }
+  setFormatter(new_val);
+}
+
+std::string Logger::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["name"] = m_name;
+  if (m_ownLevel != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_ownLevel);
+  }
+  if (m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  for (auto &i : *m_appenders) {
+    node["appenders"].push_back(YAML::Load(i->toYamlString()));
+  }
+
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+LogFormatter::ptr Logger::getFormatter() {
+  MutexType::Lock lock(m_mutex);
+  return m_formatter;
+}
+
+void Logger::setLevel(LogLevel::Level level) {
+  {
+    MutexType::Lock lock(m_mutex);
+    m_ownLevel = level;
+  }
+  refresh();
+}
+
+LogLevel::Level Logger::getOwnLevel() {
+  MutexType::Lock lock(m_mutex);
+  return m_ownLevel;
+}
+
+void Logger::addAppender(LogAppender::ptr appender) {
+  {
+    MutexType::Lock lock(m_mutex);
+    if (!appender->getFormatter()) {
+      MutexType::Lock ll(appender->m_mutex);
+      appender->m_formatter = m_formatter;
+    }
+    std::shared_ptr<AppenderList> appenders(new AppenderList(*m_appenders));
+    appenders->push_back(appender);
+    setAppenders(appenders);
+  }
+  refresh();
+}
+
+void Logger::delAppender(LogAppender::ptr appender) {
+  {
+    MutexType::Lock lock(m_mutex);
+    std::shared_ptr<AppenderList> appenders(new AppenderList(*m_appenders));
+    for (auto it = appenders->begin(); it != appenders->end(); ++it) {
+      if (*it == appender) {
+        appenders->erase(it);
+        break;
+      }
+    }
+    setAppenders(appenders);
+  }
+  refresh();
+}
+
+void Logger::replaceAppenders(const AppenderList &appenders) {
+  {
+    MutexType::Lock lock(m_mutex);
+    for (auto &i : appenders) {
+      MutexType::Lock ll(i->m_mutex);
+      if (!i->m_hasFormatter) {
+        i->m_formatter = m_formatter;
+      }
+    }
+    setAppenders(std::make_shared<AppenderList>(appenders));
+  }
+  refresh();
+}
+
+void Logger::clearAppenders() {
+  {
+    MutexType::Lock lock(m_mutex);
+    setAppenders(std::make_shared<AppenderList>());
+  }
+  refresh();
+}
+
+void Logger::setAppenders(std::shared_ptr<const AppenderList> appenders) {
+  m_appenders = appenders;
+}
+
+std::shared_ptr<const Logger::AppenderList> Logger::getAppenders() const {
+  MutexType::Lock lock(m_mutex);
+  return m_appenders;
+}
+
+std::shared_ptr<const Logger::AppenderList> Logger::getEffectiveAppenders()
+    const {
+  MutexType::Lock lock(m_mutex);
+  return m_effectiveAppenders;
+}
+
+void Logger::refresh() {
+  if (m_manager) {
+    m_manager->refresh(this);
+  } else {
+    updateEffective();
+  }
+}
+
+void Logger::updateEffective() {
+  std::shared_ptr<const AppenderList> old;
+  {
+    MutexType::Lock lock(m_mutex);
+    LogLevel::Level level = m_ownLevel;
+    std::shared_ptr<const AppenderList> appenders = m_appenders;
+    if (m_parent) {
+      if (level == LogLevel::UNKNOW) {
+        level = m_parent->getLevel();
+      }
+      if (appenders->empty()) {
+        appenders = m_parent->getEffectiveAppenders();
+      }
+    }
+    bool binary = false;
+    for (auto &i : *appenders) {
+      if (i->isBinary()) {
+        binary = true;
+        break;
+      }
+    }
+    if (binary && !m_binary) {
+      LogBinary::RegisterLogger(shared_from_this());
+    }
+    if (appenders != m_effectiveAppenders) {
+      m_effective.store(appenders.get(), std::memory_order_seq_cst);
+      old.swap(m_effectiveAppenders);
+      m_effectiveAppenders = appenders;
+    }
+    m_binary.store(binary, std::memory_order_relaxed);
+    m_level.store(level, std::memory_order_relaxed);
+  }
+  if (old) {
+    // 正在写日志的线程可能还在用旧列表
+    LogEpoch::Retire(old);
+  }
+}
+
+void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
+  if (level < getLevel()) {
+#if SYLAR_LOG_METRICS
+    m_metrics.add(LogCounters::FILTERED);
+#endif
+    return;
+  }
+#if SYLAR_LOG_METRICS
+  m_metrics.add(LogCounters::EMITTED);
+#endif
+  {
+    LogEpoch::Guard guard;
+    LogEventQueue *queue = m_queuePtr.load(std::memory_order_seq_cst);
+    if (queue) {
+      if (!queue->push(shared_from_this(), level, event)) {
+#if SYLAR_LOG_METRICS
+        m_metrics.add(LogCounters::DROPPED);
+#endif
+      }
+    } else if (!isBinary() ||
+               !LogBinary::WriteEvent(shared_from_this(), level, event)) {
+      // 二进制日志与格式化日志经过同一个线程缓冲, 保持先后顺序
+      dispatch(level, event);
+    }
+  }
+  if (level >= LogLevel::FATAL) {
+    // 日志器不一定由 LoggerManager 管理, 一并传入
+    FlushAll(shared_from_this());
+  }
+}
+
+void Logger::flush() {
+  LogEventQueue::ptr queue = getQueue();
+  if (queue) {
+    queue->flush();
+  }
+  if (isBinary()) {
+    LogBinary::Flush();
+  }
+  std::shared_ptr<const AppenderList> appenders = getEffectiveAppenders();
+  for (auto &i : *appenders) {
+    i->flush();
+  }
+}
+
+void Logger::FlushAll(const Logger::ptr &logger) {
+  LoggerMgr::GetInstance()->flushAll(logger);
+}
+
+void Logger::dispatch(LogLevel::Level level, LogEvent::ptr event) {
+  auto self = shared_from_this();
+  // 只读取快照, 写日志期间配置修改不会阻塞, 也不会被阻塞
+  LogEpoch::Guard guard;
+  const AppenderList *appenders =
+      m_effective.load(std::memory_order_seq_cst);
+  for (auto &i : *appenders) {
+    append(self, i.get(), level, event);
+  }
+}
+
+void Logger::append(const Logger::ptr &self, LogAppender *appender,
+                    LogLevel::Level level, const LogEvent::ptr &event) {
+#if SYLAR_LOG_METRICS
+  LogAppender::Metrics &metrics = appender->m_metrics;
+  if (level < appender->getLevel()) {
+    metrics.counters.add(LogCounters::FILTERED);
+    return;
+  }
+  metrics.counters.add(LogCounters::EMITTED);
+  // 字节数取差值而不清零, Appender 内部再写日志时外层的统计不会被打乱
+  uint64_t bytes = t_format_stat.bytes;
+  bool timed = t_format_stat.timed;
+  if (LogLatencySampled()) {
+    uint64_t start = LogClock::Now();
+    t_format_stat.end = start;
+    t_format_stat.timed = true;
+    appender->log(self, level, event);
+    uint64_t now = std::max(LogClock::Now(), start);
+    uint64_t format_end = std::min(std::max(t_format_stat.end, start), now);
+    metrics.format.record(format_end - start);
+    metrics.write.record(now - format_end);
+  } else {
+    t_format_stat.timed = false;
+    appender->log(self, level, event);
+  }
+  t_format_stat.timed = timed;
+  bytes = t_format_stat.bytes - bytes;
+  metrics.counters.add(LogCounters::BYTES, bytes);
+  m_metrics.add(LogCounters::BYTES, bytes);
+#else
+  appender->log(self, level, event);
+#endif
+}
+
+void Logger::setQueue(LogEventQueue::ptr queue) {
+  LogEventQueue::ptr old;
+  {
+    MutexType::Lock lock(m_mutex);
+    old.swap(m_queue);
+    m_queue = queue;
+    m_queuePtr.store(queue.get(), std::memory_order_seq_cst);
+  }
+  // 旧队列析构时写出剩余的事件, 等正在入队的线程退出后同步析构
+  if (old && !LogEpoch::Synchronize()) {
+    LogEpoch::Retire(old);
+  }
+}
+
+LogEventQueue::ptr Logger::getQueue() {
+  MutexType::Lock lock(m_mutex);
+  return m_queue;
+}
+
+void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); };
+
+void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); };
+
+void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); };
+
+void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); };
+
+static size_t RoundUpPowerOfTwo(size_t v) {
+  size_t n = 2;
+  while (n < v) {
+    n <<= 1;
+  }
+  return n;
+}
+
+LogEventQueue::LogEventQueue(size_t capacity, OverflowPolicy policy,
+                             LogLevel::Level drop_level)
+    : m_mask(RoundUpPowerOfTwo(capacity) - 1),
+      m_cells(m_mask + 1),
+      m_policy(policy),
+      m_dropLevel(drop_level),
+      m_enqueuePos(0),
+      m_pushed(0),
+      m_popped(0),
+      m_dropped(0),
+      m_waiting(false),
+      m_stop(false) {
+  for (size_t i = 0; i < m_cells.size(); ++i) {
+    m_cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  m_thread.reset(
+      new Thread(std::bind(&LogEventQueue::run, this), "log_queue"));
+}
+
+LogEventQueue::~LogEventQueue() {
+  m_stop = true;
+  {
+    MutexType::Lock lock(m_mutex);
+    m_cond.notify_all();
+  }
+  m_thread->join();
+}
+
+bool LogEventQueue::tryPush(Item &item) {
+  Cell *cell;
+  size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &m_cells[pos & m_mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (m_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->item.logger.swap(item.logger);
+  cell->item.level = item.level;
+  cell->item.event.swap(item.event);
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool LogEventQueue::tryPop(Item &item) {
+  Cell *cell = &m_cells[m_dequeuePos & m_mask];
+  size_t seq = cell->seq.load(std::memory_order_acquire);
+  if (seq != m_dequeuePos + 1) {
+    return false;
+  }
+  item.logger.swap(cell->item.logger);
+  item.level = cell->item.level;
+  item.event.swap(cell->item.event);
+  cell->seq.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+  ++m_dequeuePos;
+  return true;
+}
+
+bool LogEventQueue::push(std::shared_ptr<Logger> logger,
+                         LogLevel::Level level, LogEvent::ptr event) {
+  Item item;
+  item.logger.swap(logger);
+  item.level = level;
+  item.event.swap(event);
+  int spins = 0;
+  while (!tryPush(item)) {
+    if (m_policy == DROP_NEWEST ||
+        (m_policy == DROP_BELOW_LEVEL && level < m_dropLevel)) {
+      ++m_dropped;
+      return false;
+    }
+    // 队列已满, 先让出CPU, 多次失败后短暂休眠
+    if (++spins < 64) {
+      sched_yield();
+    } else {
+      usleep(100);
+    }
+  }
+  ++m_pushed;
+  if (m_waiting) {
+    MutexType::Lock lock(m_mutex);
+    m_cond.notify_one();
+  }
+  return true;
+}
+
+void LogEventQueue::flush() {
+  uint64_t target = m_pushed;
+  while (m_popped < target) {
+    {
+      MutexType::Lock lock(m_mutex);
+      m_cond.notify_one();
+    }
+    usleep(100);
+  }
+}
+
+void LogEventQueue::run() {
+  Item item;
+  while (true) {
+    if (tryPop(item)) {
+      item.logger->dispatch(item.level, item.event);
+      item.logger.reset();
+      item.event.reset();
+      ++m_popped;
+      continue;
+    }
+    if (m_stop && m_popped == m_pushed) {
+      break;
+    }
+    MutexType::Lock lock(m_mutex);
+    m_waiting = true;
+    // 置位后再检查一次, 避免与生产者的通知错过
+    Cell *cell = &m_cells[m_dequeuePos & m_mask];
+    if (cell->seq.load(std::memory_order_acquire) != m_dequeuePos + 1 &&
+        !m_stop) {
+      m_cond.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    m_waiting = false;
+  }
+}
+
+static uint64_t GetMonotonicMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 检查所有 LogSink 的等待时间, 超过 max_latency 的写出
+ *
+ * @details 只有缓冲由空变为非空时才被唤醒, 没有日志时不会空转
+ */
+class LogSink::Flusher {
+ public:
+  typedef Mutex MutexType;
+
+  static Flusher *GetInstance() {
+    // 不析构, 进程退出时由 atexit 写出剩余内容
+    static Flusher *s_flusher = new Flusher;
+    return s_flusher;
+  }
+
+  void add(LogSink *sink) {
+    MutexType::Lock lock(m_mutex);
+    m_sinks.push_back(sink);
+    if (!m_thread && !s_exiting) {
+      m_thread.reset(
+          new Thread(std::bind(&Flusher::run, this), "log_sink"));
+    }
+  }
+
+  void del(LogSink *sink) {
+    MutexType::Lock lock(m_mutex);
+    // 后台线程正在写这个Sink时等它写完
+    while (m_flushing == sink) {
+      m_cond.wait(lock);
+    }
+    m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink),
+                  m_sinks.end());
+  }
+
+  void notify() {
+    MutexType::Lock lock(m_mutex);
+    m_pending = true;
+    m_cond.notify_all();
+  }
+
+  /// 进程退出后追加的日志直接写出
+  static std::atomic<bool> s_exiting;
+
+ private:
+  Flusher() {
+    atexit([]() {
+      s_exiting = true;
+      Flusher *flusher = GetInstance();
+      MutexType::Lock lock(flusher->m_mutex);
+      for (auto &i : flusher->m_sinks) {
+        i->flush();
+      }
+    });
+  }
+
+  void run() {
+    MutexType::Lock lock(m_mutex);
+    while (true) {
+      while (!m_pending) {
+        m_cond.wait(lock);
+      }
+      m_pending = false;
+      while (true) {
+        uint64_t now = GetMonotonicMS();
+        uint64_t next = 0;
+        LogSink *expired = nullptr;
+        for (auto &i : m_sinks) {
+          uint64_t since = 0;
+          {
+            LogSink::MutexType::Lock sink_lock(i->m_mutex);
+            since = i->m_since;
+          }
+          if (!since) {
+            continue;
+          }
+          uint64_t deadline = since + i->m_maxLatency;
+          if (deadline <= now) {
+            expired = i;
+            break;
+          }
+          if (!next || deadline < next) {
+            next = deadline;
+          }
+        }
+        if (expired) {
+          m_flushing = expired;
+          lock.unlock();
+          expired->flush();
+          lock.lock();
+          m_flushing = nullptr;
+          m_cond.notify_all();
+          continue;
+        }
+        if (!next) {
+          break;
+        }
+        m_cond.wait_for(lock, std::chrono::milliseconds(next - now));
+        m_pending = false;
+      }
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  std::condition_variable_any m_cond;
+  std::vector<LogSink *> m_sinks;
+  LogSink *m_flushing = nullptr;
+  bool m_pending = false;
+  Thread::ptr m_thread;
+};
+
+std::atomic<bool> LogSink::Flusher::s_exiting(false);
+
+/**
+ * @brief 把数据完整写入fd, 只调用 write(2), 可在信号处理函数中使用
+ *
+ */
+static void WriteFully(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::write(fd, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+namespace {
+
+/**
+ * @brief 致命信号处理, 崩溃时写出缓冲中的日志和调用栈
+ *
+ * @details LogSink 和 LogAsyncWriter 在构造时登记到定长的原子指针数组,
+ *          信号处理函数只读这些数组, 不加锁也不分配内存
+ */
+class LogCrashHandler {
+ public:
+  static const size_t kMaxEntries = 256;
+
+  template <class T>
+  static void Add(std::atomic<T *> *slots, T *v) {
+    for (size_t i = 0; i < kMaxEntries; ++i) {
+      T *expected = nullptr;
+      if (slots[i].compare_exchange_strong(expected, v)) {
+        return;
+      }
+    }
+    // 表满时崩溃只会丢失这一个的缓冲, 只提示一次避免刷屏
+    static std::atomic<bool> s_warned(false);
+    if (!s_warned.exchange(true)) {
+      std::cout << "LogCrashHandler table full (" << kMaxEntries
+                << " entries), unflushed logs of later sinks will be lost "
+                   "on crash"
+                << std::endl;
+    }
+  }
+
+  template <class T>
+  static void Del(std::atomic<T *> *slots, T *v) {
+    for (size_t i = 0; i < kMaxEntries; ++i) {
+      T *expected = v;
+      if (slots[i].compare_exchange_strong(expected, nullptr)) {
+        return;
+      }
+    }
+  }
+
+  static void Install() {
+    MutexType::Lock lock(GetMutex());
+    if (s_installed) {
+      return;
+    }
+    // backtrace 第一次调用时会加载 libgcc, 提前调用避免在信号处理函数中分配
+    void *frames[2];
+    backtrace(frames, 2);
+    // 栈溢出时在备用栈上处理, 其他线程需要自己调用 InstallAltStack
+    InstallAltStack();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sa.sa_sigaction = &LogCrashHandler::OnSignal;
+    for (size_t i = 0; i < kSignalCount; ++i) {
+      sigaction(kSignals[i], &sa, &s_oldActions[i]);
+    }
+    s_installed = true;
+  }
+
+  static void Uninstall() {
+    MutexType::Lock lock(GetMutex());
+    if (!s_installed) {
+      return;
+    }
+    for (size_t i = 0; i < kSignalCount; ++i) {
+      sigaction(kSignals[i], &s_oldActions[i], nullptr);
+    }
+    s_installed = false;
+  }
+
+  /**
+   * @brief 为当前线程安装备用信号栈, 线程已有备用栈时不处理
+   *
+   * @details 备用栈在线程退出时释放
+   */
+  static void InstallAltStack() {
+    struct AltStack {
+      AltStack() : stack(nullptr) {}
+      ~AltStack() {
+        if (!stack) {
+          return;
+        }
+        stack_t ss;
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, nullptr);
+        delete[] stack;
+      }
+      char *stack;
+    };
+    static thread_local AltStack t_alt;
+    stack_t old;
+    if (t_alt.stack || (sigaltstack(nullptr, &old) == 0 &&
+                        !(old.ss_flags & SS_DISABLE))) {
+      return;
+    }
+    t_alt.stack = new char[kAltStackSize];
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = t_alt.stack;
+    ss.ss_size = kAltStackSize;
+    sigaltstack(&ss, nullptr);
+  }
+
+  static std::atomic<LogSink *> s_sinks[kMaxEntries];
+  static std::atomic<LogAsyncWriter *> s_writers[kMaxEntries];
+
+ private:
+  typedef Mutex MutexType;
+  static const size_t kAltStackSize = 64 * 1024;
+  static const size_t kSignalCount = 5;
+  static const size_t kMaxFds = kMaxEntries * 2 + 1;
+  static const int kSignals[kSignalCount];
+
+  static MutexType &GetMutex() {
+    static MutexType *s_mutex = new MutexType;
+    return *s_mutex;
+  }
+
+  /**
+   * @brief 记录要写调用栈的文件, 同一个文件只记录一次
+   *
+   */
+  static void AddFd(int fd, int *fds, struct stat *stats, size_t &count) {
+    struct stat st;
+    if (fd < 0 || count >= kMaxFds || fstat(fd, &st) != 0) {
+      return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (stats[i].st_dev == st.st_dev && stats[i].st_ino == st.st_ino) {
+        return;
+      }
+    }
+    stats[count] = st;
+    fds[count++] = fd;
+  }
+
+  static const char *SignalName(int sig) {
+    switch (sig) {
+      case SIGSEGV:
+        return "SIGSEGV";
+      case SIGABRT:
+        return "SIGABRT";
+      case SIGBUS:
+        return "SIGBUS";
+      case SIGILL:
+        return "SIGILL";
+      case SIGFPE:
+        return "SIGFPE";
+      default:
+        return "signal";
+    }
+  }
+
+  static void OnSignal(int sig, siginfo_t *info, void *ctx) {
+    // 多个线程同时崩溃时只由第一个处理, 其他线程等待进程结束
+    static std::atomic<bool> s_entered(false);
+    if (s_entered.exchange(true)) {
+      while (true) {
+        pause();
+      }
+    }
+    int saved_errno = errno;
+
+    static int s_fds[kMaxFds];
+    static struct stat s_stats[kMaxFds];
+    size_t count = 0;
+    for (size_t i = 0; i < kMaxEntries; ++i) {
+      LogSink *sink = s_sinks[i].load(std::memory_order_acquire);
+      if (sink) {
+        AddFd(sink->emergencyFlush(), s_fds, s_stats, count);
+      }
+    }
+    for (size_t i = 0; i < kMaxEntries; ++i) {
+      LogAsyncWriter *writer = s_writers[i].load(std::memory_order_acquire);
+      if (writer) {
+        AddFd(writer->emergencyFlush(), s_fds, s_stats, count);
+      }
+    }
+    AddFd(STDERR_FILENO, s_fds, s_stats, count);
+
+    // *** SIGSEGV (addr 0x...) pid 123 tid 456 time 1700000000 ***
+    char head[128];
+    char *p = head;
+    char num[24];
+    auto put = [&p](const char *str, size_t len) {
+      memcpy(p, str, len);
+      p += len;
+    };
+    auto put_uint = [&put, &num](uint64_t v) {
+      char *b = UIntToBuffer(v, num + sizeof(num));
+      put(b, num + sizeof(num) - b);
+    };
+    const char *name = SignalName(sig);
+    put("*** ", 4);
+    put(name, strlen(name));
+    // kill/raise 发来的信号没有出错地址
+    if (info->si_code > 0) {
+      put(" (addr 0x", 9);
+      uintptr_t addr = (uintptr_t)info->si_addr;
+      for (int i = sizeof(addr) * 2 - 1; i >= 0; --i) {
+        *p++ = "0123456789abcdef"[(addr >> (i * 4)) & 0xf];
+      }
+      put(")", 1);
+    }
+    put(" pid ", 5);
+    put_uint(getpid());
+    put(" tid ", 5);
+    put_uint(syscall(SYS_gettid));
+    put(" time ", 6);
+    put_uint(time(nullptr));
+    put(" ***\n", 5);
+
+    void *frames[64];
+    int depth = backtrace(frames, 64);
+    for (size_t i = 0; i < count; ++i) {
+      WriteFully(s_fds[i], head, p - head);
+      // 可执行文件带 -rdynamic 链接时能解析出函数名
+      backtrace_symbols_fd(frames, depth, s_fds[i]);
+    }
+
+    // 交还原来的处理方式: 硬件异常返回后会再次触发, kill/raise/abort
+    // 发来的信号要重新发送
+    for (size_t i = 0; i < kSignalCount; ++i) {
+      if (kSignals[i] == sig) {
+        sigaction(sig, &s_oldActions[i], nullptr);
+      }
+    }
+    if (info->si_code <= 0) {
+      raise(sig);
+    }
+    errno = saved_errno;
+  }
+
+ private:
+  static bool s_installed;
+  static struct sigaction s_oldActions[kSignalCount];
+};
+
+std::atomic<LogSink *> LogCrashHandler::s_sinks[kMaxEntries];
+std::atomic<LogAsyncWriter *> LogCrashHandler::s_writers[kMaxEntries];
+const int LogCrashHandler::kSignals[kSignalCount] = {SIGSEGV, SIGABRT, SIGBUS,
+                                                     SIGILL, SIGFPE};
+bool LogCrashHandler::s_installed = false;
+struct sigaction LogCrashHandler::s_oldActions[kSignalCount];
+
+}  // namespace
+
+/// 重新打开代数, 见 LoggerManager::reopenAll
+static std::atomic<uint64_t> s_reopen_generation(0);
+
+LogSink::ptr LogSink::Stdout() {
+  static LogSink::ptr *s_stdout = new LogSink::ptr(new LogSink(STDOUT_FILENO));
+  return *s_stdout;
+}
+
+LogSink::LogSink(int fd, uint32_t max_latency, uint32_t max_bytes)
+    : m_fd(fd),
+      m_owned(false),
+      m_maxLatency(max_latency),
+      m_maxBytes(max_bytes),
+      m_generation(0) {
+  m_buffer.reserve(m_maxBytes);
+  if (m_maxLatency) {
+    Flusher::GetInstance()->add(this);
+  }
+  LogCrashHandler::Add(LogCrashHandler::s_sinks, this);
+}
+
+LogSink::LogSink(const std::string &filename, uint32_t max_latency,
+                 uint32_t max_bytes)
+    : m_filename(filename),
+      m_fd(-1),
+      m_owned(true),
+      m_maxLatency(max_latency),
+      m_maxBytes(max_bytes),
+      m_generation(s_reopen_generation.load(std::memory_order_relaxed)) {
+  m_buffer.reserve(m_maxBytes);
+  reopen();
+  if (m_maxLatency) {
+    Flusher::GetInstance()->add(this);
+  }
+  LogCrashHandler::Add(LogCrashHandler::s_sinks, this);
+}
+
+LogSink::~LogSink() {
+  LogCrashHandler::Del(LogCrashHandler::s_sinks, this);
+  if (m_maxLatency) {
+    Flusher::GetInstance()->del(this);
+  }
+  flush();
+  if (m_owned && m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+void LogSink::append(const char *data, size_t len) {
+  bool first = false;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_buffer.size() + len < m_maxBytes && !Flusher::s_exiting) {
+      if (m_buffer.empty()) {
+        m_since = GetMonotonicMS();
+        first = true;
+      }
+      m_buffer.append(data, len);
+      data = nullptr;
+    }
+  }
+  if (!data) {
+    if (first && m_maxLatency) {
+      Flusher::GetInstance()->notify();
+    }
+    return;
+  }
+  WriteMutexType::Lock lock(m_writeMutex);
+  flushLocked(data, len);
+}
+
+void LogSink::append(const char *data, size_t len, time_t now) {
+  LogFileRotator::ptr rotator;
+  {
+    MutexType::Lock lock(m_mutex);
+    rotator = m_rotator.lock();
+  }
+  if (rotator) {
+    rotator->write(*this, data, len, now);
+  } else {
+    append(data, len);
+  }
+}
+
+LogFileRotator::ptr LogSink::setRotate(uint64_t max_size,
+                                       LogFileRotator::Period period,
+                                       uint32_t max_files, uint32_t max_days,
+                                       bool compress) {
+  WriteMutexType::Lock lock(m_writeMutex);
+  LogFileRotator::ptr rotator = getRotator();
+  if (rotator) {
+    if (rotator->getMaxSize() == max_size && rotator->getPeriod() == period &&
+        rotator->getMaxFiles() == max_files &&
+        rotator->getMaxDays() == max_days &&
+        rotator->isCompress() == compress) {
+      return rotator;
+    }
+    std::cout << "LogSink setRotate file=" << m_filename
+              << " conflicts with the rotate config of another appender"
+              << std::endl;
+    return nullptr;
+  }
+  rotator.reset(new LogFileRotator(m_filename, max_size, period, max_files,
+                                   max_days, compress));
+  MutexType::Lock buf_lock(m_mutex);
+  m_rotator = rotator;
+  return rotator;
+}
+
+LogFileRotator::ptr LogSink::getRotator() {
+  MutexType::Lock lock(m_mutex);
+  return m_rotator.lock();
+}
+
+int LogSink::emergencyFlush() {
+  int fd = m_fd;
+  if (fd >= 0) {
+    WriteFully(fd, m_buffer.data(), m_buffer.size());
+  }
+  return fd;
+}
+
+void LogSink::flush() {
+  WriteMutexType::Lock lock(m_writeMutex);
+  flushLocked(nullptr, 0);
+}
+
+void LogSink::flushLocked(const char *data, size_t len) {
+  std::string buf;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_buffer.empty() && !len) {
+      return;
+    }
+    buf.swap(m_buffer);
+    m_buffer.swap(m_spare);
+    m_since = 0;
+  }
+  write(buf, data, len);
+  buf.clear();
+  MutexType::Lock lock(m_mutex);
+  if (m_buffer.empty() && m_buffer.capacity() < buf.capacity()) {
+    m_buffer.swap(buf);
+  } else if (m_spare.capacity() < buf.capacity()) {
+    m_spare.swap(buf);
+  }
+}
+
+void LogSink::write(const std::string &buf, const char *data, size_t len) {
+  if (m_fd < 0) {
+    return;
+  }
+  struct iovec iov[2];
+  int cnt = 0;
+  if (!buf.empty()) {
+    iov[cnt].iov_base = (void *)buf.data();
+    iov[cnt].iov_len = buf.size();
+    ++cnt;
+  }
+  if (len) {
+    iov[cnt].iov_base = (void *)data;
+    iov[cnt].iov_len = len;
+    ++cnt;
+  }
+  struct iovec *cur = iov;
+  while (cnt > 0) {
+    ssize_t n = writev(m_fd, cur, cnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    // 处理部分写入
+    while (cnt > 0 && (size_t)n >= cur->iov_len) {
+      n -= cur->iov_len;
+      ++cur;
+      --cnt;
+    }
+    if (cnt > 0) {
+      cur->iov_base = (char *)cur->iov_base + n;
+      cur->iov_len -= n;
+    }
+  }
+}
+
+void LogSink::checkReopen() {
+  uint64_t generation = s_reopen_generation.load(std::memory_order_relaxed);
+  if (SYLAR_LIKELY(m_generation.load(std::memory_order_relaxed) ==
+                   generation) ||
+      !m_owned) {
+    return;
+  }
+  WriteMutexType::Lock lock(m_writeMutex);
+  // 共用这个Sink的其他Appender已经重新打开过
+  if (m_generation.load(std::memory_order_relaxed) == generation) {
+    return;
+  }
+  m_generation.store(generation, std::memory_order_relaxed);
+  reopenLocked();
+  lock.unlock();
+  LogFileRotator::ptr rotator = getRotator();
+  if (rotator) {
+    rotator->reload();
+  }
+}
+
+bool LogSink::reopen() {
+  if (!m_owned) {
+    return m_fd >= 0;
+  }
+  WriteMutexType::Lock lock(m_writeMutex);
+  return reopenLocked();
+}
+
+bool LogSink::reopenLocked() {
+  flushLocked(nullptr, 0);
+  int fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    FSUtil::Mkdir(FSUtil::Dirname(m_filename));
+    fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+              0644);
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  m_fd = fd;
+  return m_fd >= 0;
+}
+
+/**
+ * @brief 目录部分解析为绝对路径(不存在时先创建), 文件名不解析
+ *
+ */
+static std::string CanonicalLogPath(const std::string &filename) {
+  std::string dir = FSUtil::Dirname(filename);
+  std::string real;
+  if (!FSUtil::Realpath(dir, real)) {
+    FSUtil::Mkdir(dir);
+    if (!FSUtil::Realpath(dir, real)) {
+      return filename;
+    }
+  }
+  if (real.empty() || real[real.size() - 1] != '/') {
+    real += '/';
+  }
+  return real + FSUtil::Basename(filename);
+}
+
+namespace {
+
+/**
+ * @brief 用 inotify 监视日志文件所在目录, 日志文件被移走或删除时递增重新打开代数
+ *
+ */
+class LogFileWatcher {
+ public:
+  typedef Mutex MutexType;
+
+  static LogFileWatcher *GetInstance() {
+    // 不析构, Appender 可能在静态对象析构时才注销
+    static LogFileWatcher *s_watcher = new LogFileWatcher;
+    return s_watcher;
+  }
+
+  void add(const std::string &filename) {
+    MutexType::Lock lock(m_mutex);
+    std::string name = Normalize(filename);
+    ++m_files[name];
+    if (m_fd >= 0) {
+      watch(name);
+    }
+  }
+
+  void del(const std::string &filename) {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_files.find(Normalize(filename));
+    if (it == m_files.end() || --it->second != 0) {
+      return;
+    }
+    std::string dir = FSUtil::Dirname(it->first);
+    m_files.erase(it);
+    for (auto &i : m_files) {
+      if (FSUtil::Dirname(i.first) == dir) {
+        return;
+      }
+    }
+    // 目录中最后一个日志文件, 不再监视
+    for (auto i = m_dirs.begin(); i != m_dirs.end(); ++i) {
+      if (i->second == dir) {
+        inotify_rm_watch(m_fd, i->first);
+        m_dirs.erase(i);
+        break;
+      }
+    }
+  }
+
+  /**
+   * @brief 切分前登记要被自己移走的文件, 其移走事件不触发全局重新打开
+   *
+   * @return 是否登记, 未开启监视时不登记
+   */
+  bool ignore(const std::string &filename) {
+    MutexType::Lock lock(m_mutex);
+    if (m_fd < 0) {
+      return false;
+    }
+    ++m_ignored[Normalize(filename)];
+    return true;
+  }
+
+  /**
+   * @brief 移走失败时撤销登记
+   *
+   */
+  void unignore(const std::string &filename) {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_ignored.find(Normalize(filename));
+    if (it != m_ignored.end() && --it->second == 0) {
+      m_ignored.erase(it);
+    }
+  }
+
+  void start() {
+    MutexType::Lock lock(m_mutex);
+    if (m_fd >= 0) {
+      return;
+    }
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+      std::cout << "LogFileWatcher inotify_init1 error: " << strerror(errno)
+                << std::endl;
+      return;
+    }
+    for (auto &i : m_files) {
+      watch(i.first);
+    }
+    m_stop = false;
+    m_thread.reset(
+        new Thread(std::bind(&LogFileWatcher::run, this), "log_watch"));
+  }
+
+  void stop() {
+    Thread::ptr thread;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_fd < 0) {
+        return;
+      }
+      m_stop = true;
+      thread.swap(m_thread);
+    }
+    thread->join();
+    MutexType::Lock lock(m_mutex);
+    close(m_fd);
+    m_fd = -1;
+    m_dirs.clear();
+    m_ignored.clear();
+  }
+
+ private:
+  static std::string Normalize(const std::string &filename) {
+    return CanonicalLogPath(filename);
+  }
+
+  /**
+   * @brief 监视文件所在目录, 调用时持有m_mutex
+   *
+   */
+  void watch(const std::string &filename) {
+    std::string dir = FSUtil::Dirname(filename);
+    for (auto &i : m_dirs) {
+      if (i.second == dir) {
+        return;
+      }
+    }
+    int wd = inotify_add_watch(m_fd, dir.c_str(), IN_MOVED_FROM | IN_DELETE);
+    if (wd < 0) {
+      std::cout << "LogFileWatcher watch " << dir
+                << " error: " << strerror(errno) << std::endl;
+      return;
+    }
+    m_dirs[wd] = dir;
+  }
+
+  void run() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!m_stop) {
+      struct pollfd pfd = {m_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 200) <= 0) {
+        continue;
+      }
+      ssize_t n = read(m_fd, buf, sizeof(buf));
+      if (n <= 0) {
+        continue;
+      }
+      bool reopen = false;
+      MutexType::Lock lock(m_mutex);
+      for (char *p = buf; p < buf + n;) {
+        struct inotify_event *event = (struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + event->len;
+        auto it = m_dirs.find(event->wd);
+        if (it == m_dirs.end() || !event->len) {
+          continue;
+        }
+        std::string name = it->second + "/" + event->name;
+        if (!m_files.count(name)) {
+          continue;
+        }
+        auto ig = m_ignored.find(name);
+        if ((event->mask & IN_MOVED_FROM) && ig != m_ignored.end()) {
+          // 切分时自己移走的, 切分方已经重新打开
+          if (--ig->second == 0) {
+            m_ignored.erase(ig);
+          }
+          continue;
+        }
+        reopen = true;
+      }
+      if (reopen) {
+        s_reopen_generation.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  int m_fd = -1;
+  std::atomic<bool> m_stop{false};
+  /// 日志文件(目录/文件名) -> 引用数
+  std::map<std::string, uint32_t> m_files;
+  /// watch descriptor -> 目录
+  std::map<int, std::string> m_dirs;
+  /// 切分时自己移走的文件 -> 尚未收到的移走事件数
+  std::map<std::string, uint32_t> m_ignored;
+  Thread::ptr m_thread;
+};
+
+}  // namespace
+
+namespace {
+
+/**
+ * @brief 切分文件的后台压缩和清理线程
+ *
+ */
+class LogFileCompressor {
+ public:
+  typedef Mutex MutexType;
+
+  struct Task {
+    /// 切分出来的文件
+    std::string path;
+    /// 原日志文件名
+    std::string filename;
+    uint32_t max_files;
+    uint32_t max_days;
+    bool compress;
+  };
+
+  static LogFileCompressor *GetInstance() {
+    // 不析构, 进程退出时未完成的任务留到下次切分时清理
+    static LogFileCompressor *s_compressor = new LogFileCompressor;
+    return s_compressor;
+  }
+
+  void add(const Task &task) {
+    MutexType::Lock lock(m_mutex);
+    m_tasks.push_back(task);
+    ++m_added;
+    if (!m_thread) {
+      m_thread.reset(new Thread(std::bind(&LogFileCompressor::run, this),
+                                "log_compress"));
+    }
+    m_cond.notify_all();
+  }
+
+  void flush() {
+    MutexType::Lock lock(m_mutex);
+    while (m_done < m_added) {
+      m_cond.wait(lock);
+    }
+  }
+
+ private:
+  void run() {
+    while (true) {
+      Task task;
+      {
+        MutexType::Lock lock(m_mutex);
+        while (m_tasks.empty()) {
+          m_cond.wait(lock);
+        }
+        task = m_tasks.front();
+        m_tasks.pop_front();
+      }
+      if (task.compress) {
+        Compress(task.path);
+      }
+      Cleanup(task);
+
+      MutexType::Lock lock(m_mutex);
+      ++m_done;
+      m_cond.notify_all();
+    }
+  }
+
+  /**
+   * @brief 压缩为 path.gz, 先写临时文件再改名, 保留原文件的修改时间
+   *
+   */
+  static bool Compress(const std::string &path) {
+    struct stat st;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+      // 还没压缩就被清理掉了
+      return false;
+    }
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      std::cout << "LogFileCompressor open " << path
+                << " error: " << strerror(errno) << std::endl;
+      if (fd >= 0) {
+        close(fd);
+      }
+      return false;
+    }
+    std::string tmp = path + ".gz.tmp";
+    gzFile gz = gzopen(tmp.c_str(), "wb6");
+    if (!gz) {
+      std::cout << "LogFileCompressor gzopen " << tmp << " error" << std::endl;
+      close(fd);
+      return false;
+    }
+    std::vector<char> buf(64 * 1024);
+    bool ok = true;
+    while (true) {
+      ssize_t n = read(fd, &buf[0], buf.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        ok = n == 0;
+        break;
+      }
+      if (gzwrite(gz, &buf[0], n) != n) {
+        ok = false;
+        break;
+      }
+    }
+    close(fd);
+    if (gzclose(gz) != Z_OK || !ok) {
+      std::cout << "LogFileCompressor compress " << path << " error"
+                << std::endl;
+      unlink(tmp.c_str());
+      return false;
+    }
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, tmp.c_str(), times, 0);
+    if (rename(tmp.c_str(), (path + ".gz").c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    unlink(path.c_str());
+    return true;
+  }
+
+  /**
+   * @brief 按保留个数和天数删除旧的切分文件
+   *
+   * @details 只处理 "文件名.YYYYmmdd-HHMMSS[.序号]" 开头的文件,
+   *          按文件名中的切分时间和序号排序, 同一秒内切分的文件也能分出先后
+   */
+  static void Cleanup(const Task &task) {
+    if (!task.max_files && !task.max_days) {
+      return;
+    }
+    std::string dir = FSUtil::Dirname(task.filename);
+    std::string prefix = FSUtil::Basename(task.filename) + ".";
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+      return;
+    }
+    struct File {
+      std::string stamp;
+      uint32_t seq;
+      time_t mtime;
+      std::string path;
+      bool operator<(const File &oth) const {
+        return stamp != oth.stamp ? stamp > oth.stamp : seq > oth.seq;
+      }
+    };
+    std::vector<File> files;
+    while (struct dirent *dp = readdir(d)) {
+      std::string name = dp->d_name;
+      if (name.size() < prefix.size() + 15 ||
+          name.compare(0, prefix.size(), prefix) != 0 ||
+          name[prefix.size() + 8] != '-' ||
+          (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)) {
+        continue;
+      }
+      bool digits = true;
+      for (size_t i = 0; i < 15 && digits; ++i) {
+        digits = i == 8 || isdigit(name[prefix.size() + i]);
+      }
+      struct stat st;
+      std::string path = dir + "/" + name;
+      if (digits && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t pos = prefix.size() + 15;
+        uint32_t seq = name[pos] == '.' ? atoi(name.c_str() + pos + 1) : 0;
+        files.push_back({name.substr(prefix.size(), 15), seq, st.st_mtime,
+                         path});
+      }
+    }
+    closedir(d);
+
+    std::sort(files.begin(), files.end());
+    time_t expire = time(0) - (time_t)task.max_days * 86400;
+    for (size_t i = 0; i < files.size(); ++i) {
+      if ((task.max_files && i >= task.max_files) ||
+          (task.max_days && files[i].mtime < expire)) {
+        unlink(files[i].path.c_str());
+      }
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  std::condition_variable_any m_cond;
+  std::list<Task> m_tasks;
+  uint64_t m_added = 0;
+  uint64_t m_done = 0;
+  Thread::ptr m_thread;
+};
+
+}  // namespace
+
+const char *LogFileRotator::PeriodToString(Period period) {
+  switch (period) {
+    case HOURLY:
+      return "hourly";
+    case DAILY:
+      return "daily";
+    default:
+      return "none";
+  }
+}
+
+LogFileRotator::Period LogFileRotator::PeriodFromString(
+    const std::string &str) {
+  if (str == "hourly") {
+    return HOURLY;
+  } else if (str == "daily") {
+    return DAILY;
+  }
+  return NONE;
+}
+
+LogFileRotator::LogFileRotator(const std::string &filename, uint64_t max_size,
+                               Period period, uint32_t max_files,
+                               uint32_t max_days, bool compress)
+    : m_filename(filename),
+      m_maxSize(max_size),
+      m_period(period),
+      m_maxFiles(max_files),
+      m_maxDays(max_days),
+      m_compress(compress) {
+  time_t now = time(0);
+  struct stat st;
+  if (stat(m_filename.c_str(), &st) == 0 && st.st_size > 0) {
+    m_size = st.st_size;
+    // 上次运行留下的文件属于更早的周期时, 第一次写入就切分
+    m_periodEnd = periodEnd(std::min(st.st_mtime, now));
+  } else {
+    m_periodEnd = periodEnd(now);
+  }
+}
+
+void LogFileRotator::write(LogSink &sink, const char *data, size_t len,
+                           time_t now) {
+  MutexType::Lock lock(m_mutex);
+  if (m_period != NONE && now >= m_periodEnd) {
+    rotate(sink, now);
+  }
+  while (m_maxSize && len && m_size + len > m_maxSize) {
+    // 在剩余空间内最后一个换行处切开
+    size_t room = m_size < m_maxSize ? m_maxSize - m_size : 0;
+    const char *p = room ? (const char *)memrchr(data, '\n', room) : nullptr;
+    size_t cut = p ? p - data + 1 : 0;
+    if (!cut && !m_size) {
+      // 空文件也放不下一条, 这一条单独写一个文件
+      p = (const char *)memchr(data, '\n', len);
+      cut = p ? p - data + 1 : len;
+    }
+    if (cut) {
+      sink.append(data, cut);
+      m_size += cut;
+      data += cut;
+      len -= cut;
+    }
+    if (len) {
+      rotate(sink, now);
+    }
+  }
+  if (len) {
+    sink.append(data, len);
+    m_size += len;
+  }
+}
+
+void LogFileRotator::reload() {
+  MutexType::Lock lock(m_mutex);
+  struct stat st;
+  m_size = stat(m_filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+void LogFileRotator::Flush() { LogFileCompressor::GetInstance()->flush(); }
+
+void LogFileRotator::rotate(LogSink &sink, time_t now) {
+  sink.flush();
+  m_periodEnd = periodEnd(now);
+  struct stat st;
+  if (stat(m_filename.c_str(), &st) == 0 && st.st_size > 0) {
+    struct tm tm;
+    char buf[32];
+    localtime_r(&now, &tm);
+    strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+    std::string base = m_filename + buf;
+    std::string path = base;
+    // 同一秒内多次切分时加序号
+    for (int i = 1; access(path.c_str(), F_OK) == 0 ||
+                    access((path + ".gz").c_str(), F_OK) == 0;
+         ++i) {
+      path = base + "." + std::to_string(i);
+    }
+    bool ignored = LogFileWatcher::GetInstance()->ignore(m_filename);
+    if (rename(m_filename.c_str(), path.c_str()) == 0) {
+      LogFileCompressor::GetInstance()->add(
+          {path, m_filename, m_maxFiles, m_maxDays, m_compress});
+    } else {
+      if (ignored) {
+        LogFileWatcher::GetInstance()->unignore(m_filename);
+      }
+      std::cout << "LogFileRotator rename " << m_filename << " to " << path
+                << " error: " << strerror(errno) << std::endl;
+    }
+  }
+  sink.reopen();
+  struct stat cur;
+  m_size = stat(m_filename.c_str(), &cur) == 0 ? cur.st_size : 0;
+}
+
+time_t LogFileRotator::periodEnd(time_t now) const {
+  if (m_period == NONE) {
+    return 0;
+  }
+  struct tm tm;
+  localtime_r(&now, &tm);
+  tm.tm_min = 0;
+  tm.tm_sec = 0;
+  if (m_period == DAILY) {
+    tm.tm_hour = 0;
+    tm.tm_mday += 1;
+  } else {
+    tm.tm_hour += 1;
+  }
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+const char *LogAsyncWriter::PolicyToString(OverflowPolicy policy) {
+  switch (policy) {
+    case BLOCK:
+      return "block";
+    case DROP_OLDEST:
+      return "drop_oldest";
+    default:
+      return "drop_newest";
+  }
+}
+
+LogAsyncWriter::OverflowPolicy LogAsyncWriter::PolicyFromString(
+    const std::string &str) {
+  if (str == "block") {
+    return BLOCK;
+  } else if (str == "drop_oldest") {
+    return DROP_OLDEST;
+  }
+  return DROP_NEWEST;
+}
+
+LogAsyncWriter::LogAsyncWriter(LogSink::ptr sink, uint32_t flush_interval,
+                               uint32_t buffer_size, uint32_t max_buffers,
+                               OverflowPolicy policy)
+    : m_sink(sink),
+      m_flushInterval(flush_interval ? flush_interval : 1000),
+      m_bufferSize(buffer_size ? buffer_size : 4 * 1024 * 1024),
+      m_maxBuffers(max_buffers ? max_buffers : 25),
+      m_policy(policy) {
+  m_current.reserve(m_bufferSize);
+  m_pending.reset(new Pending[m_maxBuffers + 1]);
+  m_thread.reset(
+      new Thread(std::bind(&LogAsyncWriter::run, this), "log_writer"));
+  LogCrashHandler::Add(LogCrashHandler::s_writers, this);
+}
+
+LogAsyncWriter::~LogAsyncWriter() {
+  LogCrashHandler::Del(LogCrashHandler::s_writers, this);
+  {
+    MutexType::Lock lock(m_mutex);
+    m_stop = true;
+    m_cond.notify_all();
+  }
+  m_thread->join();
+}
+
+int LogAsyncWriter::emergencyFlush() {
+  int fd = ::open(m_sink->getFilename().c_str(), O_WRONLY | O_APPEND | O_CREAT,
+                  0644);
+  if (fd < 0) {
+    return -1;
+  }
+  // m_buffers 可能正在被其他线程修改, 只读发布出来的地址
+  for (size_t i = 0; i <= m_maxBuffers; ++i) {
+    const char *data = m_pending[i].data.load(std::memory_order_acquire);
+    size_t size = m_pending[i].size.load(std::memory_order_acquire);
+    if (data && size) {
+      WriteFully(fd, data, size);
+    }
+  }
+  return fd;
+}
+
+static void PublishPending(std::atomic<const char *> &data,
+                           std::atomic<size_t> &size, const std::string &buf) {
+  if (data.load(std::memory_order_relaxed) != buf.data()) {
+    size.store(0, std::memory_order_release);
+    data.store(buf.data(), std::memory_order_release);
+  }
+  size.store(buf.size(), std::memory_order_release);
+}
+
+void LogAsyncWriter::publish() {
+  size_t n = std::min<size_t>(m_buffers.size(), m_maxBuffers);
+  for (size_t i = 0; i < m_maxBuffers; ++i) {
+    if (i < n) {
+      PublishPending(m_pending[i].data, m_pending[i].size, m_buffers[i]);
+    } else {
+      m_pending[i].size.store(0, std::memory_order_release);
+      m_pending[i].data.store(nullptr, std::memory_order_release);
+    }
+  }
+  Pending &cur = m_pending[m_maxBuffers];
+  PublishPending(cur.data, cur.size, m_current);
+}
+
+void LogAsyncWriter::swapCurrent() {
+  m_buffers.push_back(std::string());
+  m_buffers.back().swap(m_current);
+  m_bufferRecords.push_back(m_currentRecords);
+  m_currentRecords = 0;
+  if (!m_spares.empty()) {
+    m_current.swap(m_spares.back());
+    m_spares.pop_back();
+  } else {
+    m_current.reserve(m_bufferSize);
+  }
+}
+
+void LogAsyncWriter::append(const char *data, size_t len) {
+  MutexType::Lock lock(m_mutex);
+  if (!m_current.empty() && m_current.size() + len > m_bufferSize) {
+    // 写盘跟不上时按策略处理, 避免内存无限增长
+    while (m_buffers.size() + m_writing >= m_maxBuffers && !m_stop) {
+      if (m_policy == BLOCK) {
+        m_cond.notify_all();
+        m_cond.wait(lock);
+      } else if (m_policy == DROP_NEWEST) {
+        ++m_dropped;
+        return;
+      } else if (!m_buffers.empty()) {
+        m_dropped += m_bufferRecords.front();
+        m_buffers.erase(m_buffers.begin());
+        m_bufferRecords.erase(m_bufferRecords.begin());
+      } else {
+        // 其余缓冲都在写, 前台缓冲就是最早可丢弃的
+        m_dropped += m_currentRecords;
+        m_currentRecords = 0;
+        m_current.clear();
+        break;
+      }
+    }
+    if (!m_current.empty()) {
+      swapCurrent();
+      m_cond.notify_all();
+    }
+    m_current.append(data, len);
+    ++m_currentRecords;
+    publish();
+    return;
+  }
+  m_current.append(data, len);
+  ++m_currentRecords;
+  Pending &cur = m_pending[m_maxBuffers];
+  PublishPending(cur.data, cur.size, m_current);
+}
+
+void LogAsyncWriter::flush() {
+  MutexType::Lock lock(m_mutex);
+  if (m_stop) {
+    return;
+  }
+  uint64_t seq = ++m_flushSeq;
+  m_cond.notify_all();
+  while (m_flushedSeq < seq) {
+    m_cond.wait(lock);
+  }
+}
+
+void LogAsyncWriter::reopen() {
+  MutexType::Lock lock(m_mutex);
+  m_reopen = true;
+  m_cond.notify_all();
+}
+
+void LogAsyncWriter::run() {
+  std::vector<std::string> writing;
+  while (true) {
+    uint64_t flush_seq = 0;
+    bool stop = false;
+    bool reopen = false;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_buffers.empty() && !m_stop && !m_reopen &&
+          m_flushSeq == m_flushedSeq) {
+        m_cond.wait_for(lock, std::chrono::milliseconds(m_flushInterval));
+      }
+      if (!m_current.empty()) {
+        swapCurrent();
+      }
+      writing.swap(m_buffers);
+      m_bufferRecords.clear();
+      // 取走的缓冲写完后会回收复用, 先撤下
+      publish();
+      m_writing = writing.size();
+      flush_seq = m_flushSeq;
+      stop = m_stop;
+      reopen = m_reopen;
+      m_reopen = false;
+    }
+
+    uint64_t now = time(0);
+    if (reopen) {
+      m_sink->reopen();
+      LogFileRotator::ptr rotator = m_sink->getRotator();
+      if (rotator) {
+        rotator->reload();
+      }
+    } else {
+      m_sink->checkReopen();
+    }
+    for (auto &i : writing) {
+      m_sink->append(i.data(), i.size(), now);
+    }
+    // 缓冲由本线程攒好, 写出后才算完成 flush
+    if (flush_seq != m_flushedSeq || stop) {
+      m_sink->flush();
+    }
+
+    MutexType::Lock lock(m_mutex);
+    for (auto &i : writing) {
+      if (m_spares.size() < 2 && i.capacity() >= m_bufferSize) {
+        i.clear();
+        m_spares.push_back(std::string());
+        m_spares.back().swap(i);
+      }
+    }
+    writing.clear();
+    m_writing = 0;
+    m_flushedSeq = flush_seq;
+    m_cond.notify_all();
+    if (stop) {
+      break;
+    }
+  }
+}
+
+FileLogAppender::FileLogAppender(const std::string &filename)
+    : m_filename(filename),
+      m_sink(LoggerMgr::GetInstance()->getFileSink(filename)) {
+  LogFileWatcher::GetInstance()->add(m_filename);
+}
+
+FileLogAppender::~FileLogAppender() {
+  LogFileWatcher::GetInstance()->del(m_filename);
+}
+
+void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                          LogEvent::ptr event) {
+  if (level >= m_level) {
+    LogFormatter::ptr formatter;
+    LogAsyncWriter::ptr writer;
+    {
+      MutexType::Lock lock(m_mutex);
+      formatter = m_formatter;
+      writer = m_asyncWriter;
+    }
+    if (writer) {
+      std::string msg = formatter->format(logger, level, event);
+      writer->append(msg.c_str(), msg.size());
+      return;
+    }
+
+    char buf[4096];
+    std::string str;
+    const char *data = buf;
+    size_t len = formatter->format(buf, sizeof(buf), logger, level, event);
+    if (len > sizeof(buf)) {
+      str.resize(len);
+      formatter->format(&str[0], len, logger, level, event);
+      data = str.c_str();
+    }
+
+    // m_sink 构造后不变, 写文件时不持有 m_mutex, Sink和切分器各自加锁
+    m_sink->checkReopen();
+    m_sink->append(data, len, event->getTime());
+  }
+}
+
+void FileLogAppender::flush() {
+  LogAsyncWriter::ptr writer;
+  {
+    MutexType::Lock lock(m_mutex);
+    writer = m_asyncWriter;
+  }
+  if (writer) {
+    writer->flush();
+  } else {
+    m_sink->flush();
+  }
+}
+
+uint64_t FileLogAppender::getDropped() {
+  MutexType::Lock lock(m_mutex);
+  return m_dropped + (m_asyncWriter ? m_asyncWriter->getDropped() : 0);
+}
+
+void FileLogAppender::setAsync(bool v, uint32_t flush_interval,
+                               uint32_t buffer_size, uint32_t max_buffers,
+                               LogAsyncWriter::OverflowPolicy policy) {
+  LogAsyncWriter::ptr old;
+  {
+    MutexType::Lock lock(m_mutex);
+    old.swap(m_asyncWriter);
+    if (old) {
+      m_dropped += old->getDropped();
+    }
+  }
+  // 先等旧的后台线程写完, 保证切换前后日志顺序
+  old.reset();
+  if (v) {
+    LogAsyncWriter::ptr writer(new LogAsyncWriter(
+        m_sink, flush_interval, buffer_size, max_buffers, policy));
+    m_sink->flush();
+    MutexType::Lock lock(m_mutex);
+    m_asyncWriter = writer;
+  }
+}
+
+bool FileLogAppender::isAsync() {
+  MutexType::Lock lock(m_mutex);
+  return m_asyncWriter != nullptr;
+}
+
+bool FileLogAppender::setRotate(uint64_t max_size,
+                                LogFileRotator::Period period,
+                                uint32_t max_files, uint32_t max_days,
+                                bool compress) {
+  LogFileRotator::ptr old;
+  {
+    MutexType::Lock lock(m_mutex);
+    old.swap(m_rotator);
+  }
+  // 先释放自己持有的切分器, 只有本Appender使用时才能换成新的配置
+  old.reset();
+  if (!max_size && period == LogFileRotator::NONE) {
+    return true;
+  }
+  LogFileRotator::ptr rotator =
+      m_sink->setRotate(max_size, period, max_files, max_days, compress);
+  MutexType::Lock lock(m_mutex);
+  m_rotator = rotator;
+  return rotator != nullptr;
+}
+
+LogFileRotator::ptr FileLogAppender::getRotator() {
+  MutexType::Lock lock(m_mutex);
+  return m_rotator;
+}
+
+std::string FileLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "FileLogAppender";
+  node["file"] = m_filename;
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  if (m_asyncWriter) {
+    node["async"] = true;
+    node["flush_interval"] = m_asyncWriter->getFlushInterval();
+    node["buffer_size"] = m_asyncWriter->getBufferSize();
+    node["max_buffers"] = m_asyncWriter->getMaxBuffers();
+    node["overflow"] =
+        LogAsyncWriter::PolicyToString(m_asyncWriter->getPolicy());
+  }
+  if (m_rotator) {
+    if (m_rotator->getMaxSize()) {
+      node["max_size"] = m_rotator->getMaxSize();
+    }
+    if (m_rotator->getPeriod() != LogFileRotator::NONE) {
+      node["rotate"] = LogFileRotator::PeriodToString(m_rotator->getPeriod());
+    }
+    if (m_rotator->getMaxFiles()) {
+      node["max_files"] = m_rotator->getMaxFiles();
+    }
+    if (m_rotator->getMaxDays()) {
+      node["max_days"] = m_rotator->getMaxDays();
+    }
+    if (m_rotator->isCompress()) {
+      node["compress"] = true;
+    }
+  }
+
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+bool FileLogAppender::reopen() {
+  LogAsyncWriter::ptr writer;
+  {
+    MutexType::Lock lock(m_mutex);
+    writer = m_asyncWriter;
+  }
+  if (writer) {
+    writer->reopen();
+    return true;
+  }
+  return openFile();
+}
+
+bool FileLogAppender::openFile() {
+  bool rt = m_sink->reopen();
+  LogFileRotator::ptr rotator = m_sink->getRotator();
+  if (rotator) {
+    rotator->reload();
+  }
+  return rt;
+}
+
+const char *MmapFileLogAppender::SyncPolicyToString(SyncPolicy sync) {
+  switch (sync) {
+    case SYNC_ASYNC:
+      return "async";
+    case SYNC_SYNC:
+      return "sync";
+    default:
+      return "none";
+  }
+}
+
+MmapFileLogAppender::SyncPolicy MmapFileLogAppender::SyncPolicyFromString(
+    const std::string &str) {
+  if (str == "async") {
+    return SYNC_ASYNC;
+  } else if (str == "sync") {
+    return SYNC_SYNC;
+  }
+  return SYNC_NONE;
+}
+
+MmapFileLogAppender::MmapFileLogAppender(const std::string &filename,
+                                         uint32_t chunk_size, SyncPolicy sync)
+    : m_filename(filename), m_sync(sync), m_offset(0) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  m_chunkSize = (std::max<size_t>(chunk_size, page) + page - 1) / page * page;
+  for (auto &i : m_chunks) {
+    i.index = kNoChunk;
+    i.written = 0;
+  }
+
+  FSUtil::Mkdir(FSUtil::Dirname(filename));
+  m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    std::cout << "MmapFileLogAppender open " << filename
+              << " failed, errno=" << errno << " " << strerror(errno)
+              << std::endl;
+    return;
+  }
+  struct stat st;
+  if (fstat(m_fd, &st) == 0) {
+    // 上次异常退出时没有截断, 去掉最后一块中未写入的空字节
+    uint64_t size = st.st_size;
+    uint64_t limit = size > m_chunkSize ? size - m_chunkSize : 0;
+    char buf[4096];
+    while (size > limit) {
+      size_t n = std::min<uint64_t>(sizeof(buf), size - limit);
+      if (pread(m_fd, buf, n, size - n) != (ssize_t)n) {
+        break;
+      }
+      size_t i = n;
+      while (i > 0 && buf[i - 1] == '\0') {
+        --i;
+      }
+      size -= n - i;
+      if (i > 0) {
+        break;
+      }
+    }
+    if (size != (uint64_t)st.st_size && ftruncate(m_fd, size) != 0) {
+      size = st.st_size;
+    }
+    m_start = size;
+  }
+  m_offset = m_start;
+}
+
+MmapFileLogAppender::~MmapFileLogAppender() {
+  if (m_fd < 0) {
+    return;
+  }
+  for (auto &i : m_chunks) {
+    if (i.index != kNoChunk && i.data) {
+      if (m_sync != SYNC_NONE) {
+        msync(i.data, m_chunkSize, m_sync == SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+      }
+      munmap(i.data, m_chunkSize);
+    }
+  }
+  if (ftruncate(m_fd, m_offset) != 0) {
+    std::cout << "MmapFileLogAppender truncate " << m_filename
+              << " failed, errno=" << errno << std::endl;
+  }
+  close(m_fd);
+}
+
+void MmapFileLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                              LogEvent::ptr event) {
+  if (level < m_level || m_fd < 0) {
+    return;
+  }
+  LogFormatter::ptr formatter;
+  {
+    MutexType::Lock lock(m_mutex);
+    formatter = m_formatter;
+  }
+  char buf[4096];
+  size_t n = formatter->format(buf, sizeof(buf), logger, level, event);
+  if (n <= sizeof(buf)) {
+    write(buf, n);
+  } else {
+    std::string str = formatter->format(logger, level, event);
+    write(str.c_str(), str.size());
+  }
+}
+
+void MmapFileLogAppender::write(const char *data, size_t len) {
+  uint64_t offset = m_offset.fetch_add(len, std::memory_order_relaxed);
+  while (len > 0) {
+    uint64_t index = offset / m_chunkSize;
+    size_t pos = offset % m_chunkSize;
+    size_t n = std::min<size_t>(len, m_chunkSize - pos);
+    Chunk *chunk = getChunk(index);
+    if (!chunk) {
+      return;
+    }
+    if (pos == 0) {
+      // 第一个写入新块的线程映射下一块, 下一块的第一条日志不用等待.
+      // 下一块已经全部被预留时可能已经写完并解除映射, 不能再映射
+      Mutex::Lock lock(m_mapMutex);
+      if (m_offset.load(std::memory_order_relaxed) <
+          (index + 2) * m_chunkSize) {
+        bool error = false;
+        mapChunk(index + 1, error);
+      }
+    }
+    memcpy(chunk->data + pos, data, n);
+    if (chunk->written.fetch_add(n, std::memory_order_acq_rel) + n ==
+        m_chunkSize) {
+      releaseChunk(*chunk);
+    }
+    offset += n;
+    data += n;
+    len -= n;
+  }
+}
+
+MmapFileLogAppender::Chunk *MmapFileLogAppender::getChunk(uint64_t index) {
+  Chunk &chunk = m_chunks[index % kChunks];
+  if (SYLAR_LIKELY(chunk.index.load(std::memory_order_acquire) == index)) {
+    return &chunk;
+  }
+  while (true) {
+    {
+      Mutex::Lock lock(m_mapMutex);
+      bool error = false;
+      if (mapChunk(index, error)) {
+        return &chunk;
+      }
+      if (error) {
+        return nullptr;
+      }
+    }
+    // 槽位上的旧块还有线程没写完
+    sched_yield();
+  }
+}
+
+bool MmapFileLogAppender::mapChunk(uint64_t index, bool &error) {
+  Chunk &chunk = m_chunks[index % kChunks];
+  uint64_t cur = chunk.index.load(std::memory_order_acquire);
+  if (cur == index) {
+    return true;
+  }
+  if (cur != kNoChunk) {
+    return false;
+  }
+  uint64_t offset = index * m_chunkSize;
+  int rt = fallocate(m_fd, 0, offset, m_chunkSize);
+  if (rt != 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) {
+    // 文件系统不支持fallocate时退回ftruncate
+    struct stat st;
+    rt = fstat(m_fd, &st);
+    if (rt == 0 && (uint64_t)st.st_size < offset + m_chunkSize) {
+      rt = ftruncate(m_fd, offset + m_chunkSize);
+    }
+  }
+  void *data = MAP_FAILED;
+  if (rt == 0) {
+    data = mmap(nullptr, m_chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                m_fd, offset);
+  }
+  if (data == MAP_FAILED) {
+    std::cout << "MmapFileLogAppender map " << m_filename
+              << " offset=" << offset << " failed, errno=" << errno << " "
+              << strerror(errno) << std::endl;
+    error = true;
+    return false;
+  }
+  chunk.data = (char *)data;
+  // 打开时已有内容的那一块, 已有部分算作写过
+  chunk.written = offset < m_start ? m_start - offset : 0;
+  chunk.index.store(index, std::memory_order_release);
+  return true;
+}
+
+void MmapFileLogAppender::releaseChunk(Chunk &chunk) {
+  if (m_sync != SYNC_NONE) {
+    msync(chunk.data, m_chunkSize, m_sync == SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+  }
+  munmap(chunk.data, m_chunkSize);
+  Mutex::Lock lock(m_mapMutex);
+  chunk.data = nullptr;
+  chunk.index.store(kNoChunk, std::memory_order_release);
+}
+
+void MmapFileLogAppender::flush() {
+  // 映射的内容已经在页缓存中, 只有要求msync时才需要处理
+  if (m_sync == SYNC_NONE) {
+    return;
+  }
+  Mutex::Lock lock(m_mapMutex);
+  for (auto &i : m_chunks) {
+    if (i.index != kNoChunk && i.data) {
+      msync(i.data, m_chunkSize, m_sync == SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+    }
+  }
+}
+
+std::string MmapFileLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "MmapFileLogAppender";
+  node["file"] = m_filename;
+  node["chunk_size"] = m_chunkSize;
+  node["sync"] = SyncPolicyToString(m_sync);
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+/**
+ * @brief 收到信号时转储所有 RingBufferLogAppender
+ *
+ * @details 信号处理函数只往管道写一个字节, 后台线程读到后转储
+ */
+class LogRingDumper {
+ public:
+  typedef Mutex MutexType;
+
+  static LogRingDumper *GetInstance() {
+    // 不析构, Appender 可能在静态对象析构时才注销
+    static LogRingDumper *s_dumper = new LogRingDumper;
+    return s_dumper;
+  }
+
+  void add(RingBufferLogAppender *appender) {
+    MutexType::Lock lock(m_mutex);
+    m_appenders.insert(appender);
+  }
+
+  void del(RingBufferLogAppender *appender) {
+    MutexType::Lock lock(m_mutex);
+    m_appenders.erase(appender);
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+      if (it->first == appender) {
+        it = m_pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  /**
+   * @brief 请求后台线程转储一个Appender, 不阻塞写日志的线程
+   *
+   */
+  void request(RingBufferLogAppender *appender, const std::string &reason) {
+    {
+      MutexType::Lock lock(m_mutex);
+      m_pending.push_back(std::make_pair(appender, reason));
+    }
+    {
+      MutexType::Lock lock(m_signalMutex);
+      if (!start()) {
+        return;
+      }
+    }
+    OnSignal(0);
+  }
+
+  void setSignal(int sig) {
+    MutexType::Lock lock(m_signalMutex);
+    if (sig == m_signal) {
+      return;
+    }
+    if (m_signal) {
+      sigaction(m_signal, &m_oldAction, nullptr);
+      m_signal = 0;
+    }
+    if (!sig || !start()) {
+      return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = &LogRingDumper::OnSignal;
+    if (sigaction(sig, &sa, &m_oldAction) != 0) {
+      std::cout << "LogRingDumper sigaction " << sig
+                << " error: " << strerror(errno) << std::endl;
+      return;
+    }
+    m_signal = sig;
+  }
+
+ private:
+  /**
+   * @brief 创建管道, 启动后台线程, 调用时持有m_signalMutex
+   *
+   */
+  bool start() {
+    if (s_pipe[0] < 0 && pipe2(s_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      std::cout << "LogRingDumper pipe error: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    if (!m_thread) {
+      m_thread.reset(
+          new Thread(std::bind(&LogRingDumper::run, this), "log_ring_dump"));
+    }
+    return true;
+  }
+
+  /**
+   * @brief 唤醒后台线程, 信号写入非0字节, 转储请求写入0
+   *
+   */
+  static void OnSignal(int sig) {
+    int saved_errno = errno;
+    char c = sig;
+    if (::write(s_pipe[1], &c, 1) < 0) {
+      // 管道已满说明已有未处理的转储请求
+    }
+    errno = saved_errno;
+  }
+
+  void run() {
+    char buf[64];
+    while (true) {
+      struct pollfd pfd = {s_pipe[0], POLLIN, 0};
+      if (poll(&pfd, 1, -1) <= 0) {
+        continue;
+      }
+      bool signaled = false;
+      ssize_t n;
+      while ((n = read(s_pipe[0], buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+          signaled = signaled || buf[i];
+        }
+      }
+      // 在锁内转储, Appender 析构时等待转储结束
+      MutexType::Lock lock(m_mutex);
+      std::vector<std::pair<RingBufferLogAppender *, std::string> > pending;
+      pending.swap(m_pending);
+      for (auto &i : pending) {
+        i.first->dump(i.second);
+      }
+      if (signaled) {
+        for (auto &i : m_appenders) {
+          i->dump("signal");
+        }
+      }
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  std::set<RingBufferLogAppender *> m_appenders;
+  /// 等待后台线程转储的Appender和原因
+  std::vector<std::pair<RingBufferLogAppender *, std::string> > m_pending;
+  MutexType m_signalMutex;
+  int m_signal = 0;
+  struct sigaction m_oldAction;
+  /// 不停止, 没有请求时阻塞在管道上
+  Thread::ptr m_thread;
+  static int s_pipe[2];
+};
+
+int LogRingDumper::s_pipe[2] = {-1, -1};
+
+RingBufferLogAppender::Ring::Ring(uint32_t size) : m_head(0), m_tail(0) {
+  m_data = new char[size];
+  m_mask = size - 1;
+}
+
+RingBufferLogAppender::Ring::~Ring() { delete[] m_data; }
+
+void RingBufferLogAppender::Ring::copyIn(uint64_t pos, const void *data,
+                                         size_t len) {
+  size_t off = pos & m_mask;
+  size_t n = std::min<size_t>(len, m_mask + 1 - off);
+  memcpy(m_data + off, data, n);
+  memcpy(m_data, (const char *)data + n, len - n);
+}
+
+void RingBufferLogAppender::Ring::copyOut(uint64_t pos, void *data,
+                                          size_t len) const {
+  size_t off = pos & m_mask;
+  size_t n = std::min<size_t>(len, m_mask + 1 - off);
+  memcpy(data, m_data + off, n);
+  memcpy((char *)data + n, m_data, len - n);
+}
+
+void RingBufferLogAppender::Ring::write(uint64_t time, const char *data,
+                                        size_t len) {
+  uint64_t cap = m_mask + 1;
+  len = std::min<size_t>(len, cap / 2 - sizeof(Record));
+  Record rec;
+  rec.size = (sizeof(Record) + len + 7) & ~7ull;
+  rec.len = len;
+  rec.time = time;
+  Spinlock::Lock lock(m_mutex);
+  uint64_t head = m_head.load(std::memory_order_relaxed);
+  uint64_t tail = m_tail.load(std::memory_order_relaxed);
+  if (head + rec.size - tail > cap) {
+    while (head + rec.size - tail > cap) {
+      uint32_t size;
+      copyOut(tail, &size, sizeof(size));
+      tail += size;
+    }
+    m_tail.store(tail, std::memory_order_relaxed);
+    // 读取方复制到被覆盖的数据时, 一定能读到新的 m_tail
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  copyIn(head, &rec, sizeof(rec));
+  copyIn(head + sizeof(rec), data, len);
+  m_head.store(head + rec.size, std::memory_order_release);
+}
+
+size_t RingBufferLogAppender::Ring::snapshot(std::string &buf) const {
+  // 写入线程一直在覆盖时重试几次
+  for (int i = 0; i < 4; ++i) {
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t tail = m_tail.load(std::memory_order_acquire);
+    if (tail > head) {
+      continue;
+    }
+    buf.resize(head - tail);
+    copyOut(tail, &buf[0], head - tail);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t valid = m_tail.load(std::memory_order_relaxed);
+    if (valid < head) {
+      return valid - tail;
+    }
+  }
+  buf.clear();
+  return 0;
+}
+
+RingBufferLogAppender::RingBufferLogAppender(const std::string &filename,
+                                             uint32_t ring_size,
+                                             LogLevel::Level dump_level)
+    : m_filename(filename), m_ringSize(ring_size), m_dumpLevel(dump_level) {
+  // 总大小固定, 不随线程数增长; 每个分片至少64K, 最多16个分片
+  uint64_t total = 4096;
+  while (total < ring_size) {
+    total <<= 1;
+  }
+  size_t shards = 1;
+  while (shards < 16 && total / (shards * 2) >= 64 * 1024) {
+    shards <<= 1;
+  }
+  for (size_t i = 0; i < shards; ++i) {
+    m_rings.push_back(Ring::ptr(new Ring(total / shards)));
+  }
+  LogRingDumper::GetInstance()->add(this);
+}
+
+RingBufferLogAppender::~RingBufferLogAppender() {
+  LogRingDumper::GetInstance()->del(this);
+}
+
+void RingBufferLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                                LogEvent::ptr event) {
+  if (level < m_level) {
+    return;
+  }
+  LogFormatter::ptr formatter;
+  {
+    MutexType::Lock lock(m_mutex);
+    formatter = m_formatter;
+  }
+  char buf[4096];
+  size_t n = formatter->format(buf, sizeof(buf), logger, level, event);
+  if (n <= sizeof(buf)) {
+    getRing()->write(event->getTimeNs(), buf, n);
+  } else {
+    std::string str(n, '\0');
+    formatter->format(&str[0], n, logger, level, event);
+    getRing()->write(event->getTimeNs(), str.c_str(), n);
+  }
+  if (m_dumpLevel != LogLevel::UNKNOW && level >= m_dumpLevel &&
+      !m_triggered.load(std::memory_order_relaxed) &&
+      !m_triggered.exchange(true)) {
+    // 转储要读全部分片并写文件, 交给后台线程
+    LogRingDumper::GetInstance()->request(
+        this, std::string("first ") + LogLevel::ToString(level));
+  }
+}
+
+size_t RingBufferLogAppender::dump(const std::string &reason) {
+  Mutex::Lock dump_lock(m_dumpMutex);
+  const std::vector<Ring::ptr> &rings = m_rings;
+
+  struct Item {
+    uint64_t time;
+    const char *data;
+    size_t len;
+    bool operator<(const Item &oth) const { return time < oth.time; }
+  };
+  std::vector<std::string> bufs(rings.size());
+  std::vector<Item> items;
+  for (size_t i = 0; i < rings.size(); ++i) {
+    const std::string &buf = bufs[i];
+    size_t pos = rings[i]->snapshot(bufs[i]);
+    while (pos + sizeof(Record) <= buf.size()) {
+      Record rec;
+      memcpy(&rec, buf.data() + pos, sizeof(rec));
+      if (rec.size < sizeof(Record) + rec.len || pos + rec.size > buf.size()) {
+        break;
+      }
+      Item item = {rec.time, buf.data() + pos + sizeof(Record), rec.len};
+      items.push_back(item);
+      pos += rec.size;
+    }
+  }
+  // 同一线程内时间相同的记录保持原来的顺序
+  std::stable_sort(items.begin(), items.end());
+
+  char date[64];
+  time_t now = time(nullptr);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+  std::stringstream ss;
+  ss << "==== ring buffer dump at " << date << ", reason: " << reason << ", "
+     << items.size() << " records ====\n";
+  std::string out = ss.str();
+  for (auto &i : items) {
+    out.append(i.data, i.len);
+  }
+
+  FSUtil::Mkdir(FSUtil::Dirname(m_filename));
+  int fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    std::cout << "RingBufferLogAppender open " << m_filename
+              << " failed, errno=" << errno << " " << strerror(errno)
+              << std::endl;
+    return 0;
+  }
+  WriteFully(fd, out.data(), out.size());
+  close(fd);
+  return items.size();
+}
+
+void RingBufferLogAppender::SetDumpSignal(int sig) {
+  LogRingDumper::GetInstance()->setSignal(sig);
+}
+
+std::string RingBufferLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "RingBufferLogAppender";
+  node["file"] = m_filename;
+  node["ring_size"] = m_ringSize;
+  node["dump_level"] = LogLevel::ToString(m_dumpLevel);
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                            LogEvent::ptr event) {
+  if (level >= m_level) {
+    LogFormatter::ptr formatter;
+    {
+      MutexType::Lock lock(m_mutex);
+      formatter = m_formatter;
+    }
+    char buf[4096];
+    size_t len = formatter->format(buf, sizeof(buf), logger, level, event);
+    if (len <= sizeof(buf)) {
+      LogSink::Stdout()->append(buf, len);
+    } else {
+      std::string str(len, '\0');
+      formatter->format(&str[0], len, logger, level, event);
+      LogSink::Stdout()->append(str.c_str(), len);
+    }
+  }
+}
+
+void StdoutLogAppender::flush() { LogSink::Stdout()->flush(); }
+
+std::string StdoutLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "StdoutLogAppender";
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+/**
+ * @brief 线程本地的时间格式化缓存, 同一秒内直接复用上次的格式化结果
+ *
+ */
+struct LogTimeCache {
+  /// 时间格式id, 0表示空
+  uint64_t id = 0;
+  time_t sec = 0;
+  size_t len = 0;
+  char buf[128];
+};
+
+/**
+ * @brief 线程本地的时区缓存
+ *
+ * @details localtime_r每次都要加锁检查时区, 这里每分钟只调用一次,
+ *          分钟内用缓存的UTC偏移加gmtime_r计算, 时区或夏令时变化最迟下一分钟生效
+ */
+struct LogTimeZoneCache {
+  time_t minute = -1;
+  long gmtoff = 0;
+  int isdst = 0;
+  const char *zone = nullptr;
+};
+
+static const size_t kTimeCacheSize = 8;
+static thread_local LogTimeCache t_time_cache[kTimeCacheSize];
+static thread_local LogTimeZoneCache t_tz_cache;
+
+static void LocalTime(time_t sec, struct tm *tm) {
+  time_t minute = sec / 60;
+  if (minute != t_tz_cache.minute) {
+    localtime_r(&sec, tm);
+    t_tz_cache.minute = minute;
+    t_tz_cache.gmtoff = tm->tm_gmtoff;
+    t_tz_cache.isdst = tm->tm_isdst;
+    t_tz_cache.zone = tm->tm_zone;
+    return;
+  }
+  time_t local = sec + t_tz_cache.gmtoff;
+  gmtime_r(&local, tm);
+  tm->tm_gmtoff = t_tz_cache.gmtoff;
+  tm->tm_isdst = t_tz_cache.isdst;
+  tm->tm_zone = t_tz_cache.zone;
+}
+
+/**
+ * @brief 写入纳秒时间中秒的小数部分的前digits位, 截断而不是四舍五入
+ *
+ */
+static void AppendFraction(LogBufferWriter &w, uint64_t ns, size_t digits) {
+  char tmp[9];
+  uint64_t frac = ns % 1000000000;
+  for (int n = 8; n >= 0; --n) {
+    tmp[n] = '0' + frac % 10;
+    frac /= 10;
+  }
+  w.append(tmp, digits);
+}
+
+/**
+ * @brief 写入浮点数, 优先用较短的表示, 不能还原时用17位有效数字
+ *
+ */
+static void AppendDouble(LogBufferWriter &w, double v) {
+  char tmp[32];
+  int n = snprintf(tmp, sizeof(tmp), "%.15g", v);
+  if (strtod(tmp, nullptr) != v) {
+    n = snprintf(tmp, sizeof(tmp), "%.17g", v);
+  }
+  w.append(tmp, n);
+}
+
+/**
+ * @brief 按JSON字符串的规则转义写入, 不含两边的引号
+ *
+ * @details 需要转义的只有控制字符, 引号和反斜杠, 大段文本中很少出现,
+ *          SSE2下一次检查16字节, 没有需要转义的字节时整段跳过
+ */
+static void AppendJsonEscaped(LogBufferWriter &w, const char *str,
+                              size_t len) {
+  static const char kHex[] = "0123456789abcdef";
+  const char *p = str;
+  const char *end = str + len;
+  const char *run = p;
+  while (p < end) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)p);
+      __m128i hit = _mm_or_si128(
+          _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x),
+          _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)));
+      int mask = _mm_movemask_epi8(hit);
+      if (mask) {
+        p += __builtin_ctz(mask);
+        break;
+      }
+      p += 16;
+    }
+    if (p == end) {
+      break;
+    }
+#endif
+    unsigned char c = *p;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      ++p;
+      continue;
+    }
+    w.append(run, p - run);
+    switch (c) {
+      case '"':
+        w.append("\\\"", 2);
+        break;
+      case '\\':
+        w.append("\\\\", 2);
+        break;
+      case '\n':
+        w.append("\\n", 2);
+        break;
+      case '\r':
+        w.append("\\r", 2);
+        break;
+      case '\t':
+        w.append("\\t", 2);
+        break;
+      default: {
+        char tmp[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+        w.append(tmp, 6);
+        break;
+      }
+    }
+    run = ++p;
+  }
+  w.append(run, end - run);
+}
+
+/**
+ * @brief 写入一个结构化字段的值, json为true时按JSON输出
+ *
+ */
+static void AppendFieldValue(LogBufferWriter &w, const LogFields &fields,
+                             const LogFields::Field &f, bool json) {
+  switch (f.type) {
+    case LogFields::INT:
+      w.appendInt(f.i);
+      break;
+    case LogFields::UINT:
+      w.appendUInt(f.u);
+      break;
+    case LogFields::DOUBLE:
+      if (json && !std::isfinite(f.d)) {
+        w.append("null", 4);
+      } else {
+        AppendDouble(w, f.d);
+      }
+      break;
+    case LogFields::BOOL:
+      if (f.b) {
+        w.append("true", 4);
+      } else {
+        w.append("false", 5);
+      }
+      break;
+    case LogFields::STRING:
+      if (json) {
+        w.append("\"", 1);
+        AppendJsonEscaped(w, fields.getString(f), f.len);
+        w.append("\"", 1);
+      } else {
+        w.append(fields.getString(f), f.len);
+      }
+      break;
+  }
+}
+
+LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern) {
+  init();
+}
+
+LogFormatter::ptr LogFormatter::Create(const std::string &pattern) {
+  if (pattern == "json") {
+    return std::make_shared<JsonLogFormatter>();
+  }
+  return std::make_shared<LogFormatter>(pattern);
+}
+
+std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level,
                                  LogEvent::ptr event) {
-  std::stringstream ss;
-  for (auto &i : m_items) {
-    i->format(ss, logger, level, event);
+  char buf[4096];
+  size_t len = format(buf, sizeof(buf), logger, level, event);
+  if (len <= sizeof(buf)) {
+    return std::string(buf, len);
+  }
+  std::string str(len, '\0');
+  format(&str[0], len, logger, level, event);
+  return str;
+}
+
+std::ostream &LogFormatter::format(std::ostream &ofs, Logger::ptr logger,
+                                   LogLevel::Level level,
+                                   LogEvent::ptr event) {
+  char buf[4096];
+  size_t len = format(buf, sizeof(buf), logger, level, event);
+  if (len <= sizeof(buf)) {
+    ofs.write(buf, len);
+  } else {
+    std::string str(len, '\0');
+    format(&str[0], len, logger, level, event);
+    ofs.write(str.c_str(), len);
+  }
+  if (m_hasNewLine) {
+    ofs.flush();
+  }
+  return ofs;
+}
+
+size_t LogFormatter::format(char *buf, size_t size,
+                            const std::shared_ptr<Logger> &logger,
+                            LogLevel::Level level,
+                            const LogEvent::ptr &event) {
+  LogBufferWriter w(buf, size);
+  const Op *end = m_ops.data() + m_ops.size();
+  for (const Op *op = m_ops.data(); op != end; ++op) {
+    switch (op->code) {
+      case OP_LITERAL:
+        w.append(m_literals.c_str() + op->arg, op->len);
+        break;
+      case OP_MESSAGE: {
+        const LogStream &ss = ((const LogEvent &)*event).getSS();
+        w.append(ss.data(), ss.size());
+        break;
+      }
+      case OP_LEVEL:
+        w.appendLevel(level);
+        break;
+      case OP_ELAPSE:
+        w.appendUInt(event->getElapse());
+        break;
+      case OP_NAME:
+        w.append(event->getLogger()->getName());
+        break;
+      case OP_THREAD_ID:
+        w.appendUInt(event->getThread());
+        break;
+      case OP_DATETIME: {
+        const DateFormat &df = m_dateFormats[op->arg];
+        LogTimeCache &cache = t_time_cache[df.id % kTimeCacheSize];
+        time_t sec = event->getTime();
+        if (cache.id != df.id || cache.sec != sec) {
+          struct tm tm;
+          LocalTime(sec, &tm);
+          cache.len = strftime(cache.buf, sizeof(cache.buf),
+                               df.format.c_str(), &tm);
+          cache.id = df.id;
+          cache.sec = sec;
+        }
+        w.append(cache.buf, cache.len);
+        break;
+      }
+      case OP_FILENAME:
+        if (event->getFile()) {
+          w.append(event->getFile(), strlen(event->getFile()));
+        }
+        break;
+      case OP_LINE:
+        w.appendInt(event->getLine());
+        break;
+      case OP_FIBER_ID:
+        w.appendUInt(event->getFiberId());
+        break;
+      case OP_THREAD_NAME:
+        w.append(event->getThreadName());
+        break;
+      case OP_FRACTION:
+        AppendFraction(w, event->getTimeNs(), op->arg);
+        break;
+      case OP_FIELDS: {
+        const LogFields &fields = ((const LogEvent &)*event).getFields();
+        for (size_t i = 0; i < fields.size(); ++i) {
+          const LogFields::Field &f = fields.get(i);
+          if (i) {
+            w.append(" ", 1);
+          }
+          w.append(fields.getKey(f), f.keyLen);
+          w.append("=", 1);
+          AppendFieldValue(w, fields, f, false);
+        }
+        break;
+      }
+      case OP_ITEM: {
+        std::stringstream ss;
+        m_items[op->arg]->format(ss, logger, level, event);
+        w.append(ss.str());
+        break;
+      }
+    }
+  }
+#if SYLAR_LOG_METRICS
+  LogFormatDone(w.getTotal(), size);
+#endif
+  return w.getTotal();
+}
+
+/**
+ * @brief JsonLogFormatter 的线程本地时间缓存, 同一秒内复用
+ *
+ */
+struct LogJsonTimeCache {
+  time_t sec = -1;
+  /// 2006-01-02T15:04:05
+  char date[32];
+  size_t dateLen = 0;
+  /// +08:00
+  char zone[8];
+};
+
+static thread_local LogJsonTimeCache t_json_time_cache;
+
+JsonLogFormatter::JsonLogFormatter() : LogFormatter("json") {}
+
+size_t JsonLogFormatter::format(char *buf, size_t size,
+                                const std::shared_ptr<Logger> &logger,
+                                LogLevel::Level level,
+                                const LogEvent::ptr &event) {
+  LogBufferWriter w(buf, size);
+  const LogEvent &ev = *event;
+
+  LogJsonTimeCache &cache = t_json_time_cache;
+  time_t sec = ev.getTime();
+  if (cache.sec != sec) {
+    struct tm tm;
+    LocalTime(sec, &tm);
+    cache.dateLen =
+        strftime(cache.date, sizeof(cache.date), "%Y-%m-%dT%H:%M:%S", &tm);
+    long off = tm.tm_gmtoff;
+    char sign = off < 0 ? '-' : '+';
+    off = off < 0 ? -off : off;
+    snprintf(cache.zone, sizeof(cache.zone), "%c%02ld:%02ld", sign,
+             off / 3600 % 100, off / 60 % 60);
+    cache.sec = sec;
+  }
+  w.append("{\"time\":\"", 9);
+  w.append(cache.date, cache.dateLen);
+  w.append(".", 1);
+  AppendFraction(w, ev.getTimeNs(), 9);
+  w.append(cache.zone, 6);
+  w.append("\",\"level\":\"", 11);
+  w.appendLevel(level);
+  w.append("\",\"logger\":\"", 12);
+  const std::string &name = ev.getLogger()->getName();
+  AppendJsonEscaped(w, name.c_str(), name.size());
+  w.append("\",\"thread\":", 11);
+  w.appendUInt(ev.getThread());
+  w.append(",\"thread_name\":\"", 16);
+  AppendJsonEscaped(w, ev.getThreadName().c_str(), ev.getThreadName().size());
+  w.append("\",\"fiber\":", 10);
+  w.appendUInt(ev.getFiberId());
+  w.append(",\"file\":\"", 9);
+  if (ev.getFile()) {
+    AppendJsonEscaped(w, ev.getFile(), strlen(ev.getFile()));
+  }
+  w.append("\",\"line\":", 9);
+  w.appendInt(ev.getLine());
+  w.append(",\"msg\":\"", 8);
+  AppendJsonEscaped(w, ev.getSS().data(), ev.getSS().size());
+  w.append("\"", 1);
+
+  const LogFields &fields = ev.getFields();
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const LogFields::Field &f = fields.get(i);
+    w.append(",\"", 2);
+    AppendJsonEscaped(w, fields.getKey(f), f.keyLen);
+    w.append("\":", 2);
+    AppendFieldValue(w, fields, f, true);
+  }
+  w.append("}\n", 2);
+#if SYLAR_LOG_METRICS
+  LogFormatDone(w.getTotal(), size);
+#endif
+  return w.getTotal();
+}
+
+typedef std::function<LogFormatter::FormatItem::ptr(const std::string &)>
+    FormatItemCreator;
+
+static Mutex &GetFormatItemMutex() {
+  static Mutex s_mutex;
+  return s_mutex;
+}
+
+static std::map<std::string, FormatItemCreator> &GetFormatItemCreators() {
+  static std::map<std::string, FormatItemCreator> s_creators;
+  return s_creators;
+}
+
+void LogFormatter::RegisterItem(const std::string &name,
+                                FormatItemCreator creator) {
+  Mutex::Lock lock(GetFormatItemMutex());
+  GetFormatItemCreators()[name] = creator;
+}
+
+void LogFormatter::addLiteral(const std::string &str) {
+  if (str.empty()) {
+    return;
+  }
+  // 相邻字面量合并成一条指令
+  if (!m_ops.empty() && m_ops.back().code == OP_LITERAL &&
+      m_ops.back().arg + m_ops.back().len == m_literals.size()) {
+    m_ops.back().len += str.size();
+  } else {
+    Op op;
+    op.code = OP_LITERAL;
+    op.arg = m_literals.size();
+    op.len = str.size();
+    m_ops.push_back(op);
+  }
+  m_literals.append(str);
+}
+
+void LogFormatter::addOp(OpCode code, uint32_t arg) {
+  Op op;
+  op.code = code;
+  op.arg = arg;
+  op.len = 0;
+  m_ops.push_back(op);
+}
+
+//%xxx %xxx{xxx} %%
+void LogFormatter::init() {
+  // (str, format, type)
+  std::vector<std::tuple<std::string, std::string, int>> vec;
+  std::string nstr;
+  for (size_t i = 0; i < m_pattern.size(); i++) {
+    if (m_pattern[i] != '%') {
+      nstr.append(1, m_pattern[i]);
+      continue;
+    }
+
+    if ((i + 1) < m_pattern.size()) {
+      if (m_pattern[i + 1] == '%') {
+        nstr.append(1, '%');
+        ++i;
+        continue;
+      }
+    }
+
+    size_t n = i + 1;
+    int fmt_status = 0;
+    size_t fmt_begin = 0;
+
+    std::string str;
+    std::string fmt;
+    while (n < m_pattern.size()) {
+      if (!fmt_status && (!isalpha(m_pattern[n]) && m_pattern[n] != '{' &&
+                          m_pattern[n] != '}')) {
+        str = m_pattern.substr(i + 1, n - i - 1);
+        break;
+      }
+
+      if (fmt_status == 0) {
+        if (m_pattern[n] == '{') {
+          str = m_pattern.substr(i + 1, n - i - 1);
+          fmt_status = 1;  // 解析格式
+          fmt_begin = n;
+          ++n;
+          continue;
+        }
+      } else if (fmt_status == 1) {
+        if (m_pattern[n] == '}') {
+          fmt = m_pattern.substr(fmt_begin + 1, n - fmt_begin - 1);
+          fmt_status = 0;  // 解析格式
+          ++n;
+          break;
+        }
+      }
+      ++n;
+      if (n == m_pattern.size()) {
+        if (str.empty()) {
+          str = m_pattern.substr(i + 1);
+        }
+      }
+    }
+    if (fmt_status == 0) {
+      if (!nstr.empty()) {
+        vec.push_back(std::make_tuple(nstr, std::string(), 0));
+        nstr.clear();
+      }
+      vec.push_back(std::make_tuple(str, fmt, 1));
+      i = n - 1;
+    } else if (fmt_status == 1) {
+      std::cout << "pattern parse error: " << m_pattern << " - "
+                << m_pattern.substr(i) << std::endl;
+      m_error = true;
+      vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
+    }
+  }
+
+  if (!nstr.empty()) {
+    vec.push_back(std::make_tuple(nstr, "", 0));
+  }
+
+  // %m       --- 消息体
+  // %p       --- level
+  // %r       --- 启动后的时间
+  // %c       --- 日志名称
+  // %t       --- 线程id
+  // %n       --- 回车换行
+  // %d       --- 时间
+  // %f       --- 文件名
+  // %l       --- 行号
+  // %T       --- Tab
+  // %F       --- 协程id
+  // %N       --- 线程名称
+  // %K       --- 结构化字段
+  static std::map<std::string, OpCode> s_ops = {
+#define XX(str, C) \
+  { #str, C }
+      XX(m, OP_MESSAGE),     XX(p, OP_LEVEL),     XX(r, OP_ELAPSE),
+      XX(c, OP_NAME),        XX(t, OP_THREAD_ID), XX(d, OP_DATETIME),
+      XX(f, OP_FILENAME),    XX(l, OP_LINE),      XX(F, OP_FIBER_ID),
+      XX(N, OP_THREAD_NAME), XX(K, OP_FIELDS),
+#undef XX
+  };
+
+  m_ops.clear();
+  m_literals.clear();
+  m_dateFormats.clear();
+  m_items.clear();
+  m_hasNewLine = false;
+  for (auto &i : vec) {
+    const std::string &str = std::get<0>(i);
+    if (std::get<2>(i) == 0) {
+      addLiteral(str);
+      continue;
+    }
+    // 换行和Tab直接并入字面量
+    if (str == "n") {
+      addLiteral("\n");
+      m_hasNewLine = true;
+      continue;
+    }
+    if (str == "T") {
+      addLiteral("\t");
+      continue;
+    }
+
+    auto it = s_ops.find(str);
+    if (it != s_ops.end()) {
+      if (it->second == OP_DATETIME) {
+        std::string date_fmt = std::get<1>(i);
+        if (date_fmt.empty()) {
+          date_fmt = "%Y-%m-%d %H:%M:%S";
+        }
+        static std::atomic<uint64_t> s_date_id(0);
+        auto add_date = [this](const std::string &format) {
+          if (format.empty()) {
+            return;
+          }
+          DateFormat df;
+          df.format = format;
+          df.id = ++s_date_id;
+          m_dateFormats.push_back(df);
+          addOp(OP_DATETIME, m_dateFormats.size() - 1);
+        };
+        // %3N %6N %9N 拆成单独的指令, 其余部分交给strftime按秒缓存
+        std::string part;
+        for (size_t n = 0; n < date_fmt.size(); ++n) {
+          if (date_fmt[n] != '%' || n + 1 >= date_fmt.size()) {
+            part.push_back(date_fmt[n]);
+            continue;
+          }
+          char c = date_fmt[n + 1];
+          if ((c == '3' || c == '6' || c == '9') && n + 2 < date_fmt.size() &&
+              date_fmt[n + 2] == 'N') {
+            add_date(part);
+            part.clear();
+            addOp(OP_FRACTION, c - '0');
+            n += 2;
+          } else {
+            part.append(date_fmt, n, 2);
+            ++n;
+          }
+        }
+        add_date(part);
+      } else {
+        addOp(it->second);
+      }
+      continue;
+    }
+
+    FormatItemCreator creator;
+    {
+      Mutex::Lock lock(GetFormatItemMutex());
+      auto cit = GetFormatItemCreators().find(str);
+      if (cit != GetFormatItemCreators().end()) {
+        creator = cit->second;
+      }
+    }
+    if (creator) {
+      m_items.push_back(creator(std::get<1>(i)));
+      addOp(OP_ITEM, m_items.size() - 1);
+    } else {
+      addLiteral("<<error_format %" + str + ">>");
+    }
+  }
+}
+
+/**
+ * @brief 二进制日志的线程缓冲, 单生产者单消费者的环形字节缓冲
+ *
+ * @details 记录按8字节对齐, 尾部放不下时写一条PAD记录后从头开始
+ */
+class LogBinaryBuffer {
+ public:
+  typedef std::shared_ptr<LogBinaryBuffer> ptr;
+  static const size_t kSize = 1024 * 1024;
+
+  LogBinaryBuffer()
+      : m_data(new char[kSize]),
+        m_head(0),
+        m_tail(0),
+        m_retired(false),
+        m_threadId(GetThreadId()),
+        m_threadName(Thread::GetName()) {}
+
+  ~LogBinaryBuffer() { delete[] m_data; }
+
+  /**
+   * @brief 预留空间, 只在所属线程调用
+   *
+   */
+  char *reserve(size_t size, const std::atomic<bool> &stop) {
+    size_t need = (size + 7) & ~(size_t)7;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    size_t pos = head & (kSize - 1);
+    size_t pad = pos + need > kSize ? kSize - pos : 0;
+    while (head + pad + need - m_cachedTail > kSize) {
+      m_cachedTail = m_tail.load(std::memory_order_acquire);
+      if (head + pad + need - m_cachedTail > kSize) {
+        if (stop.load(std::memory_order_relaxed)) {
+          return nullptr;
+        }
+        sched_yield();
+      }
+    }
+    if (pad) {
+      LogBinaryHeader *header = (LogBinaryHeader *)(m_data + pos);
+      header->size = pad;
+      header->kind = LogBinaryHeader::PAD;
+      pos = 0;
+    }
+    m_pending = head + pad + need;
+    return m_data + pos;
+  }
+
+  void commit() { m_head.store(m_pending, std::memory_order_release); }
+
+  /**
+   * @brief 取出所有已提交的记录, 只在后台线程调用
+   *
+   * @return 取出的记录数
+   */
+  template <class Func>
+  size_t consume(Func func) {
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t n = 0;
+    while (tail < head) {
+      const char *data = m_data + (tail & (kSize - 1));
+      const LogBinaryHeader *header = (const LogBinaryHeader *)data;
+      if (header->kind != LogBinaryHeader::PAD) {
+        func(data);
+        ++n;
+      }
+      tail += (header->size + 7) & ~(size_t)7;
+    }
+    m_tail.store(tail, std::memory_order_release);
+    return n;
+  }
+
+  uint64_t getHead() const { return m_head.load(std::memory_order_acquire); }
+  uint64_t getTail() const { return m_tail.load(std::memory_order_acquire); }
+  uint32_t getThreadId() const { return m_threadId; }
+  const std::string &getThreadName() const { return m_threadName; }
+  bool isRetired() const { return m_retired.load(std::memory_order_acquire); }
+  void retire() { m_retired.store(true, std::memory_order_release); }
+
+ private:
+  char *m_data;
+  std::atomic<uint64_t> m_head;
+  char m_pad[64];
+  std::atomic<uint64_t> m_tail;
+  /// 生产者使用
+  uint64_t m_cachedTail = 0;
+  uint64_t m_pending = 0;
+  std::atomic<bool> m_retired;
+  uint32_t m_threadId;
+  std::string m_threadName;
+};
+
+/**
+ * @brief 二进制日志后台线程, 轮询各个线程缓冲, 把记录交给日志器的Appender
+ *
+ */
+class LogBinaryWriter {
+ public:
+  typedef Spinlock MutexType;
+
+  static LogBinaryWriter *GetInstance() {
+    // 不析构, 进程退出时由 atexit 停止后台线程
+    static LogBinaryWriter *s_writer = new LogBinaryWriter;
+    return s_writer;
+  }
+
+  /**
+   * @brief 获取当前线程的缓冲, 第一次调用时创建并登记
+   *
+   */
+  LogBinaryBuffer *getBuffer() {
+    static thread_local Holder t_holder;
+    if (SYLAR_UNLIKELY(!t_holder.buffer)) {
+      t_holder.buffer.reset(new LogBinaryBuffer);
+      MutexType::Lock lock(m_mutex);
+      m_buffers.push_back(t_holder.buffer);
+      if (!m_thread && !m_stop) {
+        m_thread.reset(
+            new Thread(std::bind(&LogBinaryWriter::run, this), "log_binary"));
+      }
+    }
+    return t_holder.buffer.get();
+  }
+
+  const std::atomic<bool> &getStop() const { return m_stop; }
+
+  void registerLogger(Logger::ptr logger) {
+    MutexType::Lock lock(m_mutex);
+    m_loggers[logger->getId()] = logger;
+  }
+
+  void flush() {
+    std::vector<std::pair<LogBinaryBuffer::ptr, uint64_t> > targets;
+    {
+      MutexType::Lock lock(m_mutex);
+      for (auto &i : m_buffers) {
+        targets.push_back(std::make_pair(i, i->getHead()));
+      }
+    }
+    for (auto &i : targets) {
+      while (i.first->getTail() < i.second && m_thread && !m_stop) {
+        usleep(100);
+      }
+    }
+    std::vector<Logger::ptr> loggers;
+    {
+      MutexType::Lock lock(m_mutex);
+      for (auto &i : m_loggers) {
+        Logger::ptr logger = i.second.lock();
+        if (logger) {
+          loggers.push_back(logger);
+        }
+      }
+    }
+    for (auto &i : loggers) {
+      for (auto &ap : *i->getEffectiveAppenders()) {
+        if (ap->isBinary()) {
+          ap->flush();
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief 停止后台线程, 再在当前线程写出剩余记录
+   *
+   * @details 先置停止标志, 之后的日志退回文本方式, 不会写入已不再读取的缓冲
+   */
+  void stop() {
+    Thread::ptr thread;
+    {
+      MutexType::Lock lock(m_mutex);
+      m_stop = true;
+      thread.swap(m_thread);
+    }
+    if (thread) {
+      thread->join();
+    }
+    std::vector<LogBinaryBuffer::ptr> buffers;
+    {
+      MutexType::Lock lock(m_mutex);
+      buffers = m_buffers;
+    }
+    std::set<LogAppender::ptr> touched;
+    for (auto &buf : buffers) {
+      buf->consume([&](const char *data) { process(*buf, data, touched); });
+    }
+    for (auto &i : touched) {
+      i->flush();
+    }
+  }
+
+ private:
+  /**
+   * @brief 线程退出时标记缓冲, 后台线程取完记录后释放
+   *
+   */
+  struct Holder {
+    LogBinaryBuffer::ptr buffer;
+    ~Holder() {
+      if (buffer) {
+        buffer->retire();
+      }
+    }
+  };
+
+  LogBinaryWriter() : m_stop(false) {
+    atexit([]() { LogBinaryWriter::GetInstance()->stop(); });
   }
-  return ss.str();
+
+  void run() {
+    std::vector<LogBinaryBuffer::ptr> buffers;
+    std::set<LogAppender::ptr> touched;
+    while (!m_stop) {
+      {
+        MutexType::Lock lock(m_mutex);
+        buffers = m_buffers;
+      }
+      size_t n = 0;
+      for (auto &buf : buffers) {
+        n += buf->consume(
+            [&](const char *data) { process(*buf, data, touched); });
+        if (buf->isRetired() && buf->getTail() == buf->getHead()) {
+          MutexType::Lock lock(m_mutex);
+          m_buffers.erase(
+              std::find(m_buffers.begin(), m_buffers.end(), buf));
+        }
+      }
+      if (n == 0) {
+        // 空闲时把写过的二进制Appender刷到文件
+        for (auto &i : touched) {
+          i->flush();
+        }
+        touched.clear();
+        buffers.clear();
+        prune();
+        usleep(1000);
+      }
+    }
+  }
+
+  Logger::ptr getLogger(uint32_t id) {
+    auto it = m_cache.find(id);
+    if (it != m_cache.end()) {
+      return it->second;
+    }
+    MutexType::Lock lock(m_mutex);
+    auto rt = m_loggers.find(id);
+    if (rt == m_loggers.end()) {
+      return nullptr;
+    }
+    Logger::ptr logger = rt->second.lock();
+    if (logger) {
+      m_cache[id] = logger;
+    }
+    return logger;
+  }
+
+  /**
+   * @brief 空闲时注销已释放或不再使用二进制Appender的日志器
+   *
+   * @details 日志器在连续两轮空闲时都不是二进制的才注销, 切换前写入的记录
+   *          已经全部取走. 缓存中的日志器也在空闲时释放
+   */
+  void prune() {
+    m_cache.clear();
+    std::set<uint32_t> stale;
+    MutexType::Lock lock(m_mutex);
+    for (auto it = m_loggers.begin(); it != m_loggers.end();) {
+      Logger::ptr logger = it->second.lock();
+      if (logger && logger->isBinary()) {
+        ++it;
+      } else if (!logger || m_stale.count(it->first)) {
+        it = m_loggers.erase(it);
+      } else {
+        stale.insert(it->first);
+        ++it;
+      }
+    }
+    m_stale.swap(stale);
+  }
+
+  void process(const LogBinaryBuffer &buf, const char *data,
+               std::set<LogAppender::ptr> &touched) {
+    const LogBinaryHeader *header = (const LogBinaryHeader *)data;
+    Logger::ptr logger = getLogger(header->logger);
+    if (!logger) {
+      return;
+    }
+    LogLevel::Level level = (LogLevel::Level)header->level;
+    LogEvent::ptr event;
+    LogEpoch::Guard guard;
+    const Logger::AppenderList *appenders =
+        logger->m_effective.load(std::memory_order_seq_cst);
+    for (auto &ap : *appenders) {
+      if (ap->isBinary()) {
+#if SYLAR_LOG_METRICS
+        if (level < ap->getLevel()) {
+          ap->m_metrics.counters.add(LogCounters::FILTERED);
+          continue;
+        }
+        bool timed = LogLatencySampled();
+        uint64_t start = timed ? LogClock::Now() : 0;
+#endif
+        static_cast<BinaryFileLogAppender *>(ap.get())
+            ->write(logger, data, buf.getThreadName());
+        touched.insert(ap);
+#if SYLAR_LOG_METRICS
+        // 原样写出记录, 没有格式化
+        LogAppender::Metrics &metrics = ap->m_metrics;
+        if (timed) {
+          uint64_t now = LogClock::Now();
+          metrics.write.record(now > start ? now - start : 0);
+        }
+        metrics.counters.add(LogCounters::EMITTED);
+        metrics.counters.add(LogCounters::BYTES, header->size);
+        logger->m_metrics.add(LogCounters::BYTES, header->size);
+#endif
+      } else {
+        if (!event) {
+          event = decode(logger, buf, data);
+        }
+        logger->append(logger, ap.get(), level, event);
+      }
+    }
+  }
+
+  /**
+   * @brief 还原成日志事件, 交给文本Appender
+   *
+   */
+  LogEvent::ptr decode(const Logger::ptr &logger, const LogBinaryBuffer &buf,
+                       const char *data) {
+    const LogBinaryHeader *header = (const LogBinaryHeader *)data;
+    const char *args = data + sizeof(LogBinaryHeader);
+    const char *end = data + header->size;
+    LogLevel::Level level = (LogLevel::Level)header->level;
+    const LogCallSite *site = nullptr;
+    const char *fmt = nullptr;
+    if (header->kind == LogBinaryHeader::LOG) {
+      site = LogCallSite::Get(header->site);
+      if (site) {
+        fmt = site->getFormat();
+      }
+    } else {
+      // TEXT: 文件, 行号, 内容
+      const char *file = nullptr;
+      int32_t line = 0;
+      const char *str;
+      uint32_t len;
+      if (ReadString(args, end, str, len)) {
+        file = intern(str, len);
+      }
+      int64_t v = 0;
+      if (ReadInt(args, end, v)) {
+        line = v;
+      }
+      site = LogCallSite::Intern(level, file, line);
+    }
+    if (!site) {
+      site = LogCallSite::Intern(level, nullptr, 0);
+    }
+    LogEvent::ptr event =
+        LogEvent::Create(logger, *site, level, header->thread,
+                         header->fiber, header->time);
+    event->setThreadName(buf.getThreadName());
+    if (fmt) {
+      LogBinary::Format(event->getSS(), fmt, args, end);
+    } else {
+      const char *str;
+      uint32_t len;
+      if (ReadString(args, end, str, len)) {
+        event->getSS().append(str, len);
+      }
+      ReadFields(args, end, event->getFields());
+    }
+    return event;
+  }
+
+  const char *intern(const char *str, uint32_t len) {
+    return m_files.insert(std::string(str, len)).first->c_str();
+  }
+
+ public:
+  static bool ReadString(const char *&p, const char *end, const char *&str,
+                         uint32_t &len) {
+    if (end - p < 5 || *p != LogBinaryArg::STRING) {
+      return false;
+    }
+    memcpy(&len, p + 1, 4);
+    if ((size_t)(end - p - 5) < len) {
+      return false;
+    }
+    str = p + 5;
+    p += 5 + len;
+    return true;
+  }
+
+  static bool ReadInt(const char *&p, const char *end, int64_t &v) {
+    if (end - p < 9 || (*p != LogBinaryArg::INT && *p != LogBinaryArg::UINT)) {
+      return false;
+    }
+    memcpy(&v, p + 1, 8);
+    p += 9;
+    return true;
+  }
+
+  static bool ReadDouble(const char *&p, const char *end, double &v) {
+    if (end - p < 9 || *p != LogBinaryArg::DOUBLE) {
+      return false;
+    }
+    memcpy(&v, p + 1, 8);
+    p += 9;
+    return true;
+  }
+
+  /**
+   * @brief 读取TEXT记录内容之后的结构化字段
+   *
+   */
+  static void ReadFields(const char *&p, const char *end, LogFields &fields) {
+    const char *key;
+    uint32_t key_len;
+    int64_t type;
+    while (ReadString(p, end, key, key_len) && ReadInt(p, end, type)) {
+      int64_t i = 0;
+      double d = 0;
+      const char *str;
+      uint32_t len;
+      switch (type) {
+        case LogFields::INT:
+        case LogFields::UINT:
+        case LogFields::BOOL:
+          if (!ReadInt(p, end, i)) {
+            return;
+          }
+          if (type == LogFields::INT) {
+            fields.addInt(key, key_len, i);
+          } else if (type == LogFields::UINT) {
+            fields.addUInt(key, key_len, i);
+          } else {
+            fields.addBool(key, key_len, i != 0);
+          }
+          break;
+        case LogFields::DOUBLE:
+          if (!ReadDouble(p, end, d)) {
+            return;
+          }
+          fields.addDouble(key, key_len, d);
+          break;
+        case LogFields::STRING:
+          if (!ReadString(p, end, str, len)) {
+            return;
+          }
+          fields.addString(key, key_len, str, len);
+          break;
+        default:
+          return;
+      }
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  std::vector<LogBinaryBuffer::ptr> m_buffers;
+  /// 登记的日志器, 不持有, 空闲时注销
+  std::map<uint32_t, std::weak_ptr<Logger> > m_loggers;
+  std::atomic<bool> m_stop;
+  Thread::ptr m_thread;
+  /// 以下后台线程使用
+  std::map<uint32_t, Logger::ptr> m_cache;
+  /// 上一轮空闲时已不是二进制的日志器
+  std::set<uint32_t> m_stale;
+  std::set<std::string> m_files;
+};
+
+char *LogBinary::Reserve(size_t size) {
+  if (size > kMaxRecordSize) {
+    return nullptr;
+  }
+  LogBinaryWriter *writer = LogBinaryWriter::GetInstance();
+  if (writer->getStop()) {
+    return nullptr;
+  }
+  return writer->getBuffer()->reserve(size, writer->getStop());
 }
 
-//%xxx %xxx{xxx} %%
-void LogFormatter::init() {
-  // (str, format, type)
-  std::vector<std::tuple<std::string, std::string, int>> vec;
-  std::string nstr;
-  for (size_t i = 0; i < m_pattern.size(); i++) {
-    if (m_pattern[i] != '%') {
-      nstr.append(1, m_pattern[i]);
-      continue;
+void LogBinary::Commit() {
+  LogBinaryWriter::GetInstance()->getBuffer()->commit();
+}
+
+bool LogBinary::WriteEvent(const std::shared_ptr<Logger> &logger,
+                           LogLevel::Level level, LogEvent::ptr event) {
+  const LogStream &ss = ((const LogEvent &)*event).getSS();
+  const LogFields &fields = ((const LogEvent &)*event).getFields();
+  const char *file = event->getFile() ? event->getFile() : "";
+  uint32_t file_len = strlen(file);
+  size_t size = sizeof(LogBinaryHeader) + 5 + file_len + 9 + 5 + ss.size();
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const LogFields::Field &f = fields.get(i);
+    size += 5 + f.keyLen + 9 + (f.type == LogFields::STRING ? 5 + f.len : 9);
+  }
+  char *p = Reserve(size);
+  if (!p) {
+    return false;
+  }
+  LogBinaryHeader *header = (LogBinaryHeader *)p;
+  header->size = size;
+  header->kind = LogBinaryHeader::TEXT;
+  header->level = level;
+  header->reserved = 0;
+  header->site = 0;
+  header->logger = logger->getId();
+  header->thread = event->getThread();
+  header->fiber = event->getFiberId();
+  header->time = event->getTimeNs();
+  p += sizeof(LogBinaryHeader);
+  LogBinaryArgTraits<const char *>::Put(p, file, file_len);
+  LogBinaryArgTraits<int32_t>::Put(p, event->getLine());
+  LogBinaryArgTraits<const char *>::Put(p, ss.data(), ss.size());
+  // 结构化字段: 键, 类型, 值
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const LogFields::Field &f = fields.get(i);
+    LogBinaryArgTraits<const char *>::Put(p, fields.getKey(f), f.keyLen);
+    LogBinaryArgTraits<int32_t>::Put(p, f.type);
+    switch (f.type) {
+      case LogFields::INT:
+        LogBinaryArgTraits<int64_t>::Put(p, f.i);
+        break;
+      case LogFields::UINT:
+        LogBinaryArgTraits<uint64_t>::Put(p, f.u);
+        break;
+      case LogFields::DOUBLE:
+        LogBinaryArgTraits<double>::Put(p, f.d);
+        break;
+      case LogFields::BOOL:
+        LogBinaryArgTraits<int64_t>::Put(p, f.b);
+        break;
+      case LogFields::STRING:
+        LogBinaryArgTraits<const char *>::Put(p, fields.getString(f), f.len);
+        break;
     }
+  }
+  Commit();
+  return true;
+}
 
-    if ((i + 1) < m_pattern.size()) {
-      if (m_pattern[i + 1] == '%') {
-        nstr.append(1, '%');
-        continue;
+void LogBinary::Flush() { LogBinaryWriter::GetInstance()->flush(); }
+
+void LogBinary::RegisterLogger(std::shared_ptr<Logger> logger) {
+  LogBinaryWriter::GetInstance()->registerLogger(logger);
+}
+
+static void Appendf(LogStream &ss, const char *fmt, ...) {
+  va_list al;
+  va_start(al, fmt);
+  ss.appendf(fmt, al);
+  va_end(al);
+}
+
+void LogBinary::Format(LogStream &ss, const char *fmt, const char *args,
+                       const char *end) {
+  const char *f = fmt;
+  while (*f) {
+    if (*f != '%') {
+      const char *begin = f;
+      while (*f && *f != '%') {
+        ++f;
       }
+      ss.append(begin, f - begin);
+      continue;
+    }
+    if (f[1] == '%') {
+      ss.append("%", 1);
+      f += 2;
+      continue;
     }
 
-    size_t n = i + 1;
-    int fmt_status = 0;
-    size_t fmt_begin = 0;
+    // 解析 %[flags][width][.precision][length]conversion, 长度修饰按参数类型重写
+    const char *begin = f++;
+    char spec[32] = {'%'};
+    size_t n = 1;
+    int stars[2];
+    int nstars = 0;
+    while (*f && strchr("-+ #0'", *f) && n < 8) {
+      spec[n++] = *f++;
+    }
+    for (int part = 0; part < 2; ++part) {
+      if (part == 1) {
+        if (*f != '.') {
+          break;
+        }
+        spec[n++] = *f++;
+      }
+      if (*f == '*') {
+        int64_t v = 0;
+        if (!LogBinaryWriter::ReadInt(args, end, v)) {
+          v = 0;
+        }
+        stars[nstars++] = v;
+        spec[n++] = *f++;
+      } else {
+        while (*f >= '0' && *f <= '9' && n < 20) {
+          spec[n++] = *f++;
+        }
+      }
+    }
+    while (*f && strchr("hlLqjzt", *f)) {
+      ++f;
+    }
+    char conv = *f;
+    if (!conv) {
+      ss.append(begin, f - begin);
+      break;
+    }
+    ++f;
+    if (conv == 'n') {
+      continue;
+    }
 
+    if (end - args < 1) {
+      ss.append(begin, f - begin);
+      continue;
+    }
+    char type = *args;
+    uint64_t u = 0;
+    double d = 0;
     std::string str;
-    std::string fmt;
-    while (n < m_pattern.size()) {
-      if (!fmt_status && (!isalpha(m_pattern[n]) && m_pattern[n] != '{' &&
-                          m_pattern[n] != '}')) {
-        str = m_pattern.substr(i + 1, n - i - 1);
+    if (type == LogBinaryArg::STRING) {
+      const char *p;
+      uint32_t len;
+      if (!LogBinaryWriter::ReadString(args, end, p, len)) {
         break;
       }
+      str.assign(p, len);
+    } else if (end - args >= 9) {
+      memcpy(&u, args + 1, 8);
+      memcpy(&d, args + 1, 8);
+      args += 9;
+    } else {
+      break;
+    }
 
-      if (fmt_status == 0) {
-        if (m_pattern[n] == '{') {
-          str = m_pattern.substr(i + 1, n - i - 1);
-          fmt_status = 1;  // 解析格式
-          fmt_begin = n;
-          ++n;
-          continue;
+    switch (type) {
+      case LogBinaryArg::INT:
+      case LogBinaryArg::UINT:
+        if (conv == 'c') {
+          spec[n++] = 'c';
+        } else {
+          spec[n++] = 'l';
+          spec[n++] = 'l';
+          spec[n++] = strchr("diouxX", conv) ? conv
+                      : type == LogBinaryArg::INT ? 'd'
+                                                   : 'u';
         }
-      } else if (fmt_status == 1) {
-        if (m_pattern[n] == '}') {
-          fmt = m_pattern.substr(fmt_begin + 1, n - fmt_begin - 1);
-          fmt_status = 0;  // 解析格式
-          ++n;
+        break;
+      case LogBinaryArg::DOUBLE:
+        spec[n++] = strchr("fFeEgGaA", conv) ? conv : 'g';
+        break;
+      case LogBinaryArg::STRING:
+        spec[n++] = 's';
+        break;
+      case LogBinaryArg::POINTER:
+        if (conv == 'p') {
+          spec[n++] = 'p';
+        } else {
+          spec[n++] = 'l';
+          spec[n++] = 'l';
+          spec[n++] = 'x';
+        }
+        break;
+      default:
+        return;
+    }
+    spec[n] = '\0';
+
+#define XX(...)                                       \
+  if (nstars == 0) {                                  \
+    Appendf(ss, spec, __VA_ARGS__);                   \
+  } else if (nstars == 1) {                           \
+    Appendf(ss, spec, stars[0], __VA_ARGS__);         \
+  } else {                                            \
+    Appendf(ss, spec, stars[0], stars[1], __VA_ARGS__); \
+  }
+
+    if (type == LogBinaryArg::DOUBLE) {
+      XX(d);
+    } else if (type == LogBinaryArg::STRING) {
+      XX(str.c_str());
+    } else if (type == LogBinaryArg::POINTER && conv == 'p') {
+      XX((void *)(uintptr_t)u);
+    } else if (conv == 'c') {
+      XX((int)u);
+    } else {
+      XX((unsigned long long)u);
+    }
+#undef XX
+  }
+}
+
+BinaryFileLogAppender::BinaryFileLogAppender(const std::string &filename)
+    : m_filename(filename) {
+  reopen();
+  LogFileWatcher::GetInstance()->add(m_filename);
+}
+
+BinaryFileLogAppender::~BinaryFileLogAppender() {
+  LogFileWatcher::GetInstance()->del(m_filename);
+}
+
+void BinaryFileLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                                LogEvent::ptr event) {
+  if (level < m_level) {
+    return;
+  }
+  const LogStream &ss = ((const LogEvent &)*event).getSS();
+  const char *file = event->getFile() ? event->getFile() : "";
+  uint32_t file_len = strlen(file);
+  size_t size = sizeof(LogBinaryHeader) + 5 + file_len + 9 + 5 + ss.size();
+
+  MutexType::Lock lock(m_mutex);
+  checkReopen();
+  m_buffer.resize(size);
+  char *p = &m_buffer[0];
+  LogBinaryHeader *header = (LogBinaryHeader *)p;
+  header->size = size;
+  header->kind = LogBinaryHeader::TEXT;
+  header->level = level;
+  header->reserved = 0;
+  header->site = 0;
+  header->logger = logger->getId();
+  header->thread = event->getThread();
+  header->fiber = event->getFiberId();
+  header->time = event->getTimeNs();
+  p += sizeof(LogBinaryHeader);
+  LogBinaryArgTraits<const char *>::Put(p, file, file_len);
+  LogBinaryArgTraits<int32_t>::Put(p, event->getLine());
+  LogBinaryArgTraits<const char *>::Put(p, ss.data(), ss.size());
+
+  writeDefines(logger, *header, event->getThreadName());
+  m_filestream.write(m_buffer.c_str(), size);
+#if SYLAR_LOG_METRICS
+  t_format_stat.bytes += size;
+#endif
+}
+
+void BinaryFileLogAppender::write(const Logger::ptr &logger, const char *data,
+                                  const std::string &thread_name) {
+  const LogBinaryHeader *header = (const LogBinaryHeader *)data;
+  if (header->level < m_level) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex);
+  checkReopen();
+  writeDefines(logger, *header, thread_name);
+  m_filestream.write(data, header->size);
+}
+
+void BinaryFileLogAppender::writeDefines(const Logger::ptr &logger,
+                                         const LogBinaryHeader &header,
+                                         const std::string &thread_name) {
+  std::string buf;
+  auto write_define = [&](LogBinaryHeader::Kind kind, uint32_t id,
+                          uint8_t level, const char *file, int32_t line,
+                          const std::string &str) {
+    size_t size = sizeof(LogBinaryHeader) + 5 + str.size();
+    if (file) {
+      size += 5 + strlen(file) + 9;
+    }
+    buf.resize(size);
+    char *p = &buf[0];
+    LogBinaryHeader *h = (LogBinaryHeader *)p;
+    memset(h, 0, sizeof(LogBinaryHeader));
+    h->size = size;
+    h->kind = kind;
+    h->level = level;
+    h->site = kind == LogBinaryHeader::SITE ? id : 0;
+    h->logger = kind == LogBinaryHeader::LOGGER ? id : 0;
+    h->thread = kind == LogBinaryHeader::THREAD ? id : 0;
+    p += sizeof(LogBinaryHeader);
+    if (file) {
+      LogBinaryArgTraits<const char *>::Put(p, file);
+      LogBinaryArgTraits<int32_t>::Put(p, line);
+    }
+    LogBinaryArgTraits<const char *>::Put(p, str.c_str(), str.size());
+    m_filestream.write(buf.c_str(), size);
+  };
+
+  if (header.site) {
+    if (m_sites.size() <= header.site) {
+      m_sites.resize(header.site + 1);
+    }
+    if (!m_sites[header.site]) {
+      const LogCallSite *site = LogCallSite::Get(header.site);
+      if (site) {
+        write_define(LogBinaryHeader::SITE, header.site, site->getLevel(),
+                     site->getFile(), site->getLine(), site->getFormat());
+      }
+      m_sites[header.site] = true;
+    }
+  }
+  if (m_loggers.size() <= header.logger) {
+    m_loggers.resize(header.logger + 1);
+  }
+  if (!m_loggers[header.logger]) {
+    write_define(LogBinaryHeader::LOGGER, header.logger, 0, nullptr, 0,
+                 logger->getName());
+    m_loggers[header.logger] = true;
+  }
+  auto it = m_threads.find(header.thread);
+  if (it == m_threads.end() || it->second != thread_name) {
+    write_define(LogBinaryHeader::THREAD, header.thread, 0, nullptr, 0,
+                 thread_name);
+    m_threads[header.thread] = thread_name;
+  }
+}
+
+static const char s_binary_magic[8] = {'S', 'Y', 'L', 'A',
+                                       'R', 'B', 'L', '1'};
+
+void BinaryFileLogAppender::flush() {
+  MutexType::Lock lock(m_mutex);
+  m_filestream.flush();
+}
+
+bool BinaryFileLogAppender::reopen() {
+  MutexType::Lock lock(m_mutex);
+  return openFile();
+}
+
+void BinaryFileLogAppender::checkReopen() {
+  if (SYLAR_UNLIKELY(s_reopen_generation.load(std::memory_order_relaxed) !=
+                     m_generation)) {
+    openFile();
+  }
+}
+
+bool BinaryFileLogAppender::openFile() {
+  m_generation = s_reopen_generation.load(std::memory_order_relaxed);
+  if (m_filestream) {
+    m_filestream.close();
+  }
+  if (!FSUtil::OpenForWrite(m_filestream, m_filename,
+                            std::ios::app | std::ios::binary)) {
+    return false;
+  }
+  // 新文件写文件头, 定义记录在新打开的文件中重新写
+  if (m_filestream.tellp() == 0) {
+    m_filestream.write(s_binary_magic, sizeof(s_binary_magic));
+  }
+  m_sites.clear();
+  m_loggers.clear();
+  m_threads.clear();
+  return true;
+}
+
+std::string BinaryFileLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "BinaryFileLogAppender";
+  node["file"] = m_filename;
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+bool LogBinaryReader::open(const std::string &filename) {
+  m_in.open(filename, std::ios::binary);
+  char magic[sizeof(s_binary_magic)];
+  if (!m_in.read(magic, sizeof(magic)) ||
+      memcmp(magic, s_binary_magic, sizeof(magic))) {
+    m_error = true;
+    return false;
+  }
+  return true;
+}
+
+const char *LogBinaryReader::intern(const char *str, uint32_t len) {
+  return m_files.insert(std::string(str, len)).first->c_str();
+}
+
+bool LogBinaryReader::next(Logger::ptr &logger, LogLevel::Level &level,
+                           LogEvent::ptr &event) {
+  while (!m_error) {
+    LogBinaryHeader header;
+    if (!m_in.read((char *)&header, sizeof(header))) {
+      // 正常结束时一个字节都读不到
+      m_error = m_in.gcount() != 0;
+      return false;
+    }
+    if (header.size < sizeof(header) ||
+        header.size > LogBinary::kMaxRecordSize * 2) {
+      m_error = true;
+      return false;
+    }
+    m_buffer.resize(header.size - sizeof(header));
+    if (!m_buffer.empty() && !m_in.read(&m_buffer[0], m_buffer.size())) {
+      m_error = true;
+      return false;
+    }
+    const char *args = m_buffer.c_str();
+    const char *end = args + m_buffer.size();
+    const char *str = nullptr;
+    uint32_t len = 0;
+    int64_t line = 0;
+
+    switch (header.kind) {
+      case LogBinaryHeader::SITE: {
+        Site &site = m_sites[header.site];
+        if (!LogBinaryWriter::ReadString(args, end, str, len)) {
           break;
         }
+        site.file = intern(str, len);
+        LogBinaryWriter::ReadInt(args, end, line);
+        site.line = line;
+        if (LogBinaryWriter::ReadString(args, end, str, len)) {
+          site.fmt.assign(str, len);
+        }
+        continue;
+      }
+      case LogBinaryHeader::LOGGER:
+        if (LogBinaryWriter::ReadString(args, end, str, len)) {
+          m_loggers[header.logger].reset(new Logger(std::string(str, len)));
+        }
+        continue;
+      case LogBinaryHeader::THREAD:
+        if (LogBinaryWriter::ReadString(args, end, str, len)) {
+          m_threads[header.thread].assign(str, len);
+        }
+        continue;
+      case LogBinaryHeader::LOG:
+      case LogBinaryHeader::TEXT:
+        break;
+      default:
+        // 未知记录类型, 跳过
+        continue;
+    }
+
+    auto lit = m_loggers.find(header.logger);
+    if (lit == m_loggers.end()) {
+      lit = m_loggers.insert(std::make_pair(header.logger,
+                                            Logger::ptr(new Logger("unknow"))))
+                .first;
+    }
+    logger = lit->second;
+    level = (LogLevel::Level)header.level;
+
+    const char *file = "";
+    const std::string *fmt = nullptr;
+    if (header.kind == LogBinaryHeader::LOG) {
+      auto sit = m_sites.find(header.site);
+      if (sit != m_sites.end()) {
+        file = sit->second.file;
+        line = sit->second.line;
+        fmt = &sit->second.fmt;
+      }
+    } else {
+      if (LogBinaryWriter::ReadString(args, end, str, len)) {
+        file = intern(str, len);
       }
+      LogBinaryWriter::ReadInt(args, end, line);
     }
-    ++n;
-    if (n == m_pattern.size()) {
-      if (str.empty()) {
-        str = m_pattern.substr(i + 1);
+    const LogCallSite *site = LogCallSite::Intern(
+        level, file, line, fmt ? fmt->c_str() : nullptr);
+    event.reset(new LogEvent(logger, *site, level, header.thread,
+                             header.fiber, header.time,
+                             m_threads[header.thread]));
+    if (fmt) {
+      LogBinary::Format(event->getSS(), fmt->c_str(), args, end);
+    } else if (LogBinaryWriter::ReadString(args, end, str, len)) {
+      event->getSS().append(str, len);
+      LogBinaryWriter::ReadFields(args, end, event->getFields());
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief 日志器名称的开放寻址哈希表, 查找无锁
+ *
+ * @details 只在LoggerManager的锁内插入, 不删除. 槽位先写哈希值, 再以release
+ *          发布指向日志器的指针, 查找时acquire读取指针后哈希值一定可见.
+ *          装载率超过1/2时由LoggerManager复制到两倍大小的新表后整体替换
+ */
+class LoggerManager::LoggerTable {
+ public:
+  explicit LoggerTable(size_t capacity)
+      : m_mask(capacity - 1), m_slots(new Slot[capacity]) {}
+  ~LoggerTable() { delete[] m_slots; }
+
+  const Logger::ptr *find(const std::string &name, size_t hash) const {
+    for (size_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+      const Logger::ptr *logger =
+          m_slots[i].logger.load(std::memory_order_acquire);
+      if (!logger) {
+        return nullptr;
       }
-    }
-    if (status == 0) {
-      if (!nstr.empty()) {
-        vec.push_back(std::make_tuple(nstr, std::string(), 0));
-        nstr.clear();
+      if (m_slots[i].hash == hash && (*logger)->getName() == name) {
+        return logger;
       }
-      vec.push_back(std::make_tuple(str, fmt, 1));
-      i = n - 1;
-    } else if (fmt_status == 1) {
-      std::cout << "pattern parde error: " << m_pattern << " - "
-                << m_pattern.substr(i) << std::endl;
-      m_error = true;
-      vec.push_back(std::make_tuple("<<pattern_error>>", fmt, 0));
     }
   }
 
-  if (!nstr.empty()) {
-    vec.push_back(std::make_tuple(nstr, "", 0));
+  /**
+   * @brief 插入, 表已到装载上限时返回false
+   *
+   */
+  bool insert(size_t hash, const Logger::ptr *logger) {
+    if ((m_size + 1) * 2 > m_mask + 1) {
+      return false;
+    }
+    size_t i = hash & m_mask;
+    while (m_slots[i].logger.load(std::memory_order_relaxed)) {
+      i = (i + 1) & m_mask;
+    }
+    m_slots[i].hash = hash;
+    m_slots[i].logger.store(logger, std::memory_order_release);
+    ++m_size;
+    return true;
   }
 
-  static std::map<std::string,
-                  std::function<FormatItem::ptr(const std::string &str)>>
-      s_format_items = {
-#define XX(str, C)                                                           \
-  {                                                                          \
-#str, [](const std::string &fmt) { return FormatItem::ptr(new C(fmt)); } \
-  }
-          // %m       --- 消息体
-          // %p       --- level
-          // %r       --- 启动后的时间
-          // %c       --- 日志名称
-          // %t       --- 线程id
-          // %n       --- 回车换行
-          // %d       --- 时间
-          // %f       --- 文件名
-          // %l       --- 行号
-          // %T       --- Tab
-          // %F       --- 协程id
-          // %N       --- 线程名称
-          XX(m, MessageFormatItem),  XX(p, LevelFormatItem),
-          XX(r, ElapseFormatItem),   XX(c, NameFormatItem),
-          XX(t, ThreadIdFormatItem), XX(n, NewLineFormatItem),
-          XX(f, FileNameFormatItem), XX(d, DateTimeFormatItem),
-          XX(l, LineFormatItem),     XX(T, TabFormatItem),
-          XX(F, FirbeIdFormatItem),  XX(N, ThreadNameFormatItem),
-#undef XX
-      };
+  size_t capacity() const { return m_mask + 1; }
 
-  for (auto &i : vec) {
-    if (std::get<2>(i) == 0) {
-      m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
-    } else {
-      auto it = s_format_items.find(std::get<0>(i));
-      if (it == s_format_items.end()) {
-        m_items.push_back(FormatItem::ptr(
-            new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-      } else {
-        m_items.push_back(it->second(std::get<1>(i)));
+  /**
+   * @brief 把所有元素插入到other
+   *
+   */
+  void copyTo(LoggerTable &other) const {
+    for (size_t i = 0; i <= m_mask; ++i) {
+      const Logger::ptr *logger =
+          m_slots[i].logger.load(std::memory_order_relaxed);
+      if (logger) {
+        other.insert(m_slots[i].hash, logger);
       }
     }
-
-    //      std::cout << std::get<0>(i) << " - " << std::get<1>(i) << " - "
-    //                << std::get<2>(i) << std::endl;
   }
-}
 
-LoggerManager::LoggerManager() {
+ private:
+  struct Slot {
+    size_t hash = 0;
+    std::atomic<const Logger::ptr *> logger{nullptr};
+  };
+
+  size_t m_mask;
+  size_t m_size = 0;
+  Slot *m_slots;
+};
+
+LoggerManager::LoggerManager() : m_table(new LoggerTable(64)) {
   m_root.reset(new Logger);
-  m_root->addAppender(LoggerAppender::ptr(new StdoutLogAppender));
-  m_logger[m_root->m_name] = m_root;
+  m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
+  m_root->m_manager = this;
+  // 哈希表引用的是 m_loggers 中保存 root 的那个元素
+  Logger::ptr &root = m_loggers[m_root->m_name];
+  root = m_root;
+  publish(std::hash<std::string>()(m_root->m_name), &root);
 
   init();
 }
 
-Logger::ptr LoggerManager::getLogger(const std::string$ name) {
+LoggerManager::~LoggerManager() {
+  delete m_table.load(std::memory_order_relaxed);
+  for (auto i : m_retired) {
+    delete i;
+  }
+}
+
+void LoggerManager::publish(size_t hash, const Logger::ptr *logger) {
+  LoggerTable *table = m_table.load(std::memory_order_relaxed);
+  if (table->insert(hash, logger)) {
+    return;
+  }
+  LoggerTable *bigger = new LoggerTable(table->capacity() * 2);
+  table->copyTo(*bigger);
+  bigger->insert(hash, logger);
+  m_table.store(bigger, std::memory_order_release);
+  m_retired.push_back(table);
+}
+
+Logger::ptr LoggerManager::getLogger(const std::string &name) {
+  return getLoggerRef(name);
+}
+
+const Logger::ptr &LoggerManager::getLoggerRef(const std::string &name) {
+  size_t hash = std::hash<std::string>()(name);
+  const Logger::ptr *found =
+      m_table.load(std::memory_order_acquire)->find(name, hash);
+  if (found) {
+    return *found;
+  }
+
   MutexType::Lock lock(m_mutex);
   auto it = m_loggers.find(name);
   if (it != m_loggers.end()) {
     return it->second;
   }
 
-  Logger::ptr logger(new Logger(name));
-  logger->m_root = m_root;
-  m_loggers[name] = logger;
+  Logger::ptr &logger = m_loggers[name];
+  logger.reset(new Logger(name));
+  logger->m_ownLevel = LogLevel::UNKNOW;
+  logger->m_manager = this;
+  logger->m_parent = findParent(name);
+  logger->updateEffective();
+  // 新日志器插在已有的下级和它们原来的上级之间
+  std::string prefix = name + ".";
+  for (auto it = m_loggers.lower_bound(prefix);
+       it != m_loggers.end() &&
+       it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    it->second->m_parent = findParent(it->first);
+  }
+  publish(hash, &logger);
   return logger;
 }
 
-sturct LogAppenderDefine {
-  int type = 0;  // 1: File  2: Stdout
-  LogLevel::level level = LogLevel::UNKNOW;
+Logger::ptr LoggerManager::findParent(const std::string &name) {
+  size_t pos = name.rfind('.');
+  while (pos != std::string::npos && pos > 0) {
+    auto it = m_loggers.find(name.substr(0, pos));
+    if (it != m_loggers.end() && it->second) {
+      return it->second;
+    }
+    pos = name.rfind('.', pos - 1);
+  }
+  return m_root;
+}
+
+void LoggerManager::refresh(Logger *logger) {
+  MutexType::Lock lock(m_mutex);
+  logger->updateEffective();
+  // map按名称排序, 上级总在下级之前
+  if (logger == m_root.get()) {
+    for (auto &i : m_loggers) {
+      if (i.second != m_root) {
+        i.second->updateEffective();
+      }
+    }
+    return;
+  }
+  std::string prefix = logger->getName() + ".";
+  for (auto it = m_loggers.lower_bound(prefix);
+       it != m_loggers.end() &&
+       it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    it->second->updateEffective();
+  }
+}
+
+struct LogAppenderDefine {
+  int type = 0;  // 1: File  2: Stdout  3: BinaryFile  4: MmapFile  5: Ring
+  LogLevel::Level level = LogLevel::UNKNOW;
   std::string formatter;
   std::string file;
+  bool async = false;               // 异步写文件
+  uint32_t flush_interval = 1000;   // 异步刷新间隔(毫秒)
+  uint32_t buffer_size = 4 * 1024 * 1024;  // 异步缓冲区大小
+  uint32_t max_buffers = 25;                // 等待落盘的缓冲个数上限
+  std::string overflow = "drop_newest";     // 达到上限: block/drop_newest/drop_oldest
+  uint32_t chunk_size = 16 * 1024 * 1024;  // 内存映射块大小
+  std::string sync = "none";               // 内存映射msync策略
+  uint64_t max_size = 0;        // 切分文件大小, 0不按大小切分
+  std::string rotate = "none";  // 按时间切分: none/hourly/daily
+  uint32_t max_files = 0;       // 保留的切分文件个数, 0不限制
+  uint32_t max_days = 0;        // 切分文件保留天数, 0不限制
+  bool compress = false;        // 切分后gzip压缩
+  uint32_t ring_size = 1024 * 1024;  // 环形缓冲总大小
+  LogLevel::Level dump_level = LogLevel::ERROR;  // 自动转储的级别
   bool operator==(const LogAppenderDefine &oth) const {
-    return type == oth.type && level == oth.level &&
-           formatter == oth.formatter && file == oth.file;
+    return level == oth.level && formatter == oth.formatter &&
+           isSameSink(oth) && isSameRotate(oth);
   }
-}
+  /**
+   * @brief 除级别, 格式和切分外的配置都相同, 重新加载配置时可以沿用原来的Appender
+   *
+   */
+  bool isSameSink(const LogAppenderDefine &oth) const {
+    return type == oth.type && file == oth.file && async == oth.async &&
+           flush_interval == oth.flush_interval &&
+           buffer_size == oth.buffer_size && max_buffers == oth.max_buffers &&
+           overflow == oth.overflow && chunk_size == oth.chunk_size &&
+           sync == oth.sync && ring_size == oth.ring_size &&
+           dump_level == oth.dump_level;
+  }
+  bool isSameRotate(const LogAppenderDefine &oth) const {
+    return max_size == oth.max_size && rotate == oth.rotate &&
+           max_files == oth.max_files && max_days == oth.max_days &&
+           compress == oth.compress;
+  }
+};
 
 struct LogDefine {
   std::string name;
@@ -600,11 +5871,11 @@ struct LogDefine {
   std::vector<LogAppenderDefine> appenders;
   bool operator==(const LogDefine &oth) const {
     return name == oth.name && level == oth.level &&
-           formatter == oth.formatter && file == oth.file;
+           formatter == oth.formatter && appenders == oth.appenders;
   }
-  bool operator<(const LogDefine &oth) { return name < oth.name; }
+  bool operator<(const LogDefine &oth) const { return name < oth.name; }
   bool isVaild() const { return !name.empty(); }
-}
+};
 
 template <>
 class LexicalCast<std::string, LogDefine> {
@@ -626,7 +5897,7 @@ class LexicalCast<std::string, LogDefine> {
     if (n["appenders"].IsDefined()) {
       for (size_t x = 0; x < n["appenders"].size(); ++x) {
         auto a = n["appenders"][x];
-        if (!a["type".IsDefined()]) {
+        if (!a["type"].IsDefined()) {
           std::cout << "log config error: appender type is null, " << a
                     << std::endl;
           continue;
@@ -641,12 +5912,85 @@ class LexicalCast<std::string, LogDefine> {
             continue;
           }
           lad.file = a["file"].as<std::string>();
-          if (a["formater"].IsDefined()) {
+          if (a["formatter"].IsDefined()) {
+            lad.formatter = a["formatter"].as<std::string>();
+          }
+          if (a["async"].IsDefined()) {
+            lad.async = a["async"].as<bool>();
+          }
+          if (a["flush_interval"].IsDefined()) {
+            lad.flush_interval = a["flush_interval"].as<uint32_t>();
+          }
+          if (a["buffer_size"].IsDefined()) {
+            lad.buffer_size = a["buffer_size"].as<uint32_t>();
+          }
+          if (a["max_buffers"].IsDefined()) {
+            lad.max_buffers = a["max_buffers"].as<uint32_t>();
+          }
+          if (a["overflow"].IsDefined()) {
+            lad.overflow = a["overflow"].as<std::string>();
+          }
+          if (a["max_size"].IsDefined()) {
+            lad.max_size = a["max_size"].as<uint64_t>();
+          }
+          if (a["rotate"].IsDefined()) {
+            lad.rotate = a["rotate"].as<std::string>();
+          }
+          if (a["max_files"].IsDefined()) {
+            lad.max_files = a["max_files"].as<uint32_t>();
+          }
+          if (a["max_days"].IsDefined()) {
+            lad.max_days = a["max_days"].as<uint32_t>();
+          }
+          if (a["compress"].IsDefined()) {
+            lad.compress = a["compress"].as<bool>();
+          }
+        } else if (type == "BinaryFileLogAppender") {
+          lad.type = 3;
+          if (!a["file"].IsDefined()) {
+            std::cout << "log config error: binaryfileappender file is null, "
+                      << a << std::endl;
+            continue;
+          }
+          lad.file = a["file"].as<std::string>();
+        } else if (type == "MmapFileLogAppender") {
+          lad.type = 4;
+          if (!a["file"].IsDefined()) {
+            std::cout << "log config error: mmapfileappender file is null, "
+                      << a << std::endl;
+            continue;
+          }
+          lad.file = a["file"].as<std::string>();
+          if (a["formatter"].IsDefined()) {
+            lad.formatter = a["formatter"].as<std::string>();
+          }
+          if (a["chunk_size"].IsDefined()) {
+            lad.chunk_size = a["chunk_size"].as<uint32_t>();
+          }
+          if (a["sync"].IsDefined()) {
+            lad.sync = a["sync"].as<std::string>();
+          }
+        } else if (type == "RingBufferLogAppender") {
+          lad.type = 5;
+          if (!a["file"].IsDefined()) {
+            std::cout << "log config error: ringbufferappender file is null, "
+                      << a << std::endl;
+            continue;
+          }
+          lad.file = a["file"].as<std::string>();
+          if (a["formatter"].IsDefined()) {
             lad.formatter = a["formatter"].as<std::string>();
           }
+          if (a["ring_size"].IsDefined()) {
+            lad.ring_size = a["ring_size"].as<uint32_t>();
+          }
+          if (a["dump_level"].IsDefined()) {
+            lad.dump_level =
+                LogLevel::FromString(a["dump_level"].as<std::string>());
+          }
         } else if (type == "StdoutLogAppender") {
           lad.type = 2;
-          if (a["formater"].IsDefined()) {
+          if (a["formatter"].IsDefined()) {
             lad.formatter = a["formatter"].as<std::string>();
           }
         } else {
@@ -654,12 +5998,15 @@ class LexicalCast<std::string, LogDefine> {
                     << std::endl;
           continue;
         }
+        if (a["level"].IsDefined()) {
+          lad.level = LogLevel::FromString(a["level"].as<std::string>());
+        }
         ld.appenders.push_back(lad);
       }
     }
     return ld;
   }
-}
+};
 
 template <>
 class LexicalCast<LogDefine, std::string> {
@@ -679,8 +6026,35 @@ class LexicalCast<LogDefine, std::string> {
       if (a.type == 1) {
         na["type"] = "FileLogAppender";
         na["file"] = a.file;
+        if (a.async) {
+          na["async"] = true;
+          na["flush_interval"] = a.flush_interval;
+          na["buffer_size"] = a.buffer_size;
+          na["max_buffers"] = a.max_buffers;
+          na["overflow"] = a.overflow;
+        }
+        if (a.max_size || a.rotate != "none") {
+          na["max_size"] = a.max_size;
+          na["rotate"] = a.rotate;
+          na["max_files"] = a.max_files;
+          na["max_days"] = a.max_days;
+          na["compress"] = a.compress;
+        }
       } else if (a.type == 2) {
         na["type"] = "StdoutLogAppender";
+      } else if (a.type == 3) {
+        na["type"] = "BinaryFileLogAppender";
+        na["file"] = a.file;
+      } else if (a.type == 4) {
+        na["type"] = "MmapFileLogAppender";
+        na["file"] = a.file;
+        na["chunk_size"] = a.chunk_size;
+        na["sync"] = a.sync;
+      } else if (a.type == 5) {
+        na["type"] = "RingBufferLogAppender";
+        na["file"] = a.file;
+        na["ring_size"] = a.ring_size;
+        na["dump_level"] = LogLevel::ToString(a.dump_level);
       }
       if (a.level != LogLevel::UNKNOW) {
         na["level"] = LogLevel::ToString(a.level);
@@ -694,73 +6068,250 @@ class LexicalCast<LogDefine, std::string> {
     ss << n;
     return ss.str();
   }
-}
+};
 
 sylar::ConfigVar<std::set<LogDefine>>::ptr g_log_defines =
     sylar::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
 
-struct LogIniter {
-  LogIniter() {
-    g_log_defines->addListener([](const std::set<LogDefine> &old_value,
-                                  const std::set<LogDefine> &new_value)) {
-      SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on_logger_conf_changed";
-      for (auto &i : new_value) {
-        auto it = old_value.find(i);
-        sylar::Logger::ptr logger;
-        if (it == old_value.end()) {
-          logger = SYLAR_LOG_NAME(i.name);
-        } else {
-          if (!(i == *it)) {
-            logger = SYLAR_LOG_NAME(i.name);
-          } else {
-            continue;
-          }
-        }
-        logger->setLevel(i.level);
+sylar::ConfigVar<bool>::ptr g_log_watch_files = sylar::Config::Lookup(
+    "log.watch_files", false, "reopen log files moved or deleted by logrotate");
 
-        if (!i.formatter.empty()) {
-          logger->setFormatter(i.formatter);
-        }
-        logger->clearAppenders();
-        for (auto &a : i.appenders) {
-          sylar::LogAppender::ptr ap;
-          if (a.type == 1) {
-            ap.reset(new FileLogAppender(a.file));
-          } else if (a.type == 2) {
-            if (!sylar::EnvMgr::GetInstance()->has("d")) {
-              ap.reset(new StdoutLogAppender);
-            } else {
-              continue;
-            }
-          }
-          ap->setLevel(a.level);
-          if (!a.format.empty()) {
-            LogFormatter::ptr fmt(new LogFormatter(a.formatter));
-            if (!fmt->isError()) {
-              ap->setFormatter(fmt);
-            } else {
-              std::cout << "log.name = " << i.name
-                        << " appender type = " << a.type
-                        << " formatter = " << a.formatter << " is invalid"
-                        << std::endl;
-            }
-          }
-          logger->addAppender(ap);
+sylar::ConfigVar<bool>::ptr g_log_crash_handler = sylar::Config::Lookup(
+    "log.crash_handler", false,
+    "flush buffered logs and write a backtrace on fatal signals");
+
+sylar::ConfigVar<int>::ptr g_log_ring_dump_signal = sylar::Config::Lookup(
+    "log.ring_dump_signal", 0,
+    "signal that dumps RingBufferLogAppender buffers, 0 to disable");
+
+sylar::ConfigVar<int>::ptr g_log_stats_interval = sylar::Config::Lookup(
+    "log.stats_interval", 0,
+    "seconds between logging self-metrics dumps to root, 0 to disable");
+
+sylar::ConfigVar<int>::ptr g_log_latency_sample = sylar::Config::Lookup(
+    "log.latency_sample", 16,
+    "time one in N appender writes per thread for the latency histograms");
+
+sylar::ConfigVar<std::string>::ptr g_log_clock =
+    sylar::Config::Lookup("log.clock", std::string("realtime"),
+                          "log timestamp source: tsc, realtime, coarse");
+
+sylar::ConfigVar<std::vector<std::string>>::ptr g_log_disabled_callsites =
+    sylar::Config::Lookup("log.disabled_callsites", std::vector<std::string>(),
+                          "disabled log callsites, file or file:line");
+
+/**
+ * @brief 按 "文件" 或 "文件:行号" 打开或关闭调用点
+ *
+ */
+static void SetCallSiteEnabled(const std::string &str, bool v) {
+  size_t pos = str.rfind(':');
+  if (pos != std::string::npos && pos + 1 < str.size() &&
+      str.find_first_not_of("0123456789", pos + 1) == std::string::npos) {
+    LogCallSite::SetEnabled(str.substr(0, pos), atoi(str.c_str() + pos + 1),
+                            v);
+  } else {
+    LogCallSite::SetEnabled(str, 0, v);
+  }
+}
+
+/**
+ * @brief 按配置设置文件切分, 沿用的Appender在切分配置变化时也调用.
+ *        与写同一文件的其他Appender冲突时由 LogSink::setRotate 输出错误
+ *
+ */
+static void SetAppenderRotate(const FileLogAppender::ptr &fap,
+                              const LogAppenderDefine &a) {
+  fap->setRotate(a.max_size, LogFileRotator::PeriodFromString(a.rotate),
+                 a.max_files, a.max_days, a.compress);
+}
+
+static LogAppender::ptr CreateAppender(const LogAppenderDefine &a) {
+  if (a.type == 1) {
+    FileLogAppender::ptr fap(new FileLogAppender(a.file));
+    if (a.max_size || a.rotate != "none") {
+      SetAppenderRotate(fap, a);
+    }
+    if (a.async) {
+      fap->setAsync(true, a.flush_interval, a.buffer_size, a.max_buffers,
+                    LogAsyncWriter::PolicyFromString(a.overflow));
+    }
+    return fap;
+  } else if (a.type == 3) {
+    return LogAppender::ptr(new BinaryFileLogAppender(a.file));
+  } else if (a.type == 4) {
+    return LogAppender::ptr(new MmapFileLogAppender(
+        a.file, a.chunk_size,
+        MmapFileLogAppender::SyncPolicyFromString(a.sync)));
+  } else if (a.type == 5) {
+    return LogAppender::ptr(
+        new RingBufferLogAppender(a.file, a.ring_size, a.dump_level));
+  } else if (a.type == 2) {
+    if (!sylar::EnvMgr::GetInstance()->has("d")) {
+      return LogAppender::ptr(new StdoutLogAppender);
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief 按配置设置Appender的格式, old 为沿用的Appender原来的配置
+ *
+ */
+static void SetAppenderFormatter(const std::string &name,
+                                 const LogAppender::ptr &ap,
+                                 const LogAppenderDefine &a,
+                                 const LogAppenderDefine *old) {
+  if (old && old->formatter == a.formatter) {
+    return;
+  }
+  if (a.formatter.empty()) {
+    // 由 Logger::replaceAppenders 换成日志器的格式器
+    ap->clearFormatter();
+    return;
+  }
+  LogFormatter::ptr fmt = LogFormatter::Create(a.formatter);
+  if (!fmt->isError()) {
+    ap->setFormatter(fmt);
+  } else {
+    std::cout << "log.name = " << name << " appender type = " << a.type
+              << " formatter = " << a.formatter << " is invalid" << std::endl;
+  }
+}
+
+/**
+ * @brief 配置生成的Appender, 重新加载时按配置比较决定是否沿用
+ *
+ */
+struct LogConfigAppenders {
+  typedef Mutex MutexType;
+  typedef std::vector<std::pair<LogAppenderDefine, LogAppender::ptr>> List;
+
+  static LogConfigAppenders *GetInstance() {
+    static LogConfigAppenders *s_appenders = new LogConfigAppenders;
+    return s_appenders;
+  }
+
+  MutexType mutex;
+  /// 日志器名称 -> (配置, Appender)
+  std::map<std::string, List> loggers;
+};
+
+/**
+ * @brief 把配置的变化应用到日志器
+ *
+ * @details 只修改变化了的日志器. 文件等输出目标的配置没变的Appender直接沿用,
+ *          只更新级别和格式, 不重新打开文件; 新的Appender列表一次性替换,
+ *          写日志的线程持有的旧列表快照仍然有效, 不会被阻塞,
+ *          旧Appender在最后一个引用释放时写完缓冲中的日志
+ */
+static void ApplyLogDefines(const std::set<LogDefine> &old_value,
+                            const std::set<LogDefine> &new_value) {
+  LogConfigAppenders *state = LogConfigAppenders::GetInstance();
+  LogConfigAppenders::MutexType::Lock lock(state->mutex);
+  for (auto &i : new_value) {
+    auto it = old_value.find(i);
+    if (it != old_value.end() && i == *it) {
+      continue;
+    }
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME(i.name);
+    if (it == old_value.end() || it->level != i.level) {
+      logger->setLevel(i.level);
+    }
+    if (!i.formatter.empty() &&
+        (it == old_value.end() || it->formatter != i.formatter)) {
+      logger->setFormatter(i.formatter);
+    }
+
+    LogConfigAppenders::List &current = state->loggers[i.name];
+    LogConfigAppenders::List next;
+    Logger::AppenderList appenders;
+    std::vector<bool> reused(current.size(), false);
+    for (auto &a : i.appenders) {
+      LogAppender::ptr ap;
+      const LogAppenderDefine *old = nullptr;
+      for (size_t k = 0; k < current.size(); ++k) {
+        if (!reused[k] && current[k].first.isSameSink(a)) {
+          reused[k] = true;
+          ap = current[k].second;
+          old = &current[k].first;
+          break;
         }
       }
-
-      for (auto &i : old_value) {
-        auto it = new_value.find(i);
-        if (it == new_value.end()) {
-          auto logger = SYLAR_LOG_NAME(i.name);
-          logger->setLevel((LogLevel::Level)0);
-          logger->clearAppenders();
+      if (!ap) {
+        ap = CreateAppender(a);
+        if (!ap) {
+          continue;
         }
       }
-    });
+      if (old && !old->isSameRotate(a) && a.type == 1) {
+        SetAppenderRotate(std::static_pointer_cast<FileLogAppender>(ap), a);
+      }
+      ap->setLevel(a.level);
+      SetAppenderFormatter(i.name, ap, a, old);
+      appenders.push_back(ap);
+      next.push_back(std::make_pair(a, ap));
+    }
+    logger->replaceAppenders(appenders);
+    current.swap(next);
+  }
+
+  for (auto &i : old_value) {
+    auto it = new_value.find(i);
+    if (it == new_value.end()) {
+      auto logger = SYLAR_LOG_NAME(i.name);
+      logger->setLevel((LogLevel::Level)0);
+      logger->clearAppenders();
+      state->loggers.erase(i.name);
+    }
   }
 }
 
+struct LogIniter {
+  LogIniter() {
+    LogClock::SetSource(LogClock::SourceFromString(g_log_clock->getValue()));
+    g_log_clock->addListener(
+        [](const std::string &old_value, const std::string &new_value) {
+          LogClock::SetSource(LogClock::SourceFromString(new_value));
+        });
+    g_log_watch_files->addListener(
+        [](const bool &old_value, const bool &new_value) {
+          LoggerMgr::GetInstance()->setWatchFiles(new_value);
+        });
+    g_log_ring_dump_signal->addListener(
+        [](const int &old_value, const int &new_value) {
+          RingBufferLogAppender::SetDumpSignal(new_value);
+        });
+    g_log_crash_handler->addListener(
+        [](const bool &old_value, const bool &new_value) {
+          LoggerMgr::GetInstance()->setCrashHandler(new_value);
+        });
+    g_log_stats_interval->addListener(
+        [](const int &old_value, const int &new_value) {
+          LoggerMgr::GetInstance()->setStatsInterval(std::max(0, new_value));
+        });
+    g_log_latency_sample->addListener(
+        [](const int &old_value, const int &new_value) {
+          LoggerManager::SetLatencySample(std::max(1, new_value));
+        });
+    g_log_disabled_callsites->addListener(
+        [](const std::vector<std::string> &old_value,
+           const std::vector<std::string> &new_value) {
+          for (auto &i : old_value) {
+            SetCallSiteEnabled(i, true);
+          }
+          for (auto &i : new_value) {
+            SetCallSiteEnabled(i, false);
+          }
+        });
+    g_log_defines->addListener([](const std::set<LogDefine> &old_value,
+                                  const std::set<LogDefine> &new_value) {
+      SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on_logger_conf_changed";
+      ApplyLogDefines(old_value, new_value);
+    });
+  }
+};
+
 static LogIniter __log_init;
 
 std::string LoggerManager::toYamlString() {
@@ -776,4 +6327,287 @@ std::string LoggerManager::toYamlString() {
 
 void LoggerManager::init() {}
 
+void LoggerManager::reopenAll() {
+  s_reopen_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LoggerManager::GetReopenGeneration() {
+  return s_reopen_generation.load(std::memory_order_relaxed);
+}
+
+void LoggerManager::setWatchFiles(bool v) {
+  if (v) {
+    LogFileWatcher::GetInstance()->start();
+  } else {
+    LogFileWatcher::GetInstance()->stop();
+  }
+}
+
+LogSink::ptr LoggerManager::getFileSink(const std::string &filename) {
+  std::string path = CanonicalLogPath(filename);
+  Mutex::Lock lock(m_sinkMutex);
+  LogSink::ptr sink = m_sinks[path].lock();
+  if (sink) {
+    return sink;
+  }
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    auto it = m_sinkInodes.find(std::make_pair(st.st_dev, st.st_ino));
+    if (it != m_sinkInodes.end()) {
+      sink = it->second.lock();
+      // 文件被移走后 inode 可能已属于别的路径, 确认 Sink 的路径仍是这个文件
+      struct stat cur;
+      if (sink && stat(sink->getFilename().c_str(), &cur) == 0 &&
+          cur.st_dev == st.st_dev && cur.st_ino == st.st_ino) {
+        m_sinks[path] = sink;
+        return sink;
+      }
+    }
+  }
+
+  sink.reset(new LogSink(path));
+  m_sinks[path] = sink;
+  if (stat(path.c_str(), &st) == 0) {
+    m_sinkInodes[std::make_pair(st.st_dev, st.st_ino)] = sink;
+  }
+  // 顺便清理已关闭的
+  for (auto it = m_sinks.begin(); it != m_sinks.end();) {
+    if (it->second.expired()) {
+      it = m_sinks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = m_sinkInodes.begin(); it != m_sinkInodes.end();) {
+    if (it->second.expired()) {
+      it = m_sinkInodes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return sink;
+}
+
+void LoggerManager::flushAll(const Logger::ptr &extra) {
+  std::vector<Logger::ptr> loggers;
+  {
+    MutexType::Lock lock(m_mutex);
+    loggers.reserve(m_loggers.size() + 1);
+    for (auto &i : m_loggers) {
+      loggers.push_back(i.second);
+    }
+  }
+  if (extra &&
+      std::find(loggers.begin(), loggers.end(), extra) == loggers.end()) {
+    loggers.push_back(extra);
+  }
+  // 和 Logger::flush 同样的顺序: 队列写入Appender, 二进制缓冲, 最后Appender
+  std::set<LogEventQueue::ptr> queues;
+  bool binary = false;
+  for (auto &i : loggers) {
+    LogEventQueue::ptr queue = i->getQueue();
+    if (queue && queues.insert(queue).second) {
+      queue->flush();
+    }
+    binary = binary || i->isBinary();
+  }
+  if (binary) {
+    LogBinary::Flush();
+  }
+  std::set<LogAppender::ptr> appenders;
+  for (auto &i : loggers) {
+    std::shared_ptr<const Logger::AppenderList> list =
+        i->getEffectiveAppenders();
+    for (auto &ap : *list) {
+      if (appenders.insert(ap).second) {
+        ap->flush();
+      }
+    }
+  }
+}
+
+void LoggerManager::setCrashHandler(bool v) {
+  if (v) {
+    LogCrashHandler::Install();
+  } else {
+    LogCrashHandler::Uninstall();
+  }
+}
+
+void LoggerManager::InstallCrashStack() { LogCrashHandler::InstallAltStack(); }
+
+static YAML::Node LatencyToYaml(const LogHistogram::Snapshot &snap) {
+  YAML::Node node;
+  node["count"] = snap.count;
+  node["p50"] = snap.p50;
+  node["p90"] = snap.p90;
+  node["p99"] = snap.p99;
+  node["p999"] = snap.p999;
+  node["max"] = snap.max;
+  return node;
+}
+
+std::string LogStats::toYamlString() const {
+  YAML::Node node;
+  node["enabled"] = enabled;
+  for (auto &i : loggers) {
+    YAML::Node n;
+    n["name"] = i.name;
+    n["emitted"] = i.emitted;
+    n["filtered"] = i.filtered;
+    n["dropped"] = i.dropped;
+    n["bytes"] = i.bytes;
+    if (i.async) {
+      n["queue_depth"] = i.queue_depth;
+      n["queue_dropped"] = i.queue_dropped;
+    }
+    node["loggers"].push_back(n);
+  }
+  for (auto &i : appenders) {
+    YAML::Node n;
+    n["type"] = i.type;
+    if (!i.file.empty()) {
+      n["file"] = i.file;
+    }
+    for (auto &name : i.loggers) {
+      n["loggers"].push_back(name);
+    }
+    n["emitted"] = i.emitted;
+    n["filtered"] = i.filtered;
+    n["bytes"] = i.bytes;
+    n["dropped"] = i.dropped;
+    n["format_ns"] = LatencyToYaml(i.format);
+    n["write_ns"] = LatencyToYaml(i.write);
+    node["appenders"].push_back(n);
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+LogStats LoggerManager::getStats() {
+  std::vector<Logger::ptr> loggers;
+  {
+    MutexType::Lock lock(m_mutex);
+    loggers.reserve(m_loggers.size());
+    for (auto &i : m_loggers) {
+      loggers.push_back(i.second);
+    }
+  }
+  LogStats stats;
+  stats.enabled = SYLAR_LOG_METRICS != 0;
+  // 多个日志器共用的Appender只统计一次
+  std::map<LogAppender *, size_t> appenders;
+  for (auto &logger : loggers) {
+    LogStats::LoggerStat ls;
+    ls.name = logger->getName();
+#if SYLAR_LOG_METRICS
+    LogCounters &counters = logger->getMetrics();
+    ls.emitted = counters.get(LogCounters::EMITTED);
+    ls.filtered = counters.get(LogCounters::FILTERED);
+    ls.dropped = counters.get(LogCounters::DROPPED);
+    ls.bytes = counters.get(LogCounters::BYTES);
+#endif
+    LogEventQueue::ptr queue = logger->getQueue();
+    if (queue) {
+      ls.async = true;
+      ls.queue_depth = queue->getSize();
+      ls.queue_dropped = queue->getDropped();
+    }
+    stats.loggers.push_back(ls);
+
+    for (auto &ap : *logger->getAppenders()) {
+      auto it = appenders.find(ap.get());
+      if (it == appenders.end()) {
+        LogStats::AppenderStat as;
+        as.type = ap->getType();
+        as.file = ap->getFile();
+        as.dropped = ap->getDropped();
+#if SYLAR_LOG_METRICS
+        const LogAppender::Metrics &metrics = ap->getMetrics();
+        as.filtered = metrics.counters.get(LogCounters::FILTERED);
+        as.bytes = metrics.counters.get(LogCounters::BYTES);
+        as.format = metrics.format.snapshot();
+        as.write = metrics.write.snapshot();
+        as.emitted = metrics.counters.get(LogCounters::EMITTED);
+#endif
+        it = appenders.insert(std::make_pair(ap.get(), stats.appenders.size()))
+                 .first;
+        stats.appenders.push_back(as);
+      }
+      stats.appenders[it->second].loggers.push_back(ls.name);
+    }
+  }
+  return stats;
+}
+
+namespace {
+
+/**
+ * @brief 定期把日志统计写到 root 日志器的后台线程
+ *
+ */
+class LogStatsReporter {
+ public:
+  typedef Mutex MutexType;
+
+  static LogStatsReporter *GetInstance() {
+    // 不析构, 和其他日志后台线程一样在进程退出时直接结束
+    static LogStatsReporter *s_reporter = new LogStatsReporter;
+    return s_reporter;
+  }
+
+  void setInterval(uint32_t seconds) {
+    MutexType::Lock lock(m_mutex);
+    m_interval = seconds;
+    if (seconds && !m_thread) {
+      m_stop = false;
+      m_thread.reset(
+          new Thread(std::bind(&LogStatsReporter::run, this), "log_stats"));
+    } else if (!seconds && m_thread) {
+      m_stop = true;
+      m_thread->join();
+      m_thread.reset();
+    }
+  }
+
+ private:
+  void run() {
+    uint64_t last = LogClock::Now();
+    while (!m_stop) {
+      usleep(100 * 1000);
+      uint64_t now = LogClock::Now();
+      if (now - last < m_interval * 1000000000ull) {
+        continue;
+      }
+      last = now;
+      SYLAR_LOG_INFO(SYLAR_LOG_ROOT())
+          << "log stats\n"
+          << LoggerMgr::GetInstance()->getStats().toYamlString();
+    }
+  }
+
+ private:
+  MutexType m_mutex;
+  std::atomic<uint32_t> m_interval{0};
+  std::atomic<bool> m_stop{false};
+  Thread::ptr m_thread;
+};
+
+}  // namespace
+
+void LoggerManager::setStatsInterval(uint32_t seconds) {
+  LogStatsReporter::GetInstance()->setInterval(seconds);
+}
+
+void LoggerManager::SetLatencySample(uint32_t n) {
+#if SYLAR_LOG_METRICS
+  uint32_t v = 1;
+  while (v < n && v < (1u << 31)) {
+    v <<= 1;
+  }
+  s_latency_mask.store(v - 1, std::memory_order_relaxed);
+#endif
+}
+
 }  // namespace sylar
\ No newline at end of file
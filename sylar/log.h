@@ -14,27 +14,90 @@
 
 #include <stdarg.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "singleton.h"
+#include "thread.h"
+#include "util.h"
+
 /**
- * @brief 使用流式方式将日志级别level的日志写入到logger
+ * @brief 编译期日志级别下限, 取值同 LogLevel::Level (0 表示不裁剪)
+ *
+ * @details 通常由 CMake 的 SYLAR_LOG_MIN_LEVEL 选项设置.
+ *          低于该级别的日志语句条件恒为假, 编译器直接删除整条语句,
+ *          输出的表达式仍做类型检查, 但不会被求值
+ */
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief 级别level的日志是否被编译进程序
+ *
+ */
+#define SYLAR_LOG_ENABLED(level) ((int)(level) >= SYLAR_LOG_MIN_LEVEL)
+
+/**
+ * @brief 是否编译日志模块自身的统计(条数, 字节数, 格式化和写入耗时)
+ *
+ * @details 通常由 CMake 的 SYLAR_LOG_METRICS 选项设置. 开启时每次写入做几次
+ *          relaxed 原子加, 耗时只对采样到的写入读时钟(见
+ *          LoggerManager::SetLatencySample). 为0时不编译统计用的
+ *          成员和计数代码, LoggerManager::getStats 只返回日志器名称和队列状态
+ */
+#ifndef SYLAR_LOG_METRICS
+#define SYLAR_LOG_METRICS 1
+#endif
+
+/**
+ * @brief 当前位置的调用点, 第一次执行时构造并注册, 返回 sylar::LogCallSite*
  *
  */
-#define SYLAR_LOG_LEVEL(logger, level)                                \
-  if (logger->getLevel() <= level)                                    \
-  sylar::LogEventWrap(                                                \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                       \
-          logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), \
-          sylar::GetFibreId(), time(0), sylar::Thread::GetName())))   \
+#define SYLAR_LOG_CALLSITE(logger, level, fmt)                             \
+  [&](const char* sylar_func_) -> sylar::LogCallSite* {                    \
+    static sylar::LogCallSite s_site(level, __FILE__, __LINE__, sylar_func_, \
+                                     #logger, fmt);                        \
+    return &s_site;                                                        \
+  }(__func__)
+
+/**
+ * @brief 以调用点创建日志事件, 返回日志内容流
+ *
+ */
+#define SYLAR_LOG_EVENT(logger, site, level)                           \
+  sylar::LogEventWrap(sylar::LogEvent::Create(logger, *site, level,    \
+                                              sylar::GetThreadId(),    \
+                                              sylar::GetFiberId(),     \
+                                              sylar::LogClock::Now())) \
       .getSS()
 
+/**
+ * @brief 使用流式方式将日志级别level的日志写入到logger
+ *
+ * @details level可以在运行时确定, 事件的级别取自本次调用, 调用点只记录第一次的级别;
+ *          调用点在运行时被关闭时不创建日志事件
+ */
+#define SYLAR_LOG_LEVEL(logger, level)                                       \
+  if (SYLAR_LOG_ENABLED(level) && logger->getLevel() <= level)               \
+  if (sylar::LogCallSite* sylar_site_ =                                      \
+          SYLAR_LOG_CALLSITE(logger, level, nullptr))                        \
+  if (sylar_site_->isEnabled())                                              \
+  SYLAR_LOG_EVENT(logger, sylar_site_, level)
+
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
 #define SYLAR_LOG_WARN(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::WARN)
@@ -44,15 +107,16 @@
 /**
  * @brief 使用格式化方式将日志级别level的日志写入到logger
  *
+ * @details 调用点第一次执行时注册一次静态信息(LogCallSite).
+ *          日志器带有二进制Appender, fmt是字符串常量且所有参数都能编码时
+ *          只记录调用点id和原始参数, 不在调用线程格式化; 否则在调用线程格式化
  */
-#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)                  \
-  if (logger->getLevel() <= level)                                    \
-  sylar::LogEventWrap(                                                \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                       \
-          logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), \
-          sylar::GetFirbeId(), time(0), sylar::Thread::GetName())))   \
-      .getEvent()                                                     \
-      ->format(fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)                     \
+  if (SYLAR_LOG_ENABLED(level) && logger->getLevel() <= level)           \
+  if (sylar::LogCallSite* sylar_site_ = SYLAR_LOG_CALLSITE(              \
+          logger, level, sylar::LogFormatLiteral(fmt)))                  \
+  if (sylar_site_->isEnabled())                                          \
+  sylar::LogCallSite::Log(*sylar_site_, logger, level, fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) \
   SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
@@ -65,21 +129,78 @@
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) \
   SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+/**
+ * @brief 调用点通过 limiter->pass 时才以流式方式写日志
+ *
+ * @details 每个调用点在静态变量中保存一个 LogLimiter, 无锁.
+ *          被丢弃的调用不创建 LogEvent, 恢复输出时在日志内容前加上
+ *          "[suppressed K messages] ", K 为上次输出以来丢弃的条数.
+ *          用只执行一次的 for 代替 if, 宏后面的 else 属于外层的 if
+ */
+#define SYLAR_LOG_LIMITED(logger, level, pass)                               \
+  for (sylar::LogCallSite* sylar_site_ =                                    \
+           SYLAR_LOG_ENABLED(level) && logger->getLevel() <= level          \
+               ? SYLAR_LOG_CALLSITE(logger, level, nullptr)                 \
+               : nullptr;                                                   \
+       sylar_site_ && sylar_site_->isEnabled(); sylar_site_ = nullptr)      \
+  for (sylar::LogLimiter* sylar_limiter_ = &[]() -> sylar::LogLimiter& {    \
+         static sylar::LogLimiter s_limiter;                                \
+         return s_limiter;                                                  \
+       }();                                                                 \
+       sylar_limiter_ && sylar_limiter_->pass; sylar_limiter_ = nullptr)    \
+  SYLAR_LOG_EVENT(logger, sylar_site_, level)                               \
+      << sylar::LogSuppressed{sylar_limiter_->takeSuppressed()}
+
+/**
+ * @brief 调用点每执行n次写一次日志(第1次, 第n+1次...)
+ *
+ */
+#define SYLAR_LOG_EVERY_N(logger, level, n) \
+  SYLAR_LOG_LIMITED(logger, level, every(n))
+
+/**
+ * @brief 调用点只写前n次日志
+ *
+ */
+#define SYLAR_LOG_FIRST_N(logger, level, n) \
+  SYLAR_LOG_LIMITED(logger, level, first(n))
+
+/**
+ * @brief 调用点每秒最多写per_sec条日志, per_sec为0时不写
+ *
+ */
+#define SYLAR_LOG_RATE_LIMITED(logger, level, per_sec) \
+  SYLAR_LOG_LIMITED(logger, level, rate(per_sec))
+
 /**
  * @brief 获取主日志器
  *
  */
-#define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstall()->getRoot()
+#define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstance()->getRoot()
 /**
  * @brief 获取name日志器
  *
  */
-#define SYLAR_LOG_NAME(name) sylar::LoggerMgr::GetInstall()->getLogger(name)
+#define SYLAR_LOG_NAME(name) sylar::LoggerMgr::GetInstance()->getLogger(name)
+
+/**
+ * @brief 获取name日志器, 每个调用点只查找一次
+ *
+ * @details name必须是常量. 第一次执行时查找(不存在则创建)并保存在静态变量中,
+ *          之后只读一个指针, 不增加引用计数
+ */
+#define SYLAR_LOG_STATIC_NAME(name)                            \
+  ([]() -> const sylar::Logger::ptr& {                         \
+    static const sylar::Logger::ptr& s_logger =                \
+        sylar::LoggerMgr::GetInstance()->getLoggerRef(name);   \
+    return s_logger;                                           \
+  }())
 
 namespace sylar {
 
 class Logger;
 class LoggerManager;
+class LogBinaryWriter;
 
 /**
  * @brief 日志级别
@@ -117,381 +238,2932 @@ class LogLevel {
 };
 
 /**
- * @brief 日志事件
+ * @brief 日志时钟, 提供纳秒精度的墙上时间
  *
+ * @details 时钟源:
+ *  TSC      按CLOCK_REALTIME校准的TSC, 读取只需一条rdtsc, 最长每秒重新校准一次.
+ *           只在x86_64且CPU支持恒定速率TSC时可用, 否则退回REALTIME
+ *  REALTIME clock_gettime(CLOCK_REALTIME), 走vDSO, 纳秒精度
+ *  COARSE   clock_gettime(CLOCK_REALTIME_COARSE), 开销最小, 精度为一个时钟节拍
+ *  默认使用REALTIME. TSC需要通过 log.clock 配置或 SetSource 开启,
+ *  开启时空转约2ms粗测频率, 不在程序启动时进行
  */
-class LogEvent {
+class LogClock {
  public:
-  typedef std::shared_ptr<LogEvent> ptr;
+  enum Source { REALTIME = 0, COARSE = 1, TSC = 2 };
 
   /**
-   * @brief Construct a new Log Event object  构造函数
+   * @brief 当前时间, 自1970年起的纳秒数
    *
-   * @param logger	日志器
-   * @param level 	日志级别
-   * @param file 		文件名
-   * @param line 		文件行号
-   * @param elapse 	程序启动依赖的耗时(毫秒)
-   * @param thread_id 线程id
-   * @param fiber_id 	协程id
-   * @param time 		日志时间(秒)
-   * @param thread_name 线程名称
    */
-  LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
-           const char* file, int32_t line, uint32_t elapse, uint32_t thread_id,
-           uint32_t fiber_id, uint64_t time, const std::string& thread_name);
-
-  const char* getFile() const { return m_file; }
-  int32_t getLine() const { return m_line; }
-  uint32_t getElapse() const { return m_elapse; }
-  uint32_t getThread() const { return m_threadId; }
-  uint32_t getFiberId() const { return m_fiberId; }
-  uint32_t getTime() const { return m_time; }
-  const std::string& getThreadName() const { return m_threadName; }
-  std::string getContent() const { return m_ss.str(); }
-  std::shared_ptr<Logger> getLogger() const { return m_logger; }
-  LogLevel::Level getLevel() const { return m_level; }
-  std::stringstream& getSS() { return m_ss; }
+  static uint64_t Now() {
+#if defined(__x86_64__)
+    if (s_source.load(std::memory_order_relaxed) == TSC) {
+      uint32_t seq = s_seq.load(std::memory_order_acquire);
+      uint64_t base_tsc = s_tsc.load(std::memory_order_relaxed);
+      uint64_t base_ns = s_ns.load(std::memory_order_relaxed);
+      uint64_t mult = s_mult.load(std::memory_order_relaxed);
+      uint64_t interval = s_interval.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint64_t delta = __builtin_ia32_rdtsc() - base_tsc;
+      if (!(seq & 1) && delta < interval &&
+          seq == s_seq.load(std::memory_order_relaxed)) {
+        return base_ns + (uint64_t)(((unsigned __int128)delta * mult) >> 32);
+      }
+      return Recalibrate();
+    }
+#endif
+    return NowSlow();
+  }
 
   /**
-   * @brief 格式化写入日志内容
+   * @brief 程序启动(日志模块初始化)的时间, 纳秒
    *
-   * @param fmt
-   * @param ...
    */
-  void format(const char* fmt, ...);
+  static uint64_t Start();
 
   /**
-   * @brief 格式化写入日志内容
+   * @brief now距程序启动的毫秒数
    *
-   * @param fmt
-   * @param al
    */
-  void format(const char* fmt, va_list al);
-
- private:
-  const char* m_file = nullptr;      // 文件名`
-  int32_t m_line = 0;                // 行号
-  uint32_t m_elapse = 0;             // 程序启动开始到现在的毫秒数
-  uint32_t m_threadId = 0;           // 线程号
-  uint32_t m_fiberId = 0;            // 协程号
-  uint64_t m_time;                   // 时间戳
-  std::string m_threadName;          // 线程名称
-  std::string m_ss;                  // 日志内容流
-  std::shared_ptr<Logger> m_logger;  // 日志器
-  LogLevel::Level m_level;           // 日志级别
-};
+  static uint32_t ElapseMS(uint64_t now) {
+    uint64_t start = Start();
+    return now > start ? (now - start) / 1000000 : 0;
+  }
 
-class LogEventWrap {
- public:
   /**
-   * @brief Construct a new Log Event Wrap object 构造函数
+   * @brief 设置时钟源
    *
-   * @param e 日志事件
+   * @return false 请求TSC但不可用, 已改用REALTIME
    */
-  LogEventWrap(LogEvent::ptr e);
+  static bool SetSource(Source source);
+  static Source GetSource() {
+    return (Source)s_source.load(std::memory_order_relaxed);
+  }
 
   /**
-   * @brief Destroy the Log Event Wrap object 析构函数
+   * @brief CPU是否有可用的恒定速率TSC
    *
    */
-  ~LogEventWrap();
+  static bool HasTsc();
+
+  static const char* SourceToString(Source source);
   /**
-   * @brief Get the Event object 获取日志事件
+   * @brief 解析时钟源名称(tsc, realtime, coarse), 无法识别时返回REALTIME
    *
-   * @return LogEvent::ptr 日志事件
    */
-  LogEvent::ptr getEvent() const { return m_event; }
+  static Source SourceFromString(const std::string& str);
+
+ private:
+  static uint64_t NowSlow();
   /**
-   * @brief 获取日志内容流
+   * @brief 超过校准间隔或校准正在进行时调用, 由一个线程重新校准
    *
-   * @return std::stringstream&
    */
+  static uint64_t Recalibrate();
 
-  std::stringstream& getSS();
+ private:
+  static std::atomic<int> s_source;
+  /// 校准数据的序号, 奇数表示正在更新
+  static std::atomic<uint32_t> s_seq;
+  /// 校准点的TSC
+  static std::atomic<uint64_t> s_tsc;
+  /// 校准点的时间(纳秒)
+  static std::atomic<uint64_t> s_ns;
+  /// 每个TSC周期的纳秒数, 32.32定点数
+  static std::atomic<uint64_t> s_mult;
+  /// 重新校准的间隔(TSC周期)
+  static std::atomic<uint64_t> s_interval;
+  /// 上次校准测得但未采用的频率, 0表示没有
+  static std::atomic<uint64_t> s_candidate;
+};
+
+/**
+ * @brief 日志模块自身的计数器, 固定分成8个分片
+ *
+ * @details 线程第一次使用时轮流分到一个分片, 之后固定写它(relaxed 原子加).
+ *          线程多于分片时几个线程共用一个分片, 争用减少但不消除.
+ *          每个分片独占缓存行, 读取时把各分片相加
+ */
+class LogCounters {
+ public:
+  enum Type {
+    /// 写出的日志条数(Appender的条数即写入耗时的记录数)
+    EMITTED = 0,
+    /// 低于级别被过滤的条数
+    FILTERED = 1,
+    /// 异步队列满时被丢弃的条数
+    DROPPED = 2,
+    /// 格式化后写出的字节数
+    BYTES = 3,
+    COUNT
+  };
+
+  LogCounters();
+  ~LogCounters();
+
+  void add(Type type, uint64_t v = 1) {
+    m_shards[ShardIndex()].values[type].fetch_add(v,
+                                                  std::memory_order_relaxed);
+  }
+
+  uint64_t get(Type type) const;
 
  private:
   /**
-   * @brief 日志事件
+   * @brief 当前线程使用的分片, 线程第一次调用时轮流分配
    *
    */
-  LogEvent::ptr m_event;
-}
+  static size_t ShardIndex() {
+    static thread_local size_t t_index = NextShard();
+    return t_index;
+  }
+  static size_t NextShard();
 
-// 日志格式器
-class LogFormatter {
+  LogCounters(const LogCounters&) = delete;
+  LogCounters& operator=(const LogCounters&) = delete;
+
+ private:
+  static const size_t kShards = 8;
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> values[COUNT];
+  };
+  /// C++11 的 new 不保证超出默认对齐, 分片单独按缓存行对齐分配
+  Shard* m_shards;
+};
+
+/**
+ * @brief 耗时直方图(纳秒), HDR 式对数线性分桶
+ *
+ * @details 每个2的幂区间再等分为8个桶, 相对误差不超过12.5%, 覆盖整个uint64_t
+ *          范围. 记录时只做一次 relaxed 原子加, 不加锁
+ */
+class LogHistogram {
  public:
-  typedef std::shared_ptr<LogFormatter> ptr;
   /**
-   * @brief Construct a new Log Formatter object 构造函数
-   *
-   * @param pattern 格式模板
-   *
-   * @details
-   *  %m 消息
-   *  %p 日志级别
-   *  %r 累计毫秒数
-   *  %c 日志名称
-   *  %t 线程id
-   *  %n 换行
-   *  %d 时间
-   *  %f 文件名
-   *  %l 行号
-   *  %T 制表符
-   *  %F 协程id
-   *  %N 线程名称
+   * @brief 某一时刻的统计结果, 分位数取所在桶的上界
    *
-   *  默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
    */
-  LogFormatter(const std::string& pattern);
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+  };
+
+  LogHistogram();
+
+  void record(uint64_t v) {
+    m_buckets[Index(v)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot() const;
+
+  static size_t Index(uint64_t v) {
+    if (v < kSubCount) {
+      return v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    return ((e - kSubBits + 1) << kSubBits) +
+           ((v >> (e - kSubBits)) & (kSubCount - 1));
+  }
 
   /**
-   * @brief 返回格式化日志文本
+   * @brief 第index个桶能容纳的最大值
    *
-   * @param logger 日志器
-   * @param level 日志级别
-   * @param event 日志事件
-   * @return std::string
    */
-  std::string format(Logger::ptr logger, LogLevel::Level level,
-                     LogEvent::ptr event);
-  std::ostream& format(std::ostream& ofs, Logger::ptr logger,
-                       LogLevel::Level level, LogEvent::ptr event);
+  static uint64_t UpperBound(size_t index);
+
+ private:
+  static const int kSubBits = 3;
+  static const size_t kSubCount = 1 << kSubBits;
+  static const size_t kBuckets = (64 - kSubBits + 1) << kSubBits;
+  std::atomic<uint64_t> m_buckets[kBuckets];
+};
+
+/**
+ * @brief 格式串是字符串常量时返回它, 作为调用点的静态格式串; 否则返回nullptr
+ *
+ */
+template <size_t N>
+inline const char* LogFormatLiteral(const char (&fmt)[N]) {
+  return fmt;
+}
 
+template <size_t N>
+inline const char* LogFormatLiteral(char (&)[N]) {
+  return nullptr;
+}
+
+template <class T>
+inline const char* LogFormatLiteral(const T&) {
+  return nullptr;
+}
+
+/**
+ * @brief 格式化参数, std::string 转成 const char* 供 %s 使用
+ *
+ */
+template <class T>
+inline const T& LogFormatArg(const T& v) {
+  return v;
+}
+
+inline const char* LogFormatArg(const std::string& v) { return v.c_str(); }
+
+/**
+ * @brief 日志调用点的静态信息(级别, 文件, 行号, 函数, 日志器, 格式串)
+ *
+ * @details 每个日志宏展开处只构造一次, 构造时登记到全局注册表并分配唯一的id.
+ *          日志事件只保存指向调用点的指针; 二进制日志只记录id, 解码时再通过id
+ *          找回这些信息. 每个调用点带一个原子开关, 可以在运行时单独关闭
+ */
+class LogCallSite {
  public:
   /**
-   * @brief 日志内容格式化
+   * @brief Construct a new Log Call Site object 构造函数, 登记到注册表
    *
+   * @param level 日志级别
+   * @param file 文件名
+   * @param line 行号
+   * @param func 函数名
+   * @param logger 日志器表达式, 只作提示
+   * @param fmt 格式串, 流式日志为nullptr
    */
-  class FormatItem {
-   public:
-    typedef std::shared_ptr<FormatItem> ptr;
-    virtual ~FormatItem(){};
-    /**
-     * @brief 格式化日志到流
-     *
-     * @param os 日志输出流
-     * @param logger 日志器
-     * @param level 日志等级
-     * @param event 日志事件
-     */
-    virtual void format(std::ostream& os, Logger::ptr logger,
-                        LogLevel::Level level, LogEvent::ptr event) = 0;
-  };
+  LogCallSite(LogLevel::Level level, const char* file, int32_t line,
+              const char* func, const char* logger, const char* fmt);
+
+  uint32_t getId() const { return m_id; }
+  LogLevel::Level getLevel() const { return m_level; }
+  const char* getFile() const { return m_file; }
+  /// 去掉目录的文件名
+  const char* getBasename() const { return m_basename; }
+  int32_t getLine() const { return m_line; }
+  const char* getFunction() const { return m_func; }
+  const char* getLoggerName() const { return m_logger; }
+  const char* getFormat() const { return m_fmt; }
+
+  bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+  void setEnabled(bool v) { m_enabled.store(v, std::memory_order_relaxed); }
 
   /**
-   * @brief 初始化,解析日志模板
+   * @brief 根据id查找调用点, 不存在返回nullptr
    *
    */
-  void init();
+  static const LogCallSite* Get(uint32_t id);
+
   /**
-   * @brief 是否有错误
+   * @brief 查找或创建一个不对应日志宏的调用点, 字符串会被复制
    *
-   * @return true
-   * @return false
+   * @details 用于旧接口和解码二进制日志等没有静态调用点的场合.
+   *          这些调用点不登记到注册表(id为0, 不在 List 中), 保存在单独的
+   *          定长表中, 按字符串地址, 行号和级别查找, 命中时不加锁不分配内存.
+   *          表满后返回该级别的一个公共调用点(文件名为空, 行号为0)
    */
-  bool isError() const { return m_error; }
+  static const LogCallSite* Intern(LogLevel::Level level, const char* file,
+                                   int32_t line, const char* fmt = nullptr);
 
   /**
-   * @brief Get the Pattern object 返回日志模板
+   * @brief 列出已注册的全部调用点
    *
-   * @return const std::string
+   * @details 调用点在第一次执行时才注册, 从未执行过的不在其中
    */
-  const std::string getPattern() const { return m_pattern; }
-
- private:
-  /// 日志格式模板
-  std::string m_pattern;
-  /// 日志格式解析后格式
-  std::vector<FormatItem::ptr> m_items;
-  /// 是否有错误
-  bool m_error = false;
-};
-
-// 日志输出目标
-class LogAppender {
-  friend class Logger;
+  static void List(std::vector<LogCallSite*>& sites);
 
- public:
-  typedef std::shared_ptr<LogAppender> ptr;
   /**
-   * @brief Destroy the Log Appender object 析构函数
+   * @brief 打开或关闭匹配的调用点, 之后注册的调用点也按此设置
    *
+   * @param file 文件名, 可以是完整路径, 路径后缀或去掉目录的文件名
+   * @param line 行号, 0表示文件中的所有调用点
+   * @param v 是否打开
+   * @return 当前匹配的调用点个数
    */
-  virtual ~LogAppender() {}
+  static size_t SetEnabled(const std::string& file, int32_t line, bool v);
+
   /**
-   * @brief 写入日志
+   * @brief 写格式化日志, SYLAR_LOG_FMT_* 的实现
    *
+   * @param site 调用点
    * @param logger 日志器
    * @param level 日志级别
-   * @param event 日志事件
+   * @param fmt 格式串, 不是字符串常量时每次在调用线程格式化
+   * @param args printf风格的参数
    */
-  virtual void log(Logger::ptr logger, LogLevel::Level level,
-                   LogEvent::ptr event) = 0;
+  template <class Fmt, class... Args>
+  static void Log(const LogCallSite& site, const std::shared_ptr<Logger>& logger,
+                  LogLevel::Level level, const Fmt& fmt, const Args&... args);
 
+ private:
+  friend class LogInternedSites;
   /**
-   * @brief 将日志输出目标配置转成YAML String
+   * @brief 不登记到注册表的调用点, 复制 file 和 fmt, 见 Intern
    *
    */
-  void std::string toYamlString() = 0;
+  LogCallSite(LogLevel::Level level, const char* file, int32_t line,
+              const char* fmt);
+  LogCallSite(const LogCallSite&) = delete;
+  LogCallSite& operator=(const LogCallSite&) = delete;
 
   /**
-   * @brief Set the Formatter object 更改日志格式器
+   * @brief 是否匹配 SetEnabled 的文件名和行号
    *
-   * @param val
    */
-  void setFormatter(LogFormatter::ptr val);
+  bool match(const std::string& file, int32_t line) const;
 
-  /**
-   * @brief Get the Fommater object 获取日志格式器
-   *
-   * @return LogFormatter::ptr
-   */
-  LogFormatter::ptr getFommater();
+ private:
+  uint32_t m_id;
+  LogLevel::Level m_level;
+  const char* m_file;
+  const char* m_basename;
+  int32_t m_line;
+  const char* m_func;
+  const char* m_logger;
+  const char* m_fmt;
+  std::atomic<bool> m_enabled;
+};
 
-  LogLevel::Level getLevel() const { return m_level; }
+/**
+ * @brief 侵入式引用计数智能指针, 引用计数保存在对象内部, 不需要单独分配控制块
+ *
+ * @tparam T 需要提供 ref() 和 unref() 方法
+ */
+template <class T>
+class IntrusivePtr {
+ public:
+  IntrusivePtr() : m_ptr(nullptr) {}
+  IntrusivePtr(std::nullptr_t) : m_ptr(nullptr) {}
+  explicit IntrusivePtr(T* p) : m_ptr(p) {
+    if (m_ptr) {
+      m_ptr->ref();
+    }
+  }
+  IntrusivePtr(const IntrusivePtr& o) : m_ptr(o.m_ptr) {
+    if (m_ptr) {
+      m_ptr->ref();
+    }
+  }
+  IntrusivePtr(IntrusivePtr&& o) : m_ptr(o.m_ptr) { o.m_ptr = nullptr; }
+  ~IntrusivePtr() {
+    if (m_ptr) {
+      m_ptr->unref();
+    }
+  }
 
-  void setLevel(LogLevel::Level level) { m_level = level; }
+  IntrusivePtr& operator=(const IntrusivePtr& o) {
+    IntrusivePtr(o).swap(*this);
+    return *this;
+  }
+  IntrusivePtr& operator=(IntrusivePtr&& o) {
+    IntrusivePtr(std::move(o)).swap(*this);
+    return *this;
+  }
+
+  void reset() { IntrusivePtr().swap(*this); }
+  void reset(T* p) { IntrusivePtr(p).swap(*this); }
+  void swap(IntrusivePtr& o) { std::swap(m_ptr, o.m_ptr); }
 
-  // void setFormatter(LogFormatter::ptr val) { m_formatter = val; }
-  // LogFormatter::ptr getFormatter() const { return m_formatter; }
+  T* get() const { return m_ptr; }
+  T& operator*() const { return *m_ptr; }
+  T* operator->() const { return m_ptr; }
+  explicit operator bool() const { return m_ptr != nullptr; }
+  bool operator==(const IntrusivePtr& o) const { return m_ptr == o.m_ptr; }
+  bool operator!=(const IntrusivePtr& o) const { return m_ptr != o.m_ptr; }
 
  private:
-  LogLevel::Level m_level = LogLevel::DEBUG;
-  bool m_hasFormatter = false;
-  MutexType m_mutex;
-  LogFormatter::ptr m_formatter;
+  T* m_ptr;
 };
 
 /**
- * @brief 日志器
+ * @brief 日志事件的结构化字段(键值对)
  *
+ * @details 前kInlineFields个字段和kInlineSize字节的键/字符串值保存在对象内,
+ *          超出后才在堆上分配. 键和字符串值都复制保存, 不要求调用方保持有效
  */
-class Logger : public std::enable_shared_from_this<Logger> {
-  friend class LoggerManager;
-
+class LogFields {
  public:
-  typedef std::shared_ptr<Logger> ptr;
-  typedef Spinlock MutexType;
+  enum Type { INT = 1, UINT = 2, DOUBLE = 3, BOOL = 4, STRING = 5 };
 
   /**
-   * @brief Construct a new Logger object 析构函数
+   * @brief 一个字段, 键和字符串值保存在LogFields的数据区中
    *
-   * @param name 日志器名称
    */
-  Logger(const std::string& name = "root");
+  struct Field {
+    Type type;
+    /// 键在数据区中的偏移
+    uint32_t key;
+    uint32_t keyLen;
+    union {
+      int64_t i;
+      uint64_t u;
+      double d;
+      bool b;
+      /// STRING: 值的长度, 值紧跟在键后面
+      uint32_t len;
+    };
+  };
+
+  static const size_t kInlineFields = 8;
+  static const size_t kInlineSize = 256;
+
+  LogFields();
+  ~LogFields();
+
+  void addInt(const char* key, size_t key_len, int64_t v);
+  void addUInt(const char* key, size_t key_len, uint64_t v);
+  void addDouble(const char* key, size_t key_len, double v);
+  void addBool(const char* key, size_t key_len, bool v);
+  void addString(const char* key, size_t key_len, const char* v,
+                 size_t len);
+
+  /**
+   * @brief 按值的类型添加字段, 非内置类型通过 std::ostream 转成字符串
+   *
+   */
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_signed<T>::value>::type
+  add(const char* key, const T& v) {
+    addInt(key, strlen(key), v);
+  }
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          std::is_unsigned<T>::value &&
+                          !std::is_same<T, bool>::value>::type
+  add(const char* key, const T& v) {
+    addUInt(key, strlen(key), v);
+  }
+  template <class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type add(
+      const char* key, const T& v) {
+    addDouble(key, strlen(key), v);
+  }
+  template <class T>
+  typename std::enable_if<!std::is_arithmetic<T>::value &&
+                          !std::is_convertible<T, const char*>::value>::type
+  add(const char* key, const T& v) {
+    std::ostringstream ss;
+    ss << v;
+    std::string str = ss.str();
+    addString(key, strlen(key), str.c_str(), str.size());
+  }
+  void add(const char* key, bool v) { addBool(key, strlen(key), v); }
+  void add(const char* key, const char* v) {
+    addString(key, strlen(key), v, strlen(v));
+  }
+  void add(const char* key, const std::string& v) {
+    addString(key, strlen(key), v.c_str(), v.size());
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  const Field& get(size_t i) const {
+    return i < kInlineFields ? m_inline[i] : m_more[i - kInlineFields];
+  }
+  const char* getKey(const Field& f) const { return m_data + f.key; }
+  const char* getString(const Field& f) const {
+    return m_data + f.key + f.keyLen;
+  }
+
+  /**
+   * @brief 清空字段, 保留不太大的堆缓冲区供复用
+   *
+   */
+  void clear();
+
+ private:
+  LogFields(const LogFields&) = delete;
+  LogFields& operator=(const LogFields&) = delete;
+
+  Field& append(Type type, const char* key, size_t key_len,
+                size_t extra = 0);
+
+ private:
+  Field m_inline[kInlineFields];
+  std::vector<Field> m_more;
+  size_t m_size = 0;
+  /// 键和字符串值的数据区
+  char* m_data;
+  size_t m_dataSize = 0;
+  size_t m_dataCapacity;
+  char m_inlineData[kInlineSize];
+};
+
+/**
+ * @brief 日志内容流
+ *
+ * @details 内置定长缓冲区, 内容超出后才在堆上分配; 内置类型直接转换写入缓冲区,
+ *          不经过std::ostream. 其他类型通过其 std::ostream 的 operator<< 输出.
+ *          格式控制符只支持 std::endl, std::hex, std::dec
+ */
+class LogStream {
+ public:
+  /// 内置缓冲区大小
+  static const size_t kInlineSize = 512;
+
+  LogStream();
+  ~LogStream();
+
+  LogStream& operator<<(bool v);
+  LogStream& operator<<(char v);
+  LogStream& operator<<(signed char v);
+  LogStream& operator<<(unsigned char v);
+  LogStream& operator<<(short v);
+  LogStream& operator<<(unsigned short v);
+  LogStream& operator<<(int v);
+  LogStream& operator<<(unsigned int v);
+  LogStream& operator<<(long v);
+  LogStream& operator<<(unsigned long v);
+  LogStream& operator<<(long long v);
+  LogStream& operator<<(unsigned long long v);
+  LogStream& operator<<(float v);
+  LogStream& operator<<(double v);
+  LogStream& operator<<(long double v);
+  LogStream& operator<<(const char* v);
+  LogStream& operator<<(char* v) { return *this << (const char*)v; }
+  LogStream& operator<<(const void* v);
+  LogStream& operator<<(const std::string& v) {
+    append(v.c_str(), v.size());
+    return *this;
+  }
+  LogStream& operator<<(std::ostream& (*manip)(std::ostream&));
+  LogStream& operator<<(std::ios_base& (*manip)(std::ios_base&));
+
+  /**
+   * @brief 其他类型(包括 std::setprecision, std::setw 等操纵符)使用
+   *        std::ostream 输出, 格式状态在输出前后同步
+   *
+   */
+  template <class T>
+  LogStream& operator<<(const T& v) {
+    std::ostream& os = beginOStream();
+    os << v;
+    endOStream();
+    return *this;
+  }
+
+  void append(const char* data, size_t len) {
+    if (m_size + len > m_capacity) {
+      grow(m_size + len);
+    }
+    memcpy(m_data + m_size, data, len);
+    m_size += len;
+  }
+
+  /**
+   * @brief printf风格写入
+   *
+   */
+  void appendf(const char* fmt, va_list al);
+
+  /**
+   * @brief 清空内容, 保留不太大的堆缓冲区供复用
+   *
+   */
+  void reset();
+
+  const char* data() const { return m_data; }
+  size_t size() const { return m_size; }
+  std::string str() const { return std::string(m_data, m_size); }
+
+  /**
+   * @brief 所属日志事件的结构化字段, 不属于日志事件时为空
+   *
+   */
+  LogFields* getFields() const { return m_fields; }
+  void setFields(LogFields* fields) { m_fields = fields; }
+
+ private:
+  LogStream(const LogStream&) = delete;
+  LogStream& operator=(const LogStream&) = delete;
+
+  void grow(size_t need);
+  void appendUInt(unsigned long long v, bool negative);
+  /**
+   * @brief 浮点数的printf格式, 格式状态无法用printf表达时返回false
+   *
+   */
+  bool floatFormat(char* fmt, const char* length) const;
+  bool isHex() const {
+    return (m_flags & std::ios_base::basefield) == std::ios_base::hex;
+  }
+  /**
+   * @brief 格式状态是否需要由 std::ostream 处理(设置了宽度或额外的标志)
+   *
+   */
+  bool needOStream(
+      std::ios_base::fmtflags extra = std::ios_base::fmtflags()) const {
+    return m_width != 0 || (m_flags & extra) != 0;
+  }
+  std::ostream& beginOStream();
+  void endOStream();
+
+  template <class T>
+  LogStream& appendOStream(const T& v) {
+    beginOStream() << v;
+    endOStream();
+    return *this;
+  }
+
+ private:
+  char* m_data;
+  size_t m_size;
+  size_t m_capacity;
+  /// 与 std::ostream 相同的格式状态, 默认状态下不经过 std::ostream
+  std::ios_base::fmtflags m_flags;
+  std::streamsize m_precision;
+  std::streamsize m_width;
+  char m_fill;
+  LogFields* m_fields = nullptr;
+  char m_inline[kInlineSize];
+};
+
+/**
+ * @brief 结构化字段, 由 sylar::LogKV() 创建
+ *
+ */
+template <class T>
+struct LogField {
+  const char* key;
+  const T& value;
+};
+
+/**
+ * @brief 给日志事件加一个结构化字段, 不写入日志内容
+ *
+ * @details SYLAR_LOG_INFO(logger) << sylar::LogKV("uid", uid) << "login";
+ *          键应为字符串常量, 值支持整数, 浮点数, bool, 字符串,
+ *          其他类型通过 std::ostream 转成字符串
+ */
+template <class T>
+LogField<T> LogKV(const char* key, const T& value) {
+  return LogField<T>{key, value};
+}
+
+template <class T>
+inline LogStream& operator<<(LogStream& ss, const LogField<T>& v) {
+  if (ss.getFields()) {
+    ss.getFields()->add(v.key, v.value);
+  }
+  return ss;
+}
+
+/**
+ * @brief 日志调用点的采样/限速状态
+ *
+ * @details 作为调用点的静态变量使用, 只有原子计数, 可以常量初始化.
+ *          见 SYLAR_LOG_EVERY_N, SYLAR_LOG_FIRST_N, SYLAR_LOG_RATE_LIMITED
+ */
+class LogLimiter {
+ public:
+  /**
+   * @brief 第1, n+1, 2n+1...次调用通过
+   *
+   */
+  bool every(uint64_t n) {
+    uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+    if (n <= 1 || count % n == 0) {
+      return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /**
+   * @brief 前n次调用通过, 之后不再修改计数
+   *
+   */
+  bool first(uint64_t n) {
+    return m_count.load(std::memory_order_relaxed) < n &&
+           m_count.fetch_add(1, std::memory_order_relaxed) < n;
+  }
+
+  /**
+   * @brief 同一秒内前per_sec次调用通过, per_sec为0时都不通过
+   *
+   * @details 秒数取自日志事件使用的 LogClock, 不另外调用 time()
+   */
+  bool rate(uint32_t per_sec) {
+    if (per_sec == 0) {
+      m_suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    uint64_t now = Now() / 1000000000;
+    uint64_t cur = m_count.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t next;
+      if ((cur >> 32) != now) {
+        next = (now << 32) | 1;
+      } else if ((cur & 0xffffffff) < per_sec) {
+        next = cur + 1;
+      } else {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (m_count.compare_exchange_weak(cur, next,
+                                        std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  /**
+   * @brief 取出上次取出以来丢弃的条数并清零
+   *
+   */
+  uint64_t takeSuppressed() {
+    return m_suppressed.load(std::memory_order_relaxed)
+               ? m_suppressed.exchange(0, std::memory_order_relaxed)
+               : 0;
+  }
+
+  typedef uint64_t (*Clock)();
+
+  /**
+   * @brief 替换 rate 使用的时钟(纳秒), nullptr 恢复为 LogClock::Now, 测试用
+   *
+   */
+  static void SetClock(Clock clock) {
+    s_clock.store(clock, std::memory_order_relaxed);
+  }
+
+ private:
+  static uint64_t Now() {
+    Clock clock = s_clock.load(std::memory_order_relaxed);
+    return clock ? clock() : LogClock::Now();
+  }
+
+ private:
+  static std::atomic<Clock> s_clock;
+  /// every/first 为调用次数, rate 为 (秒 << 32 | 本秒次数)
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_suppressed{0};
+};
+
+/**
+ * @brief 输出被丢弃的条数, 为0时不输出
+ *
+ */
+struct LogSuppressed {
+  uint64_t count;
+};
+
+inline LogStream& operator<<(LogStream& ss, const LogSuppressed& v) {
+  if (v.count) {
+    ss << "[suppressed " << v.count << " messages] ";
+  }
+  return ss;
+}
+
+class LogEventPool;
+
+/**
+ * @brief 日志事件
+ *
+ * @details 通过 Create() 创建的事件来自线程本地的对象池, 引用计数归零后
+ *          回到创建线程的池中复用, 稳态下不产生堆分配
+ */
+class LogEvent {
+  friend class LogEventPool;
+  friend class IntrusivePtr<LogEvent>;
+
+ public:
+  typedef IntrusivePtr<LogEvent> ptr;
+
+  /**
+   * @brief 从当前线程的对象池中取一个日志事件, 线程名称直接引用池中保存的名称
+   *
+   * @details 没有静态调用点时使用, 按(级别, 文件, 行号)经 LogCallSite::Intern
+   *          查找共享的调用点, 比日志宏使用的重载慢
+   * @param logger	日志器
+   * @param level 	日志级别
+   * @param file 		文件名
+   * @param line 		文件行号
+   * @param elapse 	程序启动依赖的耗时(毫秒)
+   * @param thread_id 线程id
+   * @param fiber_id 	协程id
+   * @param time 		日志时间(秒)
+   * @return LogEvent::ptr
+   */
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger,
+                              LogLevel::Level level, const char* file,
+                              int32_t line, uint32_t elapse,
+                              uint32_t thread_id, uint32_t fiber_id,
+                              uint64_t time);
+
+  /**
+   * @brief 以调用点从当前线程的对象池创建日志事件, 日志宏使用
+   *
+   * @details 调用点是宏展开处的静态变量, 级别在运行时才确定的日志语句
+   *          每次的级别可能不同, 所以级别单独保存在事件中
+   * @param logger 日志器
+   * @param site 调用点, 提供文件和行号
+   * @param level 日志级别
+   * @param thread_id 线程id
+   * @param fiber_id 协程id
+   * @param time 日志时间(纳秒, LogClock::Now()), 同时据此计算启动后的毫秒数
+   * @return LogEvent::ptr
+   */
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger,
+                              const LogCallSite& site, LogLevel::Level level,
+                              uint32_t thread_id, uint32_t fiber_id,
+                              uint64_t time);
+
+  /**
+   * @brief Construct a new Log Event object  构造函数
+   *
+   * @param logger	日志器
+   * @param site 		调用点
+   * @param level 	日志级别
+   * @param thread_id 线程id
+   * @param fiber_id 	协程id
+   * @param time 		日志时间(纳秒)
+   * @param thread_name 线程名称
+   */
+  LogEvent(std::shared_ptr<Logger> logger, const LogCallSite& site,
+           LogLevel::Level level, uint32_t thread_id, uint32_t fiber_id,
+           uint64_t time, const std::string& thread_name);
+
+  const LogCallSite& getCallSite() const { return *m_site; }
+  const char* getFile() const { return m_site->getFile(); }
+  int32_t getLine() const { return m_site->getLine(); }
+  uint32_t getElapse() const { return m_elapse; }
+  uint32_t getThread() const { return m_threadId; }
+  uint32_t getFiberId() const { return m_fiberId; }
+  /// 日志时间(秒)
+  uint32_t getTime() const { return m_time / 1000000000; }
+  /// 日志时间(纳秒)
+  uint64_t getTimeNs() const { return m_time; }
+  const std::string& getThreadName() const { return *m_threadName; }
+  /**
+   * @brief 设置线程名称, 用于还原其他线程产生的日志
+   *
+   */
+  void setThreadName(const std::string& name) {
+    m_ownThreadName = name;
+    m_threadName = &m_ownThreadName;
+  }
+  std::string getContent() const { return m_ss.str(); }
+  const LogStream& getSS() const { return m_ss; }
+  const std::shared_ptr<Logger>& getLogger() const { return m_logger; }
+  LogLevel::Level getLevel() const { return m_level; }
+  LogStream& getSS() { return m_ss; }
+  /// 结构化字段
+  const LogFields& getFields() const { return m_fields; }
+  LogFields& getFields() { return m_fields; }
+
+  /**
+   * @brief 格式化写入日志内容
+   *
+   * @param fmt
+   * @param ...
+   */
+  void format(const char* fmt, ...);
+
+  /**
+   * @brief 格式化写入日志内容
+   *
+   * @param fmt
+   * @param al
+   */
+  void format(const char* fmt, va_list al);
+
+ private:
+  LogEvent();
+  LogEvent(const LogEvent&) = delete;
+  LogEvent& operator=(const LogEvent&) = delete;
+
+  void ref() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+  void unref() {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      Release(this);
+    }
+  }
+  /**
+   * @brief 引用计数归零, 放回对象池或直接释放
+   *
+   */
+  static void Release(LogEvent* event);
+
+ private:
+  const LogCallSite* m_site;         // 调用点(文件, 行号)
+  LogLevel::Level m_level;           // 日志级别
+  uint32_t m_elapse = 0;             // 程序启动开始到现在的毫秒数
+  uint32_t m_threadId = 0;           // 线程号
+  uint32_t m_fiberId = 0;            // 协程号
+  uint64_t m_time;                   // 时间戳(纳秒)
+  const std::string* m_threadName;   // 线程名称
+  std::string m_ownThreadName;       // 不经过对象池创建时保存的线程名称
+  LogStream m_ss;                    // 日志内容流
+  LogFields m_fields;                // 结构化字段
+  std::shared_ptr<Logger> m_logger;  // 日志器
+  std::atomic<int32_t> m_refs;       // 引用计数
+  LogEventPool* m_pool = nullptr;    // 所属对象池
+  LogEvent* m_next = nullptr;        // 对象池空闲链表
+};
+
+class LogEventWrap {
+ public:
+  /**
+   * @brief Construct a new Log Event Wrap object 构造函数
+   *
+   * @param e 日志事件
+   */
+  LogEventWrap(LogEvent::ptr e);
+
+  /**
+   * @brief Destroy the Log Event Wrap object 析构函数
+   *
+   */
+  ~LogEventWrap();
+  /**
+   * @brief Get the Event object 获取日志事件
+   *
+   * @return LogEvent::ptr 日志事件
+   */
+  LogEvent::ptr getEvent() const { return m_event; }
+  /**
+   * @brief 获取日志内容流
+   *
+   * @return LogStream&
+   */
+
+  LogStream& getSS();
+
+ private:
+  /**
+   * @brief 日志事件
+   *
+   */
+  LogEvent::ptr m_event;
+};
+
+// 日志格式器
+class LogFormatter {
+ public:
+  typedef std::shared_ptr<LogFormatter> ptr;
+  /**
+   * @brief Construct a new Log Formatter object 构造函数
+   *
+   * @param pattern 格式模板
+   *
+   * @details
+   *  %m 消息
+   *  %p 日志级别
+   *  %r 累计毫秒数
+   *  %c 日志名称
+   *  %t 线程id
+   *  %n 换行
+   *  %d 时间
+   *  %f 文件名
+   *  %l 行号
+   *  %T 制表符
+   *  %F 协程id
+   *  %N 线程名称
+   *  %K 结构化字段, 以 key=value 空格分隔
+   *
+   *  %d{}中除strftime的格式外, 还可以用%3N, %6N, %9N输出秒的毫秒, 微秒,
+   *  纳秒部分, 如 %d{%H:%M:%S.%6N}
+   *
+   *  默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
+   */
+  LogFormatter(const std::string& pattern);
+  virtual ~LogFormatter() {}
+
+  /**
+   * @brief 根据配置创建格式器, "json" 为 JsonLogFormatter, 其他为格式模板
+   *
+   */
+  static LogFormatter::ptr Create(const std::string& pattern);
+
+  /**
+   * @brief 返回格式化日志文本
+   *
+   * @param logger 日志器
+   * @param level 日志级别
+   * @param event 日志事件
+   * @return std::string
+   */
+  std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level,
+                     LogEvent::ptr event);
+  std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger,
+                       LogLevel::Level level, LogEvent::ptr event);
+
+  /**
+   * @brief 按编译后的模板把日志直接写入调用方提供的缓冲区
+   *
+   * @param buf 输出缓冲区
+   * @param size 缓冲区大小
+   * @param logger 日志器
+   * @param level 日志级别
+   * @param event 日志事件
+   * @return size_t 完整输出需要的长度, 大于size时缓冲区中的内容不完整
+   */
+  virtual size_t format(char* buf, size_t size,
+                        const std::shared_ptr<Logger>& logger,
+                        LogLevel::Level level, const LogEvent::ptr& event);
+
+ public:
+  /**
+   * @brief 日志内容格式化
+   *
+   * @details 内置的格式项会编译成指令直接渲染, FormatItem用于扩展自定义格式项
+   */
+  class FormatItem {
+   public:
+    typedef std::shared_ptr<FormatItem> ptr;
+    virtual ~FormatItem(){};
+    /**
+     * @brief 格式化日志到流
+     *
+     * @param os 日志输出流
+     * @param logger 日志器
+     * @param level 日志等级
+     * @param event 日志事件
+     */
+    virtual void format(std::ostream& os, std::shared_ptr<Logger> logger,
+                        LogLevel::Level level, LogEvent::ptr event) = 0;
+  };
+
+  /**
+   * @brief 注册自定义格式项
+   *
+   * @param name 格式项名称, 模板中以%name或%name{fmt}引用
+   * @param creator 根据{}中的参数创建格式项
+   */
+  static void RegisterItem(
+      const std::string& name,
+      std::function<FormatItem::ptr(const std::string& fmt)> creator);
+
+  /**
+   * @brief 初始化,解析日志模板
+   *
+   */
+  void init();
+  /**
+   * @brief 是否有错误
+   *
+   * @return true
+   * @return false
+   */
+  bool isError() const { return m_error; }
+
+  /**
+   * @brief Get the Pattern object 返回日志模板
+   *
+   * @return const std::string
+   */
+  const std::string getPattern() const { return m_pattern; }
+
+ private:
+  /**
+   * @brief 编译后的指令类型
+   *
+   */
+  enum OpCode {
+    OP_LITERAL = 0,   // 字面量
+    OP_MESSAGE,       // %m
+    OP_LEVEL,         // %p
+    OP_ELAPSE,        // %r
+    OP_NAME,          // %c
+    OP_THREAD_ID,     // %t
+    OP_DATETIME,      // %d
+    OP_FILENAME,      // %f
+    OP_LINE,          // %l
+    OP_FIBER_ID,      // %F
+    OP_THREAD_NAME,   // %N
+    OP_FRACTION,      // %d{}中的%3N, %6N, %9N
+    OP_FIELDS,        // %K
+    OP_ITEM           // 自定义FormatItem
+  };
+
+  /**
+   * @brief 编译后的指令
+   *
+   */
+  struct Op {
+    uint8_t code;
+    /// OP_LITERAL: 在m_literals中的偏移, OP_DATETIME: m_dateFormats下标,
+    /// OP_FRACTION: 小数位数, OP_ITEM: m_items下标
+    uint32_t arg;
+    /// OP_LITERAL: 字面量长度
+    uint32_t len;
+  };
+
+  /**
+   * @brief %d的时间格式
+   *
+   */
+  struct DateFormat {
+    std::string format;
+    /// 全局唯一id, 作为线程本地时间缓存的key
+    uint64_t id;
+  };
+
+  void addLiteral(const std::string& str);
+  void addOp(OpCode code, uint32_t arg = 0);
+
+ private:
+  /// 日志格式模板
+  std::string m_pattern;
+  /// 编译后的指令
+  std::vector<Op> m_ops;
+  /// 所有字面量拼接在一起, 由OP_LITERAL按偏移引用
+  std::string m_literals;
+  /// %d的时间格式
+  std::vector<DateFormat> m_dateFormats;
+  /// 自定义格式项
+  std::vector<FormatItem::ptr> m_items;
+  /// 模板中是否有换行, 写入流时需要刷新
+  bool m_hasNewLine = false;
+  /// 是否有错误
+  bool m_error = false;
+};
+
+/**
+ * @brief JSON格式器, 每条日志输出一行JSON对象
+ *
+ * @details 配置中formatter为 "json" 时使用. 内置字段 time(本地时间, RFC 3339,
+ *          纳秒), level, logger, thread, thread_name, fiber, file, line, msg
+ *          之后依次是结构化字段. 直接写入输出缓冲区, 字符串转义在x86_64上
+ *          用SSE2每次检查16字节. 非UTF-8的字节原样输出
+ */
+class JsonLogFormatter : public LogFormatter {
+ public:
+  typedef std::shared_ptr<JsonLogFormatter> ptr;
+  JsonLogFormatter();
+
+  using LogFormatter::format;
+  size_t format(char* buf, size_t size, const std::shared_ptr<Logger>& logger,
+                LogLevel::Level level, const LogEvent::ptr& event) override;
+};
+
+// 日志输出目标
+class LogAppender {
+  friend class Logger;
+  friend class LogBinaryWriter;
+
+ public:
+  typedef std::shared_ptr<LogAppender> ptr;
+  typedef Spinlock MutexType;
+  /**
+   * @brief Destroy the Log Appender object 析构函数
+   *
+   */
+  virtual ~LogAppender() {}
+  /**
+   * @brief 写入日志
+   *
+   * @param logger 日志器
+   * @param level 日志级别
+   * @param event 日志事件
+   */
+  virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level,
+                   LogEvent::ptr event) = 0;
+
+  /**
+   * @brief 将日志输出目标配置转成YAML String
+   *
+   */
+  virtual std::string toYamlString() = 0;
+
+  /**
+   * @brief 返回配置中的类型名, 如 FileLogAppender
+   *
+   */
+  virtual const char* getType() const { return ""; }
+
+  /**
+   * @brief 返回写入的文件名, 不写文件时返回空串
+   *
+   */
+  virtual std::string getFile() const { return ""; }
+
+  /**
+   * @brief 返回Appender自身因写不过来丢弃的日志条数
+   *
+   */
+  virtual uint64_t getDropped() { return 0; }
+
+  /**
+   * @brief 将缓冲中的日志刷到输出目标, 返回时已写出
+   *
+   */
+  virtual void flush() {}
+
+  /**
+   * @brief 是否直接写二进制日志记录(BinaryFileLogAppender)
+   *
+   */
+  virtual bool isBinary() const { return false; }
+
+  /**
+   * @brief Set the Formatter object 更改日志格式器
+   *
+   * @param val
+   */
+  void setFormatter(LogFormatter::ptr val);
+
+  /**
+   * @brief 不再使用自己的格式器, 下次加入日志器时改用日志器的格式器
+   *
+   * @details 在此之前仍使用原来的格式器, 写日志的线程不会拿到空的格式器
+   */
+  void clearFormatter();
+
+  /**
+   * @brief Get the Formatter object 获取日志格式器
+   *
+   * @return LogFormatter::ptr
+   */
+  LogFormatter::ptr getFormatter();
+
+  LogLevel::Level getLevel() const { return m_level; }
+
+  void setLevel(LogLevel::Level level) { m_level = level; }
+
+  /**
+   * @brief 日志目标的统计, 由日志器在调用log前后记录
+   *
+   */
+  struct Metrics {
+    /// EMITTED, FILTERED, BYTES
+    LogCounters counters;
+    /// 从调用Appender到格式化完成的耗时, 按 LoggerManager::setLatencySample 采样
+    LogHistogram format;
+    /// 格式化完成后的写入耗时, 同样采样
+    LogHistogram write;
+  };
+
+#if SYLAR_LOG_METRICS
+  const Metrics& getMetrics() const { return m_metrics; }
+#endif
+
+ protected:
+  LogLevel::Level m_level = LogLevel::DEBUG;
+  bool m_hasFormatter = false;
+  MutexType m_mutex;
+  LogFormatter::ptr m_formatter;
+#if SYLAR_LOG_METRICS
+  Metrics m_metrics;
+#endif
+};
+
+/**
+ * @brief 日志事件队列, 日志器与日志输出目标之间的有界无锁MPSC环形队列
+ *
+ * @details 生产线程只做一次CAS把事件放进环形队列, 由单个消费线程按入队顺序
+ *          取出后写入日志器的Appender, 同一线程内的事件顺序保持不变
+ */
+class LogEventQueue {
+ public:
+  typedef std::shared_ptr<LogEventQueue> ptr;
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 队列满时的处理策略
+   *
+   */
+  enum OverflowPolicy {
+    /// 阻塞等待, 不丢日志
+    BLOCK = 0,
+    /// 丢弃新来的日志
+    DROP_NEWEST = 1,
+    /// 丢弃低于指定级别的日志, 其余阻塞等待
+    DROP_BELOW_LEVEL = 2
+  };
+
+  /**
+   * @brief Construct a new Log Event Queue object 构造函数
+   *
+   * @param capacity 队列容量, 向上取整为2的幂
+   * @param policy 队列满时的处理策略
+   * @param drop_level DROP_BELOW_LEVEL策略下, 低于该级别的日志会被丢弃
+   */
+  LogEventQueue(size_t capacity = 65536, OverflowPolicy policy = BLOCK,
+                LogLevel::Level drop_level = LogLevel::WARN);
+
+  /**
+   * @brief Destroy the Log Event Queue object 析构函数, 写完队列中剩余日志
+   *
+   */
+  ~LogEventQueue();
+
+  /**
+   * @brief 日志事件入队
+   *
+   * @param logger 日志器
+   * @param level 日志级别
+   * @param event 日志事件
+   * @return true 入队成功
+   * @return false 按策略丢弃
+   */
+  bool push(std::shared_ptr<Logger> logger, LogLevel::Level level,
+            LogEvent::ptr event);
+
+  /**
+   * @brief 等待调用前入队的日志全部写入Appender
+   *
+   */
+  void flush();
+
+  size_t getCapacity() const { return m_mask + 1; }
+  OverflowPolicy getPolicy() const { return m_policy; }
+  LogLevel::Level getDropLevel() const { return m_dropLevel; }
+  /// 被丢弃的日志数
+  uint64_t getDropped() const { return m_dropped; }
+  /// 队列中尚未写出的日志数(近似值)
+  uint64_t getSize() const {
+    uint64_t pushed = m_pushed;
+    uint64_t popped = m_popped;
+    return pushed > popped ? pushed - popped : 0;
+  }
+
+ private:
+  struct Item {
+    std::shared_ptr<Logger> logger;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    LogEvent::ptr event;
+  };
+
+  struct Cell {
+    std::atomic<size_t> seq;
+    Item item;
+  };
+
+  bool tryPush(Item& item);
+  bool tryPop(Item& item);
+  /**
+   * @brief 消费线程
+   *
+   */
+  void run();
+
+ private:
+  size_t m_mask;
+  std::vector<Cell> m_cells;
+  OverflowPolicy m_policy;
+  LogLevel::Level m_dropLevel;
+  /// 生产者写入位置
+  std::atomic<size_t> m_enqueuePos;
+  /// 消费者读取位置, 只有消费线程访问
+  size_t m_dequeuePos = 0;
+  std::atomic<uint64_t> m_pushed;
+  std::atomic<uint64_t> m_popped;
+  std::atomic<uint64_t> m_dropped;
+  /// 消费线程是否在等待
+  std::atomic<bool> m_waiting;
+  std::atomic<bool> m_stop;
+  MutexType m_mutex;
+  std::condition_variable_any m_cond;
+  Thread::ptr m_thread;
+};
+
+/**
+ * @brief 日志器
+ *
+ * @details 由LoggerManager创建的日志器按名称中的'.'组成层级, 上级是名称前缀
+ *          中最近的已存在日志器, 没有时为root. 未设置级别(UNKNOW)时继承上级的
+ *          级别, 没有Appender时使用上级的Appender. 生效的级别和Appender列表在
+ *          配置修改时预先算好, 写日志时不遍历上级
+ */
+class Logger : public std::enable_shared_from_this<Logger> {
+  friend class LoggerManager;
+  friend class LogEventQueue;
+  friend class LogBinaryWriter;
+
+ public:
+  typedef std::shared_ptr<Logger> ptr;
+  typedef Spinlock MutexType;
+  /// 不可变的Appender列表, 修改时整体替换
+  typedef std::vector<LogAppender::ptr> AppenderList;
+
+  /**
+   * @brief Construct a new Logger object 析构函数
+   *
+   * @param name 日志器名称
+   */
+  Logger(const std::string& name = "root");
+
+  /**
+   * @brief 写日志
+   *
+   * @param level 日志级别
+   * @param event 日志事件
+   */
+  void log(LogLevel::Level level, LogEvent::ptr event);
+  /**
+   * @brief 写debug级别日志
+   *
+   * @param event
+   */
+  void debug(LogEvent::ptr event);
+  void info(LogEvent::ptr event);
+  void warn(LogEvent::ptr event);
+  void fatal(LogEvent::ptr event);
+  /**
+   * @brief 添加日志目标
+   *
+   * @param appender
+   */
+  void addAppender(LogAppender::ptr appender);
+  /**
+   * @brief 删除日志目标
+   *
+   * @param appender
+   */
+  void delAppender(LogAppender::ptr appender);
+  /**
+   * @brief 清空日志目标
+   *
+   */
+  void clearAppenders();
+  /**
+   * @brief 一次替换全部日志目标, 没有自己格式器的目标改用日志器的格式器
+   *
+   * @details 只发布一次新的列表快照, 写日志的线程看到的要么是旧列表要么是新列表
+   */
+  void replaceAppenders(const AppenderList& appenders);
+  /**
+   * @brief Get the Name object 获取日志名称
+   *
+   * @return const std::string&
+   */
+  const std::string& getName() const { return m_name; }
+
+  /**
+   * @brief 进程内唯一的日志器id, 二进制日志用来引用日志器
+   *
+   */
+  uint32_t getId() const { return m_id; }
+
+  /**
+   * @brief 是否带有二进制Appender, 是则日志先写入线程的二进制缓冲,
+   *        由后台线程写出
+   *
+   */
+  bool isBinary() const { return m_binary.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 设置日志器自身的级别, UNKNOW表示继承上级
+   *
+   */
+  void setLevel(LogLevel::Level level);
+  /**
+   * @brief 生效的级别, 日志宏只比较这一个值
+   *
+   */
+  LogLevel::Level getLevel() const {
+    return m_level.load(std::memory_order_relaxed);
+  }
+  /**
+   * @brief 日志器自身设置的级别
+   *
+   */
+  LogLevel::Level getOwnLevel();
+
+  void setFormatter(LogFormatter::ptr var);
+  /**
+   * @brief 按格式模板设置格式器, 模板无效时保持原来的格式器
+   *
+   * @param val 格式模板, "json" 表示 JsonLogFormatter
+   */
+  void setFormatter(const std::string& val);
+  /**
+   * @brief Set the Formatter object
+   *
+   * @param val
+   */
+  LogFormatter::ptr getFormatter();
+  /**
+   * @brief 将日志器的配置转成YAML String
+   *
+   * @return std::string
+   */
+  std::string toYamlString();
+
+  /**
+   * @brief 等待队列和二进制缓冲中的日志写出, 再刷新所有生效的Appender
+   *
+   */
+  void flush();
+
+  /**
+   * @brief 刷新所有日志器, 写入 FATAL 日志后同步调用, 进程随后退出也不丢日志
+   *
+   * @param logger 写 FATAL 日志的日志器, 不由 LoggerManager 管理时一并刷新
+   */
+  static void FlushAll(const std::shared_ptr<Logger>& logger = nullptr);
+
+  /**
+   * @brief 设置日志事件队列, 设置后日志由队列的消费线程写入Appender
+   *
+   * @param queue 日志事件队列, 为空时恢复同步写入
+   */
+  void setQueue(LogEventQueue::ptr queue);
+  LogEventQueue::ptr getQueue();
+
+  /**
+   * @brief 获取日志器自身的Appender列表快照
+   *
+   */
+  std::shared_ptr<const AppenderList> getAppenders() const;
+
+  /**
+   * @brief 获取生效的Appender列表快照, 自身没有Appender时为上级的列表
+   *
+   */
+  std::shared_ptr<const AppenderList> getEffectiveAppenders() const;
+
+#if SYLAR_LOG_METRICS
+  /**
+   * @brief 日志器的统计: EMITTED, FILTERED, DROPPED, BYTES
+   *
+   * @details 只统计通过日志宏级别判断后进入日志器的日志,
+   *          宏里就被过滤掉的日志不计数, 关闭的日志语句没有额外开销
+   */
+  LogCounters& getMetrics() { return m_metrics; }
+#endif
+
+ private:
+  /**
+   * @brief 把日志事件写入各个Appender
+   *
+   * @param level 日志级别
+   * @param event 日志事件
+   */
+  void dispatch(LogLevel::Level level, LogEvent::ptr event);
+
+  /**
+   * @brief 把日志事件写入一个Appender, 开启统计时记录条数, 字节数和耗时
+   *
+   */
+  void append(const Logger::ptr& self, LogAppender* appender,
+              LogLevel::Level level, const LogEvent::ptr& event);
+
+  /**
+   * @brief 发布新的Appender列表, 调用时持有m_mutex
+   *
+   */
+  void setAppenders(std::shared_ptr<const AppenderList> appenders);
+
+  /**
+   * @brief 自身配置修改后重新计算自身和下级的生效级别和Appender
+   *
+   * @details 调用时不能持有m_mutex
+   */
+  void refresh();
+
+  /**
+   * @brief 根据自身配置和上级计算生效的级别和Appender,
+   *        受管理的日志器只在LoggerManager的锁内调用
+   *
+   */
+  void updateEffective();
+
+ private:
+  std::string m_name;                       // 日志名称
+  uint32_t m_id;                            // 日志器id
+  std::atomic<bool> m_binary;               // 生效的Appender中是否有二进制Appender
+  std::atomic<LogLevel::Level> m_level;     // 生效的日志级别
+  LogLevel::Level m_ownLevel;               // 自身设置的级别, UNKNOW为继承
+  mutable MutexType m_mutex;                // 串行化配置修改
+  // Appender集合, 修改时复制后整体替换
+  std::shared_ptr<const AppenderList> m_appenders;
+  // 生效的Appender集合, 自身为空时与上级相同
+  std::shared_ptr<const AppenderList> m_effectiveAppenders;
+  // 写日志时读取的生效Appender集合, 替换下来的旧集合等读者退出后才释放
+  std::atomic<const AppenderList*> m_effective;
+  LogFormatter::ptr m_formatter;            // 日志器格式
+  Logger::ptr m_parent;                     // 上级日志器
+  LoggerManager* m_manager = nullptr;       // 所属的LoggerManager
+  // 异步日志事件队列
+  LogEventQueue::ptr m_queue;
+  // 写日志时读取的队列, 替换后等正在入队的线程退出再释放旧队列
+  std::atomic<LogEventQueue*> m_queuePtr;
+#if SYLAR_LOG_METRICS
+  LogCounters m_metrics;                    // 日志器的统计
+#endif
+};
+
+//输出到控制台的Appender
+class StdoutLogAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<StdoutLogAppender> ptr;
+  void log(Logger::ptr logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+
+  std::string toYamlString() override;
+  const char* getType() const override { return "StdoutLogAppender"; }
+
+  /**
+   * @brief 写出标准输出Sink中缓冲的日志
+   *
+   */
+  void flush() override;
+};
+
+class LogSink;
+
+/**
+ * @brief 日志文件切分
+ *
+ * @details 按大小和/或时间周期切分日志文件. 切分时把当前文件改名为
+ *          "文件名.YYYYmmdd-HHMMSS", 再重新打开原文件名继续写.
+ *          改名后的文件交给后台线程 gzip 压缩, 并按保留个数/天数清理旧文件,
+ *          写日志的线程不会被压缩阻塞
+ */
+class LogFileRotator {
+ public:
+  typedef std::shared_ptr<LogFileRotator> ptr;
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 按时间切分的周期
+   */
+  enum Period {
+    /// 不按时间切分
+    NONE = 0,
+    /// 每小时
+    HOURLY = 1,
+    /// 每天
+    DAILY = 2
+  };
+
+  static const char* PeriodToString(Period period);
+  static Period PeriodFromString(const std::string& str);
+
+  /**
+   * @brief Construct a new Log File Rotator object 构造函数
+   *
+   * @param filename 日志文件名
+   * @param max_size 单个文件最大字节数, 0表示不按大小切分
+   * @param period 按时间切分的周期
+   * @param max_files 最多保留的切分文件个数, 0表示不限制
+   * @param max_days 切分文件最多保留的天数, 0表示不限制
+   * @param compress 切分后是否gzip压缩
+   */
+  LogFileRotator(const std::string& filename, uint64_t max_size,
+                 Period period, uint32_t max_files, uint32_t max_days,
+                 bool compress);
+
+  /**
+   * @brief 写入文件, 超过大小或跨过周期时先切分
+   *
+   * @details 按大小切分时在换行处切开, 单条日志不会跨两个文件
+   * @param sink 日志文件, 切分时会重新打开
+   * @param data 格式化好的日志
+   * @param len 日志长度
+   * @param now 当前时间(秒)
+   */
+  void write(LogSink& sink, const char* data, size_t len, time_t now);
+
+  /**
+   * @brief 文件被重新打开后调用, 重新读取文件长度
+   *
+   */
+  void reload();
+
+  /**
+   * @brief 等待后台的压缩和清理任务全部完成
+   *
+   */
+  static void Flush();
+
+  const std::string& getFilename() const { return m_filename; }
+  uint64_t getMaxSize() const { return m_maxSize; }
+  Period getPeriod() const { return m_period; }
+  uint32_t getMaxFiles() const { return m_maxFiles; }
+  uint32_t getMaxDays() const { return m_maxDays; }
+  bool isCompress() const { return m_compress; }
+
+ private:
+  /**
+   * @brief 关闭当前文件, 改名后重新打开, 并提交后台压缩清理任务
+   *
+   */
+  void rotate(LogSink& sink, time_t now);
+
+  /**
+   * @brief 返回 now 所在周期的结束时间(本地时间)
+   *
+   */
+  time_t periodEnd(time_t now) const;
+
+ private:
+  std::string m_filename;
+  uint64_t m_maxSize;
+  Period m_period;
+  uint32_t m_maxFiles;
+  uint32_t m_maxDays;
+  bool m_compress;
+  MutexType m_mutex;
+  /// 当前文件长度
+  uint64_t m_size = 0;
+  /// 当前周期结束时间
+  time_t m_periodEnd = 0;
+};
+
+/**
+ * @brief 批量写文件描述符
+ *
+ * @details 日志先追加到内存缓冲, 缓冲攒够 max_bytes 或最早的一条已等待
+ *          max_latency 毫秒时, 才用一次 writev 写出. 超时由一个共享的后台线程
+ *          检查, 写日志的线程不再每行一次 write 系统调用.
+ *          写出时先换出缓冲再写, 写的过程中其他线程可以继续追加
+ */
+class LogSink {
+ public:
+  typedef std::shared_ptr<LogSink> ptr;
+  typedef Spinlock MutexType;
+  typedef Mutex WriteMutexType;
+
+  /**
+   * @brief 标准输出共用的Sink, 不析构, 进程退出时写出剩余内容
+   *
+   */
+  static LogSink::ptr Stdout();
+
+  /**
+   * @brief 写已打开的文件描述符, 不负责关闭
+   *
+   * @param fd 文件描述符
+   * @param max_latency 最长延迟(毫秒), 0表示只在缓冲写满或 flush 时写出
+   * @param max_bytes 缓冲大小(字节), 0表示不缓冲, 每次追加直接写出
+   */
+  LogSink(int fd, uint32_t max_latency = 5, uint32_t max_bytes = 64 * 1024);
+
+  /**
+   * @brief 以追加方式打开文件, 目录不存在时创建
+   *
+   * @param filename 文件名
+   * @param max_latency 最长延迟(毫秒), 0表示只在缓冲写满或 flush 时写出
+   * @param max_bytes 缓冲大小(字节), 0表示不缓冲, 每次追加直接写出
+   */
+  LogSink(const std::string& filename, uint32_t max_latency = 5,
+          uint32_t max_bytes = 64 * 1024);
+
+  /**
+   * @brief Destroy the Log Sink object 析构函数, 写出剩余内容, 关闭打开的文件
+   *
+   */
+  ~LogSink();
+
+  /**
+   * @brief 追加一段格式化好的日志
+   *
+   */
+  void append(const char* data, size_t len);
+
+  /**
+   * @brief 追加一段格式化好的日志, 设置了切分时先经过切分
+   *
+   * @param data 日志内容
+   * @param len 日志长度
+   * @param now 当前时间(秒), 用于按时间切分
+   */
+  void append(const char* data, size_t len, time_t now);
+
+  /**
+   * @brief 立即写出缓冲中的内容
+   *
+   */
+  void flush();
+
+  /**
+   * @brief 设置文件切分, 写这个文件的所有Appender共用一个切分器
+   *
+   * @details 已有切分器且配置相同时直接共用; 配置不同时拒绝, 返回nullptr.
+   *          Sink只弱引用切分器, 所有使用者释放后不再切分
+   * @param max_size 单个文件最大字节数, 0表示不按大小切分
+   * @param period 按时间切分的周期
+   * @param max_files 最多保留的切分文件个数, 0表示不限制
+   * @param max_days 切分文件最多保留的天数, 0表示不限制
+   * @param compress 切分后是否gzip压缩
+   * @return LogFileRotator::ptr
+   */
+  LogFileRotator::ptr setRotate(uint64_t max_size,
+                                LogFileRotator::Period period,
+                                uint32_t max_files, uint32_t max_days,
+                                bool compress);
+
+  /**
+   * @brief 当前的切分器, 没有时返回nullptr
+   *
+   */
+  LogFileRotator::ptr getRotator();
+
+  /**
+   * @brief 写出缓冲后重新打开文件, 只对按文件名构造的Sink有效
+   *
+   * @return 打开成功返回true
+   */
+  bool reopen();
+
+  /**
+   * @brief 重新打开代数变化时重新打开文件并让切分器重新读取文件长度
+   *
+   * @details 见 LoggerManager::reopenAll. 代数记录在Sink中,
+   *          共用这个Sink的多个Appender每一代只重新打开一次
+   */
+  void checkReopen();
+
+  /**
+   * @brief 进程崩溃时写出缓冲中的内容, 可在信号处理函数中调用
+   *
+   * @details 只调用 write(2), 不加锁(崩溃的线程可能正持有锁),
+   *          与正在进行的追加同时发生时可能写出不完整的一段
+   * @return 写入的文件描述符, 未打开时返回-1
+   */
+  int emergencyFlush();
+
+  const std::string& getFilename() const { return m_filename; }
+  uint32_t getMaxLatency() const { return m_maxLatency; }
+  uint32_t getMaxBytes() const { return m_maxBytes; }
+
+ private:
+  class Flusher;
+
+  /**
+   * @brief 把 buf 和 data 用一次 writev 写出, 调用时持有 m_writeMutex
+   *
+   */
+  void write(const std::string& buf, const char* data, size_t len);
+
+  /**
+   * @brief 换出缓冲并写出, 调用时持有 m_writeMutex
+   *
+   */
+  void flushLocked(const char* data, size_t len);
+
+  /**
+   * @brief 写出缓冲后重新打开文件, 调用时持有 m_writeMutex
+   *
+   */
+  bool reopenLocked();
+
+ private:
+  std::string m_filename;
+  int m_fd;
+  bool m_owned;
+  uint32_t m_maxLatency;
+  uint32_t m_maxBytes;
+  /// 保护缓冲
+  MutexType m_mutex;
+  /// 保证按换出缓冲的顺序写出
+  WriteMutexType m_writeMutex;
+  std::string m_buffer;
+  /// 写出后回收的缓冲
+  std::string m_spare;
+  /// 缓冲中第一条日志的追加时间(毫秒, 单调时钟), 缓冲为空时为0
+  uint64_t m_since = 0;
+  /// 文件切分, 由设置切分的Appender持有
+  std::weak_ptr<LogFileRotator> m_rotator;
+  /// 打开文件时的重新打开代数, 见 LoggerManager::reopenAll
+  std::atomic<uint64_t> m_generation;
+};
+
+/**
+ * @brief 双缓冲异步写文件
+ *
+ * @details 调用线程只把格式化好的日志追加到前台缓冲, 缓冲写满或到达刷新间隔时
+ *          由后台线程交换缓冲, 以大块顺序写的方式交给文件的共享 LogSink,
+ *          与写同一文件的同步Appender共用文件描述符和切分器
+ */
+class LogAsyncWriter {
+ public:
+  typedef std::shared_ptr<LogAsyncWriter> ptr;
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 写盘跟不上, 等待落盘的缓冲达到上限时的处理策略
+   *
+   */
+  enum OverflowPolicy {
+    /// 阻塞写日志的线程, 不丢日志
+    BLOCK = 0,
+    /// 丢弃新来的日志
+    DROP_NEWEST = 1,
+    /// 丢弃最早的尚未开始写的缓冲
+    DROP_OLDEST = 2
+  };
+
+  static const char* PolicyToString(OverflowPolicy policy);
+  static OverflowPolicy PolicyFromString(const std::string& str);
+
+  /**
+   * @brief Construct a new Log Async Writer object 构造函数
+   *
+   * @param sink 文件的共享Sink, 见 LoggerManager::getFileSink
+   * @param flush_interval 后台刷新间隔(毫秒)
+   * @param buffer_size 单个缓冲区大小(字节)
+   * @param max_buffers 等待落盘(含正在写)的缓冲个数上限, 0表示默认25
+   * @param policy 达到上限时的处理策略
+   */
+  LogAsyncWriter(LogSink::ptr sink, uint32_t flush_interval,
+                 uint32_t buffer_size, uint32_t max_buffers = 25,
+                 OverflowPolicy policy = DROP_NEWEST);
+
+  /**
+   * @brief Destroy the Log Async Writer object 析构函数, 写完剩余日志后退出
+   *
+   */
+  ~LogAsyncWriter();
+
+  /**
+   * @brief 追加一条格式化好的日志
+   *
+   * @param data 日志内容
+   * @param len 日志长度
+   */
+  void append(const char* data, size_t len);
+
+  /**
+   * @brief 等待后台线程把已追加的日志全部写入文件
+   *
+   */
+  void flush();
+
+  /**
+   * @brief 通知后台线程重新打开文件
+   *
+   */
+  void reopen();
+
+  /**
+   * @brief 进程崩溃时把尚未交给后台线程的缓冲写入文件, 可在信号处理函数中调用
+   *
+   * @details 用 open(2) 以追加方式打开文件后 write(2), 不加锁,
+   *          只读取 m_pending 中发布的缓冲地址和长度.
+   *          后台线程已取走正在写的缓冲不在其中
+   * @return 打开的文件描述符, 失败返回-1
+   */
+  int emergencyFlush();
+
+  uint32_t getFlushInterval() const { return m_flushInterval; }
+  uint32_t getBufferSize() const { return m_bufferSize; }
+  uint32_t getMaxBuffers() const { return m_maxBuffers; }
+  OverflowPolicy getPolicy() const { return m_policy; }
+  /// 按策略丢弃的日志条数
+  uint64_t getDropped() const { return m_dropped; }
+
+ private:
+  /**
+   * @brief 后台写线程
+   *
+   */
+  void run();
+
+  /**
+   * @brief 把写满的前台缓冲交给后台线程, 调用时持有 m_mutex
+   *
+   */
+  void swapCurrent();
+
+  /**
+   * @brief 把 m_buffers 和前台缓冲的地址发布到 m_pending, 调用时持有 m_mutex
+   *
+   */
+  void publish();
+
+ private:
+  LogSink::ptr m_sink;
+  /// 刷新间隔(毫秒)
+  uint32_t m_flushInterval;
+  /// 单个缓冲区大小
+  uint32_t m_bufferSize;
+  uint32_t m_maxBuffers;
+  OverflowPolicy m_policy;
+  MutexType m_mutex;
+  std::condition_variable_any m_cond;
+  /// 前台缓冲
+  std::string m_current;
+  /// 前台缓冲中的日志条数
+  uint64_t m_currentRecords = 0;
+  /// 已写满等待落盘的缓冲
+  std::vector<std::string> m_buffers;
+  /// m_buffers 中每个缓冲的日志条数, 丢弃时计数
+  std::vector<uint64_t> m_bufferRecords;
+  /// 后台线程正在写的缓冲个数
+  size_t m_writing = 0;
+
+  /**
+   * @brief 发布给崩溃处理函数的一个缓冲
+   *
+   * @details 更新时先把长度清零再换地址, 读取方先读地址再读长度
+   */
+  struct Pending {
+    std::atomic<const char*> data{nullptr};
+    std::atomic<size_t> size{0};
+  };
+  /// m_maxBuffers 个等待落盘的缓冲, 最后一个是前台缓冲; 构造后不再分配
+  std::unique_ptr<Pending[]> m_pending;
+  std::atomic<uint64_t> m_dropped{0};
+  /// 落盘后回收的空缓冲
+  std::vector<std::string> m_spares;
+  /// 请求刷新的序号
+  uint64_t m_flushSeq = 0;
+  /// 已完成刷新的序号
+  uint64_t m_flushedSeq = 0;
+  bool m_reopen = false;
+  bool m_stop = false;
+  Thread::ptr m_thread;
+};
+
+//输出到文件
+class FileLogAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<FileLogAppender> ptr;
+  FileLogAppender(const std::string& filename);
+  ~FileLogAppender();
+  void log(Logger::ptr logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+
+  std::string toYamlString() override;
+  const char* getType() const override { return "FileLogAppender"; }
+  std::string getFile() const override { return m_filename; }
+  uint64_t getDropped() override;
+
+  /**
+   * @brief 同步模式下刷新文件流, 异步模式下等待后台线程写完
+   *
+   */
+  void flush() override;
+
+  // 重新打开文件， 文件打开成功返回true
+  bool reopen();
+
+  /**
+   * @brief 设置异步写入模式
+   *
+   * @param v 是否异步
+   * @param flush_interval 后台刷新间隔(毫秒)
+   * @param buffer_size 单个缓冲区大小(字节)
+   * @param max_buffers 等待落盘的缓冲个数上限
+   * @param policy 达到上限时的处理策略
+   */
+  void setAsync(bool v, uint32_t flush_interval = 1000,
+                uint32_t buffer_size = 4 * 1024 * 1024,
+                uint32_t max_buffers = 25,
+                LogAsyncWriter::OverflowPolicy policy =
+                    LogAsyncWriter::DROP_NEWEST);
+
+  bool isAsync();
+
+  /**
+   * @brief 设置文件切分, max_size 为0且 period 为 NONE 时关闭切分
+   *
+   * @details 切分器属于文件, 与写同一文件的其他Appender共用,
+   *          其他Appender已为这个文件设置了不同的切分时失败
+   * @param max_size 单个文件最大字节数, 0表示不按大小切分
+   * @param period 按时间切分的周期
+   * @param max_files 最多保留的切分文件个数, 0表示不限制
+   * @param max_days 切分文件最多保留的天数, 0表示不限制
+   * @param compress 切分后是否gzip压缩
+   * @return 切分配置冲突时返回false, 此时不切分
+   */
+  bool setRotate(uint64_t max_size, LogFileRotator::Period period,
+                 uint32_t max_files = 0, uint32_t max_days = 0,
+                 bool compress = false);
+
+  LogFileRotator::ptr getRotator();
+
+ private:
+  /**
+   * @brief 同步模式下重新打开文件, 不持有m_mutex
+   *
+   */
+  bool openFile();
+
+ private:
+  std::string m_filename;
+  /// 同步模式下写文件
+  LogSink::ptr m_sink;
+  /// 异步写入器, 为空时同步写文件
+  LogAsyncWriter::ptr m_asyncWriter;
+  /// 已替换掉的异步写入器丢弃的日志数
+  uint64_t m_dropped = 0;
+  /// 文件切分, 为空时不切分. 持有引用使Sink保持切分
+  LogFileRotator::ptr m_rotator;
+};
+
+/**
+ * @brief 通过内存映射写文件的Appender
+ *
+ * @details 文件按块(chunk_size)预分配并映射, 写日志时用原子 fetch_add 预留位置
+ *          后直接 memcpy, 不经过 write 系统调用. 块写满时解除映射, 进入新块时
+ *          同时映射下一块. 关闭时把文件截断到实际长度,
+ *          异常退出留下的结尾空字节在下次打开时去掉
+ */
+class MmapFileLogAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<MmapFileLogAppender> ptr;
+
+  /**
+   * @brief msync策略
+   *
+   */
+  enum SyncPolicy {
+    /// 不主动msync, 由内核回写
+    SYNC_NONE = 0,
+    /// 块写满和flush时 msync(MS_ASYNC)
+    SYNC_ASYNC = 1,
+    /// 块写满和flush时 msync(MS_SYNC)
+    SYNC_SYNC = 2
+  };
+
+  static const char* SyncPolicyToString(SyncPolicy sync);
+  static SyncPolicy SyncPolicyFromString(const std::string& str);
+
+  /**
+   * @brief 构造函数
+   *
+   * @param filename 文件名
+   * @param chunk_size 每次预分配并映射的大小, 向上取整到页大小
+   * @param sync msync策略
+   */
+  MmapFileLogAppender(const std::string& filename,
+                      uint32_t chunk_size = 16 * 1024 * 1024,
+                      SyncPolicy sync = SYNC_NONE);
+  ~MmapFileLogAppender();
+
+  void log(Logger::ptr logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+  std::string toYamlString() override;
+  const char* getType() const override { return "MmapFileLogAppender"; }
+  std::string getFile() const override { return m_filename; }
+  void flush() override;
+
+  const std::string& getFilename() const { return m_filename; }
+  uint32_t getChunkSize() const { return m_chunkSize; }
+  SyncPolicy getSyncPolicy() const { return m_sync; }
+
+ private:
+  /**
+   * @brief 一个映射块, 槽位固定, 按块序号轮流使用
+   *
+   */
+  struct Chunk {
+    /// 块序号, kNoChunk 表示空闲
+    std::atomic<uint64_t> index;
+    char* data = nullptr;
+    /// 已写入的字节数, 写满的线程负责解除映射
+    std::atomic<uint64_t> written;
+  };
+  static const size_t kChunks = 4;
+  static const uint64_t kNoChunk = ~0ull;
+
+  void write(const char* data, size_t len);
+  Chunk* getChunk(uint64_t index);
+  /**
+   * @brief 映射块到槽位, 调用时持有m_mapMutex
+   *
+   * @return 槽位还被旧块占用时返回false
+   */
+  bool mapChunk(uint64_t index, bool& error);
+  void releaseChunk(Chunk& chunk);
+
+ private:
+  std::string m_filename;
+  uint32_t m_chunkSize;
+  SyncPolicy m_sync;
+  int m_fd = -1;
+  /// 打开时的文件长度, 之前的内容不再映射
+  uint64_t m_start = 0;
+  /// 下一条日志的写入位置
+  std::atomic<uint64_t> m_offset;
+  Chunk m_chunks[kChunks];
+  Mutex m_mapMutex;
+};
+
+/**
+ * @brief 飞行记录器: 把格式化后的日志保存在内存环形缓冲中, 需要时才写入文件
+ *
+ * @details 缓冲总大小固定, 分成最多16个分片, 线程按id写入其中一个分片,
+ *          分片内用自旋锁, 写日志不做系统调用. 缓冲写满后覆盖最旧的记录,
+ *          保留的是所有线程最后 ring_size 字节左右的日志. 以下情况把所有
+ *          分片中的记录按时间排序后追加到文件:
+ *          1. 调用 dump()
+ *          2. 收到 SetDumpSignal 设置的信号(配置项 log.ring_dump_signal)
+ *          3. 第一次收到不低于 dump_level 的日志, 由后台线程转储,
+ *             rearm() 后可再次触发
+ *          典型用法是日志器级别设为DEBUG, 文件Appender级别设为INFO,
+ *          出错时才把之前的DEBUG日志写出
+ */
+class RingBufferLogAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<RingBufferLogAppender> ptr;
+
+  /**
+   * @brief 构造函数
+   *
+   * @param filename 转储文件名
+   * @param ring_size 缓冲总大小, 向上取整为2的幂, 按线程id分到若干分片
+   * @param dump_level 收到不低于该级别的日志时由后台线程自动转储,
+   *                   UNKNOW表示不自动转储
+   */
+  RingBufferLogAppender(const std::string& filename,
+                        uint32_t ring_size = 1024 * 1024,
+                        LogLevel::Level dump_level = LogLevel::ERROR);
+  ~RingBufferLogAppender();
+
+  void log(Logger::ptr logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+  std::string toYamlString() override;
+  const char* getType() const override { return "RingBufferLogAppender"; }
+  std::string getFile() const override { return m_filename; }
+
+  /**
+   * @brief 把缓冲中的记录追加到转储文件, 记录仍保留在缓冲中
+   *
+   * @param reason 写在转储开头的原因
+   * @return 写出的记录数
+   */
+  size_t dump(const std::string& reason = "manual");
+
+  /**
+   * @brief 重新允许按 dump_level 自动转储一次
+   *
+   */
+  void rearm() { m_triggered = false; }
 
   /**
-   * @brief 写日志
+   * @brief 设置触发所有 RingBufferLogAppender 转储的信号, 0表示不使用信号
    *
-   * @param level 日志级别
-   * @param event 日志事件
+   * @details 信号处理函数只写一个管道, 由后台线程转储
    */
-  void log(LogLevel::Level level, LogEvent::ptr event);
+  static void SetDumpSignal(int sig);
+
+  const std::string& getFilename() const { return m_filename; }
+  uint32_t getRingSize() const { return m_ringSize; }
+  LogLevel::Level getDumpLevel() const { return m_dumpLevel; }
+
+ private:
   /**
-   * @brief 写debug级别日志
+   * @brief 一个分片的环形缓冲, 线程id相同余数的线程共用
    *
-   * @param event
+   * @details m_tail 是最旧一条完整记录的位置, m_head 是下一条记录的位置,
+   *          都只增不减. 写入方在 m_mutex 内先推进 m_tail 再覆盖旧数据,
+   *          读取方不加锁, 复制后再读一次 m_tail, 被覆盖的部分丢弃
    */
-  void debug(LogEvent::ptr event);
-  void info(LogEvent::ptr event);
-  void warn(LogEvent::ptr event);
-  void fatal(LogEvent::ptr event);
+  class Ring {
+   public:
+    typedef std::unique_ptr<Ring> ptr;
+    explicit Ring(uint32_t size);
+    ~Ring();
+
+    void write(uint64_t time, const char* data, size_t len);
+
+    /**
+     * @brief 复制缓冲中的完整记录, 返回第一条记录在buf中的位置
+     *
+     */
+    size_t snapshot(std::string& buf) const;
+
+   private:
+    void copyIn(uint64_t pos, const void* data, size_t len);
+    void copyOut(uint64_t pos, void* data, size_t len) const;
+
+   private:
+    Spinlock m_mutex;
+    char* m_data;
+    uint64_t m_mask;
+    std::atomic<uint64_t> m_head;
+    std::atomic<uint64_t> m_tail;
+  };
+
   /**
-   * @brief 添加日志目标
+   * @brief 记录头, 后面跟格式化后的日志, 整条记录按8字节对齐
    *
-   * @param appender
    */
-  void addAppender(LogAppender::ptr appender);
+  struct Record {
+    /// 整条记录长度
+    uint32_t size;
+    /// 日志长度
+    uint32_t len;
+    /// 时间(纳秒)
+    uint64_t time;
+  };
+
+  Ring* getRing() {
+    return m_rings[GetThreadId() & (m_rings.size() - 1)].get();
+  }
+
+ private:
+  std::string m_filename;
+  uint32_t m_ringSize;
+  LogLevel::Level m_dumpLevel;
+  std::atomic<bool> m_triggered{false};
+  /// 分片, 个数是2的幂, 构造后不变; 线程退出后它的日志仍留在分片中
+  std::vector<Ring::ptr> m_rings;
+  /// 保证同一时间只有一个转储
+  Mutex m_dumpMutex;
+};
+
+/**
+ * @brief 二进制日志记录头
+ *
+ * @details 线程缓冲和文件中的记录格式相同: 记录头后面跟参数,
+ *          每个参数以一个字节的类型开头(LogBinaryArg::Type)
+ */
+struct LogBinaryHeader {
+  enum Kind {
+    /// 线程缓冲尾部的填充
+    PAD = 0,
+    /// 调用点定义, 参数: 文件, 行号, 格式串
+    SITE = 1,
+    /// 日志器定义, 参数: 名称
+    LOGGER = 2,
+    /// 线程名称, 参数: 名称
+    THREAD = 3,
+    /// 格式化日志, 参数: printf参数
+    LOG = 4,
+    /// 已格式化的日志, 参数: 文件, 行号, 内容, 之后每个结构化字段为 键, 类型, 值
+    TEXT = 5
+  };
+  uint32_t size;      // 整条记录长度
+  uint8_t kind;       // 记录类型
+  uint8_t level;      // 日志级别
+  uint16_t reserved;
+  uint32_t site;      // 调用点id
+  uint32_t logger;    // 日志器id
+  uint32_t thread;    // 线程id
+  uint32_t fiber;     // 协程id
+  uint64_t time;      // 时间(纳秒)
+};
+
+/**
+ * @brief 二进制日志参数类型
+ *
+ */
+struct LogBinaryArg {
+  enum Type { INT = 1, UINT = 2, DOUBLE = 3, STRING = 4, POINTER = 5 };
+};
+
+/**
+ * @brief 二进制日志参数编码, 只支持printf可以输出的类型
+ *
+ * @details value为false的类型不能编码, 含有这种参数的日志在调用线程格式化
+ */
+template <class T, class Enable = void>
+struct LogBinaryArgTraits {
+  static const bool value = false;
+};
+
+template <class T>
+struct LogBinaryArgTraits<
+    T, typename std::enable_if<(std::is_integral<T>::value &&
+                                std::is_signed<T>::value) ||
+                               std::is_enum<T>::value>::type> {
+  static const bool value = true;
+  static size_t Size(T) { return 9; }
+  static void Put(char*& p, T v) {
+    int64_t x = (int64_t)v;
+    *p++ = LogBinaryArg::INT;
+    memcpy(p, &x, 8);
+    p += 8;
+  }
+};
+
+template <class T>
+struct LogBinaryArgTraits<
+    T, typename std::enable_if<std::is_integral<T>::value &&
+                               std::is_unsigned<T>::value>::type> {
+  static const bool value = true;
+  static size_t Size(T) { return 9; }
+  static void Put(char*& p, T v) {
+    uint64_t x = v;
+    *p++ = LogBinaryArg::UINT;
+    memcpy(p, &x, 8);
+    p += 8;
+  }
+};
+
+template <class T>
+struct LogBinaryArgTraits<
+    T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static const bool value = true;
+  static size_t Size(T) { return 9; }
+  static void Put(char*& p, T v) {
+    double x = v;
+    *p++ = LogBinaryArg::DOUBLE;
+    memcpy(p, &x, 8);
+    p += 8;
+  }
+};
+
+template <class T>
+struct LogBinaryArgTraits<
+    T, typename std::enable_if<std::is_pointer<T>::value ||
+                               std::is_same<T, std::nullptr_t>::value>::type> {
+  static const bool value = true;
+  static size_t Size(T) { return 9; }
+  static void Put(char*& p, T v) {
+    uint64_t x = (uintptr_t)v;
+    *p++ = LogBinaryArg::POINTER;
+    memcpy(p, &x, 8);
+    p += 8;
+  }
+};
+
+template <>
+struct LogBinaryArgTraits<const char*> {
+  static const bool value = true;
+  static size_t Size(const char* v) { return 5 + (v ? strlen(v) : 6); }
+  static void Put(char*& p, const char* v) { Put(p, v, v ? strlen(v) : 0); }
+  static void Put(char*& p, const char* v, uint32_t len) {
+    if (!v) {
+      v = "(null)";
+      len = 6;
+    }
+    *p++ = LogBinaryArg::STRING;
+    memcpy(p, &len, 4);
+    memcpy(p + 4, v, len);
+    p += 4 + len;
+  }
+};
+
+template <>
+struct LogBinaryArgTraits<char*> : public LogBinaryArgTraits<const char*> {};
+
+template <>
+struct LogBinaryArgTraits<std::string> {
+  static const bool value = true;
+  static size_t Size(const std::string& v) { return 5 + v.size(); }
+  static void Put(char*& p, const std::string& v) {
+    LogBinaryArgTraits<const char*>::Put(p, v.c_str(), v.size());
+  }
+};
+
+/**
+ * @brief 参数是否都能编码
+ *
+ */
+template <class... Args>
+struct LogBinaryArgsSupported;
+
+template <>
+struct LogBinaryArgsSupported<> {
+  static const bool value = true;
+};
+
+template <class T, class... Args>
+struct LogBinaryArgsSupported<T, Args...> {
+  static const bool value =
+      LogBinaryArgTraits<typename std::decay<T>::type>::value &&
+      LogBinaryArgsSupported<Args...>::value;
+};
+
+inline size_t LogBinaryArgsSize() { return 0; }
+
+template <class T, class... Args>
+size_t LogBinaryArgsSize(const T& v, const Args&... args) {
+  return LogBinaryArgTraits<typename std::decay<T>::type>::Size(v) +
+         LogBinaryArgsSize(args...);
+}
+
+inline void LogBinaryPutArgs(char*&) {}
+
+template <class T, class... Args>
+void LogBinaryPutArgs(char*& p, const T& v, const Args&... args) {
+  LogBinaryArgTraits<typename std::decay<T>::type>::Put(p, v);
+  LogBinaryPutArgs(p, args...);
+}
+
+/**
+ * @brief 二进制日志的线程缓冲
+ *
+ * @details 每个线程一个单生产者单消费者的环形缓冲, 调用线程只拷贝原始参数,
+ *          后台线程取出记录写入二进制Appender, 需要时再格式化给其他Appender
+ */
+class LogBinary {
+ public:
+  /// 单条记录的最大长度, 超过时退回文本日志
+  static const size_t kMaxRecordSize = 64 * 1024;
+
   /**
-   * @brief 删除日志目标
+   * @brief 在当前线程缓冲中预留一条记录的空间, 缓冲满时等待后台线程取走
    *
-   * @param appender
+   * @param size 记录长度
+   * @return 记录起始位置, 记录过长或后台线程已停止时返回nullptr
    */
-  void delAppender(LogAppender::ptr appender);
+  static char* Reserve(size_t size);
+
   /**
-   * @brief 清空日志目标
+   * @brief 提交 Reserve 预留的记录
    *
    */
-  void clearAppenders();
+  static void Commit();
+
   /**
-   * @brief Get the Name object 获取日志名称
+   * @brief 把已格式化的日志事件写入当前线程缓冲, 保持与格式化日志的先后顺序
    *
-   * @return const std::string&
+   * @return 是否写入
    */
-  const std::string& getName() const { return m_name; }
+  static bool WriteEvent(const std::shared_ptr<Logger>& logger,
+                         LogLevel::Level level, LogEvent::ptr event);
 
-  void setLevel(LogLevel::Level level) { m_level = level; }
-  LogLevel::Level getLevel() { return m_level; }
+  /**
+   * @brief 等待当前所有线程缓冲中的记录写出, 并刷新二进制Appender
+   *
+   */
+  static void Flush();
 
-  void setFormatter(LogFormatter::ptr var);
   /**
-   * @brief Set the Formatter object
+   * @brief 登记日志器, 后台线程根据id找到日志器
    *
-   * @param val
    */
-  LogFormatter::ptr getFormatter();
+  static void RegisterLogger(std::shared_ptr<Logger> logger);
+
   /**
-   * @brief 将日志器的配置转成YAML String
+   * @brief 当前时间(纳秒)
    *
-   * @return std::string
    */
-  std::string toYamlString();
+  static uint64_t Now() { return LogClock::Now(); }
 
- private:
-  std::string m_name;                       // 日志名称
-  LogLevel::Level m_level;                  // 日志级别
-  MutexType m_mutex;                        // mutex
-  std::list<LogAppender::ptr> m_appenders;  // Appender集合
-  LogFormatter::ptr m_formatter;            // 日志器格式
-  Logger::ptr m_root;                       // 主日志器
+  /**
+   * @brief 按printf格式串把二进制参数格式化到ss
+   *
+   * @param ss 输出
+   * @param fmt 格式串
+   * @param args 参数起始位置
+   * @param end 参数结束位置
+   */
+  static void Format(LogStream& ss, const char* fmt, const char* args,
+                     const char* end);
 };
 
-//输出到控制台的Appender
-class StdoutLogAppender : public LogAppender {
+/**
+ * @brief 输出二进制日志到文件的Appender
+ *
+ * @details 格式化日志只写调用点id和原始参数, 调用点, 日志器, 线程名称第一次出现时
+ *          写一条定义记录. 用 sylar-logdecode 或 LogBinaryReader 还原成文本
+ */
+class BinaryFileLogAppender : public LogAppender {
  public:
-  typedef std::shared_ptr<StdoutLogAppender> ptr;
+  typedef std::shared_ptr<BinaryFileLogAppender> ptr;
+  BinaryFileLogAppender(const std::string& filename);
+  ~BinaryFileLogAppender();
+
   void log(Logger::ptr logger, LogLevel::Level level,
            LogEvent::ptr event) override;
-
   std::string toYamlString() override;
-};
+  const char* getType() const override { return "BinaryFileLogAppender"; }
+  std::string getFile() const override { return m_filename; }
+  void flush() override;
+  bool isBinary() const override { return true; }
 
-//输出到文件
-class FileLogAppender : public LogAppender {
- public:
-  typedef std::shared_ptr<FileLogAppender> ptr;
-  FileLogAppender(const std::string& filename);
-  void log(Logger::ptr logger, LogLevel::Level level,
-           LogEvent::ptr event) override;
+  /**
+   * @brief 写入线程缓冲中取出的记录
+   *
+   * @param logger 日志器
+   * @param data 记录
+   * @param thread_name 产生记录的线程名称
+   */
+  void write(const Logger::ptr& logger, const char* data,
+             const std::string& thread_name);
 
-  // 重新打开文件， 文件打开成功返回true
+  /**
+   * @brief 重新打开日志文件
+   *
+   * @return 成功返回true
+   */
   bool reopen();
 
+ private:
+  /**
+   * @brief 重新打开日志文件, 调用时持有m_mutex
+   *
+   */
+  bool openFile();
+
+  /**
+   * @brief 重新打开代数变化时重新打开文件, 调用时持有m_mutex
+   *
+   */
+  void checkReopen();
+
+  /**
+   * @brief 写入记录依赖的定义记录, 调用时持有m_mutex
+   *
+   */
+  void writeDefines(const Logger::ptr& logger, const LogBinaryHeader& header,
+                    const std::string& thread_name);
+
  private:
   std::string m_filename;
   std::ofstream m_filestream;
-  /// 上次重新打开时间
-  uint64_t m_lastTime = 0;
+  /// 打开文件时的重新打开代数, 见 LoggerManager::reopenAll
+  uint64_t m_generation = 0;
+  /// 本文件中已定义的调用点, 日志器, 线程名称
+  std::vector<bool> m_sites;
+  std::vector<bool> m_loggers;
+  std::map<uint32_t, std::string> m_threads;
+  std::string m_buffer;
+};
+
+/**
+ * @brief 读取二进制日志文件, 还原成日志事件
+ *
+ */
+class LogBinaryReader {
+ public:
+  typedef std::shared_ptr<LogBinaryReader> ptr;
+
+  bool open(const std::string& filename);
+
+  /**
+   * @brief 读取下一条日志
+   *
+   * @param[out] logger 日志器(只带名称)
+   * @param[out] level 日志级别
+   * @param[out] event 日志事件
+   * @return 文件结束或格式错误时返回false
+   */
+  bool next(Logger::ptr& logger, LogLevel::Level& level, LogEvent::ptr& event);
+
+  /**
+   * @brief 是否因格式错误停止
+   *
+   */
+  bool isError() const { return m_error; }
+
+ private:
+  struct Site {
+    const char* file;
+    int32_t line;
+    std::string fmt;
+  };
+
+  const char* intern(const char* str, uint32_t len);
+
+ private:
+  std::ifstream m_in;
+  std::string m_buffer;
+  std::map<uint32_t, Site> m_sites;
+  std::map<uint32_t, Logger::ptr> m_loggers;
+  std::map<uint32_t, std::string> m_threads;
+  /// 文件名, 事件直接引用
+  std::set<std::string> m_files;
+  bool m_error = false;
+};
+
+/**
+ * @brief 把格式化日志写入线程的二进制缓冲, 缓冲不可用时返回false
+ *
+ */
+template <class... Args>
+bool LogBinaryWriteArgs(std::true_type, const LogCallSite& site,
+                        const std::shared_ptr<Logger>& logger,
+                        LogLevel::Level level, const Args&... args) {
+  size_t size = sizeof(LogBinaryHeader) + LogBinaryArgsSize(args...);
+  char* p = LogBinary::Reserve(size);
+  if (!p) {
+    return false;
+  }
+  LogBinaryHeader* header = (LogBinaryHeader*)p;
+  header->size = size;
+  header->kind = LogBinaryHeader::LOG;
+  header->level = level;
+  header->reserved = 0;
+  header->site = site.getId();
+  header->logger = logger->getId();
+  header->thread = GetThreadId();
+  header->fiber = GetFiberId();
+  header->time = LogBinary::Now();
+  p += sizeof(LogBinaryHeader);
+  LogBinaryPutArgs(p, args...);
+  LogBinary::Commit();
+#if SYLAR_LOG_METRICS
+  logger->getMetrics().add(LogCounters::EMITTED);
+#endif
+  if (level >= LogLevel::FATAL) {
+    Logger::FlushAll(logger);
+  }
+  return true;
+}
+
+/**
+ * @brief 含有不能编码的参数, 在调用线程格式化
+ *
+ */
+template <class... Args>
+bool LogBinaryWriteArgs(std::false_type, const LogCallSite&,
+                        const std::shared_ptr<Logger>&, LogLevel::Level,
+                        const Args&...) {
+  return false;
+}
+
+template <class Fmt, class... Args>
+void LogCallSite::Log(const LogCallSite& site,
+                      const std::shared_ptr<Logger>& logger,
+                      LogLevel::Level level, const Fmt& fmt,
+                      const Args&... args) {
+  // 只有字符串常量的格式串登记在调用点中, 解码时能找回
+  if (site.getFormat() && logger->isBinary() &&
+      LogBinaryWriteArgs(
+          std::integral_constant<bool,
+                                 LogBinaryArgsSupported<Args...>::value>(),
+          site, logger, level, args...)) {
+    return;
+  }
+  LogEventWrap(
+      LogEvent::Create(logger, site, level, GetThreadId(), GetFiberId(),
+                       LogClock::Now()))
+      .getEvent()
+      ->format(LogFormatArg(fmt), LogFormatArg(args)...);
+}
+
+/**
+ * @brief 日志模块自身的统计快照, 由 LoggerManager::getStats 生成
+ *
+ * @details 计数从进程启动(或日志器, Appender创建)起累计. 耗时单位为纳秒
+ */
+struct LogStats {
+  struct LoggerStat {
+    std::string name;
+    uint64_t emitted = 0;
+    uint64_t filtered = 0;
+    uint64_t dropped = 0;
+    uint64_t bytes = 0;
+    /// 是否使用异步事件队列, 是时下面两项有效
+    bool async = false;
+    /// 队列中尚未写出的日志数
+    uint64_t queue_depth = 0;
+    /// 队列累计丢弃的日志数(多个日志器共用队列时为合计)
+    uint64_t queue_dropped = 0;
+  };
+
+  struct AppenderStat {
+    std::string type;
+    /// 文件类Appender的文件名
+    std::string file;
+    /// 直接添加了该Appender的日志器
+    std::vector<std::string> loggers;
+    uint64_t emitted = 0;
+    uint64_t filtered = 0;
+    uint64_t bytes = 0;
+    /// Appender自身丢弃的日志数, 如异步写文件缓冲满
+    uint64_t dropped = 0;
+    LogHistogram::Snapshot format;
+    LogHistogram::Snapshot write;
+  };
+
+  /// 编译时是否开启了统计(SYLAR_LOG_METRICS)
+  bool enabled = false;
+  std::vector<LoggerStat> loggers;
+  std::vector<AppenderStat> appenders;
+
+  std::string toYamlString() const;
 };
 
 class LoggerManager {
+  friend class Logger;
+
  public:
   typedef Spinlock MutexType;
   LoggerManager();
+  ~LoggerManager();
 
+  /**
+   * @brief 获取name日志器, 不存在时创建
+   *
+   * @details 已存在的日志器通过无锁哈希表查找, 只有创建时加锁
+   */
   Logger::ptr getLogger(const std::string& name);
 
+  /**
+   * @brief 同 getLogger, 返回管理器中保存的智能指针的引用
+   *
+   * @details 日志器不会被删除, 引用在LoggerManager的生命周期内有效
+   */
+  const Logger::ptr& getLoggerRef(const std::string& name);
+
   void init();
 
   Logger::ptr getRoot() const { return m_root; }
 
   std::string toYamlString();
 
+  /**
+   * @brief 通知所有文件类Appender重新打开日志文件
+   *
+   * @details 只递增一个原子计数(重新打开代数), 可以在 SIGHUP 等信号处理函数中
+   *          调用. 同步写的Appender在下一次写日志时发现代数变化后重新打开,
+   *          异步写入器在后台线程下一轮写盘前重新打开
+   */
+  void reopenAll();
+
+  /**
+   * @brief 返回当前的重新打开代数
+   *
+   */
+  static uint64_t GetReopenGeneration();
+
+  /**
+   * @brief 开启/关闭用 inotify 监视日志文件所在目录
+   *
+   * @details 开启后日志文件被移走或删除(如 logrotate)时自动调用 reopenAll
+   */
+  void setWatchFiles(bool v);
+
+  /**
+   * @brief 刷新所有日志器, FATAL 日志写入后自动调用
+   *
+   * @details 共用的队列和Appender只刷新一次
+   * @param extra 额外刷新的日志器, 已由本类管理时忽略
+   */
+  void flushAll(const Logger::ptr& extra = nullptr);
+
+  /**
+   * @brief 安装/卸载致命信号(SIGSEGV, SIGABRT, SIGBUS, SIGILL, SIGFPE)处理函数
+   *
+   * @details 收到信号时只用异步信号安全的调用: 把各 LogSink 和异步写入器中
+   *          尚未写出的日志 write(2) 到已打开(或用 open(2) 打开)的文件,
+   *          在这些文件和标准错误上追加信号信息和带符号的调用栈, 然后交还
+   *          原来的处理方式. LogEventQueue 和二进制线程缓冲中尚未格式化的
+   *          日志无法在信号处理函数中安全处理, 会丢失.
+   *          备用信号栈只为调用本函数的线程安装, 其他线程栈溢出时
+   *          处理函数无栈可用, 需要在线程入口调用 InstallCrashStack.
+   *          最多登记 256 个 LogSink 和 256 个异步写入器, 超出的不做紧急刷新
+   */
+  void setCrashHandler(bool v);
+
+  /**
+   * @brief 为当前线程安装崩溃处理用的备用信号栈
+   *
+   * @details 在线程入口调用, 线程退出时自动释放; 线程已有备用栈时不处理
+   */
+  static void InstallCrashStack();
+
+  /**
+   * @brief 获取写文件的共享Sink, 同一个文件只打开一次
+   *
+   * @details 按规范化路径查找, 路径不同但 inode 相同(符号链接, 硬链接)时也共用.
+   *          写同一文件的多个 FileLogAppender 共用一个缓冲和文件描述符,
+   *          日志按写入顺序成批写出; 各Appender的级别和格式互不影响.
+   *          所有引用释放后关闭文件
+   */
+  LogSink::ptr getFileSink(const std::string& filename);
+
+  /**
+   * @brief 获取所有日志器和它们的Appender的统计
+   *
+   */
+  LogStats getStats();
+
+  /**
+   * @brief 设置定期输出统计的间隔(秒)
+   *
+   * @details 大于0时由后台线程每隔 seconds 秒把 getStats 的结果以 INFO
+   *          级别写到 root 日志器, 0 表示关闭
+   */
+  void setStatsInterval(uint32_t seconds);
+
+  /**
+   * @brief 设置耗时直方图的采样间隔
+   *
+   * @details 每个线程每 n 次写入才读时钟记录一次耗时, 向上取整为2的幂,
+   *          默认16(配置项 log.latency_sample). 条数和字节数不采样
+   */
+  static void SetLatencySample(uint32_t n);
+
+ private:
+  class LoggerTable;
+
+  /**
+   * @brief 把m_loggers中的日志器加入哈希表, 需持有m_mutex
+   *
+   */
+  void publish(size_t hash, const Logger::ptr* logger);
+
+  /**
+   * @brief 名称前缀中最近的已存在日志器, 没有时为root, 需持有m_mutex
+   *
+   */
+  Logger::ptr findParent(const std::string& name);
+
+  /**
+   * @brief 重新计算logger和它所有下级的生效级别和Appender
+   *
+   */
+  void refresh(Logger* logger);
+
  private:
   MutexType m_mutex;
   std::map<std::string, Logger::ptr> m_loggers;
   Logger::ptr m_root;
+  /// 名称到m_loggers中元素的无锁查找表
+  std::atomic<LoggerTable*> m_table;
+  /// 扩容后被替换的旧表, 可能仍有线程在上面查找, 析构时释放
+  std::vector<LoggerTable*> m_retired;
+  /// 保护共享Sink表, 打开文件时不能持有自旋锁
+  Mutex m_sinkMutex;
+  /// 规范化路径 -> 共享Sink
+  std::map<std::string, std::weak_ptr<LogSink>> m_sinks;
+  /// (设备号, inode) -> 共享Sink
+  std::map<std::pair<uint64_t, uint64_t>, std::weak_ptr<LogSink>> m_sinkInodes;
 };
 
 /// 日志管理类单例模式
@@ -0,0 +1,534 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+
+// 日志性能基准: 对 流式宏/格式化宏, 开启/关闭的级别, null/file/stdout 输出,
+// 在不同线程数下测吞吐(闭环, 尽快写)和单次调用延迟(开环, 按固定速率写).
+// 开环测量时每条日志的延迟从"计划开始时间"算起, 前一条卡住造成的排队也计入,
+// 避免 coordinated omission. 结果以 JSON 输出到标准输出, 便于不同提交间比较.
+//
+// 另外在单线程下对比编译成操作码的 LogFormatter 和原来逐项虚调用、
+// 写 std::stringstream 的格式化器(LegacyFormatter), 输出在 "formatter" 中.
+//
+// 用法: bench_log [-t 1,2,4] [-n 每组事件数] [-r 每线程速率] [-a null,file]
+//                 [-p stream,fmt] [-l enabled,disabled] > result.json
+// 测试期间标准输出重定向到 /dev/null, stdout 输出的开销即写 /dev/null 的开销
+
+static uint64_t NowNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief 格式化后丢弃, 只计格式化的开销
+ *
+ */
+class NullAppender : public sylar::LogAppender {
+ public:
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    char buf[1024];
+    m_formatter->format(buf, sizeof(buf), logger, level, event);
+  }
+  std::string toYamlString() override { return ""; }
+};
+
+/**
+ * @brief 对数分桶的延迟直方图, 相对误差约 1/16
+ *
+ */
+class Histogram {
+ public:
+  static const int kSubBits = 4;
+  static const int kSub = 1 << kSubBits;
+
+  Histogram() : m_counts(64 * kSub, 0) {}
+
+  void add(uint64_t v) {
+    ++m_counts[index(v)];
+    ++m_total;
+    m_max = std::max(m_max, v);
+  }
+
+  void merge(const Histogram& oth) {
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+      m_counts[i] += oth.m_counts[i];
+    }
+    m_total += oth.m_total;
+    m_max = std::max(m_max, oth.m_max);
+  }
+
+  uint64_t percentile(double p) const {
+    uint64_t rank = (uint64_t)(p / 100.0 * m_total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+      seen += m_counts[i];
+      if (seen > rank) {
+        return std::min(value(i), m_max);
+      }
+    }
+    return m_max;
+  }
+
+  uint64_t getMax() const { return m_max; }
+
+ private:
+  static size_t index(uint64_t v) {
+    if (v < (uint64_t)kSub) {
+      return v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    return (msb - kSubBits + 1) * kSub + ((v >> (msb - kSubBits)) & (kSub - 1));
+  }
+
+  /// 桶的上界
+  static uint64_t value(size_t i) {
+    if (i < (size_t)kSub) {
+      return i;
+    }
+    int msb = i / kSub + kSubBits - 1;
+    uint64_t sub = i % kSub;
+    return ((kSub + sub + 1) << (msb - kSubBits)) - 1;
+  }
+
+ private:
+  std::vector<uint64_t> m_counts;
+  uint64_t m_total = 0;
+  uint64_t m_max = 0;
+};
+
+/**
+ * @brief 原来的格式化器: 每个模板项一个对象, 逐项虚调用写入 std::ostream
+ *
+ * @details 与编译成操作码之前的 LogFormatter 相同: 解析出 FormatItem 列表,
+ *          每次格式化新建 std::stringstream, 按值传递 shared_ptr, %n 写 std::endl
+ */
+class LegacyFormatter {
+ public:
+  class FormatItem {
+   public:
+    typedef std::shared_ptr<FormatItem> ptr;
+    virtual ~FormatItem() {}
+    virtual void format(std::ostream& os, sylar::Logger::ptr logger,
+                        sylar::LogLevel::Level level,
+                        sylar::LogEvent::ptr event) = 0;
+  };
+
+  explicit LegacyFormatter(const std::string& pattern) { init(pattern); }
+
+  std::string format(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+                     sylar::LogEvent::ptr event) {
+    std::stringstream ss;
+    for (auto& i : m_items) {
+      i->format(ss, logger, level, event);
+    }
+    return ss.str();
+  }
+
+ private:
+  void init(const std::string& pattern);
+
+ private:
+  std::vector<FormatItem::ptr> m_items;
+};
+
+#define XX(name, expr)                                                   \
+  class name : public LegacyFormatter::FormatItem {                     \
+   public:                                                              \
+    explicit name(const std::string& fmt) : m_fmt(fmt) {}               \
+    void format(std::ostream& os, sylar::Logger::ptr logger,            \
+                sylar::LogLevel::Level level,                           \
+                sylar::LogEvent::ptr event) override {                  \
+      expr;                                                             \
+    }                                                                   \
+                                                                        \
+   private:                                                             \
+    std::string m_fmt;                                                  \
+  };
+
+XX(LegacyMessage, os << event->getContent())
+XX(LegacyLevel, os << sylar::LogLevel::ToString(level))
+XX(LegacyElapse, os << event->getElapse())
+XX(LegacyName, os << event->getLogger()->getName())
+XX(LegacyThreadId, os << event->getThread())
+XX(LegacyNewLine, os << std::endl)
+XX(LegacyFile, os << event->getFile())
+XX(LegacyLine, os << event->getLine())
+XX(LegacyTab, os << "\t")
+XX(LegacyFiberId, os << event->getFiberId())
+XX(LegacyThreadName, os << event->getThreadName())
+XX(LegacyString, os << m_fmt)
+XX(LegacyDateTime, {
+  struct tm tm;
+  time_t time = event->getTime();
+  localtime_r(&time, &tm);
+  char buf[64];
+  strftime(buf, sizeof(buf),
+           m_fmt.empty() ? "%Y-%m-%d %H:%M:%S" : m_fmt.c_str(), &tm);
+  os << buf;
+})
+#undef XX
+
+// %x 和 %x{fmt}, 与原来的解析结果相同(不处理错误的模板)
+void LegacyFormatter::init(const std::string& pattern) {
+  std::string str;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    if (pattern[i] != '%' || i + 1 == pattern.size()) {
+      str.append(1, pattern[i]);
+      continue;
+    }
+    char c = pattern[++i];
+    if (c == '%') {
+      str.append(1, '%');
+      continue;
+    }
+    std::string fmt;
+    if (i + 1 < pattern.size() && pattern[i + 1] == '{') {
+      size_t end = pattern.find('}', i + 2);
+      fmt = pattern.substr(i + 2, end - i - 2);
+      i = end;
+    }
+    if (!str.empty()) {
+      m_items.push_back(FormatItem::ptr(new LegacyString(str)));
+      str.clear();
+    }
+    FormatItem* item = nullptr;
+    switch (c) {
+      case 'm': item = new LegacyMessage(fmt); break;
+      case 'p': item = new LegacyLevel(fmt); break;
+      case 'r': item = new LegacyElapse(fmt); break;
+      case 'c': item = new LegacyName(fmt); break;
+      case 't': item = new LegacyThreadId(fmt); break;
+      case 'n': item = new LegacyNewLine(fmt); break;
+      case 'd': item = new LegacyDateTime(fmt); break;
+      case 'f': item = new LegacyFile(fmt); break;
+      case 'l': item = new LegacyLine(fmt); break;
+      case 'T': item = new LegacyTab(fmt); break;
+      case 'F': item = new LegacyFiberId(fmt); break;
+      case 'N': item = new LegacyThreadName(fmt); break;
+      default:
+        item = new LegacyString(std::string("<<error_format %") + c + ">>");
+    }
+    m_items.push_back(FormatItem::ptr(item));
+  }
+  if (!str.empty()) {
+    m_items.push_back(FormatItem::ptr(new LegacyString(str)));
+  }
+}
+
+/**
+ * @brief 单线程反复格式化同一个事件, 返回每条的纳秒数
+ *
+ * @param impl items: 原来的格式化器; string: LogFormatter 返回 std::string;
+ *             buffer: LogFormatter 写入调用方的缓冲
+ */
+static double RunFormatter(const std::string& impl, uint64_t count) {
+  static const char* kPattern =
+      "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+  sylar::Logger::ptr logger(new sylar::Logger("bench"));
+  sylar::LogEvent::ptr event = sylar::LogEvent::Create(
+      logger,
+      *SYLAR_LOG_CALLSITE(logger, sylar::LogLevel::INFO, nullptr),
+      sylar::LogLevel::INFO, sylar::GetThreadId(), 0, sylar::LogClock::Now());
+  event->getSS() << "bench event " << 12345 << " value " << 42 << " name "
+                 << "sylar";
+  sylar::LogFormatter formatter(kPattern);
+  LegacyFormatter legacy(kPattern);
+  // 两种实现的输出必须一致, 否则比较没有意义
+  if (legacy.format(logger, sylar::LogLevel::INFO, event) !=
+      formatter.format(logger, sylar::LogLevel::INFO, event)) {
+    std::cerr << "formatter output differs" << std::endl;
+    exit(1);
+  }
+
+  size_t total = 0;
+  char buf[1024];
+  uint64_t start = NowNS();
+  for (uint64_t i = 0; i < count; ++i) {
+    if (impl == "items") {
+      total += legacy.format(logger, sylar::LogLevel::INFO, event).size();
+    } else if (impl == "string") {
+      total += formatter.format(logger, sylar::LogLevel::INFO, event).size();
+    } else {
+      total += formatter.format(buf, sizeof(buf), logger,
+                                sylar::LogLevel::INFO, event);
+    }
+  }
+  uint64_t used = NowNS() - start;
+  // 防止循环被优化掉
+  if (total == 0) {
+    std::cerr << "empty output" << std::endl;
+  }
+  return (double)used / count;
+}
+
+struct Case {
+  std::string appender;
+  std::string api;
+  std::string level;
+  int threads;
+};
+
+struct Result {
+  double events_per_sec = 0;
+  double rate_per_thread = 0;
+  Histogram latency;
+};
+
+static std::vector<std::string> Split(const std::string& str) {
+  std::vector<std::string> rt;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      rt.push_back(item);
+    }
+  }
+  return rt;
+}
+
+static sylar::Logger::ptr CreateLogger(const Case& c,
+                                       const std::string& file) {
+  sylar::Logger::ptr logger(new sylar::Logger("bench"));
+  sylar::LogAppender::ptr appender;
+  if (c.appender == "file") {
+    appender.reset(new sylar::FileLogAppender(file));
+  } else if (c.appender == "stdout") {
+    appender.reset(new sylar::StdoutLogAppender);
+  } else {
+    appender.reset(new NullAppender);
+  }
+  logger->addAppender(appender);
+  logger->setLevel(c.level == "enabled" ? sylar::LogLevel::DEBUG
+                                        : sylar::LogLevel::ERROR);
+  return logger;
+}
+
+static void Flush(const sylar::Logger::ptr& logger) {
+  for (auto& i : *logger->getAppenders()) {
+    i->flush();
+  }
+}
+
+static inline void LogOne(const sylar::Logger::ptr& logger, bool fmt,
+                          uint64_t i) {
+  if (fmt) {
+    SYLAR_LOG_FMT_INFO(logger, "bench event %lu value %d name %s",
+                       (unsigned long)i, 42, "sylar");
+  } else {
+    SYLAR_LOG_INFO(logger) << "bench event " << i << " value " << 42
+                           << " name " << "sylar";
+  }
+}
+
+/**
+ * @brief 所有线程就绪后同时开始
+ *
+ */
+class StartGate {
+ public:
+  explicit StartGate(int n) : m_waiting(n) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (--m_waiting == 0) {
+      m_cond.notify_all();
+    } else {
+      m_cond.wait(lock, [this]() { return m_waiting == 0; });
+    }
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  int m_waiting;
+};
+
+/**
+ * @brief 闭环: 每个线程尽快写 count 条, 返回总吞吐
+ *
+ */
+static double RunThroughput(const Case& c, uint64_t count,
+                            const std::string& file) {
+  sylar::Logger::ptr logger = CreateLogger(c, file);
+  bool fmt = c.api == "fmt";
+  StartGate gate(c.threads + 1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < c.threads; ++t) {
+    threads.emplace_back([&]() {
+      gate.wait();
+      for (uint64_t i = 0; i < count; ++i) {
+        LogOne(logger, fmt, i);
+      }
+    });
+  }
+  gate.wait();
+  uint64_t start = NowNS();
+  for (auto& i : threads) {
+    i.join();
+  }
+  Flush(logger);
+  uint64_t used = NowNS() - start;
+  return (double)count * c.threads * 1e9 / std::max<uint64_t>(used, 1);
+}
+
+/**
+ * @brief 开环: 每个线程按固定速率写 count 条, 延迟从计划时间算起
+ *
+ */
+static void RunLatency(const Case& c, uint64_t count, double rate,
+                       const std::string& file, Histogram& hist) {
+  sylar::Logger::ptr logger = CreateLogger(c, file);
+  bool fmt = c.api == "fmt";
+  uint64_t interval = (uint64_t)(1e9 / rate);
+  StartGate gate(c.threads);
+  std::mutex mutex;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < c.threads; ++t) {
+    threads.emplace_back([&]() {
+      Histogram local;
+      gate.wait();
+      uint64_t start = NowNS();
+      for (uint64_t i = 0; i < count; ++i) {
+        uint64_t intended = start + i * interval;
+        uint64_t now = NowNS();
+        while (now < intended) {
+          if (intended - now > 100000) {
+            usleep((intended - now) / 2000);
+          }
+          now = NowNS();
+        }
+        LogOne(logger, fmt, i);
+        local.add(NowNS() - intended);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      hist.merge(local);
+    });
+  }
+  for (auto& i : threads) {
+    i.join();
+  }
+  Flush(logger);
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> appenders = {"null", "file", "stdout"};
+  std::vector<std::string> apis = {"stream", "fmt"};
+  std::vector<std::string> levels = {"enabled", "disabled"};
+  std::vector<int> thread_counts = {1, 2, 4, 8, 16, 32, 64};
+  uint64_t events = 200000;
+  double rate = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:r:a:p:l:")) != -1) {
+    switch (opt) {
+      case 't':
+        thread_counts.clear();
+        for (auto& i : Split(optarg)) {
+          thread_counts.push_back(std::max(1, atoi(i.c_str())));
+        }
+        break;
+      case 'n':
+        events = std::max(1000ll, atoll(optarg));
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'a':
+        appenders = Split(optarg);
+        break;
+      case 'p':
+        apis = Split(optarg);
+        break;
+      case 'l':
+        levels = Split(optarg);
+        break;
+      default:
+        std::cerr << "usage: " << argv[0]
+                  << " [-t threads] [-n events] [-r rate_per_thread]"
+                     " [-a null,file,stdout] [-p stream,fmt]"
+                     " [-l enabled,disabled]"
+                  << std::endl;
+        return 1;
+    }
+  }
+
+  // JSON 写到原来的标准输出, stdout 输出的日志写到 /dev/null
+  fflush(stdout);
+  int out_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+  FILE* out = fdopen(out_fd, "w");
+
+  char file[64];
+  snprintf(file, sizeof(file), "/tmp/bench_log_%d.log", (int)getpid());
+
+  fprintf(out, "{\n  \"benchmark\": \"bench_log\",\n");
+  fprintf(out, "  \"events_per_case\": %lu,\n", (unsigned long)events);
+  fprintf(out, "  \"results\": [");
+  bool first = true;
+  for (auto& appender : appenders) {
+    for (auto& api : apis) {
+      for (auto& level : levels) {
+        for (int threads : thread_counts) {
+          Case c = {appender, api, level, threads};
+          uint64_t count = std::max<uint64_t>(events / threads, 100);
+          Result result;
+          unlink(file);
+          result.events_per_sec = RunThroughput(c, count, file);
+          // 未指定速率时按吞吐的一半压测延迟, 每线程最多每微秒一条,
+          // 否则关闭的级别下计时本身的开销就超过了间隔
+          result.rate_per_thread =
+              rate > 0 ? rate
+                       : std::min(result.events_per_sec / threads / 2, 1e6);
+          unlink(file);
+          RunLatency(c, count, result.rate_per_thread, file, result.latency);
+          unlink(file);
+
+          fprintf(out,
+                  "%s\n    {\"appender\": \"%s\", \"api\": \"%s\", "
+                  "\"level\": \"%s\", \"threads\": %d, "
+                  "\"events_per_sec\": %.0f, \"rate_per_thread\": %.0f, "
+                  "\"latency_ns\": {\"p50\": %lu, \"p99\": %lu, "
+                  "\"p99.9\": %lu, \"max\": %lu}}",
+                  first ? "" : ",", appender.c_str(), api.c_str(),
+                  level.c_str(), threads, result.events_per_sec,
+                  result.rate_per_thread,
+                  (unsigned long)result.latency.percentile(50),
+                  (unsigned long)result.latency.percentile(99),
+                  (unsigned long)result.latency.percentile(99.9),
+                  (unsigned long)result.latency.getMax());
+          fflush(out);
+          first = false;
+        }
+      }
+    }
+  }
+  fprintf(out, "\n  ],\n  \"formatter\": [");
+  first = true;
+  for (const char* impl : {"items", "string", "buffer"}) {
+    fprintf(out, "%s\n    {\"impl\": \"%s\", \"ns_per_event\": %.1f}",
+            first ? "" : ",", impl, RunFormatter(impl, events * 5));
+    first = false;
+  }
+  fprintf(out, "\n  ]\n}\n");
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,232 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/config.h"
+#include "sylar/log.h"
+
+// 日志配置重新加载基准: 配置有上百个日志器, 每次修改一部分后重新加载,
+// 测重新加载的耗时, 以及期间写日志线程单次调用的最大延迟.
+// 结果以 JSON 输出到标准输出.
+//
+// 用法: bench_log_reload [-n 日志器数] [-r 每组重新加载次数] [-t 写日志线程数]
+//                        > result.json
+
+static uint64_t NowNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief 一组配置参数, 每组测试修改其中一项
+ *
+ */
+struct Options {
+  int loggers = 300;
+  std::string dir;
+  /// 第0个日志器的级别
+  std::string first_level = "DEBUG";
+  /// 所有文件Appender的级别
+  std::string appender_level = "DEBUG";
+  /// 所有日志器的格式
+  std::string formatter = "%d %p %c %m%n";
+  /// 第0个日志器写的文件
+  std::string first_file = "0.log";
+};
+
+static std::string BuildConfig(const Options& o) {
+  std::stringstream ss;
+  ss << "logs:\n";
+  for (int i = 0; i < o.loggers; ++i) {
+    ss << "  - name: reload." << i << "\n"
+       << "    level: " << (i == 0 ? o.first_level : "DEBUG") << "\n"
+       << "    formatter: \"" << o.formatter << "\"\n"
+       << "    appenders:\n"
+       << "      - type: FileLogAppender\n"
+       << "        file: " << o.dir << "/"
+       << (i == 0 ? o.first_file : std::to_string(i % 16) + ".log") << "\n"
+       << "        level: " << o.appender_level << "\n"
+       << "      - type: StdoutLogAppender\n"
+       << "        level: ERROR\n";
+  }
+  return ss.str();
+}
+
+struct Result {
+  std::string name;
+  std::vector<uint64_t> reload_ns;
+  uint64_t producer_max_ns = 0;
+  uint64_t events = 0;
+};
+
+/**
+ * @brief 写日志线程: 轮流写各个日志器, 记录单次调用的最大延迟
+ *
+ */
+class Producers {
+ public:
+  Producers(int threads, int loggers) {
+    for (int i = 0; i < loggers; ++i) {
+      m_loggers.push_back(sylar::LoggerMgr::GetInstance()->getLogger(
+          "reload." + std::to_string(i)));
+    }
+    for (int t = 0; t < threads; ++t) {
+      m_threads.emplace_back([this, t]() { run(t); });
+    }
+  }
+
+  ~Producers() {
+    m_stop = true;
+    for (auto& i : m_threads) {
+      i.join();
+    }
+  }
+
+  /// 返回并清零统计
+  void take(uint64_t& max_ns, uint64_t& events) {
+    max_ns = m_max.exchange(0);
+    events = m_events.exchange(0);
+  }
+
+ private:
+  void run(int t) {
+    size_t idx = t;
+    while (!m_stop) {
+      uint64_t max = 0;
+      for (int i = 0; i < 100; ++i) {
+        idx = (idx + 7) % m_loggers.size();
+        uint64_t start = NowNS();
+        SYLAR_LOG_INFO(m_loggers[idx]) << "reload bench " << idx;
+        max = std::max(max, NowNS() - start);
+      }
+      uint64_t cur = m_max.load();
+      while (max > cur && !m_max.compare_exchange_weak(cur, max)) {
+      }
+      m_events += 100;
+    }
+  }
+
+ private:
+  std::vector<sylar::Logger::ptr> m_loggers;
+  std::vector<std::thread> m_threads;
+  std::atomic<bool> m_stop{false};
+  std::atomic<uint64_t> m_max{0};
+  std::atomic<uint64_t> m_events{0};
+};
+
+static uint64_t Reload(const Options& o) {
+  YAML::Node root = YAML::Load(BuildConfig(o));
+  uint64_t start = NowNS();
+  sylar::Config::LoadFromYaml(root);
+  return NowNS() - start;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  int rounds = 20;
+  int threads = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:t:")) != -1) {
+    switch (opt) {
+      case 'n':
+        options.loggers = std::max(1, atoi(optarg));
+        break;
+      case 'r':
+        rounds = std::max(1, atoi(optarg));
+        break;
+      case 't':
+        threads = std::max(0, atoi(optarg));
+        break;
+      default:
+        std::cerr << "usage: " << argv[0]
+                  << " [-n loggers] [-r rounds] [-t threads]" << std::endl;
+        return 1;
+    }
+  }
+
+  // JSON 写到原来的标准输出, StdoutLogAppender 写到 /dev/null
+  fflush(stdout);
+  int out_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+  FILE* out = fdopen(out_fd, "w");
+
+  char dir[64];
+  snprintf(dir, sizeof(dir), "/tmp/bench_log_reload_%d", (int)getpid());
+  options.dir = dir;
+
+  std::vector<Result> results;
+  Result initial;
+  initial.name = "initial";
+  initial.reload_ns.push_back(Reload(options));
+  results.push_back(initial);
+
+  Producers producers(threads, options.loggers);
+  // 每组在两个配置之间来回切换
+  struct Case {
+    const char* name;
+    std::string Options::*field;
+    std::string a;
+    std::string b;
+  };
+  std::vector<Case> cases = {
+      {"unchanged", &Options::first_level, "DEBUG", "DEBUG"},
+      {"one_logger_level", &Options::first_level, "DEBUG", "WARN"},
+      {"all_appender_levels", &Options::appender_level, "DEBUG", "INFO"},
+      {"all_formatters", &Options::formatter, "%d %p %c %m%n",
+       "%d [%p] %c %m%n"},
+      {"one_file", &Options::first_file, "0.log", "other.log"},
+  };
+  for (auto& c : cases) {
+    Result result;
+    result.name = c.name;
+    uint64_t max_ns = 0;
+    uint64_t events = 0;
+    producers.take(max_ns, events);
+    for (int i = 0; i < rounds; ++i) {
+      Options o = options;
+      o.*c.field = i % 2 ? c.a : c.b;
+      result.reload_ns.push_back(Reload(o));
+    }
+    producers.take(result.producer_max_ns, result.events);
+    results.push_back(result);
+    Reload(options);
+  }
+
+  fprintf(out, "{\n  \"benchmark\": \"bench_log_reload\",\n");
+  fprintf(out, "  \"loggers\": %d,\n  \"threads\": %d,\n", options.loggers,
+          threads);
+  fprintf(out, "  \"results\": [");
+  for (size_t i = 0; i < results.size(); ++i) {
+    Result& r = results[i];
+    std::sort(r.reload_ns.begin(), r.reload_ns.end());
+    fprintf(out,
+            "%s\n    {\"case\": \"%s\", \"reloads\": %d, "
+            "\"reload_us\": {\"p50\": %.1f, \"max\": %.1f}, "
+            "\"producer_events\": %lu, \"producer_max_us\": %.1f}",
+            i ? "," : "", r.name.c_str(), (int)r.reload_ns.size(),
+            r.reload_ns[r.reload_ns.size() / 2] / 1e3,
+            r.reload_ns.back() / 1e3, (unsigned long)r.events,
+            r.producer_max_ns / 1e3);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  fclose(out);
+
+  std::string cmd = std::string("rm -rf ") + dir;
+  if (system(cmd.c_str()) != 0) {
+    return 1;
+  }
+  return 0;
+}
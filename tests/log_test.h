@@ -0,0 +1,69 @@
+/**
+ * @file log_test.h
+ * @brief 日志测试共用的 Appender 和结果输出
+ *
+ */
+
+#ifndef __SYLAR_TESTS_LOG_TEST_H__
+#define __SYLAR_TESTS_LOG_TEST_H__
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+
+/**
+ * @brief 保存收到的事件和按Appender格式器格式化后的行, 供测试取出检查
+ *
+ */
+class CaptureAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CaptureAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    MutexType::Lock lock(m_mutex);
+    m_lines.push_back(m_formatter->format(logger, level, event));
+    m_events.push_back(event);
+  }
+  std::string toYamlString() override { return ""; }
+
+  /// 取出格式化后的行并清空, 返回行数
+  size_t take(std::vector<std::string>& lines) {
+    MutexType::Lock lock(m_mutex);
+    lines.swap(m_lines);
+    m_lines.clear();
+    m_events.clear();
+    return lines.size();
+  }
+
+  /// 取出事件并清空, 返回事件数
+  size_t take(std::vector<sylar::LogEvent::ptr>& events) {
+    MutexType::Lock lock(m_mutex);
+    events.swap(m_events);
+    m_events.clear();
+    m_lines.clear();
+    return events.size();
+  }
+
+  /// 清空, 返回清空前的事件数
+  size_t take() {
+    std::vector<sylar::LogEvent::ptr> events;
+    return take(events);
+  }
+
+ private:
+  std::vector<std::string> m_lines;
+  std::vector<sylar::LogEvent::ptr> m_events;
+};
+
+/**
+ * @brief 输出测试结果 "ok"/"FAILED", 返回 main 的退出码
+ *
+ */
+inline int TestResult(bool ok) {
+  std::cout << (ok ? "ok" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static const long kCount = 20000;
+
+/**
+ * @brief 日志文件是一个FIFO, 不读时后台线程写盘阻塞, 模拟磁盘跟不上
+ *
+ */
+class SlowFile {
+ public:
+  explicit SlowFile(const std::string& path) : m_path(path) {
+    unlink(m_path.c_str());
+    mkfifo(m_path.c_str(), 0644);
+    // 先以非阻塞方式打开读端, Sink 打开写端时不会阻塞
+    m_fd = open(m_path.c_str(), O_RDONLY | O_NONBLOCK);
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+  }
+
+  ~SlowFile() {
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    close(m_fd);
+    unlink(m_path.c_str());
+  }
+
+  /// 开始读取, 直到写端全部关闭
+  void start() {
+    m_thread = std::thread([this]() {
+      char buf[4096];
+      ssize_t n;
+      while ((n = read(m_fd, buf, sizeof(buf))) > 0) {
+        m_data.append(buf, n);
+      }
+    });
+  }
+
+  const std::string& wait() {
+    m_thread.join();
+    return m_data;
+  }
+
+ private:
+  std::string m_path;
+  int m_fd;
+  std::thread m_thread;
+  std::string m_data;
+};
+
+/**
+ * @brief 解析 "n<序号>" 的日志, 序号必须递增
+ *
+ */
+static bool parse(const std::string& data, std::vector<long>& seqs) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    size_t end = data.find('\n', pos);
+    if (end == std::string::npos) {
+      std::cout << "incomplete line" << std::endl;
+      return false;
+    }
+    long n = -1;
+    if (sscanf(data.c_str() + pos, "n%ld", &n) != 1 ||
+        (!seqs.empty() && n <= seqs.back())) {
+      std::cout << "bad line: " << data.substr(pos, end - pos) << std::endl;
+      return false;
+    }
+    seqs.push_back(n);
+    pos = end + 1;
+  }
+  return true;
+}
+
+static bool run(sylar::LogAsyncWriter::OverflowPolicy policy) {
+  const char* name = sylar::LogAsyncWriter::PolicyToString(policy);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_async_%d.fifo", (int)getpid());
+  SlowFile file(path);
+
+  sylar::Logger::ptr logger(new sylar::Logger("async"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(path));
+  appender->setAsync(true, 10, 4096, 4, policy);
+  logger->addAppender(appender);
+
+  std::atomic<bool> done(false);
+  std::thread producer([logger, &done]() {
+    for (long n = 0; n < kCount; ++n) {
+      SYLAR_LOG_INFO(logger) << "n" << n << " " << std::string(32, 'x');
+    }
+    done = true;
+  });
+  // 不读FIFO时缓冲很快到达上限, BLOCK 策略下写日志的线程应被阻塞
+  usleep(200 * 1000);
+  bool blocked = !done;
+  file.start();
+  producer.join();
+  uint64_t dropped = appender->getDropped();
+  logger->clearAppenders();
+  appender.reset();
+
+  std::vector<long> seqs;
+  if (!parse(file.wait(), seqs) || seqs.empty()) {
+    std::cout << name << ": bad output" << std::endl;
+    return false;
+  }
+  bool ok = seqs.size() + dropped == (size_t)kCount;
+  if (policy == sylar::LogAsyncWriter::BLOCK) {
+    ok = ok && blocked && dropped == 0;
+  } else if (policy == sylar::LogAsyncWriter::DROP_NEWEST) {
+    // 保留最早的日志
+    ok = ok && dropped > 0 && seqs.front() == 0;
+  } else {
+    // 保留最新的日志
+    ok = ok && dropped > 0 && seqs.back() == kCount - 1;
+  }
+  if (!ok) {
+    std::cout << name << ": written=" << seqs.size() << " dropped=" << dropped
+              << " blocked=" << blocked << " first=" << seqs.front()
+              << " last=" << seqs.back() << std::endl;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  bool ok = run(sylar::LogAsyncWriter::BLOCK);
+  ok = run(sylar::LogAsyncWriter::DROP_NEWEST) && ok;
+  ok = run(sylar::LogAsyncWriter::DROP_OLDEST) && ok;
+  return TestResult(ok);
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static const char* s_pattern = "%p [%c] %f:%l %m%n";
+
+int main(int argc, char** argv) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_binary_%d.bin", (int)getpid());
+  unlink(path);
+
+  sylar::Logger::ptr logger(new sylar::Logger("binary"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter(s_pattern)));
+  CaptureAppender::ptr capture(new CaptureAppender);
+  logger->addAppender(capture);
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::BinaryFileLogAppender(path)));
+
+  std::vector<std::string> expected;
+#define CHECK_FMT(line, fmt, ...)                                     \
+  do {                                                                \
+    SYLAR_LOG_FMT_INFO(logger, fmt, __VA_ARGS__);                     \
+    char buf[256];                                                    \
+    snprintf(buf, sizeof(buf), "INFO [binary] %s:%d " fmt "\n",       \
+             __FILE__, line, __VA_ARGS__);                            \
+    expected.push_back(buf);                                          \
+  } while (0)
+
+  CHECK_FMT(__LINE__, "int=%d neg=%d u=%u ll=%lld", 42, -7, 3000000000u,
+            -1234567890123LL);
+  CHECK_FMT(__LINE__, "%5.2f|%-8s|%x|%c|%%|%*d|%.3s", 3.14159, "left", 255,
+            'z', 6, 42, "truncate");
+  CHECK_FMT(__LINE__, "%s %e %lu", "", 1e-300, (unsigned long)-1);
+  int stream_line = __LINE__ + 1;
+  SYLAR_LOG_ERROR(logger) << "stream " << 5;
+  expected.push_back(std::string("ERROR [binary] ") + __FILE__ + ":" +
+                     std::to_string(stream_line) + " stream 5\n");
+  // std::string 参数编码为字符串; 格式串不是常量时在调用线程格式化
+  std::string name = "bob";
+  int string_line = __LINE__ + 1;
+  SYLAR_LOG_FMT_INFO(logger, "name=%s", name);
+  expected.push_back(std::string("INFO [binary] ") + __FILE__ + ":" +
+                     std::to_string(string_line) + " name=bob\n");
+  const char* dynamic = "dynamic=%d";
+  int dynamic_line = __LINE__ + 1;
+  SYLAR_LOG_FMT_INFO(logger, dynamic, 9);
+  expected.push_back(std::string("INFO [binary] ") + __FILE__ + ":" +
+                     std::to_string(dynamic_line) + " dynamic=9\n");
+
+  // 多线程写满线程缓冲, 检查记录数和线程内顺序
+  const int kThreads = 4;
+  const int kCount = 50000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([logger, i]() {
+      for (int n = 0; n < kCount; ++n) {
+        SYLAR_LOG_FMT_DEBUG(logger, "thread %d seq %d", i, n);
+      }
+    });
+  }
+  for (auto& i : threads) {
+    i.join();
+  }
+  sylar::LogBinary::Flush();
+
+  bool ok = true;
+  std::vector<std::string> captured;
+  capture->take(captured);
+  sylar::LogFormatter::ptr formatter(new sylar::LogFormatter(s_pattern));
+  sylar::LogBinaryReader reader;
+  if (!reader.open(path)) {
+    std::cout << "open " << path << " failed" << std::endl;
+    return TestResult(false);
+  }
+  sylar::Logger::ptr l;
+  sylar::LogLevel::Level level;
+  sylar::LogEvent::ptr event;
+  std::vector<std::string> decoded;
+  std::map<int, int> seqs;
+  int records = 0;
+  while (reader.next(l, level, event)) {
+    std::string line = formatter->format(l, level, event);
+    if (decoded.size() < expected.size()) {
+      decoded.push_back(line);
+      continue;
+    }
+    int t = -1;
+    int n = -1;
+    bool parsed =
+        sscanf(event->getContent().c_str(), "thread %d seq %d", &t, &n) == 2;
+    if (!parsed || n != (seqs.count(t) ? seqs[t] + 1 : 0)) {
+      std::cout << "out of order: " << line;
+      ok = false;
+      break;
+    }
+    seqs[t] = n;
+    ++records;
+  }
+  if (reader.isError()) {
+    std::cout << "corrupted file" << std::endl;
+    ok = false;
+  }
+  if (records != kThreads * kCount) {
+    std::cout << "records=" << records << " expected "
+              << kThreads * kCount << std::endl;
+    ok = false;
+  }
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const std::string& d = i < decoded.size() ? decoded[i] : "";
+    const std::string& c = i < captured.size() ? captured[i] : "";
+    if (d != expected[i] || c != expected[i]) {
+      std::cout << "expected: " << expected[i] << "decoded:  " << d
+                << "captured: " << c;
+      ok = false;
+    }
+  }
+  if (captured.size() != expected.size() + kThreads * kCount) {
+    std::cout << "captured " << captured.size() << " lines"
+              << std::endl;
+    ok = false;
+  }
+  unlink(path);
+
+  // 不再使用二进制Appender的日志器会被注销, 不被后台线程一直持有
+  std::weak_ptr<sylar::Logger> weak = logger;
+  logger->clearAppenders();
+  logger.reset();
+  l.reset();
+  event.reset();
+  for (int i = 0; i < 1000 && !weak.expired(); ++i) {
+    usleep(1000);
+  }
+  if (!weak.expired()) {
+    std::cout << "logger still referenced" << std::endl;
+    ok = false;
+  }
+  return TestResult(ok);
+}
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static int s_emit_line = 0;
+
+static void emit(const sylar::Logger::ptr& logger, int i) {
+  s_emit_line = __LINE__ + 1;
+  SYLAR_LOG_WARN(logger) << "emit " << i;
+}
+
+// 级别在运行时确定, 同一个调用点每次的级别不同
+static void dynamic(const sylar::Logger::ptr& logger,
+                    sylar::LogLevel::Level level) {
+  SYLAR_LOG_LEVEL(logger, level) << sylar::LogLevel::ToString(level);
+}
+
+static const int kLateLine = __LINE__ + 2;
+static void late(const sylar::Logger::ptr& logger) {
+  SYLAR_LOG_FMT_INFO(logger, "late %d", 1);
+}
+
+// 调用点注册表: 事件引用调用点, 可以枚举调用点并在运行时单独关闭
+int main(int argc, char** argv) {
+  sylar::Logger::ptr logger(new sylar::Logger("callsite"));
+  CaptureAppender::ptr appender(new CaptureAppender);
+  logger->addAppender(appender);
+  bool ok = true;
+  std::vector<sylar::LogEvent::ptr> events;
+
+  emit(logger, 0);
+  if (appender->take(events) != 1) {
+    std::cout << "emit failed" << std::endl;
+    return TestResult(false);
+  }
+  const sylar::LogCallSite& site = events[0]->getCallSite();
+  if (strcmp(site.getBasename(), "test_log_callsite.cc") != 0 ||
+      strcmp(site.getFunction(), "emit") != 0 ||
+      strcmp(site.getLoggerName(), "logger") != 0 ||
+      site.getLine() != s_emit_line || events[0]->getLine() != s_emit_line ||
+      events[0]->getLevel() != sylar::LogLevel::WARN ||
+      site.getFormat() != nullptr) {
+    std::cout << "site info failed: " << site.getBasename() << " "
+              << site.getFunction() << " " << site.getLoggerName() << " "
+              << site.getLine() << std::endl;
+    ok = false;
+  }
+
+  std::vector<sylar::LogCallSite*> sites;
+  sylar::LogCallSite::List(sites);
+  bool found = false;
+  for (auto i : sites) {
+    found = found || i == &site;
+  }
+  if (!found || sylar::LogCallSite::Get(site.getId()) != &site) {
+    std::cout << "registry failed" << std::endl;
+    ok = false;
+  }
+
+  // 按文件名和行号关闭, 再打开
+  if (sylar::LogCallSite::SetEnabled("test_log_callsite.cc", s_emit_line,
+                                     false) != 1) {
+    std::cout << "disable matched wrong count" << std::endl;
+    ok = false;
+  }
+  emit(logger, 1);
+  if (appender->take(events) != 0) {
+    std::cout << "disabled site still logs" << std::endl;
+    ok = false;
+  }
+  sylar::LogCallSite::SetEnabled("tests/test_log_callsite.cc", 0, true);
+  emit(logger, 2);
+  if (appender->take(events) != 1) {
+    std::cout << "enable failed" << std::endl;
+    ok = false;
+  }
+  // 只匹配到目录分隔处
+  if (sylar::LogCallSite::SetEnabled("log_callsite.cc", 0, false) != 0) {
+    std::cout << "partial basename matched" << std::endl;
+    ok = false;
+  }
+
+  // 关闭规则对之后才注册的调用点同样有效
+  sylar::LogCallSite::SetEnabled("test_log_callsite.cc", kLateLine, false);
+  late(logger);
+  if (appender->take(events) != 0) {
+    std::cout << "late site not disabled" << std::endl;
+    ok = false;
+  }
+  sylar::LogCallSite::SetEnabled("test_log_callsite.cc", kLateLine, true);
+  late(logger);
+  if (appender->take(events) != 1 || events[0]->getContent() != "late 1") {
+    std::cout << "late site failed" << std::endl;
+    ok = false;
+  }
+
+  // 事件的级别取自这次调用, 不是调用点第一次记录的级别
+  dynamic(logger, sylar::LogLevel::DEBUG);
+  dynamic(logger, sylar::LogLevel::ERROR);
+  if (appender->take(events) != 2 ||
+      events[0]->getLevel() != sylar::LogLevel::DEBUG ||
+      events[1]->getLevel() != sylar::LogLevel::ERROR ||
+      &events[0]->getCallSite() != &events[1]->getCallSite()) {
+    std::cout << "dynamic level failed" << std::endl;
+    ok = false;
+  }
+
+  // 没有静态调用点的日志使用单独的定长表, 不进入注册表
+  const char* file = "interned.cc";
+  sylar::LogCallSite::List(sites);
+  size_t registered = sites.size();
+  const sylar::LogCallSite* interned =
+      sylar::LogCallSite::Intern(sylar::LogLevel::INFO, file, 7);
+  sylar::LogCallSite::List(sites);
+  if (interned != sylar::LogCallSite::Intern(sylar::LogLevel::INFO, file, 7) ||
+      interned == sylar::LogCallSite::Intern(sylar::LogLevel::WARN, file, 7) ||
+      interned->getId() != 0 || interned->getLine() != 7 ||
+      strcmp(interned->getFile(), file) != 0 || sites.size() != registered) {
+    std::cout << "intern failed" << std::endl;
+    ok = false;
+  }
+  // 地址相同内容不同的字符串不能命中旧的调用点
+  char buf[16];
+  strcpy(buf, "a.cc");
+  const sylar::LogCallSite* a =
+      sylar::LogCallSite::Intern(sylar::LogLevel::INFO, buf, 1);
+  strcpy(buf, "b.cc");
+  const sylar::LogCallSite* b =
+      sylar::LogCallSite::Intern(sylar::LogLevel::INFO, buf, 1);
+  if (a == b || strcmp(a->getFile(), "a.cc") != 0 ||
+      strcmp(b->getFile(), "b.cc") != 0) {
+    std::cout << "intern reused address failed" << std::endl;
+    ok = false;
+  }
+  // 表满后返回公共调用点, 不再增长
+  const sylar::LogCallSite* last = nullptr;
+  for (int32_t line = 1; line <= 20000; ++line) {
+    last = sylar::LogCallSite::Intern(sylar::LogLevel::DEBUG, file, line);
+  }
+  if (last->getLine() != 0 || strcmp(last->getFile(), "") != 0 ||
+      last != sylar::LogCallSite::Intern(sylar::LogLevel::DEBUG, file, 30000)) {
+    std::cout << "intern not bounded" << std::endl;
+    ok = false;
+  }
+
+  return TestResult(ok);
+}
@@ -0,0 +1,113 @@
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static int64_t RealtimeNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/**
+ * @brief 跨过几次重新校准, 检查与 CLOCK_REALTIME 的偏差
+ *
+ */
+static bool CheckClock(sylar::LogClock::Source source, int64_t tolerance) {
+  sylar::LogClock::SetSource(source);
+  std::cout << "source=" << sylar::LogClock::SourceToString(
+                                sylar::LogClock::GetSource())
+            << std::endl;
+  int64_t max_diff = 0;
+  int64_t start = RealtimeNS();
+  while (RealtimeNS() - start < 2500000000ll) {
+    int64_t before = RealtimeNS();
+    int64_t now = sylar::LogClock::Now();
+    int64_t after = RealtimeNS();
+    int64_t diff = 0;
+    if (now < before) {
+      diff = before - now;
+    } else if (now > after) {
+      diff = now - after;
+    }
+    max_diff = std::max(max_diff, diff);
+    usleep(1000);
+  }
+  std::cout << "max_diff_ns=" << max_diff << std::endl;
+  return max_diff <= tolerance;
+}
+
+// 纳秒时间戳, 启动后毫秒数, %d{}中的%3N %6N %9N
+int main(int argc, char** argv) {
+  bool ok = true;
+  // TSC 允许 0.2ms 的误差, coarse 的精度是一个时钟节拍
+  if (!CheckClock(sylar::LogClock::TSC, 200000) ||
+      !CheckClock(sylar::LogClock::COARSE, 20000000) ||
+      !CheckClock(sylar::LogClock::REALTIME, 0)) {
+    std::cout << "clock drift too large" << std::endl;
+    ok = false;
+  }
+  sylar::LogClock::SetSource(sylar::LogClock::TSC);
+
+  sylar::Logger::ptr logger(new sylar::Logger("clock"));
+  CaptureAppender::ptr appender(new CaptureAppender);
+  logger->addAppender(appender);
+
+  usleep(20000);
+  SYLAR_LOG_INFO(logger) << "hello";
+  std::vector<sylar::LogEvent::ptr> events;
+  sylar::LogEvent::ptr event;
+  if (appender->take(events) == 1) {
+    event = events[0];
+  }
+  if (!event || event->getElapse() < 20 ||
+      event->getTime() != event->getTimeNs() / 1000000000) {
+    std::cout << "elapse/time failed" << std::endl;
+    return TestResult(false);
+  }
+
+  char frac[10];
+  snprintf(frac, sizeof(frac), "%09lu",
+           (unsigned long)(event->getTimeNs() % 1000000000));
+  std::string sec;
+  {
+    time_t t = event->getTime();
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char buf[16];
+    strftime(buf, sizeof(buf), "%S", &tm);
+    sec = buf;
+  }
+  struct {
+    const char* pattern;
+    std::string expect;
+  } cases[] = {
+      {"%d{%S.%3N}", sec + "." + std::string(frac, 3)},
+      {"%d{%S.%6N}", sec + "." + std::string(frac, 6)},
+      {"%d{%S.%9N}|%m", sec + "." + std::string(frac, 9) + "|hello"},
+      {"%d{%3N%6N}", std::string(frac, 3) + std::string(frac, 6)},
+      {"%d{%%3N}", "%3N"},
+  };
+  for (auto& c : cases) {
+    sylar::LogFormatter fmt(c.pattern);
+    std::string str = fmt.format(logger, sylar::LogLevel::INFO, event);
+    if (str != c.expect) {
+      std::cout << c.pattern << " got " << str << " expect " << c.expect
+                << std::endl;
+      ok = false;
+    }
+  }
+
+  sylar::LogFormatter elapse("%r");
+  if (elapse.format(logger, sylar::LogLevel::INFO, event) !=
+      std::to_string(event->getElapse())) {
+    std::cout << "%r failed" << std::endl;
+    ok = false;
+  }
+
+  return TestResult(ok);
+}
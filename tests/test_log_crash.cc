@@ -0,0 +1,175 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+static std::string tmp_file(const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_crash_%s_%d.log", name,
+           (int)getpid());
+  unlink(path);
+  return path;
+}
+
+// 子进程写日志后崩溃, 返回终止子进程的信号
+static int run_child(void (*cb)()) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    // 调用栈同时会写到标准错误, 测试时丢弃
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+    cb();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+
+static std::string g_sink_file;
+static std::string g_async_file;
+
+// 刷新延迟很长的 LogSink, 缓冲中的日志只能由信号处理函数写出
+static void crash_sink() {
+  sylar::LoggerMgr::GetInstance()->setCrashHandler(true);
+  sylar::LogSink* sink = new sylar::LogSink(g_sink_file, 60 * 1000);
+  const char line[] = "buffered before abort\n";
+  sink->append(line, sizeof(line) - 1);
+  abort();
+}
+
+// 刷新间隔很长的异步写入, 非法访问内存
+static void crash_async() {
+  sylar::LoggerMgr::GetInstance()->setCrashHandler(true);
+  sylar::Logger::ptr logger(new sylar::Logger("crash"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr appender(
+      new sylar::FileLogAppender(g_async_file));
+  appender->setAsync(true, 60 * 1000);
+  logger->addAppender(appender);
+  SYLAR_LOG_INFO(logger) << "queued before segv";
+  volatile uintptr_t addr = 0;
+  *(volatile int*)addr = 1;
+}
+
+static std::string g_overflow_file;
+static volatile int g_depth_limit = 1 << 30;
+
+static int recurse(int n) {
+  volatile char buf[1024];
+  buf[0] = (char)n;
+  if (n >= g_depth_limit) {
+    return buf[0];
+  }
+  return recurse(n + 1) + buf[0];
+}
+
+// 非安装线程栈溢出, 线程入口安装了自己的备用栈
+static void crash_overflow() {
+  sylar::LoggerMgr::GetInstance()->setCrashHandler(true);
+  sylar::LogSink* sink = new sylar::LogSink(g_overflow_file, 60 * 1000);
+  const char line[] = "buffered before overflow\n";
+  sink->append(line, sizeof(line) - 1);
+  std::thread t([]() {
+    sylar::LoggerManager::InstallCrashStack();
+    recurse(0);
+  });
+  t.join();
+}
+
+static bool check(const std::string& file, int sig, int expect_sig,
+                  const char* line, const char* head) {
+  std::string data = read_file(file);
+  unlink(file.c_str());
+  if (sig != expect_sig) {
+    std::cout << file << " killed by " << sig << std::endl;
+    return false;
+  }
+  size_t line_pos = data.find(line);
+  size_t head_pos = data.find(head);
+  if (line_pos == std::string::npos || head_pos == std::string::npos ||
+      line_pos > head_pos ||
+      data.find("test_log_crash", head_pos) == std::string::npos) {
+    std::cout << file << " unexpected content:\n" << data << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 记录 flush 次数
+ *
+ */
+class CountingAppender : public sylar::LogAppender {
+ public:
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {}
+  void flush() override { ++flushed; }
+  std::string toYamlString() override { return ""; }
+
+  int flushed = 0;
+};
+
+// FATAL 日志写入后同步刷新, 不等后台线程的刷新间隔
+static bool check_fatal() {
+  std::string file = tmp_file("fatal");
+  sylar::Logger::ptr logger(new sylar::Logger("fatal"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+  appender->setAsync(true, 60 * 1000);
+  logger->addAppender(appender);
+  // 不由 LoggerManager 管理的日志器和被管理的日志器共用一个Appender
+  std::shared_ptr<CountingAppender> counting(new CountingAppender);
+  logger->addAppender(counting);
+  sylar::Logger::ptr managed =
+      sylar::LoggerMgr::GetInstance()->getLogger("fatal_managed");
+  managed->addAppender(counting);
+  SYLAR_LOG_ERROR(logger) << "error";
+  bool error_buffered = read_file(file).empty();
+  SYLAR_LOG_FATAL(logger) << "fatal";
+  std::string data = read_file(file);
+  logger->clearAppenders();
+  managed->clearAppenders();
+  unlink(file.c_str());
+  if (!error_buffered || data != "error\nfatal\n" || counting->flushed != 1) {
+    std::cout << "fatal flush: " << error_buffered << " " << data
+              << " flushed " << counting->flushed << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  g_sink_file = tmp_file("sink");
+  g_async_file = tmp_file("async");
+  g_overflow_file = tmp_file("overflow");
+  bool ok = check(g_sink_file, run_child(crash_sink), SIGABRT,
+                  "buffered before abort\n", "*** SIGABRT");
+  ok = check(g_async_file, run_child(crash_async), SIGSEGV,
+             "queued before segv\n", "*** SIGSEGV") && ok;
+  ok = check(g_overflow_file, run_child(crash_overflow), SIGSEGV,
+             "buffered before overflow\n", "*** SIGSEGV") && ok;
+  ok = check_fatal() && ok;
+  return TestResult(ok);
+}
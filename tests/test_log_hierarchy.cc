@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static bool Check(bool v, const char* what) {
+  if (!v) {
+    std::cout << "failed: " << what << std::endl;
+  }
+  return v;
+}
+
+// 按'.'分级的日志器: 未设置的级别和Appender从最近的上级继承,
+// 上级后创建或修改时下级的生效值随之更新
+int main(int argc, char** argv) {
+  bool ok = true;
+  sylar::Logger::ptr root = SYLAR_LOG_ROOT();
+  sylar::LogLevel::Level root_level = root->getOwnLevel();
+  root->setLevel(sylar::LogLevel::INFO);
+
+  sylar::Logger::ptr c = SYLAR_LOG_NAME("hier.a.b.c");
+  ok &= Check(c->getLevel() == sylar::LogLevel::INFO, "inherit root level");
+  ok &= Check(c->getOwnLevel() == sylar::LogLevel::UNKNOW, "own level unset");
+  ok &= Check(c->getEffectiveAppenders() == root->getEffectiveAppenders(),
+              "inherit root appenders");
+
+  // 上级在下级之后创建
+  sylar::Logger::ptr a = SYLAR_LOG_NAME("hier.a");
+  CaptureAppender::ptr appender(new CaptureAppender);
+  a->addAppender(appender);
+  a->setLevel(sylar::LogLevel::ERROR);
+  ok &= Check(c->getLevel() == sylar::LogLevel::ERROR, "inherit parent level");
+  SYLAR_LOG_WARN(c) << "dropped";
+  SYLAR_LOG_ERROR(c) << "kept";
+  ok &= Check(appender->take() == 1, "inherit parent appenders");
+
+  // 中间层不改变继承结果
+  sylar::Logger::ptr b = SYLAR_LOG_NAME("hier.a.b");
+  ok &= Check(b->getLevel() == sylar::LogLevel::ERROR, "middle level");
+  a->setLevel(sylar::LogLevel::WARN);
+  ok &= Check(c->getLevel() == sylar::LogLevel::WARN, "grandparent change");
+  SYLAR_LOG_WARN(c) << "kept";
+  ok &= Check(appender->take() == 1, "through middle");
+
+  // 自身设置优先, 清除后恢复继承
+  c->setLevel(sylar::LogLevel::DEBUG);
+  a->setLevel(sylar::LogLevel::FATAL);
+  ok &= Check(c->getLevel() == sylar::LogLevel::DEBUG, "own level wins");
+  ok &= Check(b->getLevel() == sylar::LogLevel::FATAL, "sibling path");
+  c->setLevel(sylar::LogLevel::UNKNOW);
+  ok &= Check(c->getLevel() == sylar::LogLevel::FATAL, "back to inherit");
+
+  CaptureAppender::ptr own(new CaptureAppender);
+  c->addAppender(own);
+  SYLAR_LOG_FATAL(c) << "own";
+  ok &= Check(own->take() == 1 && appender->take() == 0, "own appenders");
+  c->clearAppenders();
+  a->clearAppenders();
+  ok &= Check(c->getEffectiveAppenders() == root->getEffectiveAppenders(),
+              "fall back to root");
+
+  // 名称只是前缀但不在'.'处分隔的不是下级
+  sylar::Logger::ptr other = SYLAR_LOG_NAME("hier.ab");
+  ok &= Check(other->getLevel() == sylar::LogLevel::INFO, "not a child");
+
+  root->setLevel(sylar::LogLevel::ERROR);
+  ok &= Check(other->getLevel() == sylar::LogLevel::ERROR, "root change");
+  ok &= Check(c->getLevel() == sylar::LogLevel::FATAL, "root change hidden");
+  root->setLevel(root_level);
+
+  return TestResult(ok);
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+/**
+ * @brief 逐字节转义, 与格式器的结果对比
+ *
+ */
+static std::string Escape(const std::string& str) {
+  std::string rt;
+  for (unsigned char c : str) {
+    switch (c) {
+      case '"':
+        rt += "\\\"";
+        break;
+      case '\\':
+        rt += "\\\\";
+        break;
+      case '\n':
+        rt += "\\n";
+        break;
+      case '\r':
+        rt += "\\r";
+        break;
+      case '\t':
+        rt += "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          char tmp[8];
+          snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+          rt += tmp;
+        } else {
+          rt += (char)c;
+        }
+    }
+  }
+  return rt;
+}
+
+static bool Check(bool v, const std::string& what) {
+  if (!v) {
+    std::cout << "failed: " << what << std::endl;
+  }
+  return v;
+}
+
+// 结构化字段, JSON格式器, %K, 以及经过二进制缓冲后字段不丢失
+int main(int argc, char** argv) {
+  bool ok = true;
+  sylar::Logger::ptr logger(new sylar::Logger("json"));
+  CaptureAppender::ptr appender(new CaptureAppender);
+  appender->setFormatter(sylar::LogFormatter::Create("json"));
+  logger->addAppender(appender);
+
+  std::string text = "quote\" back\\ tab\t nl\n ctl\x01 中文";
+  SYLAR_LOG_INFO(logger) << sylar::LogKV("int", -42)
+                         << sylar::LogKV("uint", 18446744073709551615ull)
+                         << sylar::LogKV("double", 0.1)
+                         << sylar::LogKV("bool", true)
+                         << sylar::LogKV("str", text)
+                         << sylar::LogKV("lit", "x") << "hello " << text;
+  std::vector<std::string> lines;
+  appender->take(lines);
+  ok &= Check(lines.size() == 1 && lines[0].back() == '\n', "one line");
+  YAML::Node node = YAML::Load(lines[0]);
+  ok &= Check(node["level"].as<std::string>() == "INFO", "level");
+  ok &= Check(node["logger"].as<std::string>() == "json", "logger");
+  ok &= Check(node["msg"].as<std::string>() == "hello " + text, "msg");
+  ok &= Check(node["int"].as<int>() == -42, "int");
+  ok &= Check(node["uint"].as<std::string>() == "18446744073709551615",
+              "uint");
+  ok &= Check(node["double"].as<std::string>() == "0.1", "double");
+  ok &= Check(node["bool"].as<bool>(), "bool");
+  ok &= Check(node["str"].as<std::string>() == text, "str");
+  ok &= Check(node["lit"].as<std::string>() == "x", "lit");
+  ok &= Check(node["line"].as<int>() > 0 &&
+                  node["file"].as<std::string>() == __FILE__,
+              "file:line");
+  std::string time = node["time"].as<std::string>();
+  ok &= Check(time.size() == 35 && time[10] == 'T' && time[19] == '.',
+              "time " + time);
+
+  // 随机内容的转义与逐字节实现一致, 覆盖16字节分块的各种位置
+  srand(1);
+  for (int n = 0; n < 2000; ++n) {
+    std::string msg(rand() % 80, '\0');
+    for (auto& c : msg) {
+      c = rand() % 4 ? 'a' + rand() % 26 : rand() % 256;
+    }
+    SYLAR_LOG_INFO(logger) << msg;
+    appender->take(lines);
+    const std::string& line = lines.at(0);
+    size_t pos = line.find(",\"msg\":\"") + 8;
+    std::string escaped = line.substr(pos, line.size() - pos - 3);
+    if (escaped != Escape(msg)) {
+      ok &= Check(false, "escape " + escaped);
+      break;
+    }
+  }
+
+  // 超过内置数量和容量的字段, 事件复用后字段被清空
+  {
+    sylar::LogEventWrap wrap(sylar::LogEvent::Create(
+        logger, sylar::LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0, 0));
+    std::string big(1000, 'b');
+    for (int i = 0; i < 20; ++i) {
+      std::string key = "k" + std::to_string(i);
+      wrap.getEvent()->getFields().add(key.c_str(), i % 2 ? big : "s");
+    }
+  }
+  appender->take(lines);
+  node = YAML::Load(lines.at(0));
+  ok &= Check(node["k19"].as<std::string>() == std::string(1000, 'b') &&
+                  node["k0"].as<std::string>() == "s",
+              "many fields");
+  SYLAR_LOG_INFO(logger) << "plain";
+  appender->take(lines);
+  node = YAML::Load(lines.at(0));
+  ok &= Check(!node["k0"], "fields cleared");
+
+  // %K
+  sylar::LogFormatter kv("%m %K");
+  {
+    sylar::LogEventWrap wrap(sylar::LogEvent::Create(
+        logger, sylar::LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0, 0));
+    wrap.getSS() << sylar::LogKV("a", 1) << sylar::LogKV("b", "x y") << "m";
+    ok &= Check(kv.format(logger, sylar::LogLevel::INFO, wrap.getEvent()) ==
+                    "m a=1 b=x y",
+                "%K");
+  }
+  appender->take();
+
+  // 经过二进制缓冲和后台线程还原后字段不丢失
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_json_%d.bin", (int)getpid());
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::BinaryFileLogAppender(path)));
+  SYLAR_LOG_WARN(logger) << sylar::LogKV("d", 2.5) << sylar::LogKV("f", false)
+                         << sylar::LogKV("s", text) << "binary";
+  sylar::LogBinary::Flush();
+  appender->take(lines);
+  ok &= Check(lines.size() == 1, "binary line");
+  if (lines.size() == 1) {
+    node = YAML::Load(lines[0]);
+    ok &= Check(node["msg"].as<std::string>() == "binary" &&
+                    node["d"].as<double>() == 2.5 && !node["f"].as<bool>() &&
+                    node["s"].as<std::string>() == text,
+                "binary fields");
+  }
+  unlink(path);
+
+  return TestResult(ok);
+}
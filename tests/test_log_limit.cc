@@ -0,0 +1,129 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static const uint64_t kSecond = 1000000000;
+static std::atomic<uint64_t> s_now(0);
+
+static uint64_t fake_now() { return s_now; }
+
+// 同一个限速调用点
+static void rate(const sylar::Logger::ptr& logger, int round, int i) {
+  SYLAR_LOG_RATE_LIMITED(logger, sylar::LogLevel::ERROR, 50)
+      << "rate " << round << " " << i;
+}
+
+// 采样/限速宏: 检查通过的条数和恢复输出时的丢弃条数
+int main(int argc, char** argv) {
+  sylar::Logger::ptr logger(new sylar::Logger("limit"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  CaptureAppender::ptr appender(new CaptureAppender);
+  logger->addAppender(appender);
+  bool ok = true;
+  std::vector<std::string> lines;
+
+  for (int i = 0; i < 100; ++i) {
+    SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 10) << "every " << i;
+  }
+  if (appender->take(lines) != 10 || lines[0] != "every 0\n" ||
+      lines[1] != "[suppressed 9 messages] every 10\n") {
+    std::cout << "every_n failed: " << lines.size() << std::endl;
+    ok = false;
+  }
+
+  // 多线程下通过的条数也是精确的
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([logger]() {
+      for (int i = 0; i < 10000; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 100) << i;
+      }
+    });
+  }
+  for (auto& i : threads) {
+    i.join();
+  }
+  if (appender->take(lines) != 400) {
+    std::cout << "every_n threads failed: " << lines.size() << std::endl;
+    ok = false;
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    SYLAR_LOG_FIRST_N(logger, sylar::LogLevel::WARN, 5) << "first " << i;
+  }
+  if (appender->take(lines) != 5 || lines[4] != "first 4\n") {
+    std::cout << "first_n failed: " << lines.size() << std::endl;
+    ok = false;
+  }
+
+  // 关闭的级别不计数
+  logger->setLevel(sylar::LogLevel::ERROR);
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_FIRST_N(logger, sylar::LogLevel::INFO, 5) << "disabled " << i;
+  }
+  logger->setLevel(sylar::LogLevel::DEBUG);
+  if (appender->take(lines) != 0) {
+    std::cout << "disabled level failed: " << lines.size() << std::endl;
+    ok = false;
+  }
+
+  // 限速用注入的时钟, 不依赖真实时间
+  sylar::LogLimiter::SetClock(fake_now);
+  s_now = 100 * kSecond;
+  size_t suppressed = 0;
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 1000; ++i) {
+      rate(logger, round, i);
+    }
+    size_t n = appender->take(lines);
+    std::string prefix =
+        "[suppressed " + std::to_string(suppressed) + " messages] rate 1 0";
+    if (n != 50 || (round == 1 && lines[0] != prefix + "\n")) {
+      std::cout << "rate_limited round " << round << " failed: " << n << " "
+                << (lines.empty() ? "" : lines[0]) << std::endl;
+      ok = false;
+    }
+    suppressed = 1000 - n;
+    // 同一秒内不再通过, 到下一秒恢复
+    s_now += kSecond / 4;
+    rate(logger, round, -1);
+    ++suppressed;
+    s_now += kSecond;
+  }
+  if (appender->take(lines) != 0) {
+    std::cout << "rate_limited same second passed" << std::endl;
+    ok = false;
+  }
+
+  // 0 表示不写
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_RATE_LIMITED(logger, sylar::LogLevel::ERROR, 0) << "never";
+    s_now += kSecond;
+  }
+  if (appender->take(lines) != 0) {
+    std::cout << "rate_limited 0 failed: " << lines.size() << std::endl;
+    ok = false;
+  }
+  sylar::LogLimiter::SetClock(nullptr);
+
+  // 宏后面的 else 属于外层的 if
+  bool taken = false;
+  if (ok == !ok)
+    SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 1) << "dangling";
+  else
+    taken = true;
+  if (!taken || appender->take(lines) != 0) {
+    std::cout << "dangling else failed" << std::endl;
+    ok = false;
+  }
+
+  return TestResult(ok);
+}
@@ -0,0 +1,93 @@
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static uint64_t NowNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const sylar::Logger::ptr& StaticLogger() {
+  return SYLAR_LOG_STATIC_NAME("test_log_lookup");
+}
+
+// 多线程并发创建和查找日志器(超过哈希表初始大小, 触发扩容),
+// 同名总是得到同一个日志器; 调用点缓存与 getLogger 一致
+int main(int argc, char** argv) {
+  const int kThreads = 8;
+  const int kNames = 500;
+  std::vector<std::vector<sylar::Logger*>> seen(
+      kThreads, std::vector<sylar::Logger*>(kNames));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t, &seen]() {
+      for (int round = 0; round < 20; ++round) {
+        for (int n = 0; n < kNames; ++n) {
+          int i = (n * 7 + t * 13) % kNames;
+          sylar::Logger::ptr logger =
+              SYLAR_LOG_NAME("lookup." + std::to_string(i));
+          if (round == 0) {
+            seen[t][i] = logger.get();
+          } else if (seen[t][i] != logger.get()) {
+            seen[t][i] = nullptr;
+          }
+        }
+      }
+    });
+  }
+  for (auto& i : threads) {
+    i.join();
+  }
+
+  bool ok = true;
+  for (int n = 0; n < kNames; ++n) {
+    std::string name = "lookup." + std::to_string(n);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME(name);
+    if (logger->getName() != name) {
+      std::cout << "wrong logger for " << name << std::endl;
+      ok = false;
+    }
+    for (int t = 0; t < kThreads; ++t) {
+      if (seen[t][n] != logger.get()) {
+        std::cout << "different logger for " << name << std::endl;
+        ok = false;
+        break;
+      }
+    }
+  }
+  // 构造时发布到哈希表的 root 与管理器保存的是同一个元素
+  if (SYLAR_LOG_NAME("root") != SYLAR_LOG_ROOT() ||
+      sylar::LoggerMgr::GetInstance()->getLoggerRef("root") !=
+          SYLAR_LOG_ROOT()) {
+    std::cout << "root lookup failed" << std::endl;
+    ok = false;
+  }
+  if (StaticLogger() != SYLAR_LOG_NAME("test_log_lookup") ||
+      &StaticLogger() != &StaticLogger()) {
+    std::cout << "static lookup failed" << std::endl;
+    ok = false;
+  }
+
+  const int kLoops = 1000000;
+  uint64_t start = NowNS();
+  for (int i = 0; i < kLoops; ++i) {
+    SYLAR_LOG_NAME("lookup.42")->getLevel();
+  }
+  uint64_t dynamic_ns = NowNS() - start;
+  start = NowNS();
+  for (int i = 0; i < kLoops; ++i) {
+    StaticLogger()->getLevel();
+  }
+  uint64_t static_ns = NowNS() - start;
+  std::cout << "getLogger " << dynamic_ns / kLoops << "ns, static "
+            << static_ns / kLoops << "ns" << std::endl;
+
+  return TestResult(ok);
+}
@@ -0,0 +1,74 @@
+// 本文件单独把编译期日志级别下限设为 ERROR
+#undef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 4
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+/**
+ * @brief 统计收到的日志条数
+ *
+ */
+class CountAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CountAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    ++m_count;
+  }
+  std::string toYamlString() override { return ""; }
+
+  int m_count = 0;
+};
+
+static int s_evaluated = 0;
+
+static int touch() { return ++s_evaluated; }
+
+// 标记字符串在运行时反转得到, 避免查找用的字符串本身出现在程序中
+static std::string reversed(const char* str) {
+  std::string rt(str);
+  std::reverse(rt.begin(), rt.end());
+  return rt;
+}
+
+static bool binary_contains(const std::string& marker) {
+  std::ifstream ifs("/proc/self/exe", std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  return data.find(marker) != std::string::npos;
+}
+
+int main(int argc, char** argv) {
+  sylar::Logger::ptr logger(new sylar::Logger("min_level"));
+  CountAppender::ptr appender(new CountAppender);
+  logger->addAppender(appender);
+  logger->setLevel(sylar::LogLevel::DEBUG);
+
+  SYLAR_LOG_DEBUG(logger) << "SYLAR_LOG_DISABLED_MARKER" << touch();
+  SYLAR_LOG_INFO(logger) << "SYLAR_LOG_DISABLED_MARKER" << touch();
+  SYLAR_LOG_FMT_WARN(logger, "SYLAR_LOG_DISABLED_MARKER %d", touch());
+  SYLAR_LOG_ERROR(logger) << "SYLAR_LOG_ENABLED_MARKER" << touch();
+
+  bool ok = true;
+  if (s_evaluated != 1 || appender->m_count != 1) {
+    std::cout << "evaluated=" << s_evaluated << " logged=" << appender->m_count
+              << " expected 1/1" << std::endl;
+    ok = false;
+  }
+  // 被裁剪的语句连字符串常量都不应留在程序里
+  if (binary_contains(reversed("REKRAM_DELBASID_GOL_RALYS"))) {
+    std::cout << "disabled callsite found in binary" << std::endl;
+    ok = false;
+  }
+  if (!binary_contains(reversed("REKRAM_DELBANE_GOL_RALYS"))) {
+    std::cout << "enabled callsite not found in binary" << std::endl;
+    ok = false;
+  }
+  return TestResult(ok);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+// 多线程写小块映射的文件, 检查每条日志完整且线程内有序,
+// 第二轮在已有文件后追加, 并检查关闭时截断到实际长度
+int main(int argc, char** argv) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_mmap_%d.log", (int)getpid());
+  unlink(path);
+
+  const int kThreads = 4;
+  const int kCount = 50000;
+  uint64_t expected_size = 0;
+  for (int round = 0; round < 2; ++round) {
+    sylar::Logger::ptr logger(new sylar::Logger("mmap"));
+    logger->setFormatter(
+        sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::MmapFileLogAppender(
+        path, 64 * 1024,
+        round ? sylar::MmapFileLogAppender::SYNC_ASYNC
+              : sylar::MmapFileLogAppender::SYNC_NONE)));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([logger, round, t]() {
+        for (int i = 0; i < kCount; ++i) {
+          SYLAR_LOG_INFO(logger) << round << " " << t << " " << i;
+        }
+      });
+    }
+    for (auto& i : threads) {
+      i.join();
+    }
+    for (int t = 0; t < kThreads; ++t) {
+      for (int i = 0; i < kCount; ++i) {
+        expected_size += std::to_string(round).size() +
+                         std::to_string(t).size() +
+                         std::to_string(i).size() + 3;
+      }
+    }
+    // 析构Appender, 截断文件
+    logger->clearAppenders();
+  }
+
+  bool ok = true;
+  struct stat st;
+  if (stat(path, &st) != 0 || (uint64_t)st.st_size != expected_size) {
+    std::cout << "size=" << st.st_size << " expected " << expected_size
+              << std::endl;
+    ok = false;
+  }
+  std::ifstream ifs(path);
+  std::string line;
+  std::map<std::pair<int, int>, int> next;
+  int lines = 0;
+  while (ok && std::getline(ifs, line)) {
+    int round = -1;
+    int t = -1;
+    int i = -1;
+    if (sscanf(line.c_str(), "%d %d %d", &round, &t, &i) != 3 ||
+        next[std::make_pair(round, t)] != i) {
+      std::cout << "bad line " << lines << ": " << line << std::endl;
+      ok = false;
+      break;
+    }
+    next[std::make_pair(round, t)] = i + 1;
+    ++lines;
+  }
+  if (ok && lines != 2 * kThreads * kCount) {
+    std::cout << "lines=" << lines << std::endl;
+    ok = false;
+  }
+  unlink(path);
+  return TestResult(ok);
+}
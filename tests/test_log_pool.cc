@@ -0,0 +1,99 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <iostream>
+#include <new>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+#include "sylar/thread.h"
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// 统计全局堆分配次数
+static std::atomic<uint64_t> s_allocs(0);
+
+void* operator new(size_t size) {
+  ++s_allocs;
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+/**
+ * @brief 只读取事件内容, 不产生输出
+ *
+ */
+class NullAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<NullAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    m_bytes += event->getThreadName().size() + event->getLine();
+  }
+  std::string toYamlString() override { return ""; }
+
+  std::atomic<uint64_t> m_bytes{0};
+};
+
+static void log_some(sylar::Logger::ptr logger, int n, bool rename) {
+  for (int i = 0; i < n; ++i) {
+    if (rename) {
+      // 像协程调度那样在几个名称间来回切换
+      sylar::Thread::SetName(i % 2 ? "pool_a" : "pool_b");
+    }
+    SYLAR_LOG_INFO(logger) << "pooled event " << i;
+  }
+}
+
+// 写 n 条日志并等队列(如果有)消费完, 返回期间的堆分配次数
+static uint64_t run(sylar::Logger::ptr logger, int n, bool rename) {
+  uint64_t before = s_allocs;
+  log_some(logger, n, rename);
+  sylar::LogEventQueue::ptr queue = logger->getQueue();
+  if (queue) {
+    queue->flush();
+  }
+  return s_allocs - before;
+}
+
+static bool check(const char* name, sylar::Logger::ptr logger,
+                  bool rename = false) {
+  // 预热: 对象池增长到最大在途事件数, 各个缓冲区增长到稳定大小.
+  // 经过队列时在途事件数最多为队列容量, 预热写满几轮队列即可
+  for (int i = 0; i < 3; ++i) {
+    run(logger, 100000, rename);
+  }
+  // 预热之后每一轮都不能再分配
+  bool ok = true;
+  for (int round = 1; round <= 5; ++round) {
+    uint64_t allocs = run(logger, 100000, rename);
+    if (allocs != 0) {
+      std::cout << name << " round " << round << ": " << allocs
+                << " allocations for 100000 events" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  sylar::Logger::ptr logger = SYLAR_LOG_NAME("test_log_pool");
+  logger->clearAppenders();
+  logger->addAppender(NullAppender::ptr(new NullAppender));
+
+  bool ok = check("sync", logger);
+  ok = check("rename", logger, true) && ok;
+
+  // 事件在队列的消费线程释放, 走跨线程归还路径
+  logger->setQueue(sylar::LogEventQueue::ptr(new sylar::LogEventQueue(1024)));
+  ok = check("queue", logger) && ok;
+  logger->setQueue(nullptr);
+  return TestResult(ok);
+}
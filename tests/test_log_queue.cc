@@ -0,0 +1,114 @@
+#include <stdio.h>
+
+#include <iostream>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static const int kThreads = 8;
+static const int kCount = 100000;
+
+/**
+ * @brief 检查每个线程的日志是否丢失或乱序
+ *
+ */
+class CheckAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CheckAppender> ptr;
+  CheckAppender() : m_last(kThreads, -1) {}
+
+  // 只有队列的消费线程会调用, 无需加锁
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    int tid = -1;
+    int seq = -1;
+    if (sscanf(event->getContent().c_str(), "%d %d", &tid, &seq) != 2 ||
+        tid < 0 || tid >= kThreads) {
+      ++m_errors;
+      return;
+    }
+    if (m_strict ? seq != m_last[tid] + 1 : seq <= m_last[tid]) {
+      ++m_errors;
+    }
+    if (level >= sylar::LogLevel::ERROR) {
+      ++m_errorEvents;
+    }
+    m_last[tid] = seq;
+    ++m_count;
+  }
+
+  std::string toYamlString() override { return ""; }
+
+  void reset(bool strict) {
+    m_last.assign(kThreads, -1);
+    m_count = 0;
+    m_errors = 0;
+    m_errorEvents = 0;
+    m_strict = strict;
+  }
+
+  std::vector<int> m_last;
+  uint64_t m_count = 0;
+  uint64_t m_errors = 0;
+  uint64_t m_errorEvents = 0;
+  bool m_strict = true;
+};
+
+static void run_producers(sylar::Logger::ptr logger) {
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int i = 0; i < kThreads; ++i) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, i]() {
+          for (int j = 0; j < kCount; ++j) {
+            if (j % 10 == 0) {
+              SYLAR_LOG_ERROR(logger) << i << " " << j;
+            } else {
+              SYLAR_LOG_DEBUG(logger) << i << " " << j;
+            }
+          }
+        },
+        "producer_" + std::to_string(i))));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+}
+
+static bool test_policy(sylar::Logger::ptr logger, CheckAppender::ptr check,
+                        sylar::LogEventQueue::OverflowPolicy policy) {
+  sylar::LogEventQueue::ptr queue(
+      new sylar::LogEventQueue(1024, policy, sylar::LogLevel::ERROR));
+  check->reset(policy == sylar::LogEventQueue::BLOCK);
+  logger->setQueue(queue);
+  run_producers(logger);
+  queue->flush();
+  logger->setQueue(nullptr);
+
+  uint64_t total = (uint64_t)kThreads * kCount;
+  bool ok = check->m_errors == 0 &&
+            check->m_count + queue->getDropped() == total;
+  if (policy == sylar::LogEventQueue::BLOCK) {
+    ok = ok && queue->getDropped() == 0;
+  } else if (policy == sylar::LogEventQueue::DROP_BELOW_LEVEL) {
+    ok = ok && check->m_errorEvents == total / 10;
+  }
+  std::cout << "policy=" << policy << " received=" << check->m_count
+            << " dropped=" << queue->getDropped()
+            << " errors=" << check->m_errors << (ok ? " ok" : " FAILED")
+            << std::endl;
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  sylar::Logger::ptr logger = SYLAR_LOG_NAME("test_log_queue");
+  CheckAppender::ptr check(new CheckAppender);
+  logger->clearAppenders();
+  logger->addAppender(check);
+  logger->setLevel(sylar::LogLevel::DEBUG);
+
+  bool ok = test_policy(logger, check, sylar::LogEventQueue::BLOCK);
+  ok = test_policy(logger, check, sylar::LogEventQueue::DROP_NEWEST) && ok;
+  ok = test_policy(logger, check, sylar::LogEventQueue::DROP_BELOW_LEVEL) && ok;
+  return TestResult(ok);
+}
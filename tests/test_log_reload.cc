@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string g_dir;
+
+static void load(const std::string& level, const std::string& file,
+                 const std::string& formatter,
+                 const std::string& logger_formatter = "%m%n") {
+  std::string yaml =
+      "logs:\n"
+      "  - name: reload\n"
+      "    level: " + level + "\n"
+      "    formatter: \"" + logger_formatter + "\"\n"
+      "    appenders:\n"
+      "      - type: FileLogAppender\n"
+      "        file: " + g_dir + "/" + file + "\n" +
+      (formatter.empty() ? "" : "        formatter: \"" + formatter + "\"\n") +
+      "      - type: StdoutLogAppender\n"
+      "        level: FATAL\n";
+  sylar::Config::LoadFromYaml(YAML::Load(yaml));
+}
+
+#define CHECK(cond)                                             \
+  if (!(cond)) {                                                \
+    std::cout << "line " << __LINE__ << ": " #cond << std::endl; \
+    return false;                                               \
+  }
+
+// 只修改级别和格式时沿用原来的Appender, 修改文件时才新建
+static bool run() {
+  sylar::Logger::ptr logger =
+      sylar::LoggerMgr::GetInstance()->getLogger("reload");
+  load("INFO", "a.log", "");
+  auto first = logger->getAppenders();
+  CHECK(first->size() == 2);
+  CHECK((*first)[0]->getFormatter()->getPattern() == "%m%n");
+
+  load("DEBUG", "a.log", "");
+  auto second = logger->getAppenders();
+  CHECK(logger->getLevel() == sylar::LogLevel::DEBUG);
+  CHECK((*second)[0] == (*first)[0] && (*second)[1] == (*first)[1]);
+
+  load("DEBUG", "a.log", "[%p] %m%n");
+  auto third = logger->getAppenders();
+  CHECK((*third)[0] == (*first)[0]);
+  CHECK((*third)[0]->getFormatter()->getPattern() == "[%p] %m%n");
+
+  // 去掉Appender自己的格式后改用日志器的格式
+  load("DEBUG", "a.log", "");
+  auto fourth = logger->getAppenders();
+  CHECK((*fourth)[0] == (*first)[0]);
+  CHECK((*fourth)[0]->getFormatter()->getPattern() == "%m%n");
+
+  // 修改日志器的格式, 没有自己格式的Appender沿用并改用新格式
+  load("DEBUG", "a.log", "", "[%c] %m%n");
+  auto fifth = logger->getAppenders();
+  CHECK((*fifth)[0] == (*first)[0] && (*fifth)[1] == (*first)[1]);
+  CHECK(logger->getFormatter()->getPattern() == "[%c] %m%n");
+  CHECK((*fifth)[0]->getFormatter()->getPattern() == "[%c] %m%n");
+  CHECK((*fifth)[1]->getFormatter()->getPattern() == "[%c] %m%n");
+
+  load("DEBUG", "b.log", "", "[%c] %m%n");
+  auto sixth = logger->getAppenders();
+  CHECK((*sixth)[0] != (*first)[0] && (*sixth)[1] == (*first)[1]);
+  CHECK(sixth->size() == 2);
+  CHECK((*sixth)[0]->getFormatter()->getPattern() == "[%c] %m%n");
+  return true;
+}
+
+int main(int argc, char** argv) {
+  char dir[64];
+  snprintf(dir, sizeof(dir), "/tmp/test_log_reload_%d", (int)getpid());
+  g_dir = dir;
+  bool ok = run();
+  std::string cmd = "rm -rf " + g_dir;
+  if (system(cmd.c_str()) != 0) {
+    ok = false;
+  }
+  return TestResult(ok);
+}
@@ -0,0 +1,150 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// 把日志文件移走后通过 reopenAll 或 inotify 通知重新打开,
+// 检查移走前后的日志分别落在旧文件和新文件中.
+// 另一个同步Appender写同一文件, 共用的Sink重新打开后两者都写到新文件
+static bool run(bool async, bool watch) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_reopen_%d.log", (int)getpid());
+  std::string file = path;
+  std::string moved = file + ".1";
+  unlink(file.c_str());
+  unlink(moved.c_str());
+
+  sylar::Logger::ptr logger(new sylar::Logger("reopen"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+  appender->setAsync(async, 10);
+  logger->addAppender(appender);
+  sylar::Logger::ptr other(new sylar::Logger("reopen_other"));
+  other->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr other_appender(
+      new sylar::FileLogAppender(file));
+  other->addAppender(other_appender);
+
+  SYLAR_LOG_INFO(logger) << "before";
+  appender->flush();
+  uint64_t generation = sylar::LoggerManager::GetReopenGeneration();
+  rename(file.c_str(), moved.c_str());
+  if (watch) {
+    for (int i = 0; i < 200; ++i) {
+      if (sylar::LoggerManager::GetReopenGeneration() != generation) {
+        break;
+      }
+      usleep(10 * 1000);
+    }
+  } else {
+    sylar::LoggerMgr::GetInstance()->reopenAll();
+  }
+  if (async) {
+    // 等后台线程下一轮写盘时重新打开
+    appender->flush();
+  }
+  SYLAR_LOG_INFO(logger) << "after";
+  appender->flush();
+  SYLAR_LOG_INFO(other) << "other";
+  other_appender->flush();
+  logger->clearAppenders();
+  other->clearAppenders();
+
+  std::string old_data = read_file(moved);
+  std::string new_data = read_file(file);
+  unlink(file.c_str());
+  unlink(moved.c_str());
+  if (old_data != "before\n" || new_data != "after\nother\n") {
+    std::cout << "async=" << async << " watch=" << watch << " old=["
+              << old_data << "] new=[" << new_data << "]" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// 进程中 inotify 监视的目录数
+static int count_watches() {
+  int count = 0;
+  DIR* d = opendir("/proc/self/fd");
+  while (struct dirent* dp = readdir(d)) {
+    char link[256];
+    std::string fd = std::string("/proc/self/fd/") + dp->d_name;
+    ssize_t n = readlink(fd.c_str(), link, sizeof(link) - 1);
+    if (n <= 0 || std::string(link, n).find("inotify") == std::string::npos) {
+      continue;
+    }
+    std::ifstream ifs(std::string("/proc/self/fdinfo/") + dp->d_name);
+    std::string line;
+    while (std::getline(ifs, line)) {
+      count += line.compare(0, 11, "inotify wd:") == 0;
+    }
+  }
+  closedir(d);
+  return count;
+}
+
+// 切分时自己移走文件不触发全局重新打开; 目录中最后一个Appender删除后取消监视
+static bool run_rotate() {
+  char dir[64];
+  snprintf(dir, sizeof(dir), "/tmp/test_log_reopen_rotate_%d", (int)getpid());
+  mkdir(dir, 0755);
+  int watches = count_watches();
+  sylar::Logger::ptr logger(new sylar::Logger("reopen_rotate"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr appender(
+      new sylar::FileLogAppender(std::string(dir) + "/app.log"));
+  appender->setRotate(1024, sylar::LogFileRotator::NONE, 100, 0, false);
+  logger->addAppender(appender);
+  bool ok = count_watches() == watches + 1;
+  uint64_t generation = sylar::LoggerManager::GetReopenGeneration();
+  for (int i = 0; i < 200; ++i) {
+    SYLAR_LOG_INFO(logger) << "rotate line " << i;
+  }
+  appender->flush();
+  sylar::LogFileRotator::Flush();
+  usleep(500 * 1000);
+  if (sylar::LoggerManager::GetReopenGeneration() != generation) {
+    std::cout << "rotation bumped the reopen generation" << std::endl;
+    ok = false;
+  }
+  logger->clearAppenders();
+  appender.reset();
+  if (count_watches() != watches) {
+    std::cout << "watches=" << count_watches() << " expected " << watches
+              << std::endl;
+    ok = false;
+  }
+  std::string cmd = std::string("rm -rf ") + dir;
+  if (system(cmd.c_str()) != 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  bool ok = run(false, false) && run(true, false);
+  sylar::LoggerMgr::GetInstance()->setWatchFiles(true);
+  ok = ok && run(false, true) && run(true, true);
+  ok = run_rotate() && ok;
+  sylar::LoggerMgr::GetInstance()->setWatchFiles(false);
+  return TestResult(ok);
+}
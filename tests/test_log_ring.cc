@@ -0,0 +1,232 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// 转储在后台线程完成, 等到文件中出现 n 次 str
+static std::string wait_dump(const std::string& file, const std::string& str,
+                             size_t n) {
+  std::string data;
+  for (int i = 0; i < 200; ++i) {
+    data = read_file(file);
+    size_t c = 0;
+    for (size_t pos = data.find(str); pos != std::string::npos;
+         pos = data.find(str, pos + 1)) {
+      ++c;
+    }
+    if (c >= n) {
+      break;
+    }
+    usleep(10 * 1000);
+  }
+  return data;
+}
+
+static size_t count(const std::string& data, const std::string& str) {
+  size_t n = 0;
+  for (size_t pos = data.find(str); pos != std::string::npos;
+       pos = data.find(str, pos + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+/**
+ * @brief 检查转储中 "t<线程> n<序号>" 的日志: 每行完整, 同一线程的序号连续递增
+ *
+ * @return 日志行数, 格式错误返回-1
+ */
+static int check_lines(const std::string& dump, int threads) {
+  std::vector<long> last(threads, -1);
+  std::stringstream ss(dump);
+  std::string line;
+  int lines = 0;
+  while (std::getline(ss, line)) {
+    if (line.compare(0, 4, "====") == 0 || line == "error") {
+      continue;
+    }
+    int t = -1;
+    long n = -1;
+    char tail = 0;
+    if (sscanf(line.c_str(), "t%d n%ld payload-%c", &t, &n, &tail) != 3 ||
+        t < 0 || t >= threads || tail != 'x' ||
+        line.size() != line.find("payload-") + 8 + 32) {
+      std::cout << "bad line: " << line << std::endl;
+      return -1;
+    }
+    if (last[t] >= 0 && n != last[t] + 1) {
+      std::cout << "thread " << t << " jumped " << last[t] << " -> " << n
+                << std::endl;
+      return -1;
+    }
+    last[t] = n;
+    ++lines;
+  }
+  return lines;
+}
+
+static void log_lines(sylar::Logger::ptr logger, int t, long from, long to) {
+  for (long n = from; n < to; ++n) {
+    SYLAR_LOG_DEBUG(logger) << "t" << t << " n" << n << " payload-"
+                            << std::string(32, 'x');
+  }
+}
+
+// 缓冲写满后覆盖旧记录, 第一条ERROR日志由后台线程转储, rearm后再次转储
+static bool test_trigger(const std::string& file) {
+  sylar::Logger::ptr logger(new sylar::Logger("ring"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::RingBufferLogAppender::ptr ring(
+      new sylar::RingBufferLogAppender(file, 4096));
+  logger->addAppender(ring);
+
+  const int threads = 4;
+  std::vector<std::thread> ths;
+  for (int t = 0; t < threads; ++t) {
+    ths.emplace_back([logger, t]() { log_lines(logger, t, 0, 10000); });
+  }
+  for (auto& i : ths) {
+    i.join();
+  }
+  if (!read_file(file).empty()) {
+    std::cout << "dumped before error" << std::endl;
+    return false;
+  }
+  SYLAR_LOG_ERROR(logger) << "error";
+  SYLAR_LOG_ERROR(logger) << "error";
+  std::string data = wait_dump(file, "error\n", 1);
+  int lines = check_lines(data, threads);
+  // 所有线程共用4K缓冲, 约放下60条, 最后写完的线程的最后一条一定在
+  if (count(data, "reason: first ERROR") != 1 || lines < 40 || lines > 80 ||
+      count(data, " n9999 ") < 1 ||
+      data.compare(data.size() - 6, 6, "error\n") != 0) {
+    std::cout << "trigger dump: lines=" << lines << "\n" << data << std::endl;
+    return false;
+  }
+  ring->rearm();
+  SYLAR_LOG_ERROR(logger) << "error";
+  data = wait_dump(file, "reason: first ERROR", 2);
+  if (count(data, "reason: first ERROR") != 2) {
+    std::cout << "rearm did not dump" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// 大量短命线程写日志, 缓冲总大小不随线程数增长
+static bool test_threads(const std::string& file) {
+  sylar::Logger::ptr logger(new sylar::Logger("ring_threads"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::RingBufferLogAppender::ptr ring(new sylar::RingBufferLogAppender(
+      file, 4096, sylar::LogLevel::UNKNOW));
+  logger->addAppender(ring);
+
+  const int threads = 64;
+  for (int t = 0; t < threads; ++t) {
+    std::thread([logger, t]() { log_lines(logger, t, 0, 100); }).join();
+  }
+  ring->dump();
+  std::string data = read_file(file);
+  int lines = check_lines(data, threads);
+  if (lines < 40 || lines > 80 || data.find("t63 n99 ") == std::string::npos) {
+    std::cout << "threads dump: lines=" << lines << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// 写入线程不停覆盖时转储, 不能读到被覆盖了一半的记录
+static bool test_concurrent(const std::string& file) {
+  sylar::Logger::ptr logger(new sylar::Logger("ring_concurrent"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::RingBufferLogAppender::ptr ring(new sylar::RingBufferLogAppender(
+      file, 8192, sylar::LogLevel::UNKNOW));
+  logger->addAppender(ring);
+
+  const int threads = 4;
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> ths;
+  for (int t = 0; t < threads; ++t) {
+    ths.emplace_back([logger, t, &stop]() {
+      for (long n = 0; !stop; n += 100) {
+        log_lines(logger, t, n, n + 100);
+      }
+    });
+  }
+  bool ok = true;
+  for (int i = 0; i < 200 && ok; ++i) {
+    unlink(file.c_str());
+    ring->dump();
+    ok = check_lines(read_file(file), threads) >= 0;
+  }
+  stop = true;
+  for (auto& i : ths) {
+    i.join();
+  }
+  return ok;
+}
+
+static bool test_signal(const std::string& file) {
+  sylar::Logger::ptr logger(new sylar::Logger("ring_signal"));
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::RingBufferLogAppender::ptr ring(new sylar::RingBufferLogAppender(
+      file, 4096, sylar::LogLevel::UNKNOW));
+  logger->addAppender(ring);
+  log_lines(logger, 0, 0, 10);
+
+  sylar::RingBufferLogAppender::SetDumpSignal(SIGUSR2);
+  raise(SIGUSR2);
+  std::string data;
+  for (int i = 0; i < 200; ++i) {
+    data = read_file(file);
+    if (!data.empty()) {
+      break;
+    }
+    usleep(10 * 1000);
+  }
+  sylar::RingBufferLogAppender::SetDumpSignal(0);
+  if (data.find("reason: signal, 10 records") == std::string::npos ||
+      check_lines(data, 1) != 10) {
+    std::cout << "signal dump:\n" << data << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_ring_%d.log", (int)getpid());
+  std::string file = path;
+  unlink(file.c_str());
+  bool ok = test_trigger(file);
+  unlink(file.c_str());
+  ok = test_threads(file) && ok;
+  unlink(file.c_str());
+  ok = test_concurrent(file) && ok;
+  unlink(file.c_str());
+  ok = test_signal(file) && ok;
+  unlink(file.c_str());
+  return TestResult(ok);
+}
@@ -0,0 +1,107 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+// 按大小切分并压缩, 检查保留个数, 每个文件不超过上限且都是完整的行
+static bool check(const std::string& dir, uint64_t max_size,
+                  uint32_t max_files) {
+  bool ok = true;
+  size_t rotated = 0;
+  DIR* d = opendir(dir.c_str());
+  while (struct dirent* dp = readdir(d)) {
+    std::string name = dp->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    std::string path = dir + "/" + name;
+    std::string data;
+    if (name == "app.log") {
+      FILE* fp = fopen(path.c_str(), "r");
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+      }
+      fclose(fp);
+    } else if (name.size() > 3 &&
+               name.compare(name.size() - 3, 3, ".gz") == 0) {
+      ++rotated;
+      gzFile gz = gzopen(path.c_str(), "rb");
+      char buf[4096];
+      int n;
+      while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+        data.append(buf, n);
+      }
+      gzclose(gz);
+      if (data.empty()) {
+        std::cout << "empty rotated file " << name << std::endl;
+        ok = false;
+      }
+    } else {
+      std::cout << "unexpected file " << name << std::endl;
+      ok = false;
+      continue;
+    }
+    if (data.size() > max_size) {
+      std::cout << name << " size=" << data.size() << std::endl;
+      ok = false;
+    }
+    if (!data.empty() && data.back() != '\n') {
+      std::cout << name << " ends with partial line" << std::endl;
+      ok = false;
+    }
+  }
+  closedir(d);
+  if (rotated != max_files) {
+    std::cout << "rotated files=" << rotated << " expected " << max_files
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  const uint64_t kMaxSize = 4096;
+  const uint32_t kMaxFiles = 3;
+  bool ok = true;
+  for (int async = 0; async < 2; ++async) {
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/test_log_rotate_%d_%d", (int)getpid(),
+             async);
+    mkdir(dir, 0755);
+    std::string file = std::string(dir) + "/app.log";
+
+    sylar::Logger::ptr logger(new sylar::Logger("rotate"));
+    logger->setFormatter(
+        sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+    appender->setRotate(kMaxSize, sylar::LogFileRotator::NONE, kMaxFiles, 0,
+                        true);
+    appender->setAsync(async, 10, 64 * 1024);
+    logger->addAppender(appender);
+    for (int i = 0; i < 5000; ++i) {
+      SYLAR_LOG_INFO(logger) << "rotate test line " << i;
+    }
+    appender->flush();
+    sylar::LogFileRotator::Flush();
+    logger->clearAppenders();
+
+    if (!check(dir, kMaxSize, kMaxFiles)) {
+      std::cout << (async ? "async" : "sync") << " failed" << std::endl;
+      ok = false;
+    } else {
+      std::string cmd = std::string("rm -rf ") + dir;
+      system(cmd.c_str());
+    }
+  }
+  return TestResult(ok);
+}
@@ -0,0 +1,197 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+/**
+ * @brief 本进程打开 path 的文件描述符个数
+ *
+ */
+static int count_fds(const std::string& path) {
+  struct stat want;
+  if (stat(path.c_str(), &want) != 0) {
+    return 0;
+  }
+  int n = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  while (struct dirent* ent = readdir(dir)) {
+    struct stat st;
+    std::string fd = std::string("/proc/self/fd/") + ent->d_name;
+    if (ent->d_name[0] != '.' && stat(fd.c_str(), &st) == 0 &&
+        st.st_dev == want.st_dev && st.st_ino == want.st_ino) {
+      ++n;
+    }
+  }
+  closedir(dir);
+  return n;
+}
+
+static sylar::Logger::ptr make_logger(const std::string& name,
+                                      const std::string& file,
+                                      const std::string& pattern,
+                                      sylar::LogLevel::Level level) {
+  sylar::Logger::ptr logger(new sylar::Logger(name));
+  sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+  appender->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter(pattern)));
+  appender->setLevel(level);
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 同步和异步Appender写同一文件: 共用一个文件描述符和切分器,
+// 切分出的每个文件都不超过上限, 不同的切分配置被拒绝
+static bool test_shared_rotate(const std::string& base) {
+  const uint64_t kMaxSize = 1000;
+  std::string file = base + "/rotate.log";
+  bool ok = true;
+  {
+    sylar::Logger::ptr a =
+        make_logger("ra", file, "a %m%n", sylar::LogLevel::DEBUG);
+    sylar::Logger::ptr b =
+        make_logger("rb", file, "b %m%n", sylar::LogLevel::DEBUG);
+    sylar::FileLogAppender::ptr fa =
+        std::static_pointer_cast<sylar::FileLogAppender>(
+            (*a->getAppenders())[0]);
+    sylar::FileLogAppender::ptr fb =
+        std::static_pointer_cast<sylar::FileLogAppender>(
+            (*b->getAppenders())[0]);
+    fa->setRotate(kMaxSize, sylar::LogFileRotator::NONE);
+    fb->setRotate(kMaxSize, sylar::LogFileRotator::NONE);
+    fb->setAsync(true, 10, 4096);
+    if (fa->getRotator() != fb->getRotator() || !fa->getRotator()) {
+      std::cout << "rotator not shared" << std::endl;
+      ok = false;
+    }
+    sylar::FileLogAppender::ptr other(new sylar::FileLogAppender(file));
+    if (other->setRotate(kMaxSize * 2, sylar::LogFileRotator::NONE) ||
+        other->getRotator()) {
+      std::cout << "conflicting rotate accepted" << std::endl;
+      ok = false;
+    }
+    if (count_fds(file) != 1) {
+      std::cout << "rotate file opened " << count_fds(file) << " times"
+                << std::endl;
+      ok = false;
+    }
+    for (int i = 0; i < 200; ++i) {
+      SYLAR_LOG_INFO(a) << "line " << i;
+      SYLAR_LOG_INFO(b) << "line " << i;
+    }
+    fa->flush();
+    fb->flush();
+  }
+
+  size_t total = 0;
+  int files = 0;
+  DIR* dir = opendir(base.c_str());
+  while (struct dirent* ent = readdir(dir)) {
+    std::string name = ent->d_name;
+    if (name.compare(0, 10, "rotate.log") != 0) {
+      continue;
+    }
+    std::string path = base + "/" + name;
+    std::string data = read_file(path);
+    if (data.size() > kMaxSize) {
+      std::cout << name << " size=" << data.size() << std::endl;
+      ok = false;
+    }
+    // 除当前文件外, 切分出的文件应接近上限
+    if (name != "rotate.log" && data.size() < kMaxSize / 2) {
+      std::cout << name << " too small size=" << data.size() << std::endl;
+      ok = false;
+    }
+    total += data.size();
+    ++files;
+    unlink(path.c_str());
+  }
+  closedir(dir);
+  if (files < 2 || total == 0) {
+    std::cout << "rotate files=" << files << " total=" << total << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+// 不同写法(相对路径, "./", 符号链接)指向同一文件的Appender共用一个Sink,
+// 级别和格式各自生效, 日志按写入顺序落盘
+int main(int argc, char** argv) {
+  char dir[64];
+  snprintf(dir, sizeof(dir), "/tmp/test_log_shared_sink_%d", (int)getpid());
+  std::string base = dir;
+  std::string file = base + "/app.log";
+  std::string link = base + "/link.log";
+  mkdir(base.c_str(), 0755);
+  if (symlink("app.log", link.c_str()) != 0) {
+    std::cout << "symlink failed" << std::endl;
+    return TestResult(false);
+  }
+
+  bool ok = true;
+  {
+    sylar::Logger::ptr a =
+        make_logger("a", file, "a %m%n", sylar::LogLevel::DEBUG);
+    sylar::Logger::ptr b = make_logger("b", base + "/./app.log", "b [%p] %m%n",
+                                       sylar::LogLevel::WARN);
+    sylar::Logger::ptr c =
+        make_logger("c", link, "c %m%n", sylar::LogLevel::DEBUG);
+
+    if (sylar::LoggerMgr::GetInstance()->getFileSink(file) !=
+        sylar::LoggerMgr::GetInstance()->getFileSink(link)) {
+      std::cout << "sink not shared" << std::endl;
+      ok = false;
+    }
+    int fds = count_fds(file);
+    if (fds != 1) {
+      std::cout << "file opened " << fds << " times" << std::endl;
+      ok = false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+      SYLAR_LOG_INFO(a) << i;
+      SYLAR_LOG_INFO(b) << i;
+      SYLAR_LOG_ERROR(b) << i;
+      SYLAR_LOG_INFO(c) << i;
+    }
+    for (auto& i : *a->getAppenders()) {
+      i->flush();
+    }
+    std::string expect;
+    for (int i = 0; i < 3; ++i) {
+      std::string n = std::to_string(i);
+      expect += "a " + n + "\nb [ERROR] " + n + "\nc " + n + "\n";
+    }
+    std::string data = read_file(file);
+    if (data != expect) {
+      std::cout << "unexpected content:\n" << data << std::endl;
+      ok = false;
+    }
+  }
+
+  // 所有Appender释放后文件关闭
+  if (count_fds(file) != 0) {
+    std::cout << "file still open" << std::endl;
+    ok = false;
+  }
+  ok &= test_shared_rotate(base);
+  unlink(link.c_str());
+  unlink(file.c_str());
+  rmdir(base.c_str());
+  return TestResult(ok);
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// 多线程追加, 检查每行完整且线程内有序; 再检查只追加一行时在延迟预算内写出
+int main(int argc, char** argv) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_sink_%d.log", (int)getpid());
+  unlink(path);
+
+  const int kThreads = 4;
+  const int kCount = 50000;
+  bool ok = true;
+  {
+    sylar::LogSink sink(path, 5, 4096);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&sink, t]() {
+        char buf[64];
+        for (int i = 0; i < kCount; ++i) {
+          int n = snprintf(buf, sizeof(buf), "%d %d\n", t, i);
+          sink.append(buf, n);
+        }
+      });
+    }
+    for (auto& i : threads) {
+      i.join();
+    }
+  }
+
+  std::vector<int> next(kThreads, 0);
+  std::istringstream iss(read_file(path));
+  int t = 0;
+  int i = 0;
+  int lines = 0;
+  while (iss >> t >> i) {
+    if (t < 0 || t >= kThreads || next[t] != i) {
+      std::cout << "out of order: " << t << " " << i << std::endl;
+      ok = false;
+      break;
+    }
+    ++next[t];
+    ++lines;
+  }
+  if (lines != kThreads * kCount) {
+    std::cout << "lines=" << lines << std::endl;
+    ok = false;
+  }
+  unlink(path);
+
+  {
+    sylar::LogSink sink(path, 5, 64 * 1024);
+    sink.append("latency\n", 8);
+    usleep(100 * 1000);
+    if (read_file(path) != "latency\n") {
+      std::cout << "not flushed within latency budget" << std::endl;
+      ok = false;
+    }
+  }
+  unlink(path);
+
+  return TestResult(ok);
+}
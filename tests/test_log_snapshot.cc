@@ -0,0 +1,92 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::atomic<uint64_t> s_destroyed(0);
+static std::atomic<uint64_t> s_bad(0);
+
+/**
+ * @brief 析构后再被调用就记一次错误
+ *
+ */
+class CheckedAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CheckedAppender> ptr;
+  CheckedAppender() : m_magic(kAlive) {}
+  ~CheckedAppender() {
+    m_magic = 0;
+    ++s_destroyed;
+  }
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    // 拉长使用时间, 让替换更可能发生在写日志期间
+    for (int i = 0; i < 1000; ++i) {
+      if (m_magic != kAlive) {
+        ++s_bad;
+        return;
+      }
+    }
+  }
+  std::string toYamlString() override { return ""; }
+
+ private:
+  static const uint32_t kAlive = 0x5a5a5a5a;
+  volatile uint32_t m_magic;
+};
+
+// 写日志的线程只读取快照指针, 指针本身的原子操作必须不加锁
+static bool check_lock_free() {
+  std::atomic<const sylar::Logger::AppenderList*> list(nullptr);
+  std::atomic<sylar::LogEventQueue*> queue(nullptr);
+  if (!list.is_lock_free() || !queue.is_lock_free()) {
+    std::cout << "snapshot pointers are not lock-free" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// 写日志的同时反复替换Appender和切换队列, 旧对象等读者退出后才释放
+static bool check_replace() {
+  sylar::Logger::ptr logger(new sylar::Logger("snapshot"));
+  logger->addAppender(CheckedAppender::ptr(new CheckedAppender));
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&logger, &stop]() {
+      while (!stop) {
+        SYLAR_LOG_INFO(logger) << "snapshot";
+      }
+    });
+  }
+  for (int i = 0; i < 2000; ++i) {
+    sylar::Logger::AppenderList list;
+    list.push_back(CheckedAppender::ptr(new CheckedAppender));
+    logger->replaceAppenders(list);
+    if (i % 100 == 0) {
+      logger->setQueue(i % 200 ? nullptr
+                               : sylar::LogEventQueue::ptr(
+                                     new sylar::LogEventQueue(64)));
+    }
+  }
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  logger->setQueue(nullptr);
+  logger->clearAppenders();
+  if (s_bad != 0 || s_destroyed == 0) {
+    std::cout << "bad=" << s_bad << " destroyed=" << s_destroyed << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  bool ok = check_lock_free();
+  ok = check_replace() && ok;
+  return TestResult(ok);
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+static std::string tmp_file(const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test_log_stats_%s_%d.log", name,
+           (int)getpid());
+  unlink(path);
+  return path;
+}
+
+#define CHECK(cond)                                              \
+  if (!(cond)) {                                                 \
+    std::cout << "line " << __LINE__ << ": " #cond << std::endl; \
+    return false;                                                \
+  }
+
+static const sylar::LogStats::LoggerStat* find_logger(
+    const sylar::LogStats& stats, const std::string& name) {
+  for (auto& i : stats.loggers) {
+    if (i.name == name) {
+      return &i;
+    }
+  }
+  return nullptr;
+}
+
+static const sylar::LogStats::AppenderStat* find_appender(
+    const sylar::LogStats& stats, const std::string& file) {
+  for (auto& i : stats.appenders) {
+    if (i.file == file) {
+      return &i;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief 放行前一直阻塞的Appender, 让异步队列写满
+ *
+ */
+class BlockingAppender : public sylar::LogAppender {
+ public:
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    while (!released) {
+      usleep(1000);
+    }
+  }
+  std::string toYamlString() override { return "type: BlockingAppender"; }
+  const char* getType() const override { return "BlockingAppender"; }
+
+  std::atomic<bool> released{false};
+};
+
+// 日志器和Appender的条数, 过滤数和字节数; 多个日志器共用的Appender只列一次
+static bool test_counters(const std::string& all, const std::string& warn) {
+  sylar::Logger::ptr logger = sylar::LoggerMgr::GetInstance()->getLogger("st");
+  sylar::Logger::ptr other =
+      sylar::LoggerMgr::GetInstance()->getLogger("st_other");
+  logger->setLevel(sylar::LogLevel::INFO);
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  other->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  // 每次写入都计时, 直方图条数和写出条数一致
+  sylar::LoggerManager::SetLatencySample(1);
+  sylar::FileLogAppender::ptr a(new sylar::FileLogAppender(all));
+  sylar::FileLogAppender::ptr w(new sylar::FileLogAppender(warn));
+  w->setLevel(sylar::LogLevel::WARN);
+  logger->addAppender(a);
+  logger->addAppender(w);
+  other->addAppender(a);
+
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_INFO(logger) << "hello";
+  }
+  for (int i = 0; i < 5; ++i) {
+    SYLAR_LOG_WARN(logger) << "warn";
+  }
+  SYLAR_LOG_INFO(other) << "other";
+  // 日志宏里的级别判断在日志器之前, 直接调用 log 才会被日志器过滤
+  logger->log(sylar::LogLevel::DEBUG,
+              sylar::LogEvent::Create(
+                  logger,
+                  *SYLAR_LOG_CALLSITE(logger, sylar::LogLevel::DEBUG, nullptr),
+                  sylar::LogLevel::DEBUG, 0, 0, sylar::LogClock::Now()));
+  a->flush();
+  w->flush();
+  CHECK(read_file(warn) == "warn\nwarn\nwarn\nwarn\nwarn\n");
+
+  sylar::LogStats stats = sylar::LoggerMgr::GetInstance()->getStats();
+  std::string yaml = stats.toYamlString();
+  const sylar::LogStats::LoggerStat* ls = find_logger(stats, "st");
+  const sylar::LogStats::AppenderStat* as = find_appender(stats, all);
+  const sylar::LogStats::AppenderStat* ws = find_appender(stats, warn);
+  CHECK(ls && as && ws);
+  CHECK(as->type == "FileLogAppender");
+  CHECK(as->loggers.size() == 2 && ws->loggers.size() == 1);
+  CHECK(yaml.find(all) != std::string::npos);
+  if (!stats.enabled) {
+    std::cout << "metrics compiled out" << std::endl;
+    return true;
+  }
+  CHECK(ls->emitted == 15 && ls->filtered == 1 && ls->dropped == 0);
+  CHECK(ls->bytes == 10 * 6 + 5 * 5 + 5 * 5);
+  CHECK(as->emitted == 16 && as->filtered == 0);
+  CHECK(as->bytes == 10 * 6 + 5 * 5 + 6);
+  CHECK(ws->emitted == 5 && ws->filtered == 10 && ws->bytes == 25);
+  CHECK(as->format.count == 16 && as->write.count == 16);
+  CHECK(as->write.max > 0 && as->write.p50 <= as->write.max);
+  CHECK(yaml.find("format_ns") != std::string::npos);
+  return true;
+}
+
+// 异步队列写满后丢弃的条数和队列深度
+static bool test_queue() {
+  sylar::Logger::ptr logger =
+      sylar::LoggerMgr::GetInstance()->getLogger("st_queue");
+  std::shared_ptr<BlockingAppender> ap(new BlockingAppender);
+  logger->addAppender(ap);
+  logger->setQueue(sylar::LogEventQueue::ptr(
+      new sylar::LogEventQueue(2, sylar::LogEventQueue::DROP_NEWEST)));
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_INFO(logger) << "queued";
+  }
+  sylar::LogStats stats = sylar::LoggerMgr::GetInstance()->getStats();
+  const sylar::LogStats::LoggerStat* ls = find_logger(stats, "st_queue");
+  ap->released = true;
+  logger->setQueue(nullptr);
+  CHECK(ls && ls->async);
+  bool found = false;
+  for (auto& i : stats.appenders) {
+    found = found || (i.type == "BlockingAppender" && i.file.empty());
+  }
+  CHECK(found);
+  // 容量2, 另有一条被消费线程取出后阻塞在Appender中
+  CHECK(ls->queue_dropped >= 7 && ls->queue_depth <= 3);
+  if (stats.enabled) {
+    CHECK(ls->emitted == 10 && ls->dropped == ls->queue_dropped);
+  }
+  return true;
+}
+
+// 耗时按间隔采样, 条数和字节数不采样
+static bool test_sample(const std::string& file) {
+  sylar::Logger::ptr logger =
+      sylar::LoggerMgr::GetInstance()->getLogger("st_sample");
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  sylar::FileLogAppender::ptr ap(new sylar::FileLogAppender(file));
+  logger->addAppender(ap);
+  sylar::LoggerManager::SetLatencySample(10);
+  for (int i = 0; i < 160; ++i) {
+    SYLAR_LOG_INFO(logger) << "s";
+  }
+  sylar::LoggerManager::SetLatencySample(16);
+  sylar::LogStats stats = sylar::LoggerMgr::GetInstance()->getStats();
+  const sylar::LogStats::AppenderStat* as = find_appender(stats, file);
+  CHECK(as);
+  if (stats.enabled) {
+    // 10 取整为 16, 同一线程连续160次写入计时10次
+    CHECK(as->emitted == 160 && as->bytes == 320);
+    CHECK(as->write.count == 10 && as->format.count == 10);
+  }
+  return true;
+}
+
+// 分位数的相对误差不超过一个桶的宽度(12.5%)
+static bool test_histogram() {
+  sylar::LogHistogram h;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    h.record(i);
+  }
+  h.record(1ull << 40);
+  sylar::LogHistogram::Snapshot snap = h.snapshot();
+  CHECK(snap.count == 1001);
+  CHECK(snap.p50 >= 500 && snap.p50 <= 500 * 1.125);
+  CHECK(snap.p99 >= 990 && snap.p99 <= 990 * 1.125);
+  CHECK(snap.max >= (1ull << 40) && snap.max <= (1ull << 40) * 1.125);
+  for (uint64_t v : {0ull, 7ull, 8ull, 17ull, 1000ull, ~0ull}) {
+    size_t i = sylar::LogHistogram::Index(v);
+    CHECK(sylar::LogHistogram::UpperBound(i) >= v);
+    CHECK(i == 0 || sylar::LogHistogram::UpperBound(i - 1) < v);
+  }
+  return true;
+}
+
+// 定期把统计写到 root 日志器
+static bool test_report(const std::string& file) {
+  sylar::Logger::ptr root = sylar::LoggerMgr::GetInstance()->getRoot();
+  // 统计只写到文件, 不输出到 root 原有的标准输出
+  auto old = root->getAppenders();
+  std::vector<sylar::LogLevel::Level> levels;
+  for (auto& i : *old) {
+    levels.push_back(i->getLevel());
+    i->setLevel(sylar::LogLevel::FATAL);
+  }
+  sylar::FileLogAppender::ptr ap(new sylar::FileLogAppender(file));
+  root->addAppender(ap);
+  sylar::LoggerMgr::GetInstance()->setStatsInterval(1);
+  std::string data;
+  for (int i = 0; i < 300 && data.find("name: st_queue") == std::string::npos;
+       ++i) {
+    usleep(10 * 1000);
+    ap->flush();
+    data = read_file(file);
+  }
+  sylar::LoggerMgr::GetInstance()->setStatsInterval(0);
+  root->delAppender(ap);
+  for (size_t i = 0; i < old->size(); ++i) {
+    (*old)[i]->setLevel(levels[i]);
+  }
+  CHECK(data.find("log stats") != std::string::npos);
+  CHECK(data.find("name: st_queue") != std::string::npos);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  std::string all = tmp_file("all");
+  std::string warn = tmp_file("warn");
+  std::string report = tmp_file("report");
+  std::string sample = tmp_file("sample");
+  bool ok = test_counters(all, warn);
+  ok = test_queue() && ok;
+  ok = test_sample(sample) && ok;
+  ok = test_histogram() && ok;
+  ok = test_report(report) && ok;
+  unlink(all.c_str());
+  unlink(warn.c_str());
+  unlink(report.c_str());
+  unlink(sample.c_str());
+  return TestResult(ok);
+}
@@ -0,0 +1,61 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "sylar/log.h"
+#include "tests/log_test.h"
+
+// LogStream 和 std::ostringstream 输出同样的内容, 结果应该一致
+#define CHECK_SAME(expr)                                                      \
+  do {                                                                        \
+    sylar::LogStream ls;                                                      \
+    std::ostringstream os;                                                    \
+    ls << expr;                                                               \
+    os << expr;                                                               \
+    if (ls.str() != os.str()) {                                               \
+      std::cout << "line " << __LINE__ << ": " #expr " -> [" << ls.str()      \
+                << "] expected [" << os.str() << "]" << std::endl;            \
+      ok = false;                                                             \
+    }                                                                         \
+  } while (0)
+
+int main(int argc, char** argv) {
+  bool ok = true;
+  double pi = 3.14159265358979;
+  // 默认格式
+  CHECK_SAME(pi << " " << 1e20 << " " << 0.1f << " " << -42 << " " << 'c');
+  CHECK_SAME(true << " " << (const char*)"str" << " " << std::string("s"));
+  // 精度和浮点格式
+  CHECK_SAME(std::fixed << std::setprecision(3) << pi << " " << 2.0);
+  CHECK_SAME(std::setprecision(10) << pi << " " << 1.0L / 3);
+  CHECK_SAME(std::scientific << pi << " " << std::setprecision(2) << pi);
+  CHECK_SAME(std::fixed << pi << std::defaultfloat << " " << pi);
+  CHECK_SAME(std::fixed << std::setprecision(2) << 1e30);
+  CHECK_SAME(std::showpos << pi << " " << 5 << std::noshowpos << " " << 5);
+  CHECK_SAME(std::uppercase << std::scientific << pi);
+  // 宽度只作用于下一次输出
+  CHECK_SAME(std::setw(8) << 42 << "|" << 42);
+  CHECK_SAME(std::setw(6) << std::setfill('0') << 7 << " " << std::setw(4)
+                          << "ab" << std::left << std::setw(4) << 'x' << "|");
+  CHECK_SAME(std::setw(10) << std::fixed << std::setprecision(1) << pi);
+  // 进制
+  CHECK_SAME(std::hex << 255 << " " << -1 << std::dec << " " << 255);
+  CHECK_SAME(std::showbase << std::hex << 255 << " " << std::oct << 8);
+  CHECK_SAME(std::boolalpha << true << " " << false);
+  CHECK_SAME("a" << std::endl << "b" << std::ends);
+
+  // 日志事件复用 LogStream, 上一条日志的格式状态不影响下一条
+  sylar::LogStream ls;
+  ls << std::fixed << std::setprecision(2) << std::hex << pi << 255;
+  ls.reset();
+  ls << pi << " " << 255;
+  std::ostringstream os;
+  os << pi << " " << 255;
+  if (ls.str() != os.str()) {
+    std::cout << "reset: [" << ls.str() << "]" << std::endl;
+    ok = false;
+  }
+
+  return TestResult(ok);
+}
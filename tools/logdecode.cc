@@ -0,0 +1,43 @@
+/**
+ * @file logdecode.cc
+ * @brief 把 BinaryFileLogAppender 写出的二进制日志还原成文本
+ *
+ * 用法: sylar-logdecode <file> [pattern]
+ * 不指定pattern时使用日志器的默认格式
+ */
+#include <iostream>
+
+#include "sylar/log.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+    return 1;
+  }
+  sylar::LogBinaryReader reader;
+  if (!reader.open(argv[1])) {
+    std::cerr << argv[1] << ": not a sylar binary log" << std::endl;
+    return 1;
+  }
+  sylar::LogFormatter::ptr formatter;
+  if (argc > 2) {
+    formatter = sylar::LogFormatter::Create(argv[2]);
+    if (formatter->isError()) {
+      std::cerr << "invalid pattern: " << argv[2] << std::endl;
+      return 1;
+    }
+  }
+
+  sylar::Logger::ptr logger;
+  sylar::LogLevel::Level level;
+  sylar::LogEvent::ptr event;
+  while (reader.next(logger, level, event)) {
+    sylar::LogFormatter::ptr fmt = formatter ? formatter : logger->getFormatter();
+    fmt->format(std::cout, logger, level, event);
+  }
+  if (reader.isError()) {
+    std::cerr << argv[1] << ": truncated or corrupted record" << std::endl;
+    return 1;
+  }
+  return 0;
+}